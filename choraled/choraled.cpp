@@ -50,6 +50,7 @@ static void Usage(FILE *f)
 "The options are:\n"
 " -d, --no-daemon    Don't daemonise\n"
 " -f, --dbfile=FILE  Database file (default=" DEFAULT_DB_FILE ")\n"
+"     --db-engine=ENGINE  In-memory database: steam or column (default=steam)\n"
 " -t, --threads=N    Use max N threads to scan files (default 32)\n"
 " -r, --no-receiver  Don't become a Rio Receiver server\n"
 "     --arf=FILE       Boot from ARF (default=" DEFAULT_ARF_FILE ")\n"
@@ -185,6 +186,7 @@ int ParseArgs(int argc, char *argv[], Settings *settings,
 	{ "threads", required_argument, NULL, 't' },
 	{ "channels", required_argument, NULL, 'c' },
 	{ "timer-db", required_argument, NULL, 3 },
+	{ "db-engine", required_argument, NULL, 4 },
 	{ NULL, 0, NULL, 0 }
     };
 
@@ -256,6 +258,18 @@ int ParseArgs(int argc, char *argv[], Settings *settings,
 	case 3:
 	    settings->timer_database_file = optarg;
 	    break;
+	case 4:
+	    if (!strcmp(optarg, "column"))
+		settings->database_engine = COLUMN_DB;
+	    else if (!strcmp(optarg, "steam"))
+		settings->database_engine = STEAM_DB;
+	    else
+	    {
+		Usage(stderr);
+		exit(1);
+		return 0;
+	    }
+	    break;
 	case 11:
 	    settings->flags |= ASSIMILATE_RECEIVER;
 	    settings->flags &= ~RECEIVER;
@@ -1,7 +1,10 @@
 #include "database.h"
 #include "config.h"
+#include "main.h"
 #include "libmediadb/schema.h"
 #include "libdblocal/database_updater.h"
+#include "libdbsteam/db.h"
+#include "libdbcolumn/db.h"
 
 namespace choraled {
 
@@ -9,19 +12,81 @@ static const db::steam::Database::InitialFieldInfo field_info[] =
 {
     { mediadb::ID,      db::steam::FIELD_INT   |db::steam::FIELD_INDEXED },
     { mediadb::PATH,    db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
-    { mediadb::ARTIST,  db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
-    { mediadb::ALBUM,   db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
-    { mediadb::GENRE,   db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
-    { mediadb::TITLE,   db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
+    { mediadb::ARTIST,  db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+		       |db::steam::FIELD_TEXTINDEX|db::steam::FIELD_COLLATE },
+    { mediadb::ALBUM,   db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+		       |db::steam::FIELD_TEXTINDEX|db::steam::FIELD_COLLATE },
+    { mediadb::GENRE,   db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+		       |db::steam::FIELD_TEXTINDEX|db::steam::FIELD_COLLATE },
+    { mediadb::TITLE,   db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+		       |db::steam::FIELD_TEXTINDEX|db::steam::FIELD_COLLATE },
     { mediadb::REMIXED, db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
     { mediadb::ORIGINALARTIST, db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
     { mediadb::MOOD,    db::steam::FIELD_STRING|db::steam::FIELD_INDEXED },
+    { mediadb::CHILDREN, db::steam::FIELD_ARRAY|db::steam::FIELD_INDEXED },
+    { mediadb::IDPARENT, db::steam::FIELD_INT|db::steam::FIELD_INDEXED },
+    { mediadb::TRACKNUMBER, db::steam::FIELD_INT }, // So ORDER BY is numeric
+    { mediadb::YEAR,        db::steam::FIELD_INT },
     { 0,0 }
 };
 
-LocalDatabase::LocalDatabase(util::http::Client *client)
-    : m_sdb(mediadb::FIELD_COUNT, field_info),
-      m_ldb(&m_sdb, client),
+/** The column engine stores integer fields as integers, which is where much
+ * of its saving comes from, so it's told about more of them. (SIZEBYTES
+ * stays a string, as files can exceed 4GB.)
+ */
+static const db::column::Database::InitialFieldInfo column_field_info[] =
+{
+    { mediadb::ID,      db::column::FIELD_INT   |db::column::FIELD_INDEXED },
+    { mediadb::PATH,    db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::ARTIST,  db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::ALBUM,   db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::GENRE,   db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::TITLE,   db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::REMIXED, db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::ORIGINALARTIST, db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::MOOD,    db::column::FIELD_STRING|db::column::FIELD_INDEXED },
+    { mediadb::TRACKNUMBER, db::column::FIELD_INT },
+    { mediadb::YEAR,        db::column::FIELD_INT },
+    { mediadb::DURATIONMS,  db::column::FIELD_INT },
+    { mediadb::AUDIOCODEC,  db::column::FIELD_INT },
+    { mediadb::BITSPERSEC,  db::column::FIELD_INT },
+    { mediadb::SAMPLERATE,  db::column::FIELD_INT },
+    { mediadb::CHANNELS,    db::column::FIELD_INT },
+    { mediadb::MTIME,       db::column::FIELD_INT },
+    { mediadb::CTIME,       db::column::FIELD_INT },
+    { mediadb::TYPE,        db::column::FIELD_INT },
+    { mediadb::IDHIGH,      db::column::FIELD_INT },
+    { mediadb::IDPARENT,    db::column::FIELD_INT|db::column::FIELD_INDEXED },
+    { mediadb::VIDEOCODEC,  db::column::FIELD_INT },
+    { mediadb::CONTAINER,   db::column::FIELD_INT },
+    { 0,0 }
+};
+
+static db::Database *CreateEngine(unsigned int engine)
+{
+    if (engine == COLUMN_DB)
+	return new db::column::Database(mediadb::FIELD_COUNT,
+					column_field_info);
+    return new db::steam::Database(mediadb::FIELD_COUNT, field_info);
+}
+
+/** Steam clients (UPnP, receivers, web UI) read through a SnapshotView, so
+ * that they don't wait for -- or hold up -- rescans.
+ */
+static db::Database *CreateView(unsigned int engine, db::Database *thedb)
+{
+    if (engine == COLUMN_DB)
+	return NULL;
+    return new db::steam::SnapshotView(
+	static_cast<db::steam::Database*>(thedb));
+}
+
+LocalDatabase::LocalDatabase(util::http::Client *client, unsigned int engine)
+    : m_sdb(CreateEngine(engine)),
+      m_view(CreateView(engine, m_sdb.get())),
+      m_journaled(m_view ? m_view.get() : m_sdb.get(), &m_journal),
+      m_tracked(&m_journaled, &m_tracker),
+      m_ldb(&m_tracked, client, NULL, m_sdb.get()),
       m_database_updater(NULL)
 {
 }
@@ -39,9 +104,11 @@ unsigned int LocalDatabase::Init(const std::string& loroot,
 {
     assert(!m_database_updater);
     m_database_updater = new db::local::DatabaseUpdater(loroot, hiroot, 
-							&m_sdb, &m_ldb,
+							m_sdb.get(), &m_ldb,
 							scheduler, queue,
-							dbfilename);
+							dbfilename,
+							&m_journal,
+							&m_tracker);
     return 0;
 }
 
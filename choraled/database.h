@@ -2,8 +2,10 @@
 #define CHORALED_DATABASE_H 1
 
 #include "config.h"
-#include "libdbsteam/db.h"
 #include "libdblocal/db.h"
+#include "libmediadb/journal.h"
+#include "libmediadb/update_tracker.h"
+#include <memory>
 
 #define HAVE_LOCAL_DB HAVE_TAGLIB
 
@@ -16,12 +18,19 @@ namespace choraled {
 
 class LocalDatabase
 {
-    db::steam::Database m_sdb;
+    std::unique_ptr<db::Database> m_sdb;
+    std::unique_ptr<db::Database> m_view; ///< What clients read, if not m_sdb
+    mediadb::Journal m_journal;
+    mediadb::JournalingDatabase m_journaled; ///< m_view (or m_sdb), journaled
+    mediadb::UpdateTracker m_tracker;
+    mediadb::TrackingDatabase m_tracked; ///< m_journaled, tracked
     db::local::Database m_ldb;
     db::local::DatabaseUpdater *m_database_updater;
 
 public:
-    LocalDatabase(util::http::Client *client);
+    /** @param engine STEAM_DB or COLUMN_DB (see main.h)
+     */
+    LocalDatabase(util::http::Client *client, unsigned int engine);
     ~LocalDatabase();
 
     unsigned int Init(const std::string& loroot,
@@ -32,6 +41,11 @@ public:
     
     db::local::Database *Get() { return &m_ldb; }
 
+    /** Tracks changes by the scanner and through Get(); as IDs are this
+     * database's own, it should be the first in any db::merge::Database.
+     */
+    mediadb::UpdateTracker *GetUpdateTracker() { return &m_tracker; }
+
     void ForceRescan();
 };
 
@@ -115,14 +115,16 @@ int Main(const Settings *settings, Complaints *complaints)
     db::merge::Database mergedb;
     util::http::Client wc;
     util::BackgroundScheduler poller;
+    mediadb::UpdateTracker *update_tracker = NULL;
 
 #if HAVE_TAGLIB
-    LocalDatabase localdb(&wc);
+    LocalDatabase localdb(&wc, settings->database_engine);
     if (settings->flags & LOCAL_DB)
     {
 	localdb.Init(settings->media_root, settings->flac_root, &poller,
 		     &wtp_low, settings->database_file);
 	mergedb.AddDatabase(localdb.Get());
+	update_tracker = localdb.GetUpdateTracker();
     }
 #endif
 
@@ -138,8 +140,16 @@ int Main(const Settings *settings, Complaints *complaints)
     util::IPFilter *pipf = NULL;
 #endif
 
+    /* Not inline (see http::Server::SetInline): under load from many
+     * clients it made the worst-case latency worse, not better.
+     */
     util::http::Server ws(&poller, &wtp_normal, pipf);
 
+    /* Only the local database answers queries from memory; the TV one
+     * and assimilated receivers' ones can block.
+     */
+    bool db_in_memory = !(settings->flags & ASSIMILATE_RECEIVER);
+
 #if HAVE_DVB
     tv::dvb::Frontend dvb_frontend;
     tv::dvb::Channels dvb_channels;
@@ -181,13 +191,14 @@ int Main(const Settings *settings, Complaints *complaints)
 
 		tvdb.Init();
 		mergedb.AddDatabase(&tvdb);
+		db_in_memory = false;
 		wepg.Init(&ws, epg.GetDatabase(), &dvb_channels, &dvb_service);
 	    }
 	}
     }
 #endif
 
-    receiverd::ContentFactory rcf(&mergedb);
+    receiverd::ContentFactory rcf(&mergedb, db_in_memory);
     util::http::FileContentFactory fcf(
 	std::string(settings->web_root)+"/upnp", "/upnp");
     util::http::FileContentFactory fcf2(
@@ -265,7 +276,8 @@ int Main(const Settings *settings, Complaints *complaints)
     upnp::ssdp::Responder ssdp(&poller, pipf);
     upnp::Server upnpserver(&poller, &wc, &ws, &ssdp);
 
-    upnpd::MediaServer mediaserver(&mergedb, &upnpserver);
+    upnpd::MediaServer mediaserver(&mergedb, &upnpserver, update_tracker,
+				   &poller);
 
     if (settings->flags & MEDIA_SERVER)
     {
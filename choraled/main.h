@@ -23,9 +23,17 @@ enum {
     ASSIMILATE_RECEIVER = 0x40
 };
 
+/** Values for Settings::database_engine
+ */
+enum {
+    STEAM_DB = 0,
+    COLUMN_DB
+};
+
 struct Settings
 {
     unsigned int flags;
+    unsigned int database_engine;
     const char *database_file;
     const char *timer_database_file;
     const char *web_root;
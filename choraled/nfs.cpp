@@ -1,6 +1,7 @@
 #include "nfs.h"
 #include "libutil/trace.h"
 #include "libutil/file_stream.h"
+#include "libutil/readahead_stream.h"
 #include "libreceiverd/nfs.h"
 #include "libreceiverd/mount.h"
 #include "libreceiverd/tarfs.h"
@@ -62,6 +63,9 @@ unsigned int NFSService::Init(util::Scheduler *poller,
 	return rc;
     }
 
+    // TarFS reads headers a sector at a time, and NFS reads are small
+    stm = util::CreateReadAheadStream(std::move(stm));
+
     m_impl = new Impl(poller, filter, stm);
     TRACE << "NFS Init OK\n";
     return 0;
@@ -0,0 +1,91 @@
+#include "config.h"
+#include "libdbsteam/db.h"
+#include "libmediadb/xml.h"
+#include "libmediadb/binary.h"
+#include "libmediadb/schema.h"
+#include "libutil/file.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/time.h>
+
+/** Convert a media database between XML and binary snapshot formats.
+ *
+ * Usage: dbconvert <from> <to>
+ *
+ * The input can be either format (a snapshot is recognised by its header);
+ * the output is XML if its name ends in ".xml", else a snapshot. Reports
+ * how long the reading took, so also serves to compare the two.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+	fprintf(stderr, "Usage: dbconvert <from> <to>\n");
+	return 1;
+    }
+
+    db::steam::Database sdb(mediadb::FIELD_COUNT);
+    sdb.SetFieldInfo(mediadb::ID,
+		     db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+
+    // Nobody's reading it, so don't keep publishing (and copying) it
+    sdb.SetPublishInterval(UINT_MAX);
+
+    uint64_t start = NowUsec();
+    const char *format = "snapshot";
+    unsigned int rc;
+    {
+	mediadb::BinarySnapshot snap;
+	rc = snap.Open(argv[1]);
+    }
+    if (rc == 0)
+	rc = mediadb::ReadBinary(&sdb, argv[1]);
+    else
+    {
+	format = "XML";
+	rc = mediadb::ReadXML(&sdb, argv[1]);
+    }
+    if (rc)
+    {
+	fprintf(stderr, "Can't read %s: %u\n", argv[1], rc);
+	return 1;
+    }
+    printf("Read %s as %s in %llu ms\n", argv[1], format,
+	   (unsigned long long)(NowUsec() - start) / 1000);
+
+    FILE *f = fopen(argv[2], "wb");
+    if (!f)
+    {
+	fprintf(stderr, "Can't create %s: %u\n", argv[2], errno);
+	return 1;
+    }
+
+    bool xml = (util::GetExtension(argv[2]) == "xml");
+    start = NowUsec();
+    if (xml)
+	rc = mediadb::WriteXML(&sdb, mediadb::SCHEMA_VERSION, f);
+    else
+	rc = mediadb::WriteBinary(&sdb, mediadb::SCHEMA_VERSION, f);
+    if (fclose(f) && !rc)
+	rc = (unsigned)errno;
+    if (rc)
+    {
+	fprintf(stderr, "Can't write %s: %u\n", argv[2], rc);
+	return 1;
+    }
+    printf("Wrote %s as %s in %llu ms\n", argv[2], xml ? "XML" : "snapshot",
+	   (unsigned long long)(NowUsec() - start) / 1000);
+
+    return 0;
+}
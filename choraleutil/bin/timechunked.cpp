@@ -0,0 +1,178 @@
+#include "config.h"
+#include "libutil/http_server.h"
+#include "libutil/scheduler.h"
+#include "libutil/socket.h"
+#include "libutil/string_stream.h"
+#include "libutil/worker_thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+
+/** Time util::http::Server sending a large generated response (as for a
+ * big Browse or Search result), both built up in full before sending, as
+ * with a StringStream, and produced as it's sent, which goes chunked.
+ *
+ * Usage: timechunked [max-kilo-records] [repeats]
+ *
+ * Reports time to first byte and time to last byte, as seen by a client
+ * on the same machine.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+/** Something like one DIDL-Lite item per record */
+static void AppendRecord(std::string *s, unsigned int i)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+	     "<item id=\"%x\" parentID=\"0\" restricted=\"1\">"
+	     "<dc:title>Track %u</dc:title>"
+	     "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+	     "<res protocolInfo=\"http-get:*:audio/mpeg:*\">"
+	     "http://127.0.0.1/content/%x</res></item>\n", i, i, i);
+    *s += buffer;
+}
+
+/** Formats records as they're read, and doesn't know its length */
+class RecordStream: public util::Stream
+{
+    unsigned int m_next;
+    unsigned int m_count;
+    std::string m_pending;
+
+public:
+    explicit RecordStream(unsigned int count) : m_next(0), m_count(count) {}
+
+    unsigned GetStreamFlags() const override { return READABLE; }
+
+    unsigned Read(void *buffer, size_t len, size_t *pread) override
+    {
+	while (m_pending.size() < len && m_next < m_count)
+	    AppendRecord(&m_pending, m_next++);
+	len = std::min(len, m_pending.size());
+	memcpy(buffer, m_pending.data(), len);
+	m_pending.erase(0, len);
+	*pread = len;
+	return 0;
+    }
+};
+
+class RecordFactory: public util::http::ContentFactory
+{
+    unsigned int m_count;
+    bool m_streamed;
+
+public:
+    RecordFactory(unsigned int count, bool streamed)
+	: m_count(count), m_streamed(streamed) {}
+
+    bool StreamForPath(const util::http::Request*,
+		       util::http::Response *rs) override
+    {
+	if (m_streamed)
+	    rs->body_source.reset(new RecordStream(m_count));
+	else
+	{
+	    std::string s;
+	    for (unsigned int i=0; i<m_count; ++i)
+		AppendRecord(&s, i);
+	    rs->body_source.reset(new util::StringStream(s));
+	}
+	rs->content_type = "text/xml";
+	return true;
+    }
+};
+
+/** @return Whether the response arrived; times in usec */
+static bool Fetch(unsigned short port, uint64_t *first, uint64_t *last)
+{
+    util::StreamSocket ss;
+    util::IPEndPoint ipe;
+    ipe.addr = util::IPAddress::FromDottedQuad(127,0,0,1);
+    ipe.port = port;
+    if (ss.Connect(ipe))
+	return false;
+
+    static const char rq[] = "GET / HTTP/1.1\r\nConnection: close\r\n\r\n";
+    uint64_t start = NowUsec();
+    if (ss.WriteAll(rq, sizeof(rq) - 1))
+	return false;
+
+    char buffer[65536];
+    size_t nread;
+    if (ss.Read(buffer, sizeof(buffer), &nread) || !nread)
+	return false;
+    *first = NowUsec() - start;
+    do {
+	if (ss.Read(buffer, sizeof(buffer), &nread))
+	    return false;
+    } while (nread);
+    *last = NowUsec() - start;
+    return true;
+}
+
+static bool Run(bool streamed, unsigned int count, unsigned int repeats,
+		uint64_t *first, uint64_t *last)
+{
+    util::BackgroundScheduler poller;
+    util::WorkerThreadPool threads(util::WorkerThreadPool::NORMAL, 0);
+    util::http::Server server(&poller, &threads);
+    if (server.Init())
+	return false;
+    RecordFactory rf(count, streamed);
+    server.AddContentFactory("/", &rf);
+
+    std::thread poll_thread([&poller]() {
+	    while (!poller.IsExiting())
+		poller.Poll(util::BackgroundScheduler::INFINITE_MS);
+	});
+
+    bool ok = true;
+    *first = *last = ~(uint64_t)0;
+    for (unsigned int i=0; i<repeats && ok; ++i)
+    {
+	uint64_t f, l;
+	ok = Fetch(server.GetPort(), &f, &l);
+	*first = std::min(*first, f);
+	*last = std::min(*last, l);
+    }
+
+    poller.Shutdown();
+    poll_thread.join();
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int maxk = (argc > 1) ? (unsigned)atoi(argv[1]) : 100;
+    unsigned int repeats = (argc > 2) ? (unsigned)atoi(argv[2]) : 5;
+
+    printf("%8s %12s %12s %12s %12s\n", "records", "buffer ttfb",
+	   "buffer last", "chunk ttfb", "chunk last");
+
+    for (unsigned int k = 1; k <= maxk; k *= 10)
+    {
+	uint64_t bfirst, blast, cfirst, clast;
+	if (!Run(false, k*1000, repeats, &bfirst, &blast)
+	    || !Run(true, k*1000, repeats, &cfirst, &clast))
+	{
+	    fprintf(stderr, "Fetch failed\n");
+	    return 1;
+	}
+	printf("%8u %12llu %12llu %12llu %12llu\n", k*1000,
+	       (unsigned long long)bfirst, (unsigned long long)blast,
+	       (unsigned long long)cfirst, (unsigned long long)clast);
+    }
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "config.h"
+#include "libutil/http_client.h"
+#include "libutil/http_fetcher.h"
+#include "libutil/http_server.h"
+#include "libutil/scheduler.h"
+#include "libutil/string_stream.h"
+#include "libutil/worker_thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <string>
+#include <thread>
+
+/** Time util::http::Client making one small request after another to the
+ * same server, as libdbupnp does when browsing, both with a new connection
+ * each time and with the connection kept alive.
+ *
+ * Usage: timeclient [requests]
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+class SoapFactory: public util::http::ContentFactory
+{
+public:
+    bool StreamForPath(const util::http::Request*,
+		       util::http::Response *rs) override
+    {
+	rs->body_source.reset(new util::StringStream(
+				  "<s:Envelope><s:Body><u:BrowseResponse>"
+				  "<NumberReturned>0</NumberReturned>"
+				  "</u:BrowseResponse></s:Body>"
+				  "</s:Envelope>"));
+	rs->content_type = "text/xml";
+	return true;
+    }
+};
+
+/** @return usec per request, or 0 on error */
+static uint64_t Run(const std::string& url, bool keepalive,
+		    unsigned int requests)
+{
+    util::http::Client client;
+    std::string headers = "SOAPACTION: \"urn:schemas-upnp-org:service:"
+	"ContentDirectory:1#Browse\"\r\n";
+    if (!keepalive)
+	headers += "Connection: close\r\n";
+
+    uint64_t start = NowUsec();
+    for (unsigned int i=0; i<requests; ++i)
+    {
+	util::http::Fetcher fetcher(&client, url, headers.c_str(),
+				    "<s:Envelope/>");
+	std::string result;
+	if (fetcher.FetchToString(&result))
+	    return 0;
+    }
+    uint64_t usec = (NowUsec() - start) / requests;
+
+    util::http::Client::Stats stats = client.GetStats();
+    fprintf(stderr, "%s: %u/%u reused\n", keepalive ? "keep-alive" : "close",
+	    stats.reused, stats.requests);
+    return usec;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int requests = (argc > 1) ? (unsigned)atoi(argv[1]) : 2000;
+
+    util::BackgroundScheduler poller;
+    util::WorkerThreadPool threads(util::WorkerThreadPool::NORMAL, 0);
+    util::http::Server server(&poller, &threads);
+    if (server.Init())
+	return 1;
+    SoapFactory sf;
+    server.AddContentFactory("/", &sf);
+
+    std::thread poll_thread([&poller]() {
+	    while (!poller.IsExiting())
+		poller.Poll(util::BackgroundScheduler::INFINITE_MS);
+	});
+
+    char url[80];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/upnp/control/cd",
+	     server.GetPort());
+
+    uint64_t tclose = Run(url, false, requests);
+    uint64_t tkeep = Run(url, true, requests);
+
+    poller.Shutdown();
+    poll_thread.join();
+
+    if (!tclose || !tkeep)
+    {
+	fprintf(stderr, "Fetch failed\n");
+	return 1;
+    }
+
+    printf("%12s %12s\n", "close us", "keep-alive us");
+    printf("%12llu %12llu\n", (unsigned long long)tclose,
+	   (unsigned long long)tkeep);
+    return 0;
+}
@@ -1,16 +1,210 @@
+#include "config.h"
 #include "libdbsteam/db.h"
+#include "libdbcolumn/db.h"
+#include "libdb/query.h"
+#include "libdb/recordset.h"
 #include "libmediadb/xml.h"
 #include "libmediadb/schema.h"
+#include "libutil/counted_pointer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
-int main(int, char *argv[])
+/** Time (and size) loading and querying a database in each engine.
+ *
+ * Usage: timedb <db.xml> [steam|column]
+ *
+ * Run once per engine, as the peak RSS reported covers the whole process.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+static void Report(const char *what, uint64_t start, unsigned int n)
+{
+    printf("%-24s %8llu us  (%u)\n", what,
+	   (unsigned long long)(NowUsec() - start), n);
+}
+
+int main(int argc, char *argv[])
 {
+    if (argc < 2)
+    {
+	fprintf(stderr, "Usage: timedb <db.xml> [steam|column]\n");
+	return 1;
+    }
+
+    bool column = (argc > 2 && !strcmp(argv[2], "column"));
+
     db::steam::Database sdb(mediadb::FIELD_COUNT);
-    sdb.SetFieldInfo(mediadb::ID, 
-		     db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
-    sdb.SetFieldInfo(mediadb::PATH,
-		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+    db::column::Database cdb(mediadb::FIELD_COUNT);
+    db::Database *thedb;
+
+    if (column)
+    {
+	cdb.SetFieldInfo(mediadb::ID,
+			 db::column::FIELD_INT|db::column::FIELD_INDEXED);
+	cdb.SetFieldInfo(mediadb::PATH,
+			 db::column::FIELD_STRING|db::column::FIELD_INDEXED);
+	cdb.SetFieldInfo(mediadb::ARTIST,
+			 db::column::FIELD_STRING|db::column::FIELD_INDEXED);
+	cdb.SetFieldInfo(mediadb::ALBUM,
+			 db::column::FIELD_STRING|db::column::FIELD_INDEXED);
+	static const unsigned int ints[] = {
+	    mediadb::TRACKNUMBER, mediadb::YEAR, mediadb::DURATIONMS,
+	    mediadb::AUDIOCODEC, mediadb::TYPE, mediadb::MTIME,
+	    mediadb::CTIME, mediadb::IDPARENT
+	};
+	for (unsigned int i=0; i<sizeof(ints)/sizeof(ints[0]); ++i)
+	    cdb.SetFieldInfo(ints[i], db::column::FIELD_INT);
+	thedb = &cdb;
+    }
+    else
+    {
+	sdb.SetFieldInfo(mediadb::ID,
+			 db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+	sdb.SetFieldInfo(mediadb::PATH,
+			 db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+	sdb.SetFieldInfo(mediadb::ARTIST,
+			 db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+			 |db::steam::FIELD_COLLATE);
+	sdb.SetFieldInfo(mediadb::ALBUM,
+			 db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+			 |db::steam::FIELD_COLLATE);
+	sdb.SetFieldInfo(mediadb::TITLE,
+			 db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+			 |db::steam::FIELD_COLLATE);
+	static const unsigned int ints[] = {
+	    mediadb::TRACKNUMBER, mediadb::YEAR, mediadb::TYPE
+	};
+	for (unsigned int i=0; i<sizeof(ints)/sizeof(ints[0]); ++i)
+	    sdb.SetFieldInfo(ints[i], db::steam::FIELD_INT);
+	thedb = &sdb;
+    }
+
+    printf("Engine: %s\n", column ? "column" : "steam");
+
+    uint64_t start = NowUsec();
+    unsigned int rc = mediadb::ReadXML(thedb, argv[1]);
+    if (rc)
+    {
+	fprintf(stderr, "Can't read %s: %u\n", argv[1], rc);
+	return 1;
+    }
+
+    if (!column)
+	sdb.Publish(); // as choraled would, before serving any readers
+
+    unsigned int n = 0;
+    for (db::RecordsetPtr rs = thedb->CreateRecordset();
+	 !rs->IsEOF();
+	 rs->MoveNext())
+	++n;
+    Report("load", start, n);
+
+    start = NowUsec();
+    n = 0;
+    size_t bytes = 0;
+    for (db::RecordsetPtr rs = thedb->CreateRecordset();
+	 !rs->IsEOF();
+	 rs->MoveNext())
+    {
+	for (unsigned int i=0; i<mediadb::FIELD_COUNT; ++i)
+	    bytes += rs->GetString(i).size();
+	++n;
+    }
+    Report("scan all fields", start, n);
+
+    start = NowUsec();
+    n = 0;
+    for (db::RecordsetPtr rs = thedb->CreateRecordset();
+	 !rs->IsEOF();
+	 rs->MoveNext())
+	if (rs->GetInteger(mediadb::TYPE) == mediadb::TUNE)
+	    ++n;
+    Report("scan one field", start, n);
+
+    start = NowUsec();
+    db::QueryPtr qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::TYPE, db::EQ, mediadb::TUNE));
+    n = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	++n;
+    Report("unindexed query", start, n);
+
+    start = NowUsec();
+    qp = thedb->CreateQuery();
+    qp->CollateBy(mediadb::ARTIST);
+    n = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	++n;
+    Report("collate by artist", start, n);
+
+    start = NowUsec();
+    qp = thedb->CreateQuery();
+    qp->OrderBy(mediadb::ALBUM);
+    n = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	++n;
+    Report("order by album", start, n);
+
+    start = NowUsec();
+    qp = thedb->CreateQuery();
+    qp->OrderBy(mediadb::ALBUM);
+    qp->OrderBy(mediadb::TRACKNUMBER);
+    n = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	++n;
+    Report("order by album, track", start, n);
+
+    start = NowUsec();
+    qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::TYPE, db::EQ, mediadb::TUNE));
+    qp->OrderBy(mediadb::ARTIST);
+    qp->OrderBy(mediadb::YEAR, true);
+    qp->OrderBy(mediadb::ALBUM);
+    n = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	++n;
+    Report("artist, year desc, album", start, n);
+
+    // A paging client, wanting the first screenful
+    start = NowUsec();
+    qp = thedb->CreateQuery();
+    qp->OrderBy(mediadb::TITLE);
+    qp->Limit(20);
+    n = 0;
+    for (db::RecordsetPtr rs = qp->Execute();
+	 !rs->IsEOF() && n < 20;
+	 rs->MoveNext())
+	++n;
+    Report("first 20 by title", start, n);
+
+    start = NowUsec();
+    qp = thedb->CreateQuery();
+    qp->OrderBy(mediadb::TITLE);
+    qp->Limit(40);
+    n = 0;
+    for (db::RecordsetPtr rs = qp->Execute();
+	 !rs->IsEOF() && n < 40;
+	 rs->MoveNext())
+	++n;
+    Report("...and the next 20", start, n);
+
+    if (column)
+	printf("Engine heap: %llu KB\n",
+	       (unsigned long long)(cdb.MemoryUsage() / 1024));
 
-    mediadb::ReadXML(&sdb, argv[1]);
+    struct rusage ru;
+    ::getrusage(RUSAGE_SELF, &ru);
+    printf("Peak RSS: %ld KB\n", ru.ru_maxrss);
 
+    (void)bytes;
     return 0;
 }
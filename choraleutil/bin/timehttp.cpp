@@ -0,0 +1,216 @@
+#include "config.h"
+#include "libutil/http_server.h"
+#include "libutil/file_stream.h"
+#include "libutil/scheduler.h"
+#include "libutil/socket.h"
+#include "libutil/worker_thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Time util::http::Server serving a large file to many concurrent local
+ * clients, both straight from the file (sendfile) and copied through the
+ * server's buffer as any other stream would be.
+ *
+ * Usage: timehttp [max-clients] [file-MB] [ms-per-run]
+ *
+ * Each client keeps its connection alive, and asks alternately for the
+ * whole file and for a range of it, as a renderer seeking would.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+static const char *s_filename = "/tmp/timehttp.tmp";
+
+/** Hides the file from the server, so that it has to copy */
+class CopiedStream: public util::SeekableStream
+{
+    std::unique_ptr<util::Stream> m_stream;
+
+public:
+    explicit CopiedStream(std::unique_ptr<util::Stream> s)
+	: m_stream(std::move(s)) {}
+
+    unsigned GetStreamFlags() const override
+    {
+	return READABLE|SEEKABLE;
+    }
+    unsigned ReadAt(void *buffer, uint64_t pos, size_t len,
+		    size_t *pread) override
+    {
+	return m_stream->ReadAt(buffer, pos, len, pread);
+    }
+    uint64_t GetLength() override { return m_stream->GetLength(); }
+};
+
+class FileFactory: public util::http::ContentFactory
+{
+    bool m_copy;
+
+public:
+    explicit FileFactory(bool copy) : m_copy(copy) {}
+
+    bool StreamForPath(const util::http::Request*,
+		       util::http::Response *rs) override
+    {
+	std::unique_ptr<util::Stream> s;
+	if (util::OpenFileStream(s_filename, util::READ, &s))
+	    return false;
+	if (m_copy)
+	    s.reset(new CopiedStream(std::move(s)));
+	rs->body_source = std::move(s);
+	rs->content_type = "audio/mpeg";
+	return true;
+    }
+};
+
+/** Reads one response; returns its body size, or 0 on error */
+static uint64_t ReadResponse(util::StreamSocket *ss, char *buffer,
+			     size_t bufsize)
+{
+    std::string headers;
+    size_t nread;
+    size_t end;
+    while ((end = headers.find("\r\n\r\n")) == std::string::npos)
+    {
+	if (ss->Read(buffer, bufsize, &nread) || !nread)
+	    return 0;
+	headers.append(buffer, nread);
+    }
+
+    const char *clen = strstr(headers.c_str(), "Content-Length: ");
+    if (!clen)
+	return 0;
+    uint64_t len = strtoull(clen + 16, NULL, 10);
+    uint64_t got = headers.size() - end - 4;
+    while (got < len)
+    {
+	if (ss->Read(buffer, bufsize, &nread) || !nread)
+	    return 0;
+	got += nread;
+    }
+    return len;
+}
+
+static void Client(unsigned short port, uint64_t filesize,
+		   std::atomic<bool> *stop, std::atomic<uint64_t> *bytes)
+{
+    util::StreamSocket ss;
+    util::IPEndPoint ipe;
+    ipe.addr = util::IPAddress::FromDottedQuad(127,0,0,1);
+    ipe.port = port;
+    if (ss.Connect(ipe))
+    {
+	fprintf(stderr, "Can't connect\n");
+	return;
+    }
+
+    std::vector<char> buffer(65536);
+    uint64_t total = 0;
+    bool range = false;
+    while (!*stop)
+    {
+	char rq[128];
+	if (range)
+	    snprintf(rq, sizeof(rq), "GET /f HTTP/1.1\r\n"
+		     "Range: bytes=%llu-\r\n\r\n",
+		     (unsigned long long)(filesize / 3));
+	else
+	    snprintf(rq, sizeof(rq), "GET /f HTTP/1.1\r\n\r\n");
+	range = !range;
+
+	if (ss.WriteAll(rq, strlen(rq)))
+	    break;
+	uint64_t n = ReadResponse(&ss, &buffer[0], buffer.size());
+	if (!n)
+	{
+	    fprintf(stderr, "Bad response\n");
+	    break;
+	}
+	total += n;
+    }
+    *bytes += total;
+}
+
+/** @return MB/s */
+static unsigned int Run(bool copy, unsigned int nclients, uint64_t filesize,
+			unsigned int ms)
+{
+    util::BackgroundScheduler poller;
+    util::WorkerThreadPool threads(util::WorkerThreadPool::NORMAL, 0);
+    util::http::Server server(&poller, &threads);
+    if (server.Init())
+	return 0;
+    FileFactory ff(copy);
+    server.AddContentFactory("/", &ff);
+
+    std::thread poll_thread([&poller]() {
+	    while (!poller.IsExiting())
+		poller.Poll(util::BackgroundScheduler::INFINITE_MS);
+	});
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> bytes(0);
+    std::vector<std::thread> clients;
+    uint64_t start = NowUsec();
+    for (unsigned int i=0; i<nclients; ++i)
+	clients.push_back(std::thread(&Client, server.GetPort(), filesize,
+				      &stop, &bytes));
+    usleep(ms * 1000);
+    stop = true;
+    for (unsigned int i=0; i<nclients; ++i)
+	clients[i].join();
+    uint64_t elapsed = NowUsec() - start;
+
+    poller.Shutdown();
+    poll_thread.join();
+
+    return (unsigned int)(bytes / elapsed); // bytes/usec = MB/s
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int maxclients = (argc > 1) ? (unsigned)atoi(argv[1]) : 64;
+    unsigned int mb = (argc > 2) ? (unsigned)atoi(argv[2]) : 64;
+    unsigned int ms = (argc > 3) ? (unsigned)atoi(argv[3]) : 2000;
+
+    uint64_t filesize = (uint64_t)mb << 20;
+    {
+	FILE *f = fopen(s_filename, "wb");
+	if (!f)
+	{
+	    fprintf(stderr, "Can't create %s\n", s_filename);
+	    return 1;
+	}
+	std::vector<char> block(1 << 20);
+	for (size_t i=0; i<block.size(); ++i)
+	    block[i] = (char)i;
+	for (unsigned int i=0; i<mb; ++i)
+	    fwrite(&block[0], 1, block.size(), f);
+	fclose(f);
+    }
+
+    printf("%8s %12s %12s\n", "clients", "copy MB/s", "sendfile MB/s");
+
+    for (unsigned int n = 1; n <= maxclients; n *= 4)
+    {
+	unsigned int tcopy = Run(true, n, filesize, ms);
+	unsigned int tsend = Run(false, n, filesize, ms);
+	printf("%8u %12u %12u\n", n, tcopy, tsend);
+    }
+
+    unlink(s_filename);
+    return 0;
+}
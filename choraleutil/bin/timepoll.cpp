@@ -0,0 +1,137 @@
+#include "config.h"
+#include "libutil/scheduler.h"
+#include "libutil/bind.h"
+#include "libutil/task.h"
+#include "libutil/counted_pointer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+/** Time BackgroundScheduler wakeups against the number of connections
+ * being waited on, for each backend.
+ *
+ * Usage: timepoll [max-connections] [ms-per-run]
+ *
+ * Each "connection" is a pipe, all waited on at once with
+ * WaitForReadable(oneshot=false); each round writes a byte down one of
+ * them at random, then Polls until its callback has read it. That's the
+ * typical server case, one busy connection among many idle ones: poll()
+ * costs in proportion to all of them, epoll only to the busy one.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+static unsigned int s_calls = 0;
+
+class ReadTask: public util::Task
+{
+    int m_fd;
+
+public:
+    explicit ReadTask(int fd) : m_fd(fd) {}
+
+    unsigned int Run()
+    {
+	char ch;
+	if (::read(m_fd, &ch, 1) == 1)
+	    ++s_calls;
+	return 0;
+    }
+};
+
+typedef util::CountedPointer<ReadTask> ReadTaskPtr;
+
+/** @return Nanoseconds per round, or 0 on error */
+static uint64_t Run(util::BackgroundScheduler::Backend backend,
+		    unsigned int nconns, unsigned int ms)
+{
+    util::BackgroundScheduler poller(backend);
+    std::vector<int> fds(nconns * 2);
+    std::vector<ReadTaskPtr> tasks;
+
+    for (unsigned int i=0; i<nconns; ++i)
+    {
+	if (::pipe(&fds[i*2]) < 0)
+	{
+	    fprintf(stderr, "Can't make %u pipes\n", nconns);
+	    for (unsigned int j=0; j<i*2; ++j)
+		close(fds[j]);
+	    return 0;
+	}
+	ReadTaskPtr task(new ReadTask(fds[i*2]));
+	tasks.push_back(task);
+	poller.WaitForReadable(util::Bind(task).To<&ReadTask::Run>(),
+			       fds[i*2], false);
+    }
+
+    // Let the poll backend build its array outside the timing
+    poller.Poll(0);
+
+    unsigned int seed = 1;
+    uint64_t rounds = 0;
+    uint64_t start = NowUsec();
+    uint64_t finish = start + ms * 1000ull;
+    uint64_t now;
+    do {
+	for (unsigned int i=0; i<100; ++i)
+	{
+	    seed = seed * 1103515245 + 12345;
+	    unsigned int which = (seed >> 8) % nconns;
+	    unsigned int calls = s_calls;
+	    if (::write(fds[which*2 + 1], "*", 1) != 1)
+		return 0;
+	    while (s_calls == calls)
+		poller.Poll(util::BackgroundScheduler::INFINITE_MS);
+	}
+	rounds += 100;
+	now = NowUsec();
+    } while (now < finish);
+
+    for (unsigned int i=0; i<nconns; ++i)
+	poller.Remove(tasks[i]);
+    for (unsigned int i=0; i<nconns*2; ++i)
+	close(fds[i]);
+
+    return (now - start) * 1000 / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int maxconns = (argc > 1) ? (unsigned)atoi(argv[1]) : 1000;
+    unsigned int ms = (argc > 2) ? (unsigned)atoi(argv[2]) : 500;
+
+    // Two fds per connection, plus some spare
+    struct rlimit rl;
+    if (::getrlimit(RLIMIT_NOFILE, &rl) == 0
+	&& rl.rlim_cur < (rlim_t)maxconns*2 + 32)
+    {
+	rl.rlim_cur = rl.rlim_max;
+	::setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    printf("%8s %12s %12s\n", "conns", "poll ns", "epoll ns");
+
+    for (unsigned int n = 10; n <= maxconns; )
+    {
+	uint64_t tpoll = Run(util::BackgroundScheduler::POLL, n, ms);
+	uint64_t tepoll = Run(util::BackgroundScheduler::EPOLL, n, ms);
+	if (!tpoll || !tepoll)
+	    return 1;
+	printf("%8u %12llu %12llu\n", n, (unsigned long long)tpoll,
+	       (unsigned long long)tepoll);
+
+	// 10, 30, 100, 300, 1000, ...
+	n = (n % 3) ? n * 3 : n * 10 / 3;
+    }
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "config.h"
+#include "libutil/worker_thread_pool.h"
+#include "libutil/bind.h"
+#include "libutil/counted_pointer.h"
+#include "libutil/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Time util::WorkerThreadPool against a single shared SimpleTaskQueue (as
+ * the pool used to be), as the number of threads rises.
+ *
+ * Usage: timepool [max-threads]
+ *
+ * "tasks/s" is throughput with four threads pushing empty tasks as fast as
+ * they can. "p50" and "p99" are the latency, from push to start, of a short
+ * task pushed every millisecond while every thread is kept busy with 20ms
+ * "encodes"; the pool pushes them in its INTERACTIVE lane.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+/** The old pool: one deque, one mutex, one condvar */
+class SharedQueue
+{
+    util::SimpleTaskQueue m_queue;
+    std::vector<std::thread> m_threads;
+
+    void Run()
+    {
+	for (;;)
+	{
+	    util::TaskCallback cb = m_queue.PopTask(10);
+	    if (!cb.IsValid())
+		return;
+	    cb();
+	}
+    }
+
+public:
+    explicit SharedQueue(unsigned int n)
+    {
+	for (unsigned int i=0; i<n; ++i)
+	    m_threads.push_back(std::thread(&SharedQueue::Run, this));
+    }
+
+    ~SharedQueue()
+    {
+	for (unsigned int i=0; i<m_threads.size(); ++i)
+	    m_queue.PushTask(util::TaskCallback());
+	for (unsigned int i=0; i<m_threads.size(); ++i)
+	    m_threads[i].join();
+    }
+
+    void Push(const util::TaskCallback& cb, bool) { m_queue.PushTask(cb); }
+};
+
+class Pool
+{
+    util::WorkerThreadPool m_pool;
+
+public:
+    explicit Pool(unsigned int n) : m_pool(util::WorkerThreadPool::NORMAL, n)
+    {}
+
+    void Push(const util::TaskCallback& cb, bool interactive)
+    {
+	if (interactive)
+	    m_pool.PushTask(cb, util::WorkerThreadPool::INTERACTIVE);
+	else
+	    m_pool.PushTask(cb);
+    }
+};
+
+static std::atomic<unsigned int> s_done;
+
+class Empty: public util::Task
+{
+public:
+    unsigned int Run() override { ++s_done; return 0; }
+};
+
+class Encode: public util::Task
+{
+public:
+    unsigned int Run() override
+    {
+	uint64_t end = NowUsec() + 20000;
+	while (NowUsec() < end)
+	    ;
+	++s_done;
+	return 0;
+    }
+};
+
+static std::mutex s_mutex;
+static std::vector<unsigned int> s_latencies;
+
+class Probe: public util::Task
+{
+    uint64_t m_pushed;
+
+public:
+    Probe() : m_pushed(NowUsec()) {}
+
+    unsigned int Run() override
+    {
+	unsigned int usec = (unsigned int)(NowUsec() - m_pushed);
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_latencies.push_back(usec);
+	return 0;
+    }
+};
+
+static util::TaskCallback Make(util::Task *t)
+{
+    return util::Bind(util::TaskPtr(t)).To<&util::Task::Run>();
+}
+
+enum { PUSHERS = 4, PER_PUSHER = 50000, PROBES = 500 };
+
+template <class Q>
+static unsigned int Throughput(unsigned int nthreads)
+{
+    s_done = 0;
+    uint64_t start = NowUsec();
+    {
+	Q q(nthreads);
+	std::vector<std::thread> pushers;
+	for (unsigned int i=0; i<PUSHERS; ++i)
+	    pushers.push_back(std::thread([&q]() {
+			for (unsigned int j=0; j<PER_PUSHER; ++j)
+			    q.Push(Make(new Empty), false);
+		    }));
+	for (unsigned int i=0; i<PUSHERS; ++i)
+	    pushers[i].join();
+	while (s_done < PUSHERS * PER_PUSHER)
+	    usleep(100);
+    }
+    return (unsigned int)(PUSHERS * PER_PUSHER * 1000000ull
+			  / (NowUsec() - start));
+}
+
+template <class Q>
+static void Latency(unsigned int nthreads, unsigned int *p50,
+		    unsigned int *p99)
+{
+    s_latencies.clear();
+    s_done = 0;
+    unsigned int encodes = 0;
+    {
+	Q q(nthreads);
+	for (unsigned int i=0; i<PROBES; ++i)
+	{
+	    // Keep a backlog of encodes bigger than the pool
+	    while (encodes < s_done + nthreads * 2)
+	    {
+		q.Push(Make(new Encode), false);
+		++encodes;
+	    }
+	    q.Push(Make(new Probe), true);
+	    usleep(1000);
+	}
+	while (s_latencies.size() < PROBES || s_done < encodes)
+	    usleep(1000);
+    }
+    std::sort(s_latencies.begin(), s_latencies.end());
+    *p50 = s_latencies[PROBES / 2];
+    *p99 = s_latencies[PROBES * 99 / 100];
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int maxthreads = (argc > 1) ? (unsigned)atoi(argv[1]) : 16;
+
+    printf("%8s %10s %10s %10s %10s %10s %10s\n", "threads",
+	   "old task/s", "old p50", "old p99", "new task/s", "new p50",
+	   "new p99");
+
+    for (unsigned int n = 1; n <= maxthreads; n *= 2)
+    {
+	unsigned int old50, old99, new50, new99;
+	unsigned int oldtp = Throughput<SharedQueue>(n);
+	Latency<SharedQueue>(n, &old50, &old99);
+	unsigned int newtp = Throughput<Pool>(n);
+	Latency<Pool>(n, &new50, &new99);
+	printf("%8u %10u %10u %10u %10u %10u %10u\n", n, oldtp, old50, old99,
+	       newtp, new50, new99);
+    }
+
+    return 0;
+}
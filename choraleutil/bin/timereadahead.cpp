@@ -0,0 +1,131 @@
+#include "config.h"
+#include "libutil/file_stream.h"
+#include "libutil/readahead_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/** Time reading a file in little pieces, straight from a file stream and
+ * through util::CreateReadAheadStream.
+ *
+ * Usage: timereadahead [file-MB]
+ *
+ * "tar" reads 512 bytes at a time, like TarFS scanning headers; "nfs"
+ * reads 8K at a time, like a Receiver playing a file over NFS; "shared"
+ * is two threads both reading the same file 4K at a time, like two
+ * clients playing the same track. "reads" counts the reads which reach
+ * the file.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+static std::atomic<unsigned int> s_reads;
+
+/** Counts the reads that get through to the file */
+class CountingStream: public util::SeekableStream
+{
+    std::unique_ptr<util::Stream> m_stream;
+
+public:
+    explicit CountingStream(std::unique_ptr<util::Stream> s)
+	: m_stream(std::move(s)) {}
+
+    unsigned GetStreamFlags() const override
+    {
+	return m_stream->GetStreamFlags();
+    }
+    unsigned ReadAt(void *buffer, uint64_t pos, size_t len,
+		    size_t *pread) override
+    {
+	++s_reads;
+	return m_stream->ReadAt(buffer, pos, len, pread);
+    }
+    uint64_t GetLength() override { return m_stream->GetLength(); }
+    unsigned GetFileExtent(int *pfd, uint64_t *poffset) override
+    {
+	return m_stream->GetFileExtent(pfd, poffset);
+    }
+};
+
+static std::unique_ptr<util::Stream> Open(const char *filename,
+					  bool readahead)
+{
+    std::unique_ptr<util::Stream> sp;
+    if (util::OpenFileStream(filename, util::READ, &sp))
+	exit(1);
+    sp.reset(new CountingStream(std::move(sp)));
+    if (readahead)
+	sp = util::CreateReadAheadStream(std::move(sp));
+    return sp;
+}
+
+static void ReadAll(const char *filename, bool readahead, size_t size)
+{
+    std::unique_ptr<util::Stream> sp = Open(filename, readahead);
+    std::vector<char> buffer(size);
+    for (;;)
+    {
+	size_t nread;
+	if (sp->Read(&buffer[0], size, &nread) || !nread)
+	    break;
+    }
+}
+
+static void Run(const char *name, const char *filename, size_t size,
+		unsigned int threads)
+{
+    uint64_t usec[2];
+    unsigned int reads[2];
+    for (unsigned int i=0; i<2; ++i)
+    {
+	s_reads = 0;
+	uint64_t start = NowUsec();
+	std::vector<std::thread> v;
+	for (unsigned int j=0; j<threads; ++j)
+	    v.push_back(std::thread(ReadAll, filename, i == 1, size));
+	for (unsigned int j=0; j<threads; ++j)
+	    v[j].join();
+	usec[i] = NowUsec() - start;
+	reads[i] = s_reads;
+    }
+    printf("%8s %10llu %10u %10llu %10u\n", name,
+	   (unsigned long long)usec[0], reads[0],
+	   (unsigned long long)usec[1], reads[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int mb = (argc > 1) ? (unsigned)atoi(argv[1]) : 64;
+
+    char filename[] = "/tmp/timereadaheadXXXXXX";
+    int fd = mkstemp(filename);
+    if (fd < 0)
+	return 1;
+    std::vector<char> block(1024*1024);
+    for (unsigned int i=0; i<block.size(); ++i)
+	block[i] = (char)i;
+    for (unsigned int i=0; i<mb; ++i)
+	if (::write(fd, &block[0], block.size()) != (ssize_t)block.size())
+	    return 1;
+    ::close(fd);
+
+    printf("%8s %10s %10s %10s %10s\n", "", "plain us", "reads",
+	   "ahead us", "reads");
+    Run("tar", filename, 512, 1);
+    Run("nfs", filename, 8192, 1);
+    Run("shared", filename, 4096, 2);
+
+    unlink(filename);
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "config.h"
+#include "libdbsteam/db.h"
+#include "libdb/query.h"
+#include "libdb/recordset.h"
+#include "libmediadb/xml.h"
+#include "libmediadb/schema.h"
+#include "libutil/counted_pointer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/** Time concurrent readers of a steam database, both through the live
+ * database (one lock for everyone) and through a SnapshotView (no lock),
+ * with and without a writer busy at the same time.
+ *
+ * Usage: timereads <db.xml> [max-threads] [ms-per-run]
+ *
+ * Each read looks up a random record by ID and fetches the fields a UPnP
+ * Browse would.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+static const unsigned int fields[] = {
+    mediadb::TITLE, mediadb::ARTIST, mediadb::ALBUM, mediadb::PATH,
+    mediadb::DURATIONMS, mediadb::TYPE, mediadb::TRACKNUMBER
+};
+
+static void Reader(db::Database *thedb, const std::vector<unsigned int> *ids,
+		   unsigned int seed, std::atomic<bool> *stop,
+		   std::atomic<unsigned int> *count)
+{
+    unsigned int n = 0;
+    size_t bytes = 0;
+    while (!*stop)
+    {
+	seed = seed * 1103515245 + 12345;
+	unsigned int id = (*ids)[(seed >> 8) % ids->size()];
+	db::QueryPtr qp = thedb->CreateQuery();
+	qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+	db::RecordsetPtr rs = qp->Execute();
+	if (!rs->IsEOF())
+	    for (unsigned int i=0; i<sizeof(fields)/sizeof(fields[0]); ++i)
+		bytes += rs->GetString(fields[i]).size();
+	++n;
+    }
+    *count += n;
+    (void)bytes;
+}
+
+static void Writer(db::Database *thedb, std::atomic<bool> *stop)
+{
+    unsigned int n = 0;
+    while (!*stop)
+    {
+	for (db::RecordsetPtr rs = thedb->CreateRecordset();
+	     !rs->IsEOF() && !*stop;
+	     rs->MoveNext())
+	{
+	    rs->SetInteger(mediadb::MTIME, ++n);
+	    rs->Commit();
+	}
+    }
+}
+
+static unsigned int Run(db::Database *readdb, db::Database *writedb,
+			const std::vector<unsigned int>& ids,
+			unsigned int nthreads, unsigned int ms)
+{
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned int> count(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned int i=0; i<nthreads; ++i)
+	threads.push_back(std::thread(Reader, readdb, &ids, i+1, &stop,
+				      &count));
+    std::thread writer;
+    if (writedb)
+	writer = std::thread(Writer, writedb, &stop);
+
+    uint64_t start = NowUsec();
+    ::usleep(ms * 1000);
+    stop = true;
+    for (unsigned int i=0; i<nthreads; ++i)
+	threads[i].join();
+    uint64_t elapsed = NowUsec() - start;
+    if (writedb)
+	writer.join();
+
+    return (unsigned int)(count * 1000000ull / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+	fprintf(stderr,
+		"Usage: timereads <db.xml> [max-threads] [ms-per-run]\n");
+	return 1;
+    }
+
+    unsigned int maxthreads = (argc > 2) ? atoi(argv[2]) : 8;
+    unsigned int ms = (argc > 3) ? atoi(argv[3]) : 1000;
+
+    db::steam::Database sdb(mediadb::FIELD_COUNT);
+    sdb.SetFieldInfo(mediadb::ID,
+		     db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(mediadb::PATH,
+		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(mediadb::ARTIST,
+		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(mediadb::ALBUM,
+		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+
+    unsigned int rc = mediadb::ReadXML(&sdb, argv[1]);
+    if (rc)
+    {
+	fprintf(stderr, "Can't read %s: %u\n", argv[1], rc);
+	return 1;
+    }
+    sdb.Publish();
+
+    db::steam::SnapshotView view(&sdb);
+
+    std::vector<unsigned int> ids;
+    for (db::RecordsetPtr rs = sdb.CreateRecordset();
+	 !rs->IsEOF();
+	 rs->MoveNext())
+	ids.push_back(rs->GetInteger(mediadb::ID));
+    if (ids.empty())
+    {
+	fprintf(stderr, "%s is empty\n", argv[1]);
+	return 1;
+    }
+
+    printf("%u records, %u hardware threads; reads per second:\n",
+	   (unsigned int)ids.size(), std::thread::hardware_concurrency());
+    printf("%8s %12s %12s %12s %12s\n", "threads", "live", "snapshot",
+	   "live+writer", "snap+writer");
+
+    for (unsigned int n=1; n<=maxthreads; n*=2)
+    {
+	unsigned int live = Run(&sdb, NULL, ids, n, ms);
+	unsigned int snap = Run(&view, NULL, ids, n, ms);
+	unsigned int livew = Run(&sdb, &sdb, ids, n, ms);
+	unsigned int snapw = Run(&view, &sdb, ids, n, ms);
+	printf("%8u %12u %12u %12u %12u\n", n, live, snap, livew, snapw);
+    }
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "config.h"
+#include "libdbsteam/db.h"
+#include "libdb/query.h"
+#include "libdb/recordset.h"
+#include "libutil/counted_pointer.h"
+#include <boost/regex.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+/** Time incremental ("search as you type") LIKE queries on a large
+ * synthetic library, both the old way (a case-insensitive regex tested
+ * against every record) and through the steam database's text index.
+ *
+ * Usage: timesearch [rows] [word]
+ *
+ * For each keystroke of "word", times a prefix search on ARTIST (as the
+ * receiver protocol sends) and a substring search on TITLE (as UPnP
+ * "contains" sends).
+ */
+
+enum { ID, TITLE, ARTIST, ALBUM, GENRE, NFIELDS };
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+static unsigned int s_seed = 1;
+
+static unsigned int Random(unsigned int n)
+{
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 8) % n;
+}
+
+static std::string MakeWord()
+{
+    static const char *const syllables[] = {
+	"la", "mon", "ter", "ri", "sha", "do", "ven", "ka", "lo", "thu",
+	"mi", "an", "sel", "bo", "ra", "ne", "qui", "sta", "ro", "\xC3\xA9l"
+    };
+    enum { NSYLLABLES = sizeof(syllables)/sizeof(syllables[0]) };
+
+    std::string s;
+    unsigned int n = 1 + Random(3);
+    for (unsigned int i=0; i<n; ++i)
+	s += syllables[Random(NSYLLABLES)];
+    if (Random(2) && s[0] >= 'a' && s[0] <= 'z')
+	s[0] = (char)(s[0] - 'a' + 'A');
+    return s;
+}
+
+static std::string MakeName(const std::vector<std::string>& words,
+			    unsigned int min, unsigned int max)
+{
+    std::string s;
+    unsigned int n = min + Random(max - min + 1);
+    for (unsigned int i=0; i<n; ++i)
+    {
+	if (i)
+	    s += " ";
+	s += words[Random((unsigned int)words.size())];
+    }
+    return s;
+}
+
+/** The old way: what db::steam::Query did for any LIKE */
+static unsigned int RegexSearch(db::Database *thedb, unsigned int field,
+				const std::string& pattern)
+{
+    boost::regex re(pattern, boost::regex::icase);
+    unsigned int n = 0;
+    for (db::RecordsetPtr rs = thedb->CreateRecordset();
+	 !rs->IsEOF();
+	 rs->MoveNext())
+	if (boost::regex_match(rs->GetString(field), re))
+	    ++n;
+    return n;
+}
+
+static unsigned int IndexSearch(db::Database *thedb, unsigned int field,
+				const std::string& pattern)
+{
+    db::QueryPtr qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(field, db::LIKE, pattern));
+    unsigned int n = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	++n;
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int rows = (argc > 1) ? atoi(argv[1]) : 500000;
+    std::string word = (argc > 2) ? argv[2] : "Monterila";
+
+    db::steam::Database sdb(NFIELDS);
+    sdb.SetFieldInfo(ID, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    for (unsigned int i=TITLE; i<NFIELDS; ++i)
+	sdb.SetFieldInfo(i, db::steam::FIELD_STRING|db::steam::FIELD_INDEXED
+			 |db::steam::FIELD_TEXTINDEX);
+
+    std::vector<std::string> words, artists, albums, genres;
+    for (unsigned int i=0; i<20000; ++i)
+	words.push_back(MakeWord());
+    for (unsigned int i=0; i<rows/50 + 1; ++i)
+	artists.push_back(MakeName(words, 1, 3));
+    for (unsigned int i=0; i<rows/10 + 1; ++i)
+	albums.push_back(MakeName(words, 1, 4));
+    for (unsigned int i=0; i<40; ++i)
+	genres.push_back(MakeName(words, 1, 2));
+
+    // Nobody's reading yet, so don't keep publishing (and copying) it
+    sdb.SetPublishInterval(UINT_MAX);
+
+    uint64_t start = NowUsec();
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    for (unsigned int i=0; i<rows; ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(ID, i+1);
+	rs->SetString(TITLE, MakeName(words, 1, 5));
+	rs->SetString(ARTIST, artists[Random((unsigned int)artists.size())]);
+	rs->SetString(ALBUM, albums[Random((unsigned int)albums.size())]);
+	rs->SetString(GENRE, genres[Random((unsigned int)genres.size())]);
+	rs->Commit();
+    }
+    sdb.Publish();
+    printf("%u rows loaded in %llu ms\n", rows,
+	   (unsigned long long)(NowUsec() - start) / 1000);
+
+    printf("%-12s %10s %10s %8s   %10s %10s %8s\n", "typed",
+	   "prefix:re", "index", "matches", "substr:re", "index", "matches");
+
+    for (size_t len = 1; len <= word.size(); ++len)
+    {
+	std::string typed(word, 0, len);
+	std::string prefix = typed + ".*";
+	std::string contains = ".*" + typed + ".*";
+
+	start = NowUsec();
+	unsigned int n1 = RegexSearch(&sdb, ARTIST, prefix);
+	uint64_t t1 = NowUsec() - start;
+
+	start = NowUsec();
+	unsigned int n2 = IndexSearch(&sdb, ARTIST, prefix);
+	uint64_t t2 = NowUsec() - start;
+
+	start = NowUsec();
+	unsigned int n3 = RegexSearch(&sdb, TITLE, contains);
+	uint64_t t3 = NowUsec() - start;
+
+	start = NowUsec();
+	unsigned int n4 = IndexSearch(&sdb, TITLE, contains);
+	uint64_t t4 = NowUsec() - start;
+
+	printf("%-12s %8llu us %7llu us %8u   %8llu us %7llu us %8u%s\n",
+	       typed.c_str(),
+	       (unsigned long long)t1, (unsigned long long)t2, n2,
+	       (unsigned long long)t3, (unsigned long long)t4, n4,
+	       (n1 == n2 && n3 == n4) ? "" : "  MISMATCH");
+    }
+
+    return 0;
+}
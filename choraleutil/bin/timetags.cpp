@@ -0,0 +1,163 @@
+#include "config.h"
+#include "libreceiverd/content_factory.h"
+#include "libdbmerge/db.h"
+#include "libutil/http_server.h"
+#include "libutil/scheduler.h"
+#include "libutil/socket.h"
+#include "libutil/worker_thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Time util::http::Server answering small Receiver "/tags" requests,
+ * with everything done on the worker pool (the default) and inline on the
+ * scheduler thread.
+ *
+ * Usage: timetags [max-clients] [ms-per-run]
+ *
+ * Each client keeps its connection alive and asks again as soon as it has
+ * its answer. Reports requests per second, and the median and 99th
+ * percentile latency.
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+static bool ReadResponse(util::StreamSocket *ss)
+{
+    char buffer[4096];
+    std::string reply;
+    size_t end;
+    while ((end = reply.find("\r\n\r\n")) == std::string::npos)
+    {
+	size_t nread;
+	if (ss->Read(buffer, sizeof(buffer), &nread) || !nread)
+	    return false;
+	reply.append(buffer, nread);
+    }
+
+    const char *clen = strstr(reply.c_str(), "Content-Length: ");
+    if (!clen)
+	return false;
+    size_t len = (size_t)strtoul(clen + 16, NULL, 10);
+    size_t got = reply.size() - end - 4;
+    while (got < len)
+    {
+	size_t nread;
+	if (ss->Read(buffer, sizeof(buffer), &nread) || !nread)
+	    return false;
+	got += nread;
+    }
+    return true;
+}
+
+struct Results
+{
+    std::mutex mutex;
+    std::vector<unsigned int> latencies; ///< usec
+};
+
+static void Client(unsigned short port, std::atomic<bool> *stop,
+		   Results *results)
+{
+    util::StreamSocket ss;
+    util::IPEndPoint ipe;
+    ipe.addr = util::IPAddress::FromDottedQuad(127,0,0,1);
+    ipe.port = port;
+    if (ss.Connect(ipe))
+    {
+	fprintf(stderr, "Can't connect\n");
+	return;
+    }
+
+    static const char rq[] = "GET /tags HTTP/1.1\r\n\r\n";
+    std::vector<unsigned int> latencies;
+    while (!*stop)
+    {
+	uint64_t start = NowUsec();
+	if (ss.WriteAll(rq, sizeof(rq) - 1) || !ReadResponse(&ss))
+	{
+	    fprintf(stderr, "Bad response\n");
+	    break;
+	}
+	latencies.push_back((unsigned int)(NowUsec() - start));
+    }
+
+    std::lock_guard<std::mutex> lock(results->mutex);
+    results->latencies.insert(results->latencies.end(), latencies.begin(),
+			      latencies.end());
+}
+
+static void Run(bool inline_io, unsigned int nclients, unsigned int ms)
+{
+    db::merge::Database mergedb; // "/tags" doesn't need any records
+    receiverd::ContentFactory rcf(&mergedb, true);
+
+    util::BackgroundScheduler poller;
+    util::WorkerThreadPool threads(util::WorkerThreadPool::NORMAL, 0);
+    util::http::Server server(&poller, &threads);
+    server.SetInline(inline_io);
+    if (server.Init())
+	return;
+    server.AddContentFactory("/tags", &rcf);
+
+    std::thread poll_thread([&poller]() {
+	    while (!poller.IsExiting())
+		poller.Poll(util::BackgroundScheduler::INFINITE_MS);
+	});
+
+    std::atomic<bool> stop(false);
+    Results results;
+    std::vector<std::thread> clients;
+    uint64_t start = NowUsec();
+    for (unsigned int i=0; i<nclients; ++i)
+	clients.push_back(std::thread(&Client, server.GetPort(), &stop,
+				      &results));
+    usleep(ms * 1000);
+    stop = true;
+    for (unsigned int i=0; i<nclients; ++i)
+	clients[i].join();
+    uint64_t elapsed = NowUsec() - start;
+
+    poller.Shutdown();
+    poll_thread.join();
+
+    std::vector<unsigned int>& l = results.latencies;
+    if (l.empty())
+	return;
+    std::sort(l.begin(), l.end());
+    printf("%8u %8s %10llu %8u %8u\n", nclients,
+	   inline_io ? "inline" : "pool",
+	   (unsigned long long)(l.size() * 1000000ull / elapsed),
+	   l[l.size() / 2], l[l.size() * 99 / 100]);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int maxclients = (argc > 1) ? (unsigned)atoi(argv[1]) : 256;
+    unsigned int ms = (argc > 2) ? (unsigned)atoi(argv[2]) : 2000;
+
+    printf("%8s %8s %10s %8s %8s\n", "clients", "mode", "req/s",
+	   "p50 us", "p99 us");
+
+    for (unsigned int n = 1; n <= maxclients; n *= 4)
+    {
+	Run(false, n, ms);
+	Run(true, n, ms);
+    }
+
+    return 0;
+}
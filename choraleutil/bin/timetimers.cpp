@@ -0,0 +1,90 @@
+#include "config.h"
+#include "libutil/scheduler.h"
+#include "libutil/bind.h"
+#include "libutil/counted_pointer.h"
+#include "libutil/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+#include <vector>
+
+/** Time util::BackgroundScheduler's timers with many of them waiting, as
+ * with thousands of GENA subscriptions each with a renewal timer.
+ *
+ * Usage: timetimers [max-timers]
+ *
+ * "add", "poll" and "remove" are nanoseconds per Wait, per Poll(0) (with
+ * nothing due) and per Remove; "fire" is nanoseconds per timer when they
+ * all fall due at once.
+ */
+
+static uint64_t NowNsec()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t)ts.tv_sec) * 1000000000) + ts.tv_nsec;
+}
+
+static unsigned int s_fired;
+
+class Renewal: public util::Task
+{
+public:
+    unsigned int Run() override { ++s_fired; return 0; }
+};
+
+typedef util::CountedPointer<Renewal> RenewalPtr;
+
+int main(int argc, char *argv[])
+{
+    unsigned int max = (argc > 1) ? (unsigned)atoi(argv[1]) : 100000;
+
+    printf("%8s %10s %10s %10s %10s\n", "timers", "add ns", "poll ns",
+	   "remove ns", "fire ns");
+
+    for (unsigned int n = 100; n <= max; n *= 10)
+    {
+	util::BackgroundScheduler poller;
+	std::vector<RenewalPtr> tasks;
+	for (unsigned int i=0; i<n; ++i)
+	    tasks.push_back(RenewalPtr(new Renewal));
+
+	// Renewals spread over the next half-hour, then every half-hour
+	time_t now = time(NULL);
+	uint64_t start = NowNsec();
+	for (unsigned int i=0; i<n; ++i)
+	    poller.Wait(util::Bind(tasks[i]).To<&Renewal::Run>(),
+			now + 60 + (i % 1800), 1800*1000);
+	uint64_t add = (NowNsec() - start) / n;
+
+	enum { POLLS = 1000 };
+	start = NowNsec();
+	for (unsigned int i=0; i<POLLS; ++i)
+	    poller.Poll(0);
+	uint64_t poll = (NowNsec() - start) / POLLS;
+
+	// Unsubscribe a tenth of them
+	unsigned int removes = n / 10;
+	start = NowNsec();
+	for (unsigned int i=0; i<removes; ++i)
+	    poller.Remove(tasks[(i * 7919) % n]);
+	uint64_t remove = (NowNsec() - start) / removes;
+
+	// All due at once
+	util::BackgroundScheduler poller2;
+	for (unsigned int i=0; i<n; ++i)
+	    poller2.Wait(util::Bind(tasks[i]).To<&Renewal::Run>(), now, 0);
+	s_fired = 0;
+	start = NowNsec();
+	while (s_fired < n)
+	    poller2.Poll(1000);
+	uint64_t fire = (NowNsec() - start) / n;
+
+	printf("%8u %10llu %10llu %10llu %10llu\n", n,
+	       (unsigned long long)add, (unsigned long long)poll,
+	       (unsigned long long)remove, (unsigned long long)fire);
+    }
+    return 0;
+}
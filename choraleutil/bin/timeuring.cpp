@@ -0,0 +1,195 @@
+#include "config.h"
+#include "libutil/http_server.h"
+#include "libutil/io_uring.h"
+#include "libutil/scheduler.h"
+#include "libutil/file.h"
+#include "libutil/worker_thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Time util::http::Server serving random Range requests on a large file
+ * to many concurrent clients: as usual (sendfile from worker threads), and
+ * with FileContentFactory::SetAsync on an inline server (io_uring reads,
+ * all on the scheduler thread).
+ *
+ * Usage: timeuring [clients [requests-per-client [range-bytes]]]
+ */
+
+static uint64_t NowUsec()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return (((uint64_t)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
+
+enum { FILE_SIZE = 64*1024*1024 };
+
+static std::mutex s_mutex;
+static std::vector<unsigned int> s_latencies;
+static unsigned int s_errors;
+
+/** One keep-alive connection making Range requests one after another */
+static void Client(unsigned short port, unsigned int requests,
+		   unsigned int range, unsigned int seed)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+    {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_errors += requests;
+	::close(fd);
+	return;
+    }
+
+    std::vector<unsigned int> latencies;
+    std::string buffer;
+    char chunk[65536];
+
+    for (unsigned int i=0; i<requests; ++i)
+    {
+	unsigned int start = rand_r(&seed) % (FILE_SIZE - range);
+	char rq[200];
+	int n = snprintf(rq, sizeof(rq),
+			 "GET /f/big HTTP/1.1\r\n"
+			 "Range: bytes=%u-%u\r\n\r\n", start, start+range-1);
+
+	uint64_t t = NowUsec();
+	if (::write(fd, rq, (size_t)n) != n)
+	    break;
+
+	// Headers, then exactly Content-Length bytes of body
+	size_t body = std::string::npos;
+	size_t length = 0;
+	for (;;)
+	{
+	    if (body == std::string::npos)
+	    {
+		body = buffer.find("\r\n\r\n");
+		if (body != std::string::npos)
+		{
+		    size_t cl = buffer.find("Content-Length: ");
+		    if (cl == std::string::npos || cl > body)
+			break;
+		    length = strtoul(buffer.c_str() + cl + 16, NULL, 10);
+		    body += 4;
+		}
+	    }
+	    if (body != std::string::npos && buffer.size() >= body + length)
+		break;
+	    ssize_t rc = ::read(fd, chunk, sizeof(chunk));
+	    if (rc <= 0)
+		break;
+	    buffer.append(chunk, (size_t)rc);
+	}
+	if (body == std::string::npos || length != range
+	    || buffer.size() < body + length)
+	{
+	    std::lock_guard<std::mutex> lock(s_mutex);
+	    s_errors += requests - i;
+	    break;
+	}
+	buffer.erase(0, body + length);
+	latencies.push_back((unsigned int)(NowUsec() - t));
+    }
+    ::close(fd);
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_latencies.insert(s_latencies.end(), latencies.begin(),
+		       latencies.end());
+}
+
+static void Run(const char *name, const std::string& root, bool async,
+		unsigned int clients, unsigned int requests,
+		unsigned int range)
+{
+    util::BackgroundScheduler poller;
+    util::WorkerThreadPool threads(util::WorkerThreadPool::NORMAL, 0);
+    util::http::Server server(&poller, &threads);
+    server.SetInline(async);
+    if (server.Init())
+	return;
+    util::http::FileContentFactory fcf(root, "/f");
+    fcf.SetAsync(async);
+    server.AddContentFactory("/f", &fcf);
+
+    std::thread poll_thread([&poller]() {
+	    while (!poller.IsExiting())
+		poller.Poll(util::BackgroundScheduler::INFINITE_MS);
+	});
+
+    s_latencies.clear();
+    s_errors = 0;
+    uint64_t start = NowUsec();
+    std::vector<std::thread> client_threads;
+    for (unsigned int i=0; i<clients; ++i)
+	client_threads.push_back(std::thread(Client, server.GetPort(),
+					     requests, range, i+1));
+    for (unsigned int i=0; i<clients; ++i)
+	client_threads[i].join();
+    uint64_t usec = NowUsec() - start;
+
+    poller.Shutdown();
+    poll_thread.join();
+
+    if (s_latencies.empty())
+    {
+	fprintf(stderr, "%s: all requests failed\n", name);
+	return;
+    }
+    std::sort(s_latencies.begin(), s_latencies.end());
+    printf("%10s %10llu %10u %10u %8u\n", name,
+	   (unsigned long long)(s_latencies.size() * 1000000ull / usec),
+	   s_latencies[s_latencies.size() / 2],
+	   s_latencies[s_latencies.size() * 99 / 100], s_errors);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int clients = (argc > 1) ? (unsigned)atoi(argv[1]) : 32;
+    unsigned int requests = (argc > 2) ? (unsigned)atoi(argv[2]) : 500;
+    unsigned int range = (argc > 3) ? (unsigned)atoi(argv[3]) : 16384;
+
+    char dir[] = "/tmp/timeuringXXXXXX";
+    if (!mkdtemp(dir))
+	return 1;
+    std::string root = util::Canonicalise(dir);
+    std::string path = root + "/big";
+    int fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    std::vector<char> block(1024*1024);
+    for (unsigned int i=0; i<block.size(); ++i)
+	block[i] = (char)i;
+    for (unsigned int i=0; i<FILE_SIZE/block.size(); ++i)
+	if (::write(fd, &block[0], block.size()) != (ssize_t)block.size())
+	    return 1;
+    ::close(fd);
+
+    printf("%10s %10s %10s %10s %8s\n", "server", "req/s", "p50 us",
+	   "p99 us", "errors");
+    Run("sendfile", root, false, clients, requests, range);
+    if (util::IOUring::IsAvailable())
+	Run("io_uring", root, true, clients, requests, range);
+    else
+	fprintf(stderr, "No io_uring here\n");
+
+    unlink(path.c_str());
+    rmdir(dir);
+    return 0;
+}
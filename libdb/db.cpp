@@ -0,0 +1,88 @@
+#include "db.h"
+#include "fetch_rs.h"
+#include "empty_recordset.h"
+#include "query.h"
+#include "libutil/counted_pointer.h"
+
+namespace db {
+
+
+        /* FetchRecordset */
+
+
+FetchRecordset::FetchRecordset()
+    : DelegatingRecordset(RecordsetPtr(new EmptyRecordset), true),
+      m_next(0),
+      m_count(0)
+{
+}
+
+void FetchRecordset::Start(size_t count)
+{
+    m_count = count;
+    Advance();
+}
+
+void FetchRecordset::Advance()
+{
+    while (m_rs->IsEOF() && m_next < m_count)
+    {
+	RecordsetPtr rs = Part(m_next++);
+	if (rs)
+	    m_rs = rs;
+    }
+}
+
+bool FetchRecordset::IsEOF() const
+{
+    return m_rs->IsEOF();
+}
+
+void FetchRecordset::MoveNext()
+{
+    m_rs->MoveNext();
+    Advance();
+}
+
+unsigned int FetchRecordset::Delete()
+{
+    unsigned int rc = m_rs->Delete();
+    Advance();
+    return rc;
+}
+
+
+        /* Database::Fetch */
+
+
+/** One query per value.
+ */
+class QueryFetchRecordset final: public FetchRecordset
+{
+    Database *m_db;
+    unsigned int m_which;
+    std::vector<unsigned int> m_values;
+
+    RecordsetPtr Part(size_t n) override
+    {
+	QueryPtr qp = m_db->CreateQuery();
+	qp->Where(qp->Restrict(m_which, EQ, m_values[n]));
+	return qp->Execute();
+    }
+
+public:
+    QueryFetchRecordset(Database *db, unsigned int which,
+			const std::vector<unsigned int>& values)
+	: m_db(db), m_which(which), m_values(values)
+    {
+	Start(m_values.size());
+    }
+};
+
+RecordsetPtr Database::Fetch(unsigned int which,
+			     const std::vector<unsigned int>& values)
+{
+    return RecordsetPtr(new QueryFetchRecordset(this, which, values));
+}
+
+} // namespace db
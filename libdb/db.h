@@ -6,6 +6,8 @@
 #ifndef DB_DB_H
 #define DB_DB_H
 
+#include <vector>
+
 namespace util { template <class T> class CountedPointer; }
 
 /** Interface classes for a generic database abstraction.
@@ -31,6 +33,17 @@ public:
     virtual ~Database() {}
     virtual RecordsetPtr CreateRecordset() = 0;
     virtual QueryPtr CreateQuery() = 0;
+
+    /** Fetches the records whose integer field "which" has each of the
+     * given values (typically, a list of IDs), in the order of the values.
+     * Values no record has are skipped.
+     *
+     * The default runs a query per value, as the recordset reaches it;
+     * databases which can do better, such as by fetching them all at
+     * once, override it.
+     */
+    virtual RecordsetPtr Fetch(unsigned int which,
+			       const std::vector<unsigned int>& values);
 };
 
 } // namespace db
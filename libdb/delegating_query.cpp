@@ -34,9 +34,9 @@ unsigned int DelegatingQuery::Where(const Subexpression& s)
     return m_qp->Where(s);
 }
 
-unsigned int DelegatingQuery::OrderBy(unsigned int which)
+unsigned int DelegatingQuery::OrderBy(unsigned int which, bool descending)
 {
-    return m_qp->OrderBy(which);
+    return m_qp->OrderBy(which, descending);
 }
 
 unsigned int DelegatingQuery::CollateBy(unsigned int which)
@@ -44,9 +44,19 @@ unsigned int DelegatingQuery::CollateBy(unsigned int which)
     return m_qp->CollateBy(which);
 }
 
+unsigned int DelegatingQuery::Limit(unsigned int n)
+{
+    return m_qp->Limit(n);
+}
+
 util::CountedPointer<Recordset> DelegatingQuery::Execute()
 {
     return m_qp->Execute();
 }
 
+std::string DelegatingQuery::Explain()
+{
+    return m_qp->Explain();
+}
+
 } // namespace db
@@ -26,9 +26,12 @@ public:
     Subexpression And(const Subexpression&, const Subexpression&) override;
     Subexpression Or(const Subexpression&, const Subexpression&) override;
     unsigned int Where(const Subexpression&) override;
-    unsigned int OrderBy(unsigned int which) override;
+    unsigned int OrderBy(unsigned int which,
+			 bool descending = false) override;
     unsigned int CollateBy(unsigned int which) override;
+    unsigned int Limit(unsigned int n) override;
     util::CountedPointer<Recordset> Execute() override;
+    std::string Explain() override;
 };
 
 } // namespace db
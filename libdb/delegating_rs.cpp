@@ -11,6 +11,24 @@ uint32_t DelegatingRecordset::GetInteger(unsigned int which) const
 std::string DelegatingRecordset::GetString(unsigned int which) const 
 { return m_rs->GetString(which); }
 
+std::string_view DelegatingRecordset::GetStringView(unsigned int which,
+						    std::string *scratch) const
+{
+    if (m_forward_all)
+	return m_rs->GetStringView(which, scratch);
+    return Recordset::GetStringView(which, scratch);
+}
+
+void DelegatingRecordset::GetStringViews(const unsigned int *fields,
+					 size_t n, std::string_view *views,
+					 std::string *scratch) const
+{
+    if (m_forward_all)
+	m_rs->GetStringViews(fields, n, views, scratch);
+    else
+	Recordset::GetStringViews(fields, n, views, scratch);
+}
+
 unsigned int DelegatingRecordset::SetInteger(unsigned int which, 
 					     uint32_t value)
 {
@@ -23,6 +41,47 @@ unsigned int DelegatingRecordset::SetString(unsigned int which,
     return m_rs->SetString(which, value);
 }
 
+size_t DelegatingRecordset::GetArraySize(unsigned int which) const
+{
+    if (m_forward_all)
+	return m_rs->GetArraySize(which);
+    return Recordset::GetArraySize(which);
+}
+
+void DelegatingRecordset::GetArray(unsigned int which,
+				   std::vector<unsigned int> *vec,
+				   size_t start, size_t count) const
+{
+    if (m_forward_all)
+	m_rs->GetArray(which, vec, start, count);
+    else
+	Recordset::GetArray(which, vec, start, count);
+}
+
+unsigned int DelegatingRecordset::SetArray(
+    unsigned int which, const std::vector<unsigned int>& vec)
+{
+    if (m_forward_all)
+	return m_rs->SetArray(which, vec);
+    return Recordset::SetArray(which, vec);
+}
+
+unsigned int DelegatingRecordset::AppendToArray(unsigned int which,
+						unsigned int value)
+{
+    if (m_forward_all)
+	return m_rs->AppendToArray(which, value);
+    return Recordset::AppendToArray(which, value);
+}
+
+unsigned int DelegatingRecordset::RemoveFromArray(unsigned int which,
+						  unsigned int value)
+{
+    if (m_forward_all)
+	return m_rs->RemoveFromArray(which, value);
+    return Recordset::RemoveFromArray(which, value);
+}
+
 void DelegatingRecordset::MoveNext()
 {
     m_rs->MoveNext();
@@ -43,4 +102,14 @@ unsigned int DelegatingRecordset::Delete()
     return m_rs->Delete();
 }
 
+uint64_t DelegatingRecordset::GetRevision() const
+{
+    return m_forward_all ? m_rs->GetRevision() : 0;
+}
+
+unsigned int DelegatingRecordset::GetCount(size_t *count) const
+{
+    return m_forward_all ? m_rs->GetCount(count) : Recordset::GetCount(count);
+}
+
 } // namespace db
@@ -9,26 +9,55 @@ namespace db {
 /** A class that does nothing but pass Recordset operations on to another.
  *
  * This is useful to derive from when only overriding one or two operations.
+ *
+ * The array operations (GetArray and so on) and the string views
+ * (GetStringView, GetStringViews) are only passed on if forward_all is set;
+ * otherwise they're Recordset's defaults, so that they go through any
+ * overridden GetString or SetString. Derived classes which don't override
+ * those should set it, to keep arrays and views fast.
  */
 class DelegatingRecordset: public Recordset
 {
 protected:
     util::CountedPointer<Recordset> m_rs;
+    bool m_forward_all;
 
 public:
-    explicit DelegatingRecordset(util::CountedPointer<Recordset> rs)
-	: m_rs(rs) {}
+    explicit DelegatingRecordset(util::CountedPointer<Recordset> rs,
+				 bool forward_all = false)
+	: m_rs(rs), m_forward_all(forward_all) {}
 
     bool IsEOF() const override;
     uint32_t GetInteger(unsigned int which) const override;
     std::string GetString(unsigned int which) const override;
+    std::string_view GetStringView(unsigned int which,
+				   std::string *scratch) const override;
+    void GetStringViews(const unsigned int *fields, size_t n,
+			std::string_view *views,
+			std::string *scratch) const override;
     unsigned int SetInteger(unsigned int which, uint32_t value) override;
     unsigned int SetString(unsigned int which,
                            const std::string& value) override;
+    size_t GetArraySize(unsigned int which) const override;
+    void GetArray(unsigned int which, std::vector<unsigned int> *vec,
+		  size_t start = 0,
+		  size_t count = (size_t)-1) const override;
+    unsigned int SetArray(unsigned int which,
+			  const std::vector<unsigned int>& vec) override;
+    unsigned int AppendToArray(unsigned int which,
+			       unsigned int value) override;
+    unsigned int RemoveFromArray(unsigned int which,
+				 unsigned int value) override;
     void MoveNext() override;
     unsigned int AddRecord() override;
     unsigned int Commit() override;
     unsigned int Delete() override;
+
+    /** Only passed on if forward_all is set, as otherwise the values
+     * might not be the underlying recordset's.
+     */
+    uint64_t GetRevision() const override;
+    unsigned int GetCount(size_t *count) const override;
 };
 
 } // namespace db
@@ -12,6 +12,11 @@ public:
     void MoveNext() override {}
     uint32_t GetInteger(unsigned int) const override { return 0; }
     std::string GetString(unsigned int) const override { return std::string(); }
+    unsigned int GetCount(size_t *count) const override
+    {
+	*count = 0;
+	return 0;
+    }
 };
 
 } // namespace db
@@ -0,0 +1,47 @@
+#ifndef LIBDB_FETCH_RS_H
+#define LIBDB_FETCH_RS_H 1
+
+#include "delegating_rs.h"
+#include <stddef.h>
+
+namespace db {
+
+/** A recordset which visits, in turn, the records of a series of "parts"
+ * (each a recordset of its own), each made only once the one before is used
+ * up. Used for Database::Fetch: by default, one query per value makes one
+ * part; databases which can fetch in batches make one part per batch.
+ */
+class FetchRecordset: public DelegatingRecordset
+{
+    size_t m_next;
+    size_t m_count;
+
+    void Advance();
+
+protected:
+    /** Makes part n (0..count-1); may return NULL or an empty recordset.
+     */
+    virtual RecordsetPtr Part(size_t n) = 0;
+
+    /** Call from the derived class's constructor, once Part() can work.
+     */
+    void Start(size_t count);
+
+public:
+    FetchRecordset();
+
+    // Being a Recordset
+    bool IsEOF() const override;
+    void MoveNext() override;
+    unsigned int Delete() override;
+
+    /** Only the current part's count is known, not the whole */
+    unsigned int GetCount(size_t *count) const override
+    {
+	return Recordset::GetCount(count);
+    }
+};
+
+} // namespace db
+
+#endif
@@ -18,8 +18,9 @@ bool FreeRecordset::IsEOF() const
 
 uint32_t FreeRecordset::GetInteger(unsigned int which) const
 {
-    std::string s = GetString(which);
-    return (uint32_t)strtoul(s.c_str(), NULL, 10);
+    if (which >= m_strings.size())
+	return 0;
+    return (uint32_t)strtoul(m_strings[which].c_str(), NULL, 10);
 }
 
 std::string FreeRecordset::GetString(unsigned int which) const
@@ -29,6 +30,14 @@ std::string FreeRecordset::GetString(unsigned int which) const
     return m_strings[which];
 }
 
+std::string_view FreeRecordset::GetStringView(unsigned int which,
+					      std::string*) const
+{
+    if (which >= m_strings.size())
+	return std::string_view();
+    return m_strings[which];
+}
+
 unsigned int FreeRecordset::SetInteger(unsigned int which, uint32_t value)
 {
     std::ostringstream os;
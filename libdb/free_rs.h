@@ -25,6 +25,8 @@ public:
 
     uint32_t GetInteger(unsigned int which) const;
     std::string GetString(unsigned int which) const;
+    std::string_view GetStringView(unsigned int which,
+				   std::string *scratch) const;
 
     unsigned int SetInteger(unsigned int which, uint32_t value);
     unsigned int SetString(unsigned int which, const std::string& value);
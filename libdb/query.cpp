@@ -1,12 +1,14 @@
 #include "query.h"
 #include "libutil/trace.h"
+#include <algorithm>
 #include <sstream>
 #include <assert.h>
 
 namespace db {
 
 Query::Query() 
-    : m_root(0)
+    : m_root(0),
+      m_limit(0)
 {
 }
 
@@ -84,14 +86,23 @@ unsigned int Query::Where(const Subexpression& expr)
     return 0;
 }
 
-/** Impose a sort order on the results (like SQL "ORDER BY ...")
+/** Impose a sort order on the results (like SQL "ORDER BY ..."). Call
+ * again to add further keys, for records which tie on the earlier ones.
  */
-unsigned int Query::OrderBy(unsigned int which)
+unsigned int Query::OrderBy(unsigned int which, bool descending)
 {
     m_orderby.push_back(which);
+    if (descending)
+	m_descending.push_back(which);
     return 0;
 }
 
+bool Query::IsDescending(unsigned int which) const
+{
+    return std::find(m_descending.begin(), m_descending.end(), which)
+	!= m_descending.end();
+}
+
 /** Do a collation query (like SQL "GROUP BY ...")
  *
  * This is unlike the other options, in that the recordset returned has a
@@ -104,6 +115,12 @@ unsigned int Query::CollateBy(unsigned int which)
     return 0;
 }
 
+unsigned int Query::Limit(unsigned int n)
+{
+    m_limit = n;
+    return 0;
+}
+
 std::string Query::ToString() const
 {
     std::ostringstream os;
@@ -112,16 +129,24 @@ std::string Query::ToString() const
     for (orderby_t::const_iterator i = m_orderby.begin();
          i != m_orderby.end();
          ++i)
-        os << "order by #" << *i << " ";
+        os << "order by #" << *i << (IsDescending(*i) ? " desc " : " ");
 
     for (orderby_t::const_iterator i = m_collateby.begin();
          i != m_collateby.end();
          ++i)
         os << "collate by #" << *i << " ";
 
+    if (m_limit)
+	os << "limit " << m_limit << " ";
+
     return os.str();
 }
 
+std::string Query::Explain()
+{
+    return ToString();
+}
+
 std::string Query::ToStringElement(ssize_t elem) const
 {
     if (elem == 0)
@@ -214,7 +239,7 @@ unsigned int Query::Clone(const Query *other)
 	 i != other->m_orderby.end();
 	 ++i)
     {
-	rc = OrderBy(*i);
+	rc = OrderBy(*i, other->IsDescending(*i));
 	if (rc)
 	    return rc;
     }
@@ -228,6 +253,13 @@ unsigned int Query::Clone(const Query *other)
 	    return rc;
     }
 
+    if (other->m_limit)
+    {
+	rc = Limit(other->m_limit);
+	if (rc)
+	    return rc;
+    }
+
 //    TRACE << "Cloned: " << ToString() << "\n";
 
     return 0;
@@ -66,10 +66,14 @@ protected:
     relations_t m_relations;
     int m_root;
     orderby_t m_orderby;
+    orderby_t m_descending; ///< Those of m_orderby to sort in reverse
     orderby_t m_collateby;
+    unsigned int m_limit; ///< 0 for no limit
 
     std::string ToStringElement(ssize_t) const;
 
+    bool IsDescending(unsigned int which) const;
+
 public:
     Query();
     virtual ~Query();
@@ -93,14 +97,27 @@ public:
     virtual Subexpression Or(const Subexpression&, const Subexpression&);
 
     virtual unsigned int Where(const Subexpression&);
-    virtual unsigned int OrderBy(unsigned int which);
+    virtual unsigned int OrderBy(unsigned int which, bool descending = false);
     virtual unsigned int CollateBy(unsigned int which);
 
+    /** Promises that only the first n results will be read, so that an
+     * ordered query needn't order the rest (SQL "LIMIT n", but results
+     * after the first n may or may not still be returned). Paging
+     * clients should pass the end of the page they want.
+     */
+    virtual unsigned int Limit(unsigned int n);
+
     virtual util::CountedPointer<Recordset> Execute() = 0;
 
     std::string ToString() const;
 
-    /** Copies the Where, OrderBy, and CollateBy information from
+    /** Describes how Execute() would go about answering the query (like
+     * SQL "EXPLAIN ..."), for diagnosing slow ones. By default, just
+     * describes the query itself.
+     */
+    virtual std::string Explain();
+
+    /** Copies the Where, OrderBy, CollateBy, and Limit information from
      * another query.
      *
      * Useful for applying the same query to more than one
@@ -0,0 +1,302 @@
+#include "recordset.h"
+#include "libutil/trace.h"
+#include <algorithm>
+#include <errno.h>
+
+namespace db {
+
+static void AppendUTF8(std::string& s, unsigned int ch)
+{
+    if (ch == 0)
+	s += '?';
+    else if (ch < 0x80)
+	s += (char)ch;
+    else if (ch < 0x800)
+    {
+	s += (char)(0xC0 + (ch>>6));
+	s += (char)(0x80 + (ch & 0x3F));
+    }
+    else if (ch < 0x10000)
+    {
+	s += (char)(0xE0 + (ch>>12));
+	s += (char)(0x80 + ((ch>>6) & 0x3F));
+	s += (char)(0x80 + (ch & 0x3F));
+    }
+    else if (ch < 0x200000)
+    {
+	s += (char)(0xF0 + (ch>>18));
+	s += (char)(0x80 + ((ch>>12) & 0x3F));
+	s += (char)(0x80 + ((ch>>6) & 0x3F));
+	s += (char)(0x80 + (ch & 0x3F));
+    }
+    else if (ch < 0x04000000)
+    {
+	s += (char)(0xF8 + (ch>>24));
+	s += (char)(0x80 + ((ch>>18) & 0x3F));
+	s += (char)(0x80 + ((ch>>12) & 0x3F));
+	s += (char)(0x80 + ((ch>>6) & 0x3F));
+	s += (char)(0x80 + (ch & 0x3F));
+    }
+    else if (ch < 0x80000000)
+    {
+	s += (char)(0xFC + (ch>>30));
+	s += (char)(0x80 + ((ch>>24) & 0x3F));
+	s += (char)(0x80 + ((ch>>18) & 0x3F));
+	s += (char)(0x80 + ((ch>>12) & 0x3F));
+	s += (char)(0x80 + ((ch>>6) & 0x3F));
+	s += (char)(0x80 + (ch & 0x3F));
+    }
+}
+
+static uint32_t GetUTF8Char(const char **pptr)
+{
+    unsigned char ch = (unsigned char)**pptr;
+    if (!ch)
+	return ch;
+    else if (ch < 0x80)
+    {
+	(*pptr)++;
+	return ch;
+    }
+    else if (ch < 0xC0) // %10xxxxxx
+    {
+	// UTF-8 error
+	TRACE << "UTF-8 error\n";
+	(*pptr)++;
+	return 0;
+    }
+    else if (ch < 0xE0) // %110xxxxx
+    {
+	(*pptr)++;
+	unsigned char ch2 = (unsigned char)**pptr;
+	(*pptr)++;
+	return (ch2 & 0x3Fu) + ((ch & 0x1Fu) << 6);
+    }
+    else if (ch < 0xF0) // %1110xxxx
+    {
+	(*pptr)++;
+	unsigned char ch2 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch3 = (unsigned char)**pptr;
+	(*pptr)++;
+	return (ch3 & 0x3Fu) + ((ch2 & 0x3Fu)<<6) + ((ch & 0xFu) << 12);
+    }
+    else if (ch < 0xF8) // %11110xxx
+    {
+	(*pptr)++;
+	unsigned char ch2 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch3 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch4 = (unsigned char)**pptr;
+	(*pptr)++;
+	return (ch4 & 0x3Fu)
+	    + ((ch3 & 0x3Fu)<<6)
+	    + ((ch2 & 0x3Fu)<<12)
+	    + ((ch & 7u) << 18);
+    }
+    else if (ch < 0xFC) // %111110xx
+    {
+	(*pptr)++;
+	unsigned char ch2 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch3 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch4 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch5 = (unsigned char)**pptr;
+	(*pptr)++;
+	return (ch5 & 0x3Fu)
+	    + ((ch4 & 0x3Fu)<<6) 
+	    + ((ch3 & 0x3Fu)<<12)
+	    + ((ch2 & 0x3Fu)<<18)
+	    + ((ch & 3u) << 24);
+    }
+    else if (ch < 0xFE) // %1111110x
+    {
+	(*pptr)++;
+	unsigned char ch2 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch3 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch4 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch5 = (unsigned char)**pptr;
+	(*pptr)++;
+	unsigned char ch6 = (unsigned char)**pptr;
+	(*pptr)++;
+	return (ch6 & 0x3Fu)
+	    + ((ch5 & 0x3Fu)<<6) 
+	    + ((ch4 & 0x3Fu)<<12)
+	    + ((ch3 & 0x3Fu)<<18)
+	    + ((ch2 & 0x3Fu)<<24)
+	    + ((ch & 1u) << 30);
+    }
+
+    TRACE << "UTF-8 error 2\n";
+    (*pptr)++;
+    return 0;
+}
+
+std::string EncodeArray(const std::vector<unsigned int>& v)
+{
+    if (v.size() == 0)
+	return std::string();
+
+    std::string result;
+    result.reserve(v.size() * 3);
+
+    AppendUTF8(result, (unsigned int)v.size());
+    for (unsigned int i=0; i<v.size(); ++i)
+    {
+	AppendUTF8(result, v[i]);
+    }
+    return result;
+}
+
+size_t DecodeArraySize(const std::string& s)
+{
+    const char *ptr = s.c_str();
+    if (!*ptr)
+	return 0; // No elements
+
+    // Each element takes at least one byte
+    size_t n = GetUTF8Char(&ptr);
+    if (n > s.size() - 1) // Sanity check
+	return 0;
+    return n;
+}
+
+void DecodeArray(const std::string& s, std::vector<unsigned int> *vec,
+		 size_t start, size_t count)
+{
+    vec->clear();
+
+    size_t n = DecodeArraySize(s);
+    if (start >= n)
+	return;
+    count = std::min(count, n - start);
+
+    const char *ptr = s.c_str();
+    GetUTF8Char(&ptr);
+    for (size_t i=0; i<start; ++i)
+	GetUTF8Char(&ptr);
+
+    vec->resize(count);
+    for (size_t i=0; i<count; ++i)
+	(*vec)[i] = GetUTF8Char(&ptr);
+}
+
+
+        /* Recordset */
+
+
+std::string_view Recordset::GetStringView(unsigned int which,
+					  std::string *scratch) const
+{
+    *scratch = GetString(which);
+    return *scratch;
+}
+
+void Recordset::GetStringViews(const unsigned int *fields, size_t n,
+			       std::string_view *views,
+			       std::string *scratch) const
+{
+    for (size_t i=0; i<n; ++i)
+	views[i] = GetStringView(fields[i], &scratch[i]);
+}
+
+size_t Recordset::GetArraySize(unsigned int which) const
+{
+    return DecodeArraySize(GetString(which));
+}
+
+unsigned int Recordset::GetCount(size_t*) const
+{
+    return ENOSYS;
+}
+
+void Recordset::GetArray(unsigned int which, std::vector<unsigned int> *vec,
+			 size_t start, size_t count) const
+{
+    DecodeArray(GetString(which), vec, start, count);
+}
+
+unsigned int Recordset::SetArray(unsigned int which,
+				 const std::vector<unsigned int>& vec)
+{
+    return SetString(which, EncodeArray(vec));
+}
+
+unsigned int Recordset::AppendToArray(unsigned int which, unsigned int value)
+{
+    std::vector<unsigned int> vec;
+    GetArray(which, &vec);
+    vec.push_back(value);
+    return SetArray(which, vec);
+}
+
+unsigned int Recordset::RemoveFromArray(unsigned int which,
+					unsigned int value)
+{
+    std::vector<unsigned int> vec;
+    GetArray(which, &vec);
+    std::vector<unsigned int>::iterator i = std::remove(vec.begin(),
+							vec.end(), value);
+    if (i == vec.end())
+	return 0;
+    vec.erase(i, vec.end());
+    return SetArray(which, vec);
+}
+
+} // namespace db
+
+#ifdef TEST
+
+# include "free_rs.h"
+# include "libutil/counted_pointer.h"
+# include <assert.h>
+
+int main()
+{
+    std::vector<unsigned int> in, out;
+    for (unsigned int i=1; i<=100; ++i)
+	in.push_back(i * 1009);
+
+    std::string s = db::EncodeArray(in);
+    assert(db::DecodeArraySize(s) == 100);
+    db::DecodeArray(s, &out);
+    assert(out == in);
+    db::DecodeArray(s, &out, 98, 10);
+    assert(out.size() == 2);
+    assert(out[0] == 99*1009);
+    db::DecodeArray(s, &out, 100, 10);
+    assert(out.empty());
+
+    // Corrupt: says 100 elements, holds 2
+    assert(db::DecodeArraySize(s.substr(0, 3)) == 0);
+
+    util::CountedPointer<db::Recordset> rs = db::FreeRecordset::Create();
+    assert(rs->GetArraySize(0) == 0);
+    rs->AppendToArray(0, 7);
+    rs->AppendToArray(0, 8);
+    rs->AppendToArray(0, 7);
+    assert(rs->GetArraySize(0) == 3);
+    rs->RemoveFromArray(0, 7);
+    rs->GetArray(0, &out);
+    assert(out.size() == 1);
+    assert(out[0] == 8);
+    assert(rs->GetString(0) == db::EncodeArray(out));
+
+    // FreeRecordset's views point at its own strings
+    rs->SetString(1, "a string too long to fit inside a std::string");
+    std::string scratch;
+    std::string_view sv = rs->GetStringView(1, &scratch);
+    assert(sv == rs->GetString(1));
+    assert(scratch.empty());
+    assert(rs->GetStringView(5, &scratch).empty());
+
+    return 0;
+}
+
+#endif
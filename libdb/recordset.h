@@ -2,7 +2,10 @@
 #define LIBDB_RECORDSET_H 1
 
 #include <stdint.h>
+#include <stddef.h>
 #include <string>
+#include <string_view>
+#include <vector>
 #include "libutil/counted_object.h"
 
 namespace db {
@@ -22,10 +25,57 @@ public:
     virtual uint32_t GetInteger(unsigned int which) const = 0;
     virtual std::string GetString(unsigned int which) const = 0;
 
+    /** The value GetString would return, but without copying it where the
+     * engine can avoid that.
+     *
+     * The view points either into the recordset's own storage, or into
+     * *scratch, which is where the value goes if it has to be made (such
+     * as an integer field's decimal form, or, in this default, a copy).
+     * It lasts until the recordset is next moved, changed or destroyed,
+     * or *scratch is, whichever comes first. On a recordset reading the
+     * live database (not a snapshot), it also ends when anyone else
+     * writes to the database.
+     */
+    virtual std::string_view GetStringView(unsigned int which,
+					   std::string *scratch) const;
+
+    /** GetStringView(fields[i], &scratch[i]) into views[i], for each i < n.
+     *
+     * One call instead of n, so an engine can find the record (and take
+     * any lock) just once. Callers can keep the arrays across records.
+     */
+    virtual void GetStringViews(const unsigned int *fields, size_t n,
+				std::string_view *views,
+				std::string *scratch) const;
+
     virtual unsigned int SetInteger(unsigned int which, uint32_t value) = 0;
     virtual unsigned int SetString(unsigned int which,
 				   const std::string& value) = 0;
 
+    /** Fields holding arrays of integers (such as mediadb::CHILDREN).
+     *
+     * These defaults store the array as a string (see EncodeArray) via
+     * GetString and SetString, so every access decodes, and every change
+     * re-encodes, the whole array. Engines that store arrays natively
+     * override them, to slice and update in place.
+     */
+    virtual size_t GetArraySize(unsigned int which) const;
+
+    /** Sets *vec to elements [start, start+count) of the array, or as
+     * many of them as there are.
+     */
+    virtual void GetArray(unsigned int which, std::vector<unsigned int> *vec,
+			  size_t start = 0, size_t count = (size_t)-1) const;
+    virtual unsigned int SetArray(unsigned int which,
+				  const std::vector<unsigned int>& vec);
+    virtual unsigned int AppendToArray(unsigned int which,
+				       unsigned int value);
+
+    /** Removes every occurrence of value from the array.
+     */
+    virtual unsigned int RemoveFromArray(unsigned int which,
+					 unsigned int value);
+
     virtual void MoveNext() = 0;
     virtual unsigned int AddRecord() = 0;
     virtual unsigned int Commit() = 0;
@@ -33,8 +83,40 @@ public:
     /** Deletes current record, if any. Implicitly does MoveNext.
      */
     virtual unsigned int Delete() = 0;
+
+    /** A number which changes whenever the current record is committed
+     * with changes, so that anything made from the record can be cached
+     * until then (see mediadb::didl::Cache).
+     *
+     * Zero, this default, means the engine can't tell, and so nothing
+     * should be cached.
+     */
+    virtual uint64_t GetRevision() const { return 0; }
+
+    /** Sets *count to the number of records in the whole result --
+     * including those already passed, and any that a Query::Limit cut
+     * off -- if the engine knows it without visiting them all. Records
+     * deleted since the query ran may still be counted.
+     *
+     * This default returns ENOSYS, meaning only visiting them would tell.
+     */
+    virtual unsigned int GetCount(size_t *count) const;
 };
 
+/** The string form of an integer array: the count then each element, as
+ * UTF-8 characters (an element of 0 is stored as '?'). Empty if there are
+ * no elements.
+ */
+std::string EncodeArray(const std::vector<unsigned int>&);
+
+/** Decodes elements [start, start+count) of an EncodeArray string.
+ */
+void DecodeArray(const std::string&, std::vector<unsigned int> *vec,
+		 size_t start = 0, size_t count = (size_t)-1);
+
+/** The number of elements in an EncodeArray string. */
+size_t DecodeArraySize(const std::string&);
+
 } // namespace db
 
 #endif
@@ -0,0 +1,269 @@
+#include "config.h"
+#include "db.h"
+#include "query.h"
+#include "rs.h"
+#include "libutil/trace.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+namespace db {
+namespace column {
+
+Database::Database(unsigned int nfields, const InitialFieldInfo *ifi)
+    : m_nfields(nfields),
+      m_next_recno(0),
+      m_flags(nfields, FIELD_STRING),
+      m_columns(nfields),
+      m_stringindexes(nfields, stringindex_t(PoolLess(&m_pool))),
+      m_intindexes(nfields)
+{
+    if (ifi)
+    {
+	while (ifi->which || ifi->flags)
+	{
+	    SetFieldInfo(ifi->which, ifi->flags);
+	    ++ifi;
+	}
+    }
+}
+
+Database::~Database()
+{
+}
+
+void Database::SetFieldInfo(unsigned int which, unsigned int flags)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    assert(which < m_nfields);
+    assert(m_row_to_recno.empty());
+    m_flags[which] = flags;
+}
+
+size_t Database::MemoryUsage()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+    size_t total = m_pool.MemoryUsage()
+	+ (m_row_to_recno.capacity() + m_recno_to_row.capacity())
+	    * sizeof(uint32_t);
+    for (unsigned int i=0; i<m_nfields; ++i)
+    {
+	total += m_columns[i].capacity() * sizeof(uint32_t);
+
+	// Rough allowance for a red-black tree node
+	enum { MAP_NODE = 32 + sizeof(uint32_t) + sizeof(postings_t) };
+
+	for (stringindex_t::const_iterator j = m_stringindexes[i].begin();
+	     j != m_stringindexes[i].end();
+	     ++j)
+	    total += MAP_NODE + j->second.capacity() * sizeof(uint32_t);
+	for (intindex_t::const_iterator j = m_intindexes[i].begin();
+	     j != m_intindexes[i].end();
+	     ++j)
+	    total += MAP_NODE + j->second.capacity() * sizeof(uint32_t);
+    }
+    return total;
+}
+
+uint32_t Database::NextRecord(uint32_t recno) const
+{
+    while (recno < m_recno_to_row.size())
+    {
+	if (m_recno_to_row[recno] != NO_ROW)
+	    return recno;
+	++recno;
+    }
+    return NO_ROW;
+}
+
+const Database::postings_t *Database::FindPostings(unsigned int which,
+						   uint32_t key) const
+{
+    if (IsInt(which))
+    {
+	intindex_t::const_iterator i = m_intindexes[which].find(key);
+	return (i == m_intindexes[which].end()) ? NULL : &i->second;
+    }
+    stringindex_t::const_iterator i = m_stringindexes[which].find(key);
+    return (i == m_stringindexes[which].end()) ? NULL : &i->second;
+}
+
+void Database::IndexInsert(unsigned int which, uint32_t key, uint32_t recno)
+{
+    postings_t& p = IsInt(which) ? m_intindexes[which][key]
+				 : m_stringindexes[which][key];
+
+    // Usually appending, as record numbers are allocated in order
+    if (p.empty() || p.back() < recno)
+	p.push_back(recno);
+    else
+	p.insert(std::lower_bound(p.begin(), p.end(), recno), recno);
+}
+
+void Database::IndexErase(unsigned int which, uint32_t key, uint32_t recno)
+{
+    if (IsInt(which))
+    {
+	intindex_t::iterator i = m_intindexes[which].find(key);
+	if (i == m_intindexes[which].end())
+	    return;
+	postings_t::iterator j = std::lower_bound(i->second.begin(),
+						  i->second.end(), recno);
+	if (j != i->second.end() && *j == recno)
+	    i->second.erase(j);
+	if (i->second.empty())
+	    m_intindexes[which].erase(i);
+    }
+    else
+    {
+	stringindex_t::iterator i = m_stringindexes[which].find(key);
+	if (i == m_stringindexes[which].end())
+	    return;
+	postings_t::iterator j = std::lower_bound(i->second.begin(),
+						  i->second.end(), recno);
+	if (j != i->second.end() && *j == recno)
+	    i->second.erase(j);
+	if (i->second.empty())
+	    m_stringindexes[which].erase(i);
+    }
+}
+
+void Database::SetRaw(uint32_t recno, unsigned int which, uint32_t raw)
+{
+    uint32_t& cell = m_columns[which][m_recno_to_row[recno]];
+    if (cell == raw)
+	return;
+    if (IsIndexed(which))
+    {
+	IndexErase(which, cell, recno);
+	IndexInsert(which, raw, recno);
+    }
+    cell = raw;
+}
+
+uint32_t Database::GetInteger(uint32_t recno, unsigned int which) const
+{
+    uint32_t row = RowOf(recno);
+    if (row == NO_ROW || which >= m_nfields)
+	return 0;
+    uint32_t raw = m_columns[which][row];
+    if (IsInt(which))
+	return raw;
+    return (uint32_t)strtoul(m_pool.Data(raw), NULL, 10);
+}
+
+std::string Database::GetString(uint32_t recno, unsigned int which) const
+{
+    uint32_t row = RowOf(recno);
+    if (row == NO_ROW || which >= m_nfields)
+	return std::string();
+    uint32_t raw = m_columns[which][row];
+    if (!IsInt(which))
+	return m_pool.Get(raw);
+    if (!raw)
+	return std::string();
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%u", raw);
+    return buf;
+}
+
+unsigned int Database::SetInteger(uint32_t recno, unsigned int which,
+				  uint32_t value)
+{
+    if (RowOf(recno) == NO_ROW || which >= m_nfields)
+	return ENOENT;
+    if (IsInt(which))
+	SetRaw(recno, which, value);
+    else if (!value)
+	SetRaw(recno, which, 0);
+    else
+    {
+	char buf[12];
+	snprintf(buf, sizeof(buf), "%u", value);
+	SetRaw(recno, which, m_pool.Intern(buf));
+    }
+    return 0;
+}
+
+unsigned int Database::SetString(uint32_t recno, unsigned int which,
+				 const std::string& value)
+{
+    if (RowOf(recno) == NO_ROW || which >= m_nfields)
+	return ENOENT;
+    if (IsInt(which))
+	SetRaw(recno, which, (uint32_t)strtoul(value.c_str(), NULL, 10));
+    else
+	SetRaw(recno, which, m_pool.Intern(value));
+    return 0;
+}
+
+uint32_t Database::AddRecord()
+{
+    uint32_t recno = m_next_recno++;
+    uint32_t row = (uint32_t)m_row_to_recno.size();
+
+    m_row_to_recno.push_back(recno);
+    assert(m_recno_to_row.size() == recno);
+    m_recno_to_row.push_back(row);
+
+    for (unsigned int i=0; i<m_nfields; ++i)
+    {
+	m_columns[i].push_back(0);
+	if (IsIndexed(i))
+	    IndexInsert(i, 0, recno);
+    }
+    return recno;
+}
+
+unsigned int Database::Delete(uint32_t recno)
+{
+    uint32_t row = RowOf(recno);
+    if (row == NO_ROW)
+	return ENOENT;
+
+    for (unsigned int i=0; i<m_nfields; ++i)
+	if (IsIndexed(i))
+	    IndexErase(i, m_columns[i][row], recno);
+
+    // Keep the columns dense by moving the last row into the hole
+    uint32_t last = (uint32_t)m_row_to_recno.size() - 1;
+    if (row != last)
+    {
+	uint32_t moved = m_row_to_recno[last];
+	for (unsigned int i=0; i<m_nfields; ++i)
+	    m_columns[i][row] = m_columns[i][last];
+	m_row_to_recno[row] = moved;
+	m_recno_to_row[moved] = row;
+    }
+    for (unsigned int i=0; i<m_nfields; ++i)
+	m_columns[i].pop_back();
+    m_row_to_recno.pop_back();
+    m_recno_to_row[recno] = NO_ROW;
+    return 0;
+}
+
+db::RecordsetPtr Database::CreateRecordset()
+{
+    return db::RecordsetPtr(new ScanRecordset(this, QueryPtr()));
+}
+
+db::QueryPtr Database::CreateQuery()
+{
+    return db::QueryPtr(new Query(this));
+}
+
+} // namespace column
+} // namespace db
+
+#ifdef TEST
+
+int main()
+{
+    db::column::Test();
+    return 0;
+}
+
+#endif
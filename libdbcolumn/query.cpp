@@ -0,0 +1,320 @@
+#include "config.h"
+#include "query.h"
+#include "db.h"
+#include "rs.h"
+#include "libutil/trace.h"
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+
+namespace db {
+namespace column {
+
+Query::Query(Database *db)
+    : m_db(db)
+{
+}
+
+void Query::Prepare()
+{
+    m_regexes.clear();
+    m_ids.assign(m_restrictions.size(), (uint32_t)StringPool::NOT_FOUND);
+
+    for (unsigned int i=0; i<m_restrictions.size(); ++i)
+    {
+	const Restriction& r = m_restrictions[i];
+	if (r.rt == db::LIKE)
+	    m_regexes[i] = boost::regex(r.sval, boost::regex::icase);
+	else if (r.is_string && !m_db->IsInt(r.which))
+	    m_ids[i] = m_db->m_pool.Find(r.sval);
+    }
+}
+
+template <typename T>
+static bool Compare(RestrictionType rt, const T& val, const T& ref)
+{
+    switch (rt)
+    {
+    case db::EQ: return val == ref;
+    case db::NE: return !(val == ref);
+    case db::GT: return ref < val;
+    case db::LT: return val < ref;
+    case db::GE: return !(val < ref);
+    case db::LE: return !(ref < val);
+    default:
+	assert(false);
+	return false;
+    }
+}
+
+bool Query::Match(uint32_t recno) const
+{
+    if (!m_root)
+	return true;
+    return MatchElement(recno, m_root);
+}
+
+bool Query::MatchElement(uint32_t recno, ssize_t elem) const
+{
+    if (elem < 0)
+    {
+	const Relation& r = m_relations[(size_t)(-elem-1)];
+	bool lhs = MatchElement(recno, r.a);
+	if (r.anditive ? !lhs : lhs)
+	    return lhs;
+	return MatchElement(recno, r.b);
+    }
+
+    assert(elem > 0);
+    size_t index = (size_t)(elem-1);
+    const Restriction& r = m_restrictions[index];
+    uint32_t row = m_db->RowOf(recno);
+    if (row == Database::NO_ROW)
+	return false;
+    uint32_t raw = m_db->m_columns[r.which][row];
+
+    if (r.rt == db::LIKE)
+    {
+	regexes_t::const_iterator i = m_regexes.find((unsigned int)index);
+	if (m_db->IsInt(r.which))
+	{
+	    std::string val = m_db->GetString(recno, r.which);
+	    return boost::regex_match(val, i->second);
+	}
+	const char *val = m_db->m_pool.Data(raw);
+	return boost::regex_match(val, val + m_db->m_pool.Size(raw),
+				  i->second);
+    }
+
+    if (r.is_string)
+    {
+	if (!m_db->IsInt(r.which))
+	{
+	    // The quick cases: compare ids, not strings
+	    if (r.rt == db::EQ)
+		return raw == m_ids[index];
+	    if (r.rt == db::NE)
+		return raw != m_ids[index];
+	}
+	return Compare(r.rt, m_db->GetString(recno, r.which), r.sval);
+    }
+
+    uint32_t val = m_db->IsInt(r.which)
+	? raw
+	: (uint32_t)strtoul(m_db->m_pool.Data(raw), NULL, 10);
+    return Compare(r.rt, val, r.ival);
+}
+
+/** Finds, among the indexed equality restrictions which must hold for
+ * elem to hold, the one matching the fewest records.
+ *
+ * Returns NULL if there's no such restriction. If there is one, but it
+ * can't match anything, sets *empty instead.
+ */
+const std::vector<uint32_t> *Query::BestPostings(ssize_t elem,
+						 bool *empty) const
+{
+    if (elem == 0)
+	return NULL;
+
+    if (elem < 0)
+    {
+	const Relation& r = m_relations[(size_t)(-elem-1)];
+	if (!r.anditive)
+	    return NULL;
+	const std::vector<uint32_t> *a = BestPostings(r.a, empty);
+	if (*empty)
+	    return NULL;
+	const std::vector<uint32_t> *b = BestPostings(r.b, empty);
+	if (*empty)
+	    return NULL;
+	if (!a)
+	    return b;
+	if (!b)
+	    return a;
+	return (a->size() <= b->size()) ? a : b;
+    }
+
+    size_t index = (size_t)(elem-1);
+    const Restriction& r = m_restrictions[index];
+    if (r.rt != db::EQ || !m_db->IsIndexed(r.which)
+	|| r.is_string == m_db->IsInt(r.which))
+	return NULL;
+
+    uint32_t key = r.is_string ? m_ids[index] : r.ival;
+    const std::vector<uint32_t> *p = NULL;
+    if (key != (uint32_t)StringPool::NOT_FOUND || !r.is_string)
+	p = m_db->FindPostings(r.which, key);
+    if (!p)
+	*empty = true;
+    return p;
+}
+
+void Query::Filter(const std::vector<uint32_t>& in,
+		   std::vector<uint32_t> *out) const
+{
+    for (std::vector<uint32_t>::const_iterator i = in.begin();
+	 i != in.end();
+	 ++i)
+	if (Match(*i))
+	    out->push_back(*i);
+}
+
+namespace {
+
+/** Orders record numbers by a list of fields
+ */
+class KeyLess
+{
+    const std::vector<const uint32_t*>& m_columns;
+    const std::vector<bool>& m_is_int;
+    const std::vector<bool>& m_descending;
+    const std::vector<uint32_t>& m_rows;
+    const StringPool& m_pool;
+
+public:
+    KeyLess(const std::vector<const uint32_t*>& columns,
+	    const std::vector<bool>& is_int,
+	    const std::vector<bool>& descending,
+	    const std::vector<uint32_t>& rows, const StringPool& pool)
+	: m_columns(columns), m_is_int(is_int), m_descending(descending),
+	  m_rows(rows), m_pool(pool)
+    {}
+
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+	uint32_t rowa = m_rows[a];
+	uint32_t rowb = m_rows[b];
+	for (size_t i=0; i<m_columns.size(); ++i)
+	{
+	    uint32_t va = m_columns[i][rowa];
+	    uint32_t vb = m_columns[i][rowb];
+	    if (va == vb)
+		continue;
+	    if (m_descending[i])
+		std::swap(va, vb);
+	    if (m_is_int[i])
+		return va < vb;
+	    int rc = m_pool.Compare(va, vb);
+	    if (rc)
+		return rc < 0;
+	}
+	return false;
+    }
+};
+
+} // anon namespace
+
+db::RecordsetPtr Query::Execute()
+{
+    if (!m_restrictions.empty())
+	assert(m_root != 0);
+
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+
+    Prepare();
+
+    if (!m_collateby.empty())
+    {
+	unsigned int field = m_collateby.front();
+	if (!m_db->IsIndexed(field))
+	{
+	    TRACE << "Can't collate on unindexed field " << field << "\n";
+	    return db::RecordsetPtr();
+	}
+	if (m_collateby.size() > 1)
+	{
+	    TRACE << "Can't do multiple collate-by yet\n";
+	    return db::RecordsetPtr();
+	}
+	return db::RecordsetPtr(new CollateRecordset(m_db, field,
+						     QueryPtr(this)));
+    }
+
+    bool empty = false;
+    const std::vector<uint32_t> *postings = BestPostings(m_root, &empty);
+    if (empty)
+	return db::RecordsetPtr(new ListRecordset(m_db,
+						  std::vector<uint32_t>()));
+
+    if (m_orderby.empty())
+    {
+	if (!postings)
+	    return db::RecordsetPtr(new ScanRecordset(m_db, QueryPtr(this)));
+
+	std::vector<uint32_t> recnos;
+	Filter(*postings, &recnos);
+	return db::RecordsetPtr(new ListRecordset(m_db, std::move(recnos)));
+    }
+
+    std::vector<const uint32_t*> columns;
+    std::vector<bool> is_int, descending;
+    for (orderby_t::const_iterator i = m_orderby.begin();
+	 i != m_orderby.end();
+	 ++i)
+    {
+	columns.push_back(m_db->m_columns[*i].data());
+	is_int.push_back(m_db->IsInt(*i));
+	descending.push_back(IsDescending(*i));
+    }
+
+    std::vector<uint32_t> recnos;
+    unsigned int first = m_orderby.front();
+    bool sorted = false;
+
+    if (postings)
+	Filter(*postings, &recnos);
+    else if (m_db->IsIndexed(first))
+    {
+	// Walk the index, so the results come out already sorted on the
+	// first key
+	if (m_db->IsInt(first))
+	{
+	    const Database::intindex_t& index = m_db->m_intindexes[first];
+	    for (Database::intindex_t::const_iterator i = index.begin();
+		 i != index.end();
+		 ++i)
+		Filter(i->second, &recnos);
+	}
+	else
+	{
+	    const Database::stringindex_t& index = m_db->m_stringindexes[first];
+	    for (Database::stringindex_t::const_iterator i = index.begin();
+		 i != index.end();
+		 ++i)
+		Filter(i->second, &recnos);
+	}
+	sorted = (m_orderby.size() == 1 && !descending[0]);
+    }
+    else
+    {
+	for (uint32_t r = m_db->NextRecord(0);
+	     r != (uint32_t)Database::NO_ROW;
+	     r = m_db->NextRecord(r+1))
+	    if (Match(r))
+		recnos.push_back(r);
+    }
+
+    if (!sorted)
+    {
+	// KeyLess works in rows, via this recno->row map
+	std::stable_sort(recnos.begin(), recnos.end(),
+			 KeyLess(columns, is_int, descending,
+				 m_db->m_recno_to_row, m_db->m_pool));
+    }
+
+    return db::RecordsetPtr(new ListRecordset(m_db, std::move(recnos)));
+}
+
+} // namespace column
+} // namespace db
+
+#ifdef TEST
+
+int main()
+{
+    db::column::Test();
+    return 0;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/* libdbcolumn/query.h */
+#ifndef LIBDBCOLUMN_QUERY_H
+#define LIBDBCOLUMN_QUERY_H 1
+
+#include "libdb/query.h"
+#include <boost/regex.hpp>
+#include <map>
+#include <vector>
+
+namespace db {
+namespace column {
+
+class Database;
+
+class Query: public db::Query
+{
+    Database *m_db;
+
+    typedef std::map<unsigned int, boost::regex> regexes_t;
+    regexes_t m_regexes;
+
+    /** For each restriction on a string field, the StringPool id of its
+     * value (or NOT_FOUND); this turns string equality into integer
+     * equality.
+     */
+    std::vector<uint32_t> m_ids;
+
+    void Prepare();
+    bool MatchElement(uint32_t recno, ssize_t elem) const;
+    const std::vector<uint32_t> *BestPostings(ssize_t elem, bool *empty) const;
+    void Filter(const std::vector<uint32_t>& in,
+		std::vector<uint32_t> *out) const;
+
+public:
+    explicit Query(Database*);
+
+    /** Call with the database lock held */
+    bool Match(uint32_t recno) const;
+
+    // Being a db::Query
+    util::CountedPointer<db::Recordset> Execute() override;
+};
+
+typedef util::CountedPointer<db::column::Query> QueryPtr;
+
+} // namespace column
+} // namespace db
+
+#endif
@@ -0,0 +1,271 @@
+#include "config.h"
+#include "rs.h"
+#include "db.h"
+#include "query.h"
+#include "libutil/trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace db {
+namespace column {
+
+Recordset::Recordset(Database *db)
+    : m_db(db),
+      m_record(0),
+      m_eof(true)
+{
+}
+
+bool Recordset::IsEOF() const
+{
+    return m_eof;
+}
+
+uint32_t Recordset::GetInteger(unsigned int which) const
+{
+    if (m_eof)
+	return 0;
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    return m_db->GetInteger(m_record, which);
+}
+
+std::string Recordset::GetString(unsigned int which) const
+{
+    if (m_eof)
+	return std::string();
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    return m_db->GetString(m_record, which);
+}
+
+unsigned int Recordset::SetString(unsigned int which, const std::string& s)
+{
+    if (m_eof)
+	return ENOENT;
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    return m_db->SetString(m_record, which, s);
+}
+
+unsigned int Recordset::SetInteger(unsigned int which, uint32_t n)
+{
+    if (m_eof)
+	return ENOENT;
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    return m_db->SetInteger(m_record, which, n);
+}
+
+unsigned int Recordset::AddRecord()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    m_record = m_db->AddRecord();
+    m_eof = false;
+    return 0;
+}
+
+unsigned int Recordset::Commit()
+{
+    return 0;
+}
+
+unsigned int Recordset::Delete()
+{
+    if (m_eof)
+	return ENOENT;
+
+    unsigned int rc;
+    {
+	std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+	rc = m_db->Delete(m_record);
+    }
+    if (rc)
+	return rc;
+
+    MoveNext();
+    return 0;
+}
+
+
+	/* ScanRecordset */
+
+
+ScanRecordset::ScanRecordset(Database *db, QueryPtr query)
+    : Recordset(db),
+      m_query(query)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    MoveFrom(0);
+}
+
+void ScanRecordset::MoveFrom(uint32_t recno)
+{
+    for (;;)
+    {
+	recno = m_db->NextRecord(recno);
+	if (recno == (uint32_t)Database::NO_ROW)
+	{
+	    m_eof = true;
+	    return;
+	}
+	if (!m_query || m_query->Match(recno))
+	{
+	    m_record = recno;
+	    m_eof = false;
+	    return;
+	}
+	++recno;
+    }
+}
+
+void ScanRecordset::MoveNext()
+{
+    if (m_eof)
+	return;
+
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    MoveFrom(m_record + 1);
+}
+
+
+	/* ListRecordset */
+
+
+ListRecordset::ListRecordset(Database *db, std::vector<uint32_t>&& recnos)
+    : Recordset(db),
+      m_recnos(std::move(recnos)),
+      m_index(0)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    MoveFrom(0);
+}
+
+unsigned int ListRecordset::GetCount(size_t *count) const
+{
+    *count = m_recnos.size();
+    return 0;
+}
+
+void ListRecordset::MoveFrom(size_t index)
+{
+    while (index < m_recnos.size())
+    {
+	if (m_db->RowOf(m_recnos[index]) != (uint32_t)Database::NO_ROW)
+	{
+	    m_index = index;
+	    m_record = m_recnos[index];
+	    m_eof = false;
+	    return;
+	}
+	++index;
+    }
+    m_index = index;
+    m_eof = true;
+}
+
+void ListRecordset::MoveNext()
+{
+    if (m_eof)
+	return;
+
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    MoveFrom(m_index + 1);
+}
+
+
+	/* CollateRecordset */
+
+
+CollateRecordset::CollateRecordset(Database *db, unsigned int field,
+				   QueryPtr query)
+    : m_db(db),
+      m_is_int(false),
+      m_index(0)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    m_is_int = m_db->IsInt(field);
+
+    /** @todo Optimisation: if all restrictions are on the collate field,
+     *        we only need to examine one record.
+     */
+    if (m_is_int)
+    {
+	const Database::intindex_t& index = m_db->m_intindexes[field];
+	for (Database::intindex_t::const_iterator i = index.begin();
+	     i != index.end();
+	     ++i)
+	{
+	    for (size_t j=0; j<i->second.size(); ++j)
+	    {
+		if (query->Match(i->second[j]))
+		{
+		    m_values.push_back(i->first);
+		    break;
+		}
+	    }
+	}
+    }
+    else
+    {
+	const Database::stringindex_t& index = m_db->m_stringindexes[field];
+	for (Database::stringindex_t::const_iterator i = index.begin();
+	     i != index.end();
+	     ++i)
+	{
+	    for (size_t j=0; j<i->second.size(); ++j)
+	    {
+		if (query->Match(i->second[j]))
+		{
+		    m_values.push_back(i->first);
+		    break;
+		}
+	    }
+	}
+    }
+}
+
+bool CollateRecordset::IsEOF() const
+{
+    return m_index >= m_values.size();
+}
+
+uint32_t CollateRecordset::GetInteger(unsigned int) const
+{
+    if (IsEOF())
+	return 0;
+    if (m_is_int)
+	return m_values[m_index];
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    return (uint32_t)strtoul(m_db->m_pool.Data(m_values[m_index]), NULL, 10);
+}
+
+std::string CollateRecordset::GetString(unsigned int) const
+{
+    if (IsEOF())
+	return std::string();
+    if (m_is_int)
+    {
+	char buf[12];
+	snprintf(buf, sizeof(buf), "%u", m_values[m_index]);
+	return buf;
+    }
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    return m_db->m_pool.Get(m_values[m_index]);
+}
+
+void CollateRecordset::MoveNext()
+{
+    if (m_index < m_values.size())
+	++m_index;
+}
+
+} // namespace column
+} // namespace db
+
+#ifdef TEST
+
+int main()
+{
+    db::column::Test();
+    return 0;
+}
+
+#endif
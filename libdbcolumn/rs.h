@@ -0,0 +1,95 @@
+/* libdbcolumn/rs.h
+ */
+#ifndef LIBDBCOLUMN_RS_H
+#define LIBDBCOLUMN_RS_H 1
+
+#include "libdb/recordset.h"
+#include "libdb/readonly_rs.h"
+#include "libutil/counted_pointer.h"
+#include <string>
+#include <vector>
+
+namespace db {
+namespace column {
+
+class Database;
+class Query;
+
+/** Base class for column-database cursors: a cursor is just a record number.
+ */
+class Recordset: public db::Recordset
+{
+protected:
+    Database *m_db;
+    uint32_t m_record;
+    bool m_eof;
+
+public:
+    explicit Recordset(Database *db);
+
+    bool IsEOF() const override;
+    uint32_t GetInteger(unsigned int which) const override;
+    std::string GetString(unsigned int which) const override;
+
+    unsigned int SetString(unsigned int which, const std::string&) override;
+    unsigned int SetInteger(unsigned int which, uint32_t) override;
+
+    unsigned int AddRecord() override;
+    unsigned int Commit() override;
+    unsigned int Delete() override;
+};
+
+/** Visits every record, in record-number order, that matches a query.
+ */
+class ScanRecordset: public Recordset
+{
+    util::CountedPointer<Query> m_query;
+
+    void MoveFrom(uint32_t recno);
+
+public:
+    ScanRecordset(Database*, util::CountedPointer<Query>);
+
+    void MoveNext() override;
+};
+
+/** Visits a precomputed list of records, skipping any since deleted.
+ */
+class ListRecordset: public Recordset
+{
+    std::vector<uint32_t> m_recnos;
+    size_t m_index;
+
+    void MoveFrom(size_t index);
+
+public:
+    ListRecordset(Database*, std::vector<uint32_t>&& recnos);
+
+    void MoveNext() override;
+    unsigned int GetCount(size_t *count) const override;
+};
+
+/** Visits each distinct value of one (indexed) field, among the records
+ * that match a query.
+ */
+class CollateRecordset: public ReadOnlyRecordset
+{
+    Database *m_db;
+    bool m_is_int;
+    std::vector<uint32_t> m_values; ///< Integers, or StringPool ids
+    size_t m_index;
+
+public:
+    CollateRecordset(Database*, unsigned int field,
+		     util::CountedPointer<Query>);
+
+    bool IsEOF() const override;
+    uint32_t GetInteger(unsigned int which) const override;
+    std::string GetString(unsigned int which) const override;
+    void MoveNext() override;
+};
+
+} // namespace column
+} // namespace db
+
+#endif
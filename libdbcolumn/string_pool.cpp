@@ -0,0 +1,159 @@
+#include "string_pool.h"
+#include <string.h>
+#include <assert.h>
+
+namespace db {
+namespace column {
+
+StringPool::StringPool()
+{
+    // The empty string is always id 0
+    m_arena.push_back('\0');
+    m_offsets.push_back(0);
+    m_offsets.push_back(1);
+    Rehash(64);
+}
+
+/** FNV-1a: not the world's best hash, but short and adequate for the
+ * sort of strings found in tags.
+ */
+uint32_t StringPool::Hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i=0; i<len; ++i)
+    {
+	h ^= (unsigned char)s[i];
+	h *= 16777619u;
+    }
+    return h;
+}
+
+size_t StringPool::Slot(const char *s, size_t len, uint32_t hash) const
+{
+    size_t mask = m_hash.size() - 1;
+    size_t slot = hash & mask;
+    for (;;)
+    {
+	uint32_t entry = m_hash[slot];
+	if (!entry)
+	    return slot;
+	uint32_t id = entry - 1;
+	if (Size(id) == len && !memcmp(Data(id), s, len))
+	    return slot;
+	slot = (slot + 1) & mask;
+    }
+}
+
+void StringPool::Rehash(size_t buckets)
+{
+    m_hash.assign(buckets, 0);
+    for (uint32_t id=0; id<Count(); ++id)
+    {
+	size_t slot = Slot(Data(id), Size(id), Hash(Data(id), Size(id)));
+	m_hash[slot] = id+1;
+    }
+}
+
+uint32_t StringPool::Intern(const std::string& s)
+{
+    uint32_t hash = Hash(s.data(), s.size());
+    size_t slot = Slot(s.data(), s.size(), hash);
+    if (m_hash[slot])
+	return m_hash[slot] - 1;
+
+    uint32_t id = (uint32_t)Count();
+    m_arena.insert(m_arena.end(), s.begin(), s.end());
+    m_arena.push_back('\0');
+    m_offsets.push_back((uint32_t)m_arena.size());
+    m_hash[slot] = id+1;
+
+    // Keep the load factor under one half
+    if (Count() * 2 > m_hash.size())
+	Rehash(m_hash.size() * 2);
+    return id;
+}
+
+uint32_t StringPool::Find(const std::string& s) const
+{
+    size_t slot = Slot(s.data(), s.size(), Hash(s.data(), s.size()));
+    if (m_hash[slot])
+	return m_hash[slot] - 1;
+    return NOT_FOUND;
+}
+
+int StringPool::Compare(uint32_t a, uint32_t b) const
+{
+    if (a == b)
+	return 0;
+    size_t la = Size(a);
+    size_t lb = Size(b);
+    int rc = memcmp(Data(a), Data(b), la < lb ? la : lb);
+    if (rc)
+	return rc;
+    return (la < lb) ? -1 : (la > lb) ? 1 : 0;
+}
+
+size_t StringPool::MemoryUsage() const
+{
+    return m_arena.capacity()
+	+ m_offsets.capacity() * sizeof(uint32_t)
+	+ m_hash.capacity() * sizeof(uint32_t);
+}
+
+} // namespace column
+} // namespace db
+
+#ifdef TEST
+
+# include <stdio.h>
+
+int main()
+{
+    db::column::StringPool sp;
+
+    assert(sp.Count() == 1);
+    assert(sp.Intern("") == 0);
+    assert(sp.Find("") == 0);
+    assert(sp.Find("foo") == db::column::StringPool::NOT_FOUND);
+
+    uint32_t foo = sp.Intern("foo");
+    assert(foo != 0);
+    assert(sp.Intern("foo") == foo);
+    assert(sp.Find("foo") == foo);
+    assert(sp.Get(foo) == "foo");
+    assert(sp.Size(foo) == 3);
+    assert(sp.Data(foo)[3] == '\0');
+
+    uint32_t bar = sp.Intern("bar");
+    assert(bar != foo);
+    assert(sp.Compare(bar, foo) < 0);
+    assert(sp.Compare(foo, bar) > 0);
+    assert(sp.Compare(foo, foo) == 0);
+    assert(sp.Compare(0, foo) < 0);
+
+    uint32_t foobar = sp.Intern("foobar");
+    assert(sp.Compare(foo, foobar) < 0);
+
+    // Enough to force several rehashes
+    for (unsigned int i=0; i<10000; ++i)
+    {
+	char buf[20];
+	sprintf(buf, "s%u", i);
+	uint32_t id = sp.Intern(buf);
+	assert(sp.Get(id) == buf);
+    }
+    assert(sp.Count() == 10004);
+    assert(sp.Find("foo") == foo);
+    assert(sp.Find("s9999") != db::column::StringPool::NOT_FOUND);
+    assert(sp.Find("s10000") == db::column::StringPool::NOT_FOUND);
+
+    // Embedded NULs are allowed (length, not terminator, is definitive)
+    std::string nul("a\0b", 3);
+    uint32_t id = sp.Intern(nul);
+    assert(sp.Get(id) == nul);
+    assert(sp.Find(std::string("a")) != id);
+
+    return 0;
+}
+
+#endif
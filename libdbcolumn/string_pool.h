@@ -0,0 +1,73 @@
+/* libdbcolumn/string_pool.h
+ */
+#ifndef LIBDBCOLUMN_STRING_POOL_H
+#define LIBDBCOLUMN_STRING_POOL_H 1
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace db {
+namespace column {
+
+/** A set of interned strings, each identified by a small integer.
+ *
+ * All the characters live in one arena, each string NUL-terminated, so a
+ * string costs its length plus about nine bytes (terminator, offset and
+ * hash slot) -- rather than the 32 bytes of a std::string plus its own
+ * heap block. String 0 is always the empty string.
+ *
+ * Strings are never removed: a pool only grows, so ids stay valid for the
+ * lifetime of the pool. Not thread-safe; the owner does the locking.
+ */
+class StringPool
+{
+    std::vector<char> m_arena;
+    std::vector<uint32_t> m_offsets; ///< One per string, plus one at the end
+    std::vector<uint32_t> m_hash;    ///< Open-addressed, holds id+1 (0=empty)
+
+    static uint32_t Hash(const char *s, size_t len);
+    size_t Slot(const char *s, size_t len, uint32_t hash) const;
+    void Rehash(size_t buckets);
+
+public:
+    enum { NOT_FOUND = 0xFFFFFFFFu };
+
+    StringPool();
+
+    /** Returns the id of s, adding it to the pool if not already present.
+     */
+    uint32_t Intern(const std::string& s);
+
+    /** Returns the id of s, or NOT_FOUND.
+     */
+    uint32_t Find(const std::string& s) const;
+
+    size_t Count() const { return m_offsets.size() - 1; }
+
+    /** Valid until the next Intern() */
+    const char *Data(uint32_t id) const
+    {
+	return m_arena.data() + m_offsets[id];
+    }
+    size_t Size(uint32_t id) const
+    {
+	return m_offsets[id+1] - m_offsets[id] - 1;
+    }
+    std::string Get(uint32_t id) const
+    {
+	return std::string(Data(id), Size(id));
+    }
+
+    /** Byte-wise three-way comparison, consistent with std::string::compare.
+     */
+    int Compare(uint32_t a, uint32_t b) const;
+
+    size_t MemoryUsage() const;
+};
+
+} // namespace column
+} // namespace db
+
+#endif
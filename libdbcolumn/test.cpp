@@ -0,0 +1,413 @@
+#include "db.h"
+#include "libdb/recordset.h"
+#include "libdb/query.h"
+#include <assert.h>
+#include "libutil/trace.h"
+#include "libutil/counted_pointer.h"
+
+namespace db {
+namespace column {
+
+void Test()
+{
+    db::column::Database sdb(2);
+    
+    sdb.SetFieldInfo(0, db::column::FIELD_INT|db::column::FIELD_INDEXED);
+    sdb.SetFieldInfo(1, db::column::FIELD_STRING|db::column::FIELD_INDEXED);
+
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(0, 42);
+    rs->SetString(1, "foo");
+    rs->Commit();
+
+    rs->AddRecord();
+    rs->SetInteger(0, 111);
+    rs->SetString(1, "zachary");
+    rs->Commit();
+
+    rs->AddRecord();
+    rs->SetInteger(0, 222222);
+    rs->SetString(1, "beyonc\xC3\xA9");
+    rs->Commit();
+
+    /* Check string ordering */
+
+    db::QueryPtr qp = sdb.CreateQuery();
+    qp->OrderBy(1);
+    rs = qp->Execute();
+
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 222222);
+    assert(rs->GetString(1) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 42);
+    assert(rs->GetString(1) == "foo");
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 111);
+    assert(rs->GetString(1) == "zachary");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    rs->GetString(1); // test eof handling
+    rs->GetInteger(0);
+
+    /* Check int ordering */
+
+    qp = sdb.CreateQuery();
+    qp->OrderBy(0);
+    rs = qp->Execute();
+
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 42);
+    assert(rs->GetString(1) == "foo");
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 111);
+    assert(rs->GetString(1) == "zachary");
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 222222);
+    assert(rs->GetString(1) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Query by string */
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, "zachary"));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 111);
+    assert(rs->GetString(1) == "zachary");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, "foo"));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 42);
+    assert(rs->GetString(1) == "foo");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, "beyonc\xC3\xA9"));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 222222);
+    assert(rs->GetString(1) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Query by int */
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::EQ, 42));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 42);
+    assert(rs->GetString(1) == "foo");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Two-factor query */
+
+    qp = sdb.CreateQuery();
+    unsigned int rc = qp->Where(qp->And(qp->Restrict(0, db::EQ, 111),
+					qp->Restrict(1, db::EQ, "zachary")));
+    assert(rc == 0);
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 111);
+    assert(rs->GetString(1) == "zachary");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Two-factor query, not found */
+
+    qp = sdb.CreateQuery();
+    rc = qp->Where(qp->And(qp->Restrict(0, db::EQ, 111222),
+			   qp->Restrict(1, db::EQ, "zachary")));
+    assert(rc == 0);
+    rs = qp->Execute();
+    assert(rs->IsEOF());
+
+    /* Two-factor query, oritive */
+
+    qp = sdb.CreateQuery();
+    rc = qp->Where(qp->Or(qp->Restrict(0, db::EQ, 111222),
+			  qp->Restrict(1, db::EQ, "zachary")));
+    assert(rc == 0);
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 111);
+    assert(rs->GetString(1) == "zachary");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Delete a record */
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::EQ, 42));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 42);
+    assert(rs->GetString(1) == "foo");
+    rs->Delete();
+    assert(rs->IsEOF());
+
+    /* Check ordering again */
+
+    qp = sdb.CreateQuery();
+    qp->OrderBy(1);
+    rs = qp->Execute();
+
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 222222);
+    assert(rs->GetString(1) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 111);
+    assert(rs->GetString(1) == "zachary");
+    // test coercion
+    assert(rs->GetString(0) == "111");
+    assert(rs->GetInteger(1) == 0);
+    rs->SetString(0, "37");
+    rs->SetInteger(1, 999);
+    assert(rs->GetInteger(0) == 37);
+    assert(rs->GetString(1) == "999");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Check unordered reading */
+
+    rs = sdb.CreateRecordset();
+    assert(!rs->IsEOF());
+    unsigned int id1 = rs->GetInteger(0);
+    assert(id1 == 37 || id1 == 222222);
+    rs->MoveNext();
+    unsigned int id2 = rs->GetInteger(0);
+    assert(id2 == 37 || id2 == 222222);
+    assert(id1 != id2);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Introduce a duplicate string */
+
+    rs = sdb.CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(0, 112);
+    rs->SetString(1, "beyonc\xC3\xA9");
+    rs->Commit();
+
+    /* Collate-by with duplicate string */
+
+    qp = sdb.CreateQuery();
+    qp->CollateBy(1);
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetString(0) == "999");
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetString(0) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Check ordering again */
+
+    qp = sdb.CreateQuery();
+    qp->OrderBy(1);
+    rs = qp->Execute();
+
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 37);
+    assert(rs->GetString(1) == "999");
+    rs->MoveNext();
+    assert(rs->GetString(1) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetString(1) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Collate-by with LIKE query */
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::LIKE, "b.*"));
+    qp->CollateBy(1);
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetString(1) == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Introduce a duplicate int */
+
+    rs = sdb.CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(0, 112);
+    rs->SetString(1, "ptang");
+    rs->Commit();
+
+    /* Look for it */
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::EQ, 112));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 112);
+    std::string s1 = rs->GetString(1);
+    assert(s1 == "ptang" || s1 == "beyonc\xC3\xA9");
+    rs->MoveNext();
+    assert(rs->GetInteger(0) == 112);
+    std::string s2 = rs->GetString(1);
+    assert(s2 == "ptang" || s2 == "beyonc\xC3\xA9");
+    assert(s1 != s2);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+    rs->MoveNext();
+
+    /* Collate-by with duplicate int */
+
+    qp = sdb.CreateQuery();
+    qp->CollateBy(0);
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 37);
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 112);
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 222222);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+    rs->MoveNext();
+    rs->Delete();
+
+    /* Test coercion on unindexed fields */
+    Database sdb3(3);
+    db::RecordsetPtr rs3 = sdb3.CreateRecordset();
+    rs3->AddRecord();
+    rs3->SetString(1, "37");
+    assert(rs3->GetInteger(1) == 37);
+    rs3->SetInteger(2, 110);
+    assert(rs3->GetString(2) == "110");
+
+    /* Order-by honours restrictions, and subsidiary keys */
+    Database sdb4(3);
+    sdb4.SetFieldInfo(0, FIELD_INT|FIELD_INDEXED);
+    sdb4.SetFieldInfo(1, FIELD_STRING|FIELD_INDEXED);
+    sdb4.SetFieldInfo(2, FIELD_INT);
+    static const struct {
+	unsigned int id;
+	const char *album;
+	unsigned int track;
+    } tracks[] = {
+	{ 1, "Parachutes", 2 },
+	{ 2, "X&Y", 1 },
+	{ 3, "Parachutes", 1 },
+	{ 4, "A Rush of Blood", 3 },
+	{ 5, "X&Y", 2 },
+	{ 6, "A Rush of Blood", 1 },
+    };
+    rs = sdb4.CreateRecordset();
+    for (unsigned int i=0; i<sizeof(tracks)/sizeof(tracks[0]); ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(0, tracks[i].id);
+	rs->SetString(1, tracks[i].album);
+	rs->SetInteger(2, tracks[i].track);
+	rs->Commit();
+    }
+
+    qp = sdb4.CreateQuery();
+    qp->OrderBy(1);
+    qp->OrderBy(2);
+    rs = qp->Execute();
+    static const unsigned int expected[] = { 6, 4, 3, 1, 2, 5 };
+    for (unsigned int i=0; i<6; ++i)
+    {
+	assert(!rs->IsEOF());
+	assert(rs->GetInteger(0) == expected[i]);
+	rs->MoveNext();
+    }
+    assert(rs->IsEOF());
+    size_t total = 0;
+    rc = rs->GetCount(&total);
+    assert(rc == 0);
+    assert(total == 6);
+
+    qp = sdb4.CreateQuery();
+    qp->OrderBy(1, true);
+    qp->OrderBy(2);
+    rs = qp->Execute();
+    static const unsigned int reversed[] = { 2, 5, 3, 1, 6, 4 };
+    for (unsigned int i=0; i<6; ++i)
+    {
+	assert(!rs->IsEOF());
+	assert(rs->GetInteger(0) == reversed[i]);
+	rs->MoveNext();
+    }
+    assert(rs->IsEOF());
+
+    qp = sdb4.CreateQuery();
+    qp->Where(qp->Restrict(0, db::GT, 2));
+    qp->OrderBy(2);
+    rs = qp->Execute();
+    assert(rs->GetInteger(0) == 3);
+    rs->MoveNext();
+    assert(rs->GetInteger(0) == 6);
+    rs->MoveNext();
+    assert(rs->GetInteger(0) == 5);
+    rs->MoveNext();
+    assert(rs->GetInteger(0) == 4);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* Conjunction picks the index, but still applies the other term */
+    qp = sdb4.CreateQuery();
+    qp->Where(qp->And(qp->Restrict(1, db::EQ, "X&Y"),
+		      qp->Restrict(2, db::EQ, 2)));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(0) == 5);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    /* String not in the database at all */
+    qp = sdb4.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, "Viva la Vida"));
+    rs = qp->Execute();
+    assert(rs->IsEOF());
+
+    /* Deleting from the middle keeps everything else intact */
+    qp = sdb4.CreateQuery();
+    qp->Where(qp->Restrict(0, db::EQ, 2));
+    rs = qp->Execute();
+    assert(!rs->IsEOF());
+    rs->Delete();
+    unsigned int count = 0;
+    for (rs = sdb4.CreateRecordset(); !rs->IsEOF(); rs->MoveNext())
+    {
+	unsigned int id = rs->GetInteger(0);
+	assert(id != 2);
+	assert(rs->GetString(1) == tracks[id-1].album);
+	assert(rs->GetInteger(2) == tracks[id-1].track);
+	++count;
+    }
+    assert(count == 5);
+    assert(sdb4.MemoryUsage() > 0);
+
+    (void)!rc;
+    (void)!id1;
+    (void)!id2;
+    (void)!count;
+}
+
+} // namespace column
+} // namespace db
@@ -20,7 +20,7 @@ class Recordset: public db::DelegatingRecordset
 
 public:
     Recordset(util::CountedPointer<db::Recordset> rs, Connection *parent)
-	: db::DelegatingRecordset(rs), m_connection(parent)
+	: db::DelegatingRecordset(rs, true), m_connection(parent)
     {
     }
 
@@ -1,35 +1,148 @@
 #include "config.h"
 #include "database_updater.h"
 #include "libmediadb/xml.h"
+#include "libmediadb/binary.h"
+#include "libmediadb/journal.h"
 #include "libmediadb/schema.h"
 #include "libutil/errors.h"
+#include "libutil/file.h"
 #include "libutil/trace.h"
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <boost/scoped_array.hpp>
+#include <algorithm>
 
 namespace db {
 namespace local {
 
+/** Writes a binary snapshot to a temporary file, then renames it into
+ * place, so that a crash never leaves a half-written one.
+ */
+static unsigned int WriteSnapshot(db::Database *thedb,
+				  const std::string& filename)
+{
+#if HAVE_MKSTEMP
+    boost::scoped_array<char> buffer(new char[filename.size() + 8]);
+    sprintf(buffer.get(), "%s.XXXXXX", filename.c_str());
+    int fd = mkstemp(buffer.get());
+
+    FILE *f = fdopen(fd, "w");
+    if (!f)
+    {
+	unsigned int rc = (unsigned)errno;
+	close(fd);
+	return rc;
+    }
+
+    unsigned int rc = mediadb::WriteBinary(thedb, mediadb::SCHEMA_VERSION, f);
+    if (rc)
+    {
+	fclose(f);
+	::unlink(buffer.get());
+	return rc;
+    }
+
+    fsync(fd);
+    fclose(f); // Also closes the fd, see fdopen(3)
+
+    ::chmod(buffer.get(), 0644);
+
+    if (::rename(buffer.get(), filename.c_str()) < 0)
+	return (unsigned)errno;
+
+    // Journals are discarded after this, so the rename had better stick
+    rc = util::SyncDirectoryOf(filename.c_str());
+    if (rc)
+	return rc;
+#else
+    /* No mkstemp (eg. Windows)
+     */
+    std::string name2 = filename + ".2";
+    FILE *f = fopen(name2.c_str(), "wb");
+
+    if (!f)
+	return (unsigned)errno;
+
+    unsigned int rc = mediadb::WriteBinary(thedb, mediadb::SCHEMA_VERSION, f);
+    fclose(f);
+    if (rc)
+	return rc;
+
+    ::rename(name2.c_str(), filename.c_str());
+#endif
+    return 0;
+}
+
 DatabaseUpdater::DatabaseUpdater(const std::string& loroot,
 				 const std::string& hiroot,
 				 db::Database *thedb, 
 				 mediadb::Database *idallocator,
 				 util::Scheduler *scheduler,
 				 util::TaskQueue *queue,
-				 const std::string& dbfilename)
+				 const std::string& dbfilename,
+				 mediadb::Journal *journal,
+				 mediadb::UpdateTracker *tracker)
     : m_notifier(import::FileNotifierTask::Create(scheduler)),
-      m_file_scanner(loroot, hiroot, thedb, idallocator, queue,
-		     m_notifier.get()),
+      m_journaled(thedb, journal),
+      m_tracked(journal ? &m_journaled : thedb, tracker),
+      m_file_scanner(loroot, hiroot,
+		     tracker ? &m_tracked
+		     : journal ? &m_journaled : thedb,
+		     idallocator, queue, m_notifier.get()),
       m_scanning(false),
       m_changed(false),
       m_database_filename(dbfilename),
-      m_db(thedb)
+      m_snapshot_filename(util::StripExtension(dbfilename.c_str())
+			  + ".snapshot"),
+      m_journal_filename(util::StripExtension(dbfilename.c_str())
+			 + ".journal"),
+      m_db(thedb),
+      m_journal(journal)
 {
     m_file_scanner.AddObserver(this);
     m_notifier->SetObserver(this);
 
-    unsigned int rc = mediadb::ReadXML(thedb, dbfilename.c_str());
+    /* The snapshot is what we write, but an XML file newer than it (or
+     * instead of it) has been put there to be imported.
+     */
+    struct stat xmlst, snapst;
+    bool have_xml = ::stat(m_database_filename.c_str(), &xmlst) == 0;
+    bool have_snap = ::stat(m_snapshot_filename.c_str(), &snapst) == 0;
+
+    unsigned int rc = ENOENT;
+    bool imported = false;
+    if (have_snap && (!have_xml || snapst.st_mtime >= xmlst.st_mtime))
+    {
+	rc = mediadb::ReadBinary(thedb, m_snapshot_filename.c_str());
+	if (rc)
+	    TRACE << "Reading snapshot returned " << rc << "\n";
+    }
+    if (rc && have_xml)
+    {
+	rc = mediadb::ReadXML(thedb, m_database_filename.c_str());
+	imported = (rc == 0);
+    }
+
+    if (m_journal)
+    {
+	if (imported)
+	{
+	    // Any journal belongs to an old snapshot, so start afresh
+	    if (WriteSnapshot(thedb, m_snapshot_filename) == 0)
+		::unlink(m_journal_filename.c_str());
+	}
+	else
+	{
+	    // The journal carries on from the snapshot (or from nothing)
+	    unsigned int n = 0;
+	    unsigned int rc2 = mediadb::Journal::Replay(
+		thedb, m_journal_filename.c_str(), &n);
+	    if (rc2)
+		TRACE << "Replaying journal returned " << rc2 << "\n";
+	    else if (n)
+		TRACE << "Replayed " << n << " journal entries\n";
+	}
+    }
     
     if (rc)
     {
@@ -38,6 +151,13 @@ DatabaseUpdater::DatabaseUpdater(const std::string& loroot,
 	/// @bug Clear out any partial (bogus) results
     }
 
+    if (m_journal)
+    {
+	rc = m_journal->Open(m_journal_filename.c_str());
+	if (rc)
+	    TRACE << "Can't open journal: " << rc << "\n";
+    }
+
     m_scanning = true;
     m_file_scanner.StartScan();
 
@@ -66,55 +186,42 @@ unsigned int DatabaseUpdater::OnFile(const std::string&)
     return 0;
 }
 
+/** Compact the journal into a new snapshot once it's this big, or a
+ * quarter the size of the snapshot, whichever is larger.
+ */
+enum { MIN_COMPACT_BYTES = 1024*1024 };
+
 void DatabaseUpdater::OnFinished(unsigned int)
 {
-#if HAVE_MKSTEMP
-    boost::scoped_array<char> buffer(new char[m_database_filename.size() + 8]);
-    sprintf(buffer.get(), "%s.XXXXXX", m_database_filename.c_str());
-    int fd = mkstemp(buffer.get());
-
-    FILE *f = fdopen(fd, "w");
-    if (!f)
+    if (!m_journal)
     {
-	TRACE << "Can't write database: " << errno << "\n";
-	close(fd);
+	unsigned int rc = WriteSnapshot(m_db, m_snapshot_filename);
+	if (rc)
+	    TRACE << "Can't write database: " << rc << "\n";
     }
     else
     {
-	unsigned int rc = mediadb::WriteXML(m_db, mediadb::SCHEMA_VERSION, f);
+	unsigned int rc = m_journal->Sync();
 	if (rc)
-	{
-	    TRACE << "Can't write database: " << errno << "\n";
-	    fclose(f);
-	    ::unlink(buffer.get());
-	    return;
-	}
-
-	fsync(fd);
-	fclose(f); // Also closes the fd, see fdopen(3)
-
-	::chmod(buffer.get(), 0644);
-
-	::rename(buffer.get(), m_database_filename.c_str());
-    }
-#else
-    /* No mkstemp (eg. Windows)
-     */
-    std::string name2 = m_database_filename + ".2";
-    FILE *f = fopen(name2.c_str(), "w");
+	    TRACE << "Can't write journal: " << rc << "\n";
 
-    if (!f)
-    {
-	TRACE << "Can't write database: " << errno << "\n";
-    }
-    else
-    {
-	mediadb::WriteXML(m_db, mediadb::SCHEMA_VERSION, f);
-	fclose(f);
+	struct stat st;
+	uint64_t threshold = MIN_COMPACT_BYTES;
+	if (::stat(m_snapshot_filename.c_str(), &st) == 0)
+	    threshold = std::max(threshold, (uint64_t)st.st_size / 4);
+	else
+	    threshold = 0; // No snapshot at all yet
 
-	::rename(name2.c_str(), m_database_filename.c_str());
+	if (rc || m_journal->GetSize() > threshold)
+	{
+	    mediadb::Journal::checkpoint_t cp = m_journal->Checkpoint();
+	    rc = WriteSnapshot(m_db, m_snapshot_filename);
+	    if (rc)
+		TRACE << "Can't write database: " << rc << "\n";
+	    else
+		m_journal->Discard(cp);
+	}
     }
-#endif
 
     std::lock_guard<std::mutex> lock(m_mutex);
     if (m_changed)
@@ -3,6 +3,8 @@
 
 #include "libimport/file_notifier.h"
 #include "libutil/counted_pointer.h"
+#include "libmediadb/journal.h"
+#include "libmediadb/update_tracker.h"
 #include "file_scanner.h"
 #include <mutex>
 
@@ -14,12 +16,17 @@ class DatabaseUpdater: public import::FileNotifierTask::Observer,
 		       public FileScanner::Observer
 {
     import::FileNotifierPtr m_notifier;
+    mediadb::JournalingDatabase m_journaled;
+    mediadb::TrackingDatabase m_tracked; ///< The scanner's, if tracking
     FileScanner m_file_scanner;
     std::mutex m_mutex;
     bool m_scanning;
     bool m_changed;
-    std::string m_database_filename;
+    std::string m_database_filename; ///< XML, read only to import
+    std::string m_snapshot_filename; ///< Binary, see mediadb::WriteBinary
+    std::string m_journal_filename;  ///< Changes since the snapshot
     db::Database *m_db;
+    mediadb::Journal *m_journal;
 
     // Being a FileScanner::Observer
     unsigned int OnFile(const std::string& filename);
@@ -29,10 +36,21 @@ class DatabaseUpdater: public import::FileNotifierTask::Observer,
     void OnChange();
 
 public:
+    /** If journal is given, it's opened once the database is loaded, and
+     * every change is appended to it (see mediadb::Journal), with the
+     * snapshot rewritten only occasionally. Writers other than the
+     * updater should write through a mediadb::JournalingDatabase too.
+     * Without one, the whole snapshot is rewritten after every scan.
+     *
+     * If tracker is given, the scanner's changes (but not the initial
+     * load) are reported to it.
+     */
     DatabaseUpdater(const std::string& loroot, const std::string& hiroot,
 		    db::Database *thedb, mediadb::Database *idallocator,
 		    util::Scheduler *scheduler, util::TaskQueue *queue, 
-		    const std::string& dbfilename);
+		    const std::string& dbfilename,
+		    mediadb::Journal *journal = NULL,
+		    mediadb::UpdateTracker *tracker = NULL);
     ~DatabaseUpdater();
 
     void ForceRescan();
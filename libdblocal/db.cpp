@@ -7,6 +7,7 @@
 #include "libutil/file_stream.h"
 #include "libutil/http_fetcher.h"
 #include "libutil/http_stream.h"
+#include "libutil/readahead_stream.h"
 #include "libimport/playlist.h"
 #include <fcntl.h>
 #include <unistd.h>
@@ -29,7 +30,7 @@ class Database::Recordset: public db::DelegatingRecordset
 
 public:
     Recordset(db::RecordsetPtr rs, Database *parent)
-	: db::DelegatingRecordset(rs), m_parent(parent)
+	: db::DelegatingRecordset(rs, true), m_parent(parent)
     {
     }
 
@@ -108,6 +109,15 @@ db::QueryPtr Database::CreateQuery()
     return db::QueryPtr(new Query(m_db->CreateQuery(), this));
 }
 
+db::RecordsetPtr Database::Fetch(unsigned int which,
+				 const std::vector<unsigned int>& values)
+{
+    db::RecordsetPtr rs = m_db->Fetch(which, values);
+    if (!rs)
+	return rs;
+    return db::RecordsetPtr(new Recordset(rs, this));
+}
+
 std::string Database::GetURL(unsigned int id)
 {
     db::QueryPtr qp = m_db->CreateQuery();
@@ -191,8 +201,11 @@ std::unique_ptr<util::Stream> Database::OpenRead(unsigned int id)
     {
 	TRACE << "Can't open ID " << id << " file " << rs->GetString(mediadb::PATH)
 	      << " rc=" << rc << "\n";
+	return sp;
     }
-    return sp;
+
+    // Parsers and transcoders read in little bits
+    return util::CreateReadAheadStream(std::move(sp));
 }
 
 std::unique_ptr<util::Stream> Database::OpenWrite(unsigned int id)
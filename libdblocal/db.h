@@ -36,15 +36,21 @@ public:
      * @param client An HTTP client, in case of internet radio stations.
      * @param queue  A task queue for re-tagging operations.
      *
+     * @param iddb   Database to allocate new IDs from, if not thedb.
+     *
      * Passing queue=NULL means tag changes are not reflected to the actual
      * files, and exist only in the database.
+     *
+     * If thedb is a view which can lag behind the real database (eg a
+     * db::steam::SnapshotView), pass the real one as iddb, or IDs recently
+     * taken by a rescan could be handed out again.
      */
     Database(db::Database *thedb, util::http::Client *client,
-	     util::TaskQueue *queue = NULL)
+	     util::TaskQueue *queue = NULL, db::Database *iddb = NULL)
 	: m_db(thedb),
 	  m_client(client), 
 	  m_queue(queue), 
-	  m_aid(thedb),
+	  m_aid(iddb ? iddb : thedb),
 	  m_tag_serialiser(this, queue)
     {}
 
@@ -52,6 +58,8 @@ public:
 
     db::RecordsetPtr CreateRecordset() override;
     db::QueryPtr CreateQuery() override;
+    db::RecordsetPtr Fetch(unsigned int which,
+			   const std::vector<unsigned int>& values) override;
 
     unsigned int AllocateID() override { return m_aid.Allocate(); }
     std::string GetURL(unsigned int id) override;
@@ -335,8 +335,7 @@ unsigned int FileScanner::Impl::OnFile(dircookie parent_cookie,
 			std::vector<unsigned int>& vec = m_children[id];
 			vec.erase(std::remove(vec.begin(), vec.end(), 0U), 
 				  vec.end());
-			rs->SetString(mediadb::CHILDREN, 
-				      mediadb::VectorToChildren(vec));
+			rs->SetArray(mediadb::CHILDREN, vec);
 			rs->SetInteger(mediadb::TYPE, mediadb::PLAYLIST);
 		    }
 		}
@@ -415,7 +414,7 @@ unsigned int FileScanner::Impl::OnLeaveDirectory(dircookie cookie,
 	std::lock_guard<std::mutex> lock(m_mutex);
 	std::vector<unsigned int>& vec = m_children[(unsigned int)cookie];
 	vec.erase(std::remove(vec.begin(), vec.end(), 0u), vec.end());
-	rs->SetString(mediadb::CHILDREN, mediadb::VectorToChildren(vec));
+	rs->SetArray(mediadb::CHILDREN, vec);
     }
     rs->Commit();
 
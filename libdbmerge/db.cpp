@@ -2,6 +2,7 @@
 #include "libmediadb/schema.h"
 #include "libdb/empty_recordset.h"
 #include "libdb/delegating_rs.h"
+#include "libdb/fetch_rs.h"
 #include "libdb/query.h"
 #include "libutil/locking.h"
 #include "libutil/trace.h"
@@ -23,6 +24,7 @@ class Database::Impl final: public mediadb::Database,
     
     friend class Query;
     friend class RootRecordset;
+    friend class FetchRecordset;
 
 public:
     Impl();
@@ -74,8 +76,18 @@ public:
     uint32_t GetInteger(unsigned int which) const override;
     unsigned int SetInteger(unsigned int which, uint32_t value) override;
     std::string GetString(unsigned int which) const override;
+    std::string_view GetStringView(unsigned int which,
+				   std::string *scratch) const override;
+    void GetStringViews(const unsigned int *fields, size_t n,
+			std::string_view *views,
+			std::string *scratch) const override;
     unsigned int SetString(unsigned int which,
                            const std::string& value) override;
+
+    /** The underlying record's revision is good for this one too, as the
+     * wrapping depends only on m_id.
+     */
+    uint64_t GetRevision() const override { return m_rs->GetRevision(); }
 };
 
 /** A recordset that presents the root item (with merged children).
@@ -92,10 +104,33 @@ public:
     }
 
     std::string GetString(unsigned int which) const override;
+    std::string_view GetStringView(unsigned int which,
+				   std::string *scratch) const override;
     unsigned int SetString(unsigned int which,
                            const std::string& value) override;
 };
 
+/** Fetches IDs a run at a time: each run of consecutive IDs from the same
+ * database is one Fetch from that database.
+ */
+class Database::FetchRecordset final: public db::FetchRecordset
+{
+    Database::Impl *m_database;
+
+    struct Run
+    {
+	unsigned int dbno;
+	std::vector<unsigned int> ids; ///< With the database number removed
+    };
+    std::vector<Run> m_runs;
+
+    db::RecordsetPtr Part(size_t n) override;
+
+public:
+    FetchRecordset(Database::Impl *database,
+		   const std::vector<unsigned int>& ids);
+};
+
 
 		     /* Database::Impl */
 
@@ -253,6 +288,52 @@ db::RecordsetPtr Database::Query::Execute()
 }
 
 
+        /* Database::FetchRecordset */
+
+
+Database::FetchRecordset::FetchRecordset(Database::Impl *database,
+					 const std::vector<unsigned int>& ids)
+    : m_database(database)
+{
+    for (size_t i=0; i<ids.size(); ++i)
+    {
+	unsigned int dbno = ids[i] >> 24;
+
+	// The root is merged, so is always a run on its own
+	if (m_runs.empty()
+	    || m_runs.back().dbno != dbno
+	    || ids[i] == mediadb::BROWSE_ROOT
+	    || m_runs.back().ids[0] == mediadb::BROWSE_ROOT)
+	{
+	    m_runs.push_back(Run());
+	    m_runs.back().dbno = dbno;
+	}
+	m_runs.back().ids.push_back(ids[i] & 0xFFFFFF);
+    }
+    Start(m_runs.size());
+}
+
+db::RecordsetPtr Database::FetchRecordset::Part(size_t n)
+{
+    Database::Impl::Lock lock(m_database);
+
+    const Run& run = m_runs[n];
+    if (run.dbno >= m_database->m_databases.size()
+	|| !m_database->m_databases[run.dbno])
+	return db::RecordsetPtr();
+
+    db::RecordsetPtr rs = m_database->m_databases[run.dbno]->Fetch(mediadb::ID,
+								   run.ids);
+    if (!rs)
+	return rs;
+    if (run.dbno == 0 && run.ids[0] == mediadb::BROWSE_ROOT)
+	return db::RecordsetPtr(new RootRecordset(rs, m_database));
+    if (run.dbno != 0)
+	return db::RecordsetPtr(new WrapRecordset(rs, run.dbno));
+    return rs;
+}
+
+
         /* Database::WrapRecordset */
 
 
@@ -284,6 +365,26 @@ std::string Database::WrapRecordset::GetString(unsigned int which) const
     return result;
 }
 
+std::string_view Database::WrapRecordset::GetStringView(
+    unsigned int which, std::string *scratch) const
+{
+    if (which != mediadb::CHILDREN)
+	return m_rs->GetStringView(which, scratch);
+    *scratch = GetString(which);
+    return *scratch;
+}
+
+void Database::WrapRecordset::GetStringViews(const unsigned int *fields,
+					     size_t n,
+					     std::string_view *views,
+					     std::string *scratch) const
+{
+    m_rs->GetStringViews(fields, n, views, scratch);
+    for (size_t i=0; i<n; ++i)
+	if (fields[i] == mediadb::CHILDREN)
+	    views[i] = GetStringView(fields[i], &scratch[i]);
+}
+
 unsigned int Database::WrapRecordset::SetInteger(unsigned int which,
 						 uint32_t value)
 {
@@ -351,6 +452,15 @@ std::string Database::RootRecordset::GetString(unsigned int which) const
     return m_children;
 }
 
+std::string_view Database::RootRecordset::GetStringView(
+    unsigned int which, std::string *scratch) const
+{
+    if (which != mediadb::CHILDREN)
+	return m_rs->GetStringView(which, scratch);
+    *scratch = GetString(which);
+    return *scratch;
+}
+
 unsigned int Database::RootRecordset::SetString(unsigned int which,
 						const std::string& value)
 {
@@ -424,6 +534,14 @@ db::RecordsetPtr Database::CreateRecordset()
     return m_impl->CreateRecordset();
 }
 
+db::RecordsetPtr Database::Fetch(unsigned int which,
+				 const std::vector<unsigned int>& values)
+{
+    if (which != mediadb::ID)
+	return db::Database::Fetch(which, values);
+    return db::RecordsetPtr(new FetchRecordset(m_impl, values));
+}
+
 } // namespace db::merge
 } // namespace db
 
@@ -524,6 +642,43 @@ int main()
     assert(children[0] == 0x120);
     assert(children[1] == 0x120);
 
+    // Fetch, across both databases, in order, skipping the missing one
+    std::vector<unsigned int> ids = { 0x01000200, 0x999, mediadb::BROWSE_ROOT,
+				      0x120 };
+    rs = mdb.Fetch(mediadb::ID, ids);
+    assert(rs && !rs->IsEOF());
+    assert(rs->GetInteger(mediadb::ID) == 0x01000200);
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(mediadb::ID) == mediadb::BROWSE_ROOT);
+    rs->GetArray(mediadb::CHILDREN, &children);
+    assert(children.size() == 3);
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(mediadb::ID) == 0x120);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    // Records from other databases keep their revisions, for didl::Cache
+    db2.Publish();
+    rs = mdb.Fetch(mediadb::ID, std::vector<unsigned int>(1, 0x01000200));
+    assert(rs && !rs->IsEOF());
+    uint64_t rev = rs->GetRevision();
+    assert(rev != 0);
+    qp = mdb.CreateQuery();
+    qp->Where(qp->Restrict(mediadb::ID, db::EQ, 0x01000200));
+    rs = qp->Execute();
+    assert(rs && !rs->IsEOF());
+    assert(rs->GetRevision() == rev);
+    rs->SetString(mediadb::TITLE, "Wireless");
+    rs->Commit();
+    db2.Publish();
+    rs = mdb.Fetch(mediadb::ID, std::vector<unsigned int>(1, 0x01000200));
+    assert(rs && !rs->IsEOF());
+    assert(rs->GetString(mediadb::TITLE) == "Wireless");
+    assert(rs->GetRevision() != 0);
+    assert(rs->GetRevision() != rev);
+
     return 0;
 }
 
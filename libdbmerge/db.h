@@ -28,6 +28,7 @@ class Database final: public mediadb::Database
     class Query;
     class RootRecordset;
     class WrapRecordset;
+    class FetchRecordset;
 
 public:
     Database();
@@ -39,6 +40,8 @@ public:
     // Being a db::Database
     RecordsetPtr CreateRecordset() override;
     QueryPtr CreateQuery() override;
+    RecordsetPtr Fetch(unsigned int which,
+		       const std::vector<unsigned int>& values) override;
 
     // Being a mediadb::Database
     unsigned int AllocateID() override;
@@ -1,6 +1,7 @@
 #include "database.h"
 #include "query.h"
-#include "libdb/recordset.h"
+#include "recordset.h"
+#include "libmediadb/schema.h"
 #include "libutil/stream.h"
 #include "libutil/counted_pointer.h"
 
@@ -31,6 +32,14 @@ db::QueryPtr Database::CreateQuery()
     return db::QueryPtr(new Query(&m_connection));
 }
 
+db::RecordsetPtr Database::Fetch(unsigned int which,
+				 const std::vector<unsigned int>& values)
+{
+    if (which != mediadb::ID)
+	return db::Database::Fetch(which, values);
+    return db::RecordsetPtr(new FetchRecordset(&m_connection, values));
+}
+
 std::string Database::GetURL(unsigned int id)
 {
     return m_connection.GetURL(id);
@@ -32,6 +32,8 @@ public:
     // Being a db::Database
     db::RecordsetPtr CreateRecordset() override;
     db::QueryPtr CreateQuery() override;
+    db::RecordsetPtr Fetch(unsigned int which,
+			   const std::vector<unsigned int>& values) override;
 
     // Being a mediadb::Database
     unsigned int AllocateID() override { return 0; } // read-only, no new IDs
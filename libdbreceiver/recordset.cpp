@@ -243,6 +243,44 @@ bool RecordsetOne::IsEOF() const
 }
 
 
+        /* FetchRecordset */
+
+
+FetchRecordset::FetchRecordset(Connection *parent,
+			       const std::vector<unsigned int>& ids)
+    : Recordset(parent),
+      m_index(0)
+{
+    m_ids.reserve(ids.size());
+    for (unsigned int id: ids)
+	if (id)
+	    m_ids.push_back(id);
+    SelectThisItem();
+}
+
+void FetchRecordset::SelectThisItem()
+{
+    m_id = IsEOF() ? 0 : m_ids[m_index];
+    m_got_what = 0;
+    if (m_freers)
+	m_freers = NULL;
+}
+
+void FetchRecordset::MoveNext()
+{
+    if (!IsEOF())
+    {
+	++m_index;
+	SelectThisItem();
+    }
+}
+
+bool FetchRecordset::IsEOF() const
+{
+    return m_index >= m_ids.size();
+}
+
+
         /* RestrictionRecordset */
 
 
@@ -56,6 +56,25 @@ public:
     bool IsEOF() const;
 };
 
+/** The records with a list of IDs (see db::Database::Fetch). The protocol
+ * has no way of asking for several records' tags at once, so each is still
+ * fetched (lazily) on its own, but without a query per ID.
+ */
+class FetchRecordset: public Recordset
+{
+    std::vector<unsigned int> m_ids;
+    size_t m_index;
+
+    void SelectThisItem();
+
+public:
+    FetchRecordset(Connection *db, const std::vector<unsigned int>& ids);
+
+    // Remaining Recordset methods
+    void MoveNext();
+    bool IsEOF() const;
+};
+
 class RestrictionRecordset: public Recordset
 {
     /** Binary playlist from server
@@ -0,0 +1,305 @@
+/* libdbsteam/chunked_map.h
+ */
+#ifndef DBSTEAM_CHUNKED_MAP_H
+#define DBSTEAM_CHUNKED_MAP_H 1
+
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <iterator>
+#include <stddef.h>
+
+namespace db {
+
+namespace steam {
+
+/** An ordered std::map or std::set, split into chunks of neighbouring
+ * keys, each of which is shared between all the copies of the container
+ * that haven't changed it.
+ *
+ * This is what lets a new Database::Version copy an index cheaply: the
+ * copy is only of the pointers to the chunks, and the first change to
+ * each chunk copies just that chunk, not the whole index. As with
+ * Database::Shared, only the epoch that created a chunk may modify it.
+ *
+ * Reading is as for the std container (const_iterator, find, lower_bound
+ * and so on); writing is by the ChunkedMap and ChunkedSet methods.
+ */
+template <class Tree>
+class Chunked
+{
+public:
+    typedef typename Tree::key_type key_type;
+    typedef typename Tree::value_type value_type;
+
+private:
+    /** Chunks are split when they reach twice this, and merged with a
+     * neighbour when they fall below a quarter of it.
+     */
+    enum { CHUNK_SIZE = 128 };
+
+    struct Chunk
+    {
+	unsigned int epoch;
+	Tree entries;
+
+	explicit Chunk(unsigned int e) noexcept : epoch(e) {}
+	Chunk(unsigned int e, const Tree& t) : epoch(e), entries(t) {}
+    };
+    typedef std::shared_ptr<Chunk> ChunkPtr;
+
+    std::vector<ChunkPtr> m_chunks; ///< In key order, none empty
+    size_t m_size;
+
+    static const key_type& KeyOf(const key_type& k) { return k; }
+    template <class Pair>
+    static const key_type& KeyOf(const Pair& p) { return p.first; }
+
+    /** The chunk which holds k, or would if it were there */
+    size_t ChunkFor(const key_type& k) const
+    {
+	size_t lo = 0, hi = m_chunks.size();
+	while (hi - lo > 1)
+	{
+	    size_t mid = (lo + hi) / 2;
+	    if (k < KeyOf(*m_chunks[mid]->entries.begin()))
+		hi = mid;
+	    else
+		lo = mid;
+	}
+	return lo;
+    }
+
+    Tree& WritableChunk(size_t n)
+    {
+	ChunkPtr& c = m_chunks[n];
+	if (c->epoch != m_epoch)
+	    c = std::make_shared<Chunk>(m_epoch, c->entries);
+	return c->entries;
+    }
+
+    /** Moves the upper half of chunk n into a new chunk after it. The
+     * nodes themselves move, so references to them stay good.
+     */
+    void Split(size_t n)
+    {
+	Tree& t = WritableChunk(n);
+	ChunkPtr upper = std::make_shared<Chunk>(m_epoch);
+	typename Tree::iterator i = t.begin();
+	std::advance(i, t.size() / 2);
+	while (i != t.end())
+	{
+	    typename Tree::iterator next = std::next(i);
+	    upper->entries.insert(upper->entries.end(), t.extract(i));
+	    i = next;
+	}
+	m_chunks.insert(m_chunks.begin() + (ptrdiff_t)n + 1, upper);
+    }
+
+    /** Merges chunk n into a neighbour, if it's got small */
+    void MaybeMerge(size_t n)
+    {
+	if (m_chunks[n]->entries.empty())
+	{
+	    m_chunks.erase(m_chunks.begin() + (ptrdiff_t)n);
+	    return;
+	}
+	if (m_chunks.size() < 2
+	    || m_chunks[n]->entries.size() >= CHUNK_SIZE/4)
+	    return;
+
+	size_t first = (n + 1 < m_chunks.size()) ? n : n - 1;
+	const Tree& second = m_chunks[first + 1]->entries;
+	if (m_chunks[first]->entries.size() + second.size() >= CHUNK_SIZE*2)
+	    return;
+	WritableChunk(first).insert(second.begin(), second.end());
+	m_chunks.erase(m_chunks.begin() + (ptrdiff_t)first + 1);
+    }
+
+protected:
+    unsigned int m_epoch;
+
+    Chunked() : m_size(0), m_epoch(0) {}
+
+    /** The chunk to add k to, copied if need be, and its index *pn */
+    Tree& WritableChunkFor(const key_type& k, size_t *pn)
+    {
+	if (m_chunks.empty())
+	    m_chunks.push_back(std::make_shared<Chunk>(m_epoch));
+	*pn = ChunkFor(k);
+	return WritableChunk(*pn);
+    }
+
+    /** Called after adding an entry to chunk n */
+    void Added(size_t n)
+    {
+	++m_size;
+	if (m_chunks[n]->entries.size() >= CHUNK_SIZE*2)
+	    Split(n);
+    }
+
+public:
+    class const_iterator
+    {
+	friend class Chunked;
+
+	const std::vector<ChunkPtr> *m_chunks;
+	size_t m_chunk; ///< m_chunks->size() at the end
+	typename Tree::const_iterator m_i;
+
+	const_iterator(const std::vector<ChunkPtr> *chunks, size_t chunk,
+		       typename Tree::const_iterator i)
+	    : m_chunks(chunks), m_chunk(chunk), m_i(i)
+	{
+	    // Off the end of one chunk is the start of the next
+	    if (m_chunk < m_chunks->size()
+		&& m_i == (*m_chunks)[m_chunk]->entries.end()
+		&& ++m_chunk < m_chunks->size())
+		m_i = (*m_chunks)[m_chunk]->entries.begin();
+	}
+
+    public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef typename Tree::value_type value_type;
+	typedef ptrdiff_t difference_type;
+	typedef const value_type *pointer;
+	typedef const value_type& reference;
+
+	const_iterator() : m_chunks(NULL), m_chunk(0) {}
+
+	reference operator*() const { return *m_i; }
+	pointer operator->() const { return &*m_i; }
+
+	const_iterator& operator++()
+	{
+	    *this = const_iterator(m_chunks, m_chunk, std::next(m_i));
+	    return *this;
+	}
+
+	bool operator==(const const_iterator& other) const
+	{
+	    return m_chunk == other.m_chunk
+		&& (m_chunk == m_chunks->size() || m_i == other.m_i);
+	}
+	bool operator!=(const const_iterator& other) const
+	{
+	    return !(*this == other);
+	}
+    };
+
+    /** Changes from now on belong to this epoch: the first change to each
+     * chunk made in an earlier one copies it.
+     */
+    void SetEpoch(unsigned int epoch) { m_epoch = epoch; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const_iterator begin() const
+    {
+	if (m_chunks.empty())
+	    return end();
+	return const_iterator(&m_chunks, 0, m_chunks[0]->entries.begin());
+    }
+
+    const_iterator end() const
+    {
+	return const_iterator(&m_chunks, m_chunks.size(),
+			      typename Tree::const_iterator());
+    }
+
+    const_iterator find(const key_type& k) const
+    {
+	if (m_chunks.empty())
+	    return end();
+	size_t n = ChunkFor(k);
+	const Tree& t = m_chunks[n]->entries;
+	typename Tree::const_iterator i = t.find(k);
+	return i == t.end() ? end() : const_iterator(&m_chunks, n, i);
+    }
+
+    size_t count(const key_type& k) const { return find(k) != end(); }
+
+    const_iterator lower_bound(const key_type& k) const
+    {
+	if (m_chunks.empty())
+	    return end();
+	size_t n = ChunkFor(k);
+	return const_iterator(&m_chunks, n,
+			      m_chunks[n]->entries.lower_bound(k));
+    }
+
+    const_iterator upper_bound(const key_type& k) const
+    {
+	if (m_chunks.empty())
+	    return end();
+	size_t n = ChunkFor(k);
+	return const_iterator(&m_chunks, n,
+			      m_chunks[n]->entries.upper_bound(k));
+    }
+
+    void erase(const key_type& k)
+    {
+	if (m_chunks.empty())
+	    return;
+	size_t n = ChunkFor(k);
+	if (!m_chunks[n]->entries.count(k))
+	    return;
+	WritableChunk(n).erase(k);
+	--m_size;
+	MaybeMerge(n);
+    }
+};
+
+template <class K>
+class ChunkedSet: public Chunked<std::set<K> >
+{
+public:
+    void insert(const K& k)
+    {
+	size_t n;
+	if (this->WritableChunkFor(k, &n).insert(k).second)
+	    this->Added(n);
+    }
+};
+
+/** Values in a ChunkedMap which are themselves chunked need telling which
+ * epoch is writing to them; other values don't.
+ */
+template <class T>
+inline void SetEpochOf(T&, unsigned int) {}
+
+template <class K>
+inline void SetEpochOf(ChunkedSet<K>& s, unsigned int epoch)
+{
+    s.SetEpoch(epoch);
+}
+
+template <class K, class V>
+class ChunkedMap: public Chunked<std::map<K, V> >
+{
+public:
+    typedef V mapped_type;
+
+    /** The value for k, default-constructed if it wasn't there. It stays
+     * put (as in std::map) until it's erased.
+     */
+    V& operator[](const K& k)
+    {
+	size_t n;
+	std::pair<typename std::map<K, V>::iterator, bool> rc
+	    = this->WritableChunkFor(k, &n).try_emplace(k);
+	if (rc.second)
+	    this->Added(n);
+	V& v = rc.first->second;
+	SetEpochOf(v, this->m_epoch);
+	return v;
+    }
+};
+
+} // namespace steam
+
+} // namespace db
+
+#endif
@@ -2,18 +2,118 @@
 #include "db.h"
 #include "query.h"
 #include "rs.h"
+#include "libdb/recordset.h"
 #include "libutil/trace.h"
+#include "libutil/utf8.h"
+#include "libutil/compare.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
 
 namespace db {
 namespace steam {
 
+static long long NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t Database::IntValue(const FieldValue& v)
+{
+    if (v.ivalid)
+	return v.i;
+    if (v.svalid)
+	return (uint32_t)strtoul(v.s.c_str(), NULL, 10);
+    return 0;
+}
+
+std::string Database::StringValue(const FieldValue& v)
+{
+    if (v.svalid)
+	return v.s;
+    std::string scratch;
+    return std::string(StringView(v, &scratch));
+}
+
+std::string_view Database::StringView(const FieldValue& v,
+				      std::string *scratch)
+{
+    if (v.svalid)
+	return v.s;
+    if (v.ivalid && v.i)
+    {
+	// Short enough to stay inside std::string, so no allocation
+	char buf[10];
+	char *ptr = buf + sizeof(buf);
+	unsigned int n = v.i;
+	do {
+	    *--ptr = (char)('0' + n % 10);
+	    n /= 10;
+	} while (n);
+	scratch->assign(ptr, buf + sizeof(buf));
+	return *scratch;
+    }
+    if (v.avalid)
+    {
+	std::vector<unsigned int> vec;
+	ArrayValue(v, &vec);
+	*scratch = db::EncodeArray(vec);
+	return *scratch;
+    }
+    return std::string_view();
+}
+
+void Database::ArrayValue(const FieldValue& v, std::vector<unsigned int> *vec,
+			  size_t start, size_t count)
+{
+    vec->clear();
+    size_t n = v.ArraySize();
+    if (start >= n)
+	return;
+    count = std::min(count, n - start);
+    vec->resize(count);
+    for (size_t i=0; i<count; ++i)
+	(*vec)[i] = v.Element(start + i);
+}
+
+unsigned int Database::Version::NextRecord(unsigned int recno) const
+{
+    unsigned int i = recno;
+    while (i < nrecords)
+    {
+	const RecordChunk& chunk = records[i / RECORD_CHUNK]->value;
+	for (size_t j = i % RECORD_CHUNK; j < chunk.size(); ++j, ++i)
+	    if (chunk[j])
+		return i;
+    }
+    return NO_RECORD;
+}
+
 Database::Database(unsigned int nfields, const InitialFieldInfo *ifi)
     : m_nfields(nfields),
-      m_next_recno(0)
+      m_current(new Version),
+      m_frozen(true),
+      m_unpublished(false),
+      m_last_publish(NowMs()),
+      m_publish_interval_ms(1000)
 {
     m_fields.resize(nfields);
-    m_stringindexes.resize(nfields);
-    m_intindexes.resize(nfields);
+    m_ranks.resize(nfields);
+
+    m_current->epoch = 0;
+    m_current->count = 0;
+    m_current->nrecords = 0;
+    for (unsigned int i=0; i<nfields; ++i)
+    {
+	m_current->stringindexes.push_back(
+	    StringIndexPtr(new Shared<stringindex_t>(0, stringindex_t())));
+	m_current->intindexes.push_back(
+	    IntIndexPtr(new Shared<intindex_t>(0, intindex_t())));
+	m_current->textindexes.push_back(
+	    TextIndexPtr(new Shared<TextIndex>(0, TextIndex())));
+    }
+    m_published = m_current;
 
     if (ifi)
     {
@@ -30,14 +130,409 @@ Database::~Database()
 {
 }
 
+Database::Version *Database::Writable()
+{
+    if (m_frozen)
+    {
+	std::shared_ptr<Version> v(new Version(*m_current));
+	++v->epoch;
+	m_current = v;
+	m_frozen = false;
+	m_unpublished = true;
+    }
+    return m_current.get();
+}
+
+Database::record_t *Database::WritableRecord(unsigned int recno)
+{
+    Version *v = Writable();
+    if (!v->Find(recno))
+	return NULL;
+    RecordPtr& r = WritableRecordChunk(recno)[recno % RECORD_CHUNK];
+    if (r->epoch != v->epoch)
+	r.reset(new Shared<record_t>(v->epoch, r->value));
+    return &r->value;
+}
+
+Database::RecordChunk& Database::WritableRecordChunk(unsigned int recno)
+{
+    Version *v = Writable();
+    size_t n = recno / RECORD_CHUNK;
+    if (n == v->records.size())
+	v->records.push_back(RecordChunkPtr(
+				 new Shared<RecordChunk>(v->epoch,
+							 RecordChunk())));
+    RecordChunkPtr& c = v->records[n];
+    if (c->epoch != v->epoch)
+	c.reset(new Shared<RecordChunk>(v->epoch, c->value));
+    return c->value;
+}
+
+Database::stringindex_t& Database::WritableStringIndex(unsigned int which)
+{
+    Version *v = Writable();
+    StringIndexPtr& si = v->stringindexes[which];
+    if (si->epoch != v->epoch)
+    {
+	si.reset(new Shared<stringindex_t>(v->epoch, si->value));
+	si->value.SetEpoch(v->epoch);
+    }
+    return si->value;
+}
+
+Database::intindex_t& Database::WritableIntIndex(unsigned int which)
+{
+    Version *v = Writable();
+    IntIndexPtr& ii = v->intindexes[which];
+    if (ii->epoch != v->epoch)
+    {
+	ii.reset(new Shared<intindex_t>(v->epoch, ii->value));
+	ii->value.SetEpoch(v->epoch);
+    }
+    return ii->value;
+}
+
+Database::TextIndex& Database::WritableTextIndex(unsigned int which)
+{
+    Version *v = Writable();
+    TextIndexPtr& ti = v->textindexes[which];
+    if (ti->epoch != v->epoch)
+    {
+	ti.reset(new Shared<TextIndex>(v->epoch, ti->value));
+	ti->value.SetEpoch(v->epoch);
+    }
+    return ti->value;
+}
+
+void Database::PublishLocked()
+{
+    if (!m_frozen)
+    {
+	std::atomic_store(&m_published, VersionPtr(m_current));
+	m_frozen = true;
+    }
+    m_unpublished = false;
+    m_last_publish = NowMs();
+}
+
+void Database::MaybePublish()
+{
+    if (m_unpublished
+	&& NowMs() - m_last_publish >= (long long)m_publish_interval_ms)
+	PublishLocked();
+}
+
+void Database::Publish()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    PublishLocked();
+}
+
+Database::VersionPtr Database::Snapshot()
+{
+    if (m_unpublished
+	&& NowMs() - m_last_publish >= (long long)m_publish_interval_ms)
+    {
+	// Never wait for a writer, just try again next time
+	std::unique_lock<std::recursive_mutex> lock(m_mutex, std::try_to_lock);
+	if (lock.owns_lock())
+	    MaybePublish();
+    }
+    return std::atomic_load(&m_published);
+}
+
+typedef std::pair<std::string, const ChunkedSet<unsigned int>*> rankkey_t;
+
+static bool RankKeyLess(const rankkey_t& a, const rankkey_t& b)
+{
+    return a.first < b.first;
+}
+
+Database::RanksPtr Database::Ranks(const Version& v, unsigned int which,
+				   bool snapshot)
+{
+    const StringIndexPtr& indexptr = v.stringindexes[which];
+    {
+	std::lock_guard<std::mutex> lock(m_ranks_mutex);
+	if (m_ranks[which].index == indexptr)
+	    return m_ranks[which].ranks;
+    }
+
+    // Sort the distinct values, not the records
+    const stringindex_t& index = indexptr->value;
+    std::vector<rankkey_t> keys;
+    keys.reserve(index.size());
+    for (stringindex_t::const_iterator i = index.begin();
+	 i != index.end();
+	 ++i)
+	keys.push_back(std::make_pair(util::SortKey(i->first.c_str()),
+				      &i->second));
+    std::sort(keys.begin(), keys.end(), RankKeyLess);
+
+    // The empty string, if present, sorts first and gets rank 0 too
+    uint32_t first = (!index.empty() && index.begin()->first.empty()) ? 0 : 1;
+
+    std::shared_ptr<ranks_t> ranks(new ranks_t(v.nrecords, 0));
+    for (size_t i=0; i<keys.size(); ++i)
+	for (recnos_t::const_iterator j = keys[i].second->begin();
+	     j != keys[i].second->end();
+	     ++j)
+	    (*ranks)[*j] = (uint32_t)i + first;
+
+    // A writer may yet change the live version's own copy of the index
+    if (snapshot || m_frozen || indexptr->epoch != v.epoch)
+    {
+	std::lock_guard<std::mutex> lock(m_ranks_mutex);
+	m_ranks[which].index = indexptr;
+	m_ranks[which].ranks = ranks;
+    }
+    return ranks;
+}
+
 db::RecordsetPtr Database::CreateRecordset()
 {
-    return db::RecordsetPtr(new SimpleRecordset(this, QueryPtr()));
+    return db::RecordsetPtr(new SimpleRecordset(this, VersionPtr(),
+						QueryPtr()));
 }
 
 db::QueryPtr Database::CreateQuery()
 {
-    return db::QueryPtr(new Query(this));
+    return db::QueryPtr(new Query(this, false));
+}
+
+db::RecordsetPtr Database::Fetch(unsigned int which,
+				 const std::vector<unsigned int>& values)
+{
+    db::RecordsetPtr rs = FetchFrom(VersionPtr(), which, values);
+    if (!rs)
+	rs = db::Database::Fetch(which, values);
+    return rs;
+}
+
+db::RecordsetPtr Database::FetchFrom(const VersionPtr& snapshot,
+				     unsigned int which,
+				     const std::vector<unsigned int>& values)
+{
+    if (which >= m_fields.size()
+	|| (m_fields[which].flags & (FIELD_TYPEMASK|FIELD_INDEXED))
+	!= (FIELD_INT|FIELD_INDEXED))
+	return db::RecordsetPtr();
+
+    std::vector<unsigned int> recnos;
+    recnos.reserve(values.size());
+    {
+	VersionLock v(this, snapshot);
+	const intindex_t& index = v->IntIndex(which);
+	for (size_t i=0; i<values.size(); ++i)
+	{
+	    intindex_t::const_iterator j = index.find(values[i]);
+	    if (j != index.end() && !j->second.empty())
+		recnos.push_back(*j->second.begin());
+	}
+    }
+
+    size_t count = recnos.size();
+    return db::RecordsetPtr(new ListRecordset(this, snapshot,
+					      std::move(recnos), count));
+}
+
+
+        /* TextIndex */
+
+
+static uint32_t Trigram(const std::string& s, size_t i)
+{
+    return ((uint32_t)(unsigned char)s[i] << 16)
+	| ((uint32_t)(unsigned char)s[i+1] << 8)
+	| (uint32_t)(unsigned char)s[i+2];
+}
+
+static void Trigrams(const std::string& s, std::vector<uint32_t> *grams)
+{
+    grams->clear();
+    for (size_t i=0; i+3 <= s.size(); ++i)
+	grams->push_back(Trigram(s, i));
+    std::sort(grams->begin(), grams->end());
+    grams->erase(std::unique(grams->begin(), grams->end()), grams->end());
+}
+
+void Database::TextIndex::SetEpoch(unsigned int epoch)
+{
+    keys.SetEpoch(epoch);
+    terms.SetEpoch(epoch);
+    grams.SetEpoch(epoch);
+}
+
+void Database::TextIndex::Add(const std::string& value, unsigned int recno)
+{
+    std::string folded = util::FoldCase(value);
+
+    ChunkedMap<std::string, unsigned int>::const_iterator i
+	= keys.find(folded);
+    if (i != keys.end())
+    {
+	terms[i->second].recnos.insert(recno);
+	return;
+    }
+
+    // Numbered in order of creation, so new terms go on the end of lists
+    unsigned int termno = next_term++;
+    Term& term = terms[termno];
+    term.folded = folded;
+    term.recnos.insert(recno);
+    keys[folded] = termno;
+
+    std::vector<uint32_t> tg;
+    Trigrams(folded, &tg);
+    for (size_t j=0; j<tg.size(); ++j)
+    {
+	std::vector<unsigned int>& list = grams[tg[j]];
+	if (list.empty() || list.back() < termno)
+	    list.push_back(termno);
+	else
+	    list.insert(std::lower_bound(list.begin(), list.end(), termno),
+			termno);
+    }
+}
+
+void Database::TextIndex::Remove(const std::string& value,
+				 unsigned int recno)
+{
+    std::string folded = util::FoldCase(value);
+
+    ChunkedMap<std::string, unsigned int>::const_iterator i
+	= keys.find(folded);
+    if (i == keys.end())
+	return;
+    unsigned int termno = i->second;
+    recnos_t& recnos = terms[termno].recnos;
+    recnos.erase(recno);
+    if (!recnos.empty())
+	return;
+
+    std::vector<uint32_t> tg;
+    Trigrams(folded, &tg);
+    for (size_t j=0; j<tg.size(); ++j)
+    {
+	std::vector<unsigned int>& list = grams[tg[j]];
+	list.erase(std::lower_bound(list.begin(), list.end(), termno));
+	if (list.empty())
+	    grams.erase(tg[j]);
+    }
+
+    keys.erase(folded);
+    terms.erase(termno);
+}
+
+bool Database::TextIndex::Matches(MatchType type, const std::string& value,
+				  const std::string& folded)
+{
+    switch (type)
+    {
+    case EXACT:
+	return value == folded;
+    case PREFIX:
+	return value.compare(0, folded.size(), folded) == 0;
+    case SUFFIX:
+	return value.size() >= folded.size()
+	    && value.compare(value.size() - folded.size(), folded.size(),
+			     folded) == 0;
+    case CONTAINS:
+	return value.find(folded) != std::string::npos;
+    }
+    return false;
+}
+
+static bool ShorterList(const std::vector<unsigned int> *a,
+			const std::vector<unsigned int> *b)
+{
+    return a->size() < b->size();
+}
+
+void Database::TextIndex::Find(MatchType type, const std::string& folded,
+			       std::vector<unsigned int> *termnos) const
+{
+    if (type == EXACT)
+    {
+	ChunkedMap<std::string, unsigned int>::const_iterator i
+	    = keys.find(folded);
+	if (i != keys.end())
+	    termnos->push_back(i->second);
+	return;
+    }
+
+    if (type == PREFIX)
+    {
+	for (ChunkedMap<std::string, unsigned int>::const_iterator i
+		 = keys.lower_bound(folded);
+	     i != keys.end() && Matches(PREFIX, i->first, folded);
+	     ++i)
+	    termnos->push_back(i->second);
+	return;
+    }
+
+    if (folded.size() < 3)
+    {
+	// Too short to have a trigram: check every term
+	for (ChunkedMap<unsigned int, Term>::const_iterator i = terms.begin();
+	     i != terms.end();
+	     ++i)
+	    if (Matches(type, i->second.folded, folded))
+		termnos->push_back(i->first);
+	return;
+    }
+
+    // Every term containing the text has all the text's trigrams
+    std::vector<uint32_t> tg;
+    Trigrams(folded, &tg);
+    std::vector<const std::vector<unsigned int>*> lists;
+    for (size_t i=0; i<tg.size(); ++i)
+    {
+	ChunkedMap<uint32_t, std::vector<unsigned int> >::const_iterator j
+	    = grams.find(tg[i]);
+	if (j == grams.end())
+	    return;
+	lists.push_back(&j->second);
+    }
+    std::sort(lists.begin(), lists.end(), ShorterList);
+
+    std::vector<unsigned int> candidates(*lists[0]), result;
+    for (size_t i=1; i<lists.size() && !candidates.empty(); ++i)
+    {
+	result.clear();
+	std::set_intersection(candidates.begin(), candidates.end(),
+			      lists[i]->begin(), lists[i]->end(),
+			      std::back_inserter(result));
+	candidates.swap(result);
+    }
+
+    for (size_t i=0; i<candidates.size(); ++i)
+	if (Matches(type, GetTerm(candidates[i]).folded, folded))
+	    termnos->push_back(candidates[i]);
+}
+
+
+        /* SnapshotView */
+
+
+db::RecordsetPtr SnapshotView::CreateRecordset()
+{
+    return db::RecordsetPtr(new SimpleRecordset(m_db, m_db->Snapshot(),
+						QueryPtr()));
+}
+
+db::QueryPtr SnapshotView::CreateQuery()
+{
+    return db::QueryPtr(new Query(m_db, true));
+}
+
+db::RecordsetPtr SnapshotView::Fetch(unsigned int which,
+				     const std::vector<unsigned int>& values)
+{
+    db::RecordsetPtr rs = m_db->FetchFrom(m_db->Snapshot(), which, values);
+    if (!rs)
+	rs = db::Database::Fetch(which, values);
+    return rs;
 }
 
 } // namespace steam
@@ -4,11 +4,16 @@
 #define STEAMDB_STEAMDB_H
 
 #include "libdb/db.h"
+#include "chunked_map.h"
 #include <string>
 #include <mutex>
 #include <map>
 #include <vector>
 #include <set>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
 
 namespace db {
 
@@ -21,10 +26,13 @@ namespace db {
 namespace steam {
 
 enum {
-    FIELD_STRING   = 0x0, ///< The default type
-    FIELD_INT      = 0x1,
-    FIELD_TYPEMASK = 0x7,
-    FIELD_INDEXED  = 0x8
+    FIELD_STRING    = 0x0, ///< The default type
+    FIELD_INT       = 0x1,
+    FIELD_ARRAY     = 0x2, ///< Integers: see db::Recordset::GetArray
+    FIELD_TYPEMASK  = 0x7,
+    FIELD_INDEXED   = 0x8,  ///< Arrays: by element, e.g. child to parents
+    FIELD_TEXTINDEX = 0x10, ///< String fields: case-folded index, for LIKE
+    FIELD_COLLATE   = 0x20  ///< String fields: ORDER BY as util::Compare
 };
 
 class Database: public db::Database
@@ -33,16 +41,16 @@ class Database: public db::Database
     friend class Recordset;
     friend class SimpleRecordset;
     friend class CollateRecordset;
-    friend class IndexedRecordset;
-    friend class OrderedRecordset;
+    friend class ListRecordset;
+    friend class VersionLock;
+    friend class SnapshotView;
 
-    /** Could use a rwlock in theory, but the critical sections are very
-     * small.
+    /** Serialises writers, and readers of the live version. Snapshot
+     * readers (see SnapshotView) never take it.
      */
     std::recursive_mutex m_mutex;
 
     unsigned int m_nfields;
-    unsigned int m_next_recno;
 
     struct FieldInfo {
 	unsigned int flags;
@@ -50,28 +58,233 @@ class Database: public db::Database
 
     std::vector<FieldInfo> m_fields;
 
+    /** An array (FIELD_ARRAY) is held in s, as native-endian 32-bit
+     * words, with avalid set; svalid and ivalid are then both clear.
+     */
     struct FieldValue {
 	std::string s;
 	unsigned int i;
 	bool svalid : 1;
 	bool ivalid : 1;
+	bool avalid : 1;
+
+	FieldValue() noexcept : i(0), svalid(0), ivalid(0), avalid(0) {}
 
-	FieldValue() noexcept : i(0), svalid(0), ivalid(0) {}
+	size_t ArraySize() const { return avalid ? s.size() / 4 : 0; }
+	uint32_t Element(size_t n) const
+	{
+	    uint32_t u;
+	    memcpy(&u, s.data() + n*4, 4);
+	    return u;
+	}
     };
 
     typedef std::vector<FieldValue> record_t;
 
-    typedef std::map<unsigned int, record_t> records_t;
+    static uint32_t IntValue(const FieldValue&);
+    static std::string StringValue(const FieldValue&);
+
+    /** StringValue without the copy: points into v, or into *scratch if
+     * the string has to be made.
+     */
+    static std::string_view StringView(const FieldValue& v,
+				       std::string *scratch);
+    static void ArrayValue(const FieldValue&, std::vector<unsigned int>*,
+			   size_t start = 0, size_t count = (size_t)-1);
+
+    typedef ChunkedSet<unsigned int> recnos_t;
+
+    typedef ChunkedMap<std::string, recnos_t> stringindex_t;
+
+    typedef ChunkedMap<unsigned int, recnos_t> intindex_t;
+
+    /** Case-folded index of a string field, for answering LIKE queries
+     * which are just a prefix, suffix or substring (see FIELD_TEXTINDEX).
+     *
+     * Each distinct folded value is a "term". Prefixes are found from the
+     * sorted keys; substrings from the trigrams (three-byte sequences) of
+     * each term, then checked against the term itself -- so searching
+     * costs in proportion to the number of distinct values, not records.
+     */
+    struct TextIndex
+    {
+	enum MatchType { EXACT, PREFIX, SUFFIX, CONTAINS };
+
+	struct Term
+	{
+	    std::string folded;
+	    recnos_t recnos;
+
+	    friend void SetEpochOf(Term& t, unsigned int epoch)
+	    {
+		t.recnos.SetEpoch(epoch);
+	    }
+	};
+
+	ChunkedMap<std::string, unsigned int> keys; ///< Folded value to term
+	ChunkedMap<unsigned int, Term> terms;
+	unsigned int next_term;
+	ChunkedMap<uint32_t, std::vector<unsigned int> > grams; ///< Sorted
+
+	TextIndex() : next_term(0) {}
 
-    records_t m_data;
+	/** See ChunkedMap::SetEpoch */
+	void SetEpoch(unsigned int epoch);
 
-    typedef std::map<std::string, std::set<unsigned int> > stringindex_t;
+	const Term& GetTerm(unsigned int termno) const
+	{
+	    return terms.find(termno)->second;
+	}
+
+	void Add(const std::string& value, unsigned int recno);
+	void Remove(const std::string& value, unsigned int recno);
+
+	/** Appends the terms (in no particular order) matching "folded",
+	 * which must already be case-folded.
+	 */
+	void Find(MatchType, const std::string& folded,
+		  std::vector<unsigned int> *termnos) const;
+
+	/** Whether a folded value matches folded search text */
+	static bool Matches(MatchType, const std::string& value,
+			    const std::string& folded);
+    };
+
+    /** A record or index, shared between all the versions that haven't
+     * changed it. Only the version named by "epoch" (the one that
+     * created it) may modify it; any other must make its own copy first.
+     * Indexes are ChunkedMaps, so that copy is itself mostly shared.
+     */
+    template <class T>
+    struct Shared
+    {
+	unsigned int epoch;
+	T value;
+
+	Shared(unsigned int e, const T& t) : epoch(e), value(t) {}
+    };
+
+    typedef std::shared_ptr<Shared<record_t> > RecordPtr;
+
+    /** Records are listed in chunks of RECORD_CHUNK record numbers, so
+     * that, like an index, the list is copied a chunk at a time.
+     */
+    typedef std::vector<RecordPtr> RecordChunk;
+    typedef std::shared_ptr<Shared<RecordChunk> > RecordChunkPtr;
+    typedef std::shared_ptr<Shared<stringindex_t> > StringIndexPtr;
+    typedef std::shared_ptr<Shared<intindex_t> > IntIndexPtr;
+    typedef std::shared_ptr<Shared<TextIndex> > TextIndexPtr;
+
+    enum { NO_RECORD = 0xFFFFFFFFu, RECORD_CHUNK = 256 };
+
+    /** The whole contents of the database at one moment.
+     *
+     * Copying a Version only copies pointers; records and indexes are
+     * then copied lazily, by the writer, the first time each is changed.
+     * Once published, a Version is never changed again.
+     */
+    struct Version
+    {
+	unsigned int epoch;
+	unsigned int count; ///< Number of live records
+	unsigned int nrecords; ///< Including deleted ones: the next recno
+	std::vector<RecordChunkPtr> records; ///< By recno/RECORD_CHUNK
+	std::vector<StringIndexPtr> stringindexes;
+	std::vector<IntIndexPtr> intindexes;
+	std::vector<TextIndexPtr> textindexes;
+
+	/** The record, with its epoch; NULL if deleted or never added */
+	const Shared<record_t> *FindShared(unsigned int recno) const
+	{
+	    if (recno >= nrecords)
+		return NULL;
+	    return records[recno / RECORD_CHUNK]
+		->value[recno % RECORD_CHUNK].get();
+	}
+
+	const record_t *Find(unsigned int recno) const
+	{
+	    const Shared<record_t> *r = FindShared(recno);
+	    return r ? &r->value : NULL;
+	}
+
+	/** Returns the lowest live record number >= recno, or NO_RECORD */
+	unsigned int NextRecord(unsigned int recno) const;
+
+	const stringindex_t& StringIndex(unsigned int which) const
+	{
+	    return stringindexes[which]->value;
+	}
+	const intindex_t& IntIndex(unsigned int which) const
+	{
+	    return intindexes[which]->value;
+	}
+	const TextIndex& Text(unsigned int which) const
+	{
+	    return textindexes[which]->value;
+	}
+    };
 
-    std::vector<stringindex_t> m_stringindexes;
+    typedef std::shared_ptr<const Version> VersionPtr;
 
-    typedef std::map<unsigned int, std::set<unsigned int> > intindex_t;
+    std::shared_ptr<Version> m_current; ///< What writers see
+    VersionPtr m_published; ///< What snapshot readers see (use atomic_load)
+    bool m_frozen; ///< m_current has been published, so must be copied
 
-    std::vector<intindex_t> m_intindexes;
+    std::atomic<bool> m_unpublished;
+    std::atomic<long long> m_last_publish; ///< In steady_clock ms
+    unsigned int m_publish_interval_ms;
+
+    typedef std::vector<uint32_t> ranks_t;
+    typedef std::shared_ptr<const ranks_t> RanksPtr;
+
+    /** The last Ranks() made for each field, and the index it was made
+     * from: still good for as long as a version has that same index.
+     */
+    struct RanksCache
+    {
+	StringIndexPtr index;
+	RanksPtr ranks;
+    };
+    std::mutex m_ranks_mutex;
+    std::vector<RanksCache> m_ranks;
+
+    // All these must be called with m_mutex held
+
+    Version *Writable();
+    record_t *WritableRecord(unsigned int recno);
+
+    /** The chunk holding recno, copied if need be; recno may be the next
+     * one to add, in which case the chunk may be new.
+     */
+    RecordChunk& WritableRecordChunk(unsigned int recno);
+    stringindex_t& WritableStringIndex(unsigned int which);
+    intindex_t& WritableIntIndex(unsigned int which);
+    TextIndex& WritableTextIndex(unsigned int which);
+    bool HasTextIndex(unsigned int which) const
+    {
+	return (m_fields[which].flags & (FIELD_TYPEMASK|FIELD_TEXTINDEX))
+	    == (FIELD_STRING|FIELD_TEXTINDEX);
+    }
+    void MaybePublish();
+    void PublishLocked();
+
+    /** Called without the lock: the most recently published version.
+     */
+    VersionPtr Snapshot();
+
+    /** The collation order (see FIELD_COLLATE) of an indexed string
+     * field's values, as a rank for each record number; empty and unset
+     * values are 0. Call with v locked or pinned; "snapshot" says whether
+     * v is a published version, which can be cached from.
+     */
+    RanksPtr Ranks(const Version& v, unsigned int which, bool snapshot);
+
+    /** Fetch() from a snapshot, or (if NULL) the live version; NULL if
+     * the field isn't an indexed integer.
+     */
+    db::RecordsetPtr FetchFrom(const VersionPtr& snapshot, unsigned int which,
+			       const std::vector<unsigned int>& values);
 
 public:
 
@@ -89,9 +302,52 @@ public:
 	m_fields[which].flags = flags;
     }
 
+    /** Changes are made visible to snapshot readers on Commit(), but no
+     * more often than this (default one second) -- each publication means
+     * the next change copies the lists of record and index chunks, and
+     * each record or chunk it touches, which would make a full rescan
+     * quadratic.
+     * Snapshot readers themselves pick up any changes left over, once the
+     * interval has passed.
+     */
+    void SetPublishInterval(unsigned int ms) { m_publish_interval_ms = ms; }
+
+    /** Makes all changes so far visible to snapshot readers, now.
+     */
+    void Publish();
+
+    // Being a db::Database
+    db::RecordsetPtr CreateRecordset() override;
+    db::QueryPtr CreateQuery() override;
+
+    /** On an indexed integer field, one index lookup per value, all
+     * under one lock.
+     */
+    db::RecordsetPtr Fetch(unsigned int which,
+			   const std::vector<unsigned int>& values) override;
+};
+
+/** A view of a steam::Database whose readers never take its lock.
+ *
+ * Each recordset created through the view pins the most recently
+ * published version of the database, and reads that immutable snapshot
+ * however the live database changes underneath it. Good for servers
+ * answering many concurrent read-only requests. A recordset which is
+ * written to switches over to the live database (so it sees its own
+ * changes), and publishes them on Commit().
+ */
+class SnapshotView: public db::Database
+{
+    steam::Database *m_db;
+
+public:
+    explicit SnapshotView(steam::Database *db) : m_db(db) {}
+
     // Being a db::Database
     db::RecordsetPtr CreateRecordset() override;
     db::QueryPtr CreateQuery() override;
+    db::RecordsetPtr Fetch(unsigned int which,
+			   const std::vector<unsigned int>& values) override;
 };
 
 void Test();
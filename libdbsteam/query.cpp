@@ -3,90 +3,807 @@
 #include "db.h"
 #include "rs.h"
 #include "libutil/trace.h"
+#include "libutil/utf8.h"
+#include "libutil/compare.h"
+#include <algorithm>
+#include <sstream>
+#include <ctype.h>
+#include <string.h>
 
 namespace db {
 namespace steam {
 
-Query::Query(Database *db)
-    : m_db(db)
+/** A range or union bigger than this fraction of the database is no
+ * quicker to fetch than just scanning the lot.
+ */
+enum { SCAN_FRACTION = 2 };
+
+/** When intersecting, a list more than this many times longer than the
+ * shortest one is left to the filter instead of being fetched.
+ */
+enum { INTERSECT_RATIO = 8 };
+
+Query::Query(Database *db, bool use_snapshot)
+    : m_db(db),
+      m_use_snapshot(use_snapshot)
 {
 }
 
-db::RecordsetPtr Query::Execute()
+/** Whether a LIKE pattern is just text, with or without ".*" at either
+ * end; if so, returns the (unescaped) text, and where it must match.
+ */
+bool Query::ParseLike(const std::string& pattern,
+		      Database::TextIndex::MatchType *type, std::string *text)
 {
-    if (!m_restrictions.empty())
-	assert(m_root != 0);
+    bool leading = (pattern.compare(0, 2, ".*") == 0);
+    bool trailing = false;
+    size_t end = pattern.size();
+
+    text->clear();
+    for (size_t i = leading ? 2 : 0; i < end; ++i)
+    {
+	char c = pattern[i];
+	if (c == '\\')
+	{
+	    // Escaped punctuation is literal, but \d, \w etc. aren't
+	    if (i+1 == end || isalnum((unsigned char)pattern[i+1]))
+		return false;
+	    *text += pattern[++i];
+	}
+	else if (c == '.' && i+2 == end && pattern[i+1] == '*')
+	{
+	    trailing = true;
+	    break;
+	}
+	else if (strchr(".[]{}()*+?|^$", c))
+	    return false;
+	else
+	    *text += c;
+    }
+
+    if (text->empty())
+	return false;
+
+    if (leading)
+	*type = trailing ? Database::TextIndex::CONTAINS
+	                 : Database::TextIndex::SUFFIX;
+    else
+	*type = trailing ? Database::TextIndex::PREFIX
+	                 : Database::TextIndex::EXACT;
+    return true;
+}
 
-    m_regexes.clear();
+void Query::CompileLikes()
+{
+    m_likes.clear();
     for (unsigned int i=0; i<m_restrictions.size(); ++i)
     {
 	if (m_restrictions[i].rt == db::LIKE)
 	{
-	    TRACE << i << " compiling '" << m_restrictions[i].sval << "'\n";
-	    m_regexes[i] = boost::regex(m_restrictions[i].sval, 
-					boost::regex::icase);
+	    Like& like = m_likes[i];
+	    std::string text;
+	    if (ParseLike(m_restrictions[i].sval, &like.type, &text))
+	    {
+		like.is_text = true;
+		like.folded = util::FoldCase(text);
+	    }
+	    else
+	    {
+		TRACE << i << " compiling '" << m_restrictions[i].sval
+		      << "'\n";
+		like.regex = boost::regex(m_restrictions[i].sval,
+					  boost::regex::icase);
+	    }
 	}
     }
+}
 
-    if (!m_collateby.empty())
+/** The keys of an integer index which satisfy a restriction, if that's a
+ * range which excludes zero: an unset field reads as zero, but isn't in
+ * the index.
+ */
+static bool IndexRange(const db::Query::Restriction& r,
+		       uint32_t *lo, uint32_t *hi)
+{
+    switch (r.rt)
+    {
+    case db::EQ:
+	*lo = *hi = r.ival;
+	break;
+    case db::GT:
+	*lo = r.ival + 1; // 0 if it wrapped, meaning "can't"
+	*hi = UINT32_MAX;
+	break;
+    case db::GE:
+	*lo = r.ival;
+	*hi = UINT32_MAX;
+	break;
+    default:
+	return false;
+    }
+    return *lo != 0;
+}
+
+const Database::recnos_t *Query::Postings(const Database::Version& v,
+					      const Plan& plan) const
+{
+    const Restriction& r = m_restrictions[(size_t)(plan.elem-1)];
+    if (r.is_string)
     {
-	unsigned int field = *m_collateby.begin();
-	if ((m_db->m_fields[field].flags & FIELD_INDEXED) == 0)
+	const Database::stringindex_t& index = v.StringIndex(r.which);
+	Database::stringindex_t::const_iterator i = index.find(r.sval);
+	return (i == index.end()) ? NULL : &i->second;
+    }
+
+    const Database::intindex_t& index = v.IntIndex(r.which);
+    Database::intindex_t::const_iterator i = index.find(r.ival);
+    return (i == index.end()) ? NULL : &i->second;
+}
+
+void Query::CollectElements(ssize_t elem, bool anditive,
+			    std::vector<ssize_t> *elems) const
+{
+    if (elem < 0)
+    {
+	const Relation& r = m_relations[(size_t)(-elem-1)];
+	if (r.anditive == anditive)
 	{
-	    TRACE << "Can't collate on unindexed field " << field << "\n";
-	    return db::RecordsetPtr();
+	    CollectElements(r.a, anditive, elems);
+	    CollectElements(r.b, anditive, elems);
+	    return;
 	}
-	if (m_collateby.size() > 1)
+    }
+    elems->push_back(elem);
+}
+
+static bool CheaperThan(const Plan& a, const Plan& b)
+{
+    return a.cost < b.cost;
+}
+
+Plan Query::MakePlan(const Database::Version& v, ssize_t elem) const
+{
+    if (elem == 0)
+	return Plan(Plan::SCAN, 0, v.count, true);
+
+    if (elem > 0)
+    {
+	const Restriction& r = m_restrictions[(size_t)(elem-1)];
+	unsigned int flags = m_db->m_fields[r.which].flags;
+	// An array's int index is by element
+	bool int_field = (flags & FIELD_TYPEMASK) == FIELD_INT
+	    || (flags & FIELD_TYPEMASK) == FIELD_ARRAY;
+
+	if (r.rt == db::LIKE && m_db->HasTextIndex(r.which))
 	{
-	    TRACE << "Can't do multiple collate-by yet\n";
-	    return db::RecordsetPtr();
+	    const Like& like = m_likes.find((unsigned int)(elem-1))->second;
+	    if (like.is_text)
+	    {
+		// Exact, and never worth a scan: the terms are already
+		// found, whereas a scan would fold every value
+		Plan p(Plan::TEXT, elem, 0, true);
+		const Database::TextIndex& text = v.Text(r.which);
+		text.Find(like.type, like.folded, &p.terms);
+		if (p.terms.empty())
+		    return Plan(Plan::EMPTY, elem, 0, true);
+		for (size_t i=0; i<p.terms.size(); ++i)
+		    p.cost += text.GetTerm(p.terms[i]).recnos.size();
+		return p;
+	    }
+	}
+
+	if ((flags & FIELD_INDEXED) == 0)
+	    return Plan(Plan::SCAN, elem, v.count, false);
+
+	if (r.is_string && !int_field && r.rt == db::EQ && !r.sval.empty())
+	{
+	    const Database::recnos_t *postings
+		= Postings(v, Plan(Plan::LOOKUP, elem, 0, true));
+	    if (!postings)
+		return Plan(Plan::EMPTY, elem, 0, true);
+	    return Plan(Plan::LOOKUP, elem, postings->size(), true);
+	}
+
+	uint32_t lo, hi;
+	if (!r.is_string && int_field && IndexRange(r, &lo, &hi))
+	{
+	    if (lo == hi)
+	    {
+		const Database::recnos_t *postings
+		    = Postings(v, Plan(Plan::LOOKUP, elem, 0, true));
+		if (!postings)
+		    return Plan(Plan::EMPTY, elem, 0, true);
+		return Plan(Plan::LOOKUP, elem, postings->size(), true);
+	    }
+
+	    const Database::intindex_t& index = v.IntIndex(r.which);
+	    size_t cost = 0;
+	    for (Database::intindex_t::const_iterator i = index.lower_bound(lo);
+		 i != index.end() && i->first <= hi && cost <= v.count;
+		 ++i)
+		cost += i->second.size();
+	    if (!cost)
+		return Plan(Plan::EMPTY, elem, 0, true);
+	    if (cost > v.count / SCAN_FRACTION)
+		return Plan(Plan::SCAN, elem, v.count, false);
+	    return Plan(Plan::RANGE, elem, cost, true);
 	}
-	return db::RecordsetPtr(new CollateRecordset(m_db,
-						     *m_collateby.begin(),
-						     db::steam::QueryPtr(this)));
+
+	return Plan(Plan::SCAN, elem, v.count, false);
+    }
+
+    const Relation& rel = m_relations[(size_t)(-elem-1)];
+    std::vector<ssize_t> elems;
+    CollectElements(elem, rel.anditive, &elems);
+
+    if (rel.anditive)
+    {
+	// The most selective index drives; others narrow it down
+	Plan result(Plan::INTERSECT, elem, 0, true);
+	std::vector<Plan> indexed;
+	for (size_t i=0; i<elems.size(); ++i)
+	{
+	    Plan p = MakePlan(v, elems[i]);
+	    if (p.type == Plan::EMPTY)
+		return Plan(Plan::EMPTY, elem, 0, true);
+	    if (p.type == Plan::SCAN)
+		result.exact = false;
+	    else
+		indexed.push_back(p);
+	}
+	if (indexed.empty())
+	    return Plan(Plan::SCAN, elem, v.count, false);
+
+	std::stable_sort(indexed.begin(), indexed.end(), CheaperThan);
+	result.cost = indexed[0].cost;
+
+	for (size_t i=0; i<indexed.size(); ++i)
+	{
+	    // Checking a LOOKUP costs only one find() per candidate
+	    if (i == 0 || indexed[i].type == Plan::LOOKUP
+		|| indexed[i].cost <= result.cost * INTERSECT_RATIO)
+	    {
+		result.exact = result.exact && indexed[i].exact;
+		result.children.push_back(indexed[i]);
+	    }
+	    else
+		result.exact = false;
+	}
+
+	if (result.children.size() == 1)
+	{
+	    Plan p = result.children[0];
+	    p.exact = result.exact;
+	    return p;
+	}
+	return result;
+    }
+
+    Plan result(Plan::UNION, elem, 0, true);
+    for (size_t i=0; i<elems.size(); ++i)
+    {
+	Plan p = MakePlan(v, elems[i]);
+	if (p.type == Plan::SCAN)
+	    return Plan(Plan::SCAN, elem, v.count, false);
+	if (p.type == Plan::EMPTY)
+	    continue;
+	result.cost += p.cost;
+	result.exact = result.exact && p.exact;
+	result.children.push_back(p);
+    }
+
+    if (result.children.empty())
+	return Plan(Plan::EMPTY, elem, 0, true);
+    if (result.cost > v.count / SCAN_FRACTION)
+	return Plan(Plan::SCAN, elem, v.count, false);
+    if (result.children.size() == 1)
+	return result.children[0];
+    std::stable_sort(result.children.begin(), result.children.end(),
+		     CheaperThan);
+    return result;
+}
+
+Query::Strategy Query::Choose(const Plan& plan) const
+{
+    if (!m_collateby.empty())
+    {
+	unsigned int flags = m_db->m_fields[m_collateby.front()].flags;
+	if ((flags & FIELD_INDEXED)
+	    && (flags & FIELD_TYPEMASK) != FIELD_ARRAY
+	    && plan.type == Plan::SCAN)
+	    return INDEX_COLLATE;
+	return VALUE_COLLATE;
     }
 
     if (!m_orderby.empty())
+	return SORT;
+
+    if (plan.type == Plan::SCAN)
+	return LAZY_SCAN;
+
+    return LIST;
+}
+
+void Query::Fetch(const Database::Version& v, const Plan& plan,
+		  std::vector<unsigned int> *recnos) const
+{
+    recnos->clear();
+
+    switch (plan.type)
+    {
+    case Plan::EMPTY:
+	break;
+
+    case Plan::SCAN:
+	recnos->reserve(v.count);
+	for (unsigned int r = v.NextRecord(0);
+	     r != Database::NO_RECORD;
+	     r = v.NextRecord(r+1))
+	    recnos->push_back(r);
+	break;
+
+    case Plan::LOOKUP:
     {
-	return db::RecordsetPtr(new OrderedRecordset(m_db,
-						     *m_orderby.begin()));
+	const Database::recnos_t *postings = Postings(v, plan);
+	if (postings)
+	    recnos->assign(postings->begin(), postings->end());
+	break;
     }
 
-    if (m_restrictions.size() == 1
-	&& m_restrictions.begin()->rt == db::EQ)
+    case Plan::RANGE:
     {
-	unsigned int field = m_restrictions.begin()->which;
+	const Restriction& r = m_restrictions[(size_t)(plan.elem-1)];
+	uint32_t lo = 0, hi = 0;
+	IndexRange(r, &lo, &hi);
+	const Database::intindex_t& index = v.IntIndex(r.which);
+	recnos->reserve(plan.cost);
+	for (Database::intindex_t::const_iterator i = index.lower_bound(lo);
+	     i != index.end() && i->first <= hi;
+	     ++i)
+	    recnos->insert(recnos->end(), i->second.begin(), i->second.end());
+	std::sort(recnos->begin(), recnos->end());
+	// An array can have several elements in range
+	recnos->erase(std::unique(recnos->begin(), recnos->end()),
+		      recnos->end());
+	break;
+    }
+
+    case Plan::TEXT:
+    {
+	const Restriction& r = m_restrictions[(size_t)(plan.elem-1)];
+	const Database::TextIndex& text = v.Text(r.which);
+	recnos->reserve(plan.cost);
+	for (size_t i=0; i<plan.terms.size(); ++i)
+	{
+	    const Database::recnos_t& postings
+		= text.GetTerm(plan.terms[i]).recnos;
+	    recnos->insert(recnos->end(), postings.begin(), postings.end());
+	}
+	if (plan.terms.size() > 1)
+	    std::sort(recnos->begin(), recnos->end());
+	break;
+    }
 
-	if (m_db->m_fields[field].flags & FIELD_INDEXED)
+    case Plan::UNION:
+    {
+	std::vector<unsigned int> child;
+	recnos->reserve(plan.cost);
+	for (size_t i=0; i<plan.children.size(); ++i)
 	{
-	    if (m_restrictions.begin()->is_string)
-		return db::RecordsetPtr(new IndexedRecordset(m_db, field,
-							     m_restrictions.begin()->sval));
-	    return db::RecordsetPtr(new IndexedRecordset(m_db, field,
-							 m_restrictions.begin()->ival));
+	    Fetch(v, plan.children[i], &child);
+	    recnos->insert(recnos->end(), child.begin(), child.end());
 	}
-	// else fall through
+	std::sort(recnos->begin(), recnos->end());
+	recnos->erase(std::unique(recnos->begin(), recnos->end()),
+		      recnos->end());
+	break;
     }
 
-    return db::RecordsetPtr(new SimpleRecordset(m_db, QueryPtr(this)));
+    case Plan::INTERSECT:
+    {
+	Fetch(v, plan.children[0], recnos);
+
+	std::vector<unsigned int> child, result;
+	for (size_t i=1; i<plan.children.size() && !recnos->empty(); ++i)
+	{
+	    const Plan& c = plan.children[i];
+	    result.clear();
+	    if (c.type == Plan::LOOKUP)
+	    {
+		const Database::recnos_t *postings = Postings(v, c);
+		if (postings)
+		    for (size_t j=0; j<recnos->size(); ++j)
+			if (postings->count((*recnos)[j]))
+			    result.push_back((*recnos)[j]);
+	    }
+	    else
+	    {
+		Fetch(v, c, &child);
+		std::set_intersection(recnos->begin(), recnos->end(),
+				      child.begin(), child.end(),
+				      std::back_inserter(result));
+	    }
+	    recnos->swap(result);
+	}
+	break;
+    }
+    }
 }
 
-bool Query::Match(db::Recordset *rs)
+void Query::Candidates(const Database::Version& v, const Plan& plan,
+		       std::vector<unsigned int> *recnos) const
+{
+    Fetch(v, plan, recnos);
+    if (plan.exact)
+	return;
+
+    size_t j = 0;
+    for (size_t i=0; i<recnos->size(); ++i)
+	if (Match(*v.Find((*recnos)[i])))
+	    (*recnos)[j++] = (*recnos)[i];
+    recnos->resize(j);
+}
+
+/** Appends to a sort key, escaping NULs so that a shorter value sorts
+ * before any longer one it's a prefix of -- or, if descending, after.
+ */
+static void AppendKeyBytes(const std::string& bytes, bool descending,
+			   std::string *key)
+{
+    char flip = descending ? (char)0xFF : (char)0;
+    for (std::string::const_iterator i = bytes.begin(); i != bytes.end(); ++i)
+    {
+	*key += (char)(*i ^ flip);
+	if (!*i)
+	    *key += (char)(1 ^ flip);
+    }
+    *key += flip;
+    *key += flip;
+}
+
+static void AppendKeyInt(uint32_t n, bool descending, std::string *key)
+{
+    if (descending)
+	n = ~n;
+    *key += (char)(n >> 24);
+    *key += (char)(n >> 16);
+    *key += (char)(n >> 8);
+    *key += (char)n;
+}
+
+/** Makes the part of a record's sort key for the ORDER BY fields: bytes
+ * which, compared with memcmp, order the records as the fields would.
+ */
+void Query::AppendSortKey(const Database::record_t& record,
+			  unsigned int recno,
+			  const std::vector<Database::RanksPtr>& ranks,
+			  std::string *key) const
+{
+    size_t n = 0;
+    for (orderby_t::const_iterator i = m_orderby.begin();
+	 i != m_orderby.end();
+	 ++i, ++n)
+    {
+	const Database::FieldValue& fv = record[*i];
+	unsigned int flags = m_db->m_fields[*i].flags;
+	bool descending = IsDescending(*i);
+
+	if (ranks[n])
+	{
+	    const Database::ranks_t& r = *ranks[n];
+	    AppendKeyInt(recno < r.size() ? r[recno] : 0, descending, key);
+	}
+	else if ((flags & FIELD_TYPEMASK) == FIELD_INT)
+	    AppendKeyInt(Database::IntValue(fv), descending, key);
+	else
+	{
+	    std::string tmp;
+	    const std::string& val = fv.svalid
+		? fv.s : (tmp = Database::StringValue(fv));
+	    if (flags & FIELD_COLLATE)
+		AppendKeyBytes(util::SortKey(val.c_str()), descending, key);
+	    else
+		AppendKeyBytes(val, descending, key);
+	}
+    }
+}
+
+/** Orders the keys made by Query::Sort. All the keys live in one string,
+ * to save a heap block each.
+ */
+class Query::KeyLess
+{
+    const std::string& m_keys;
+
+public:
+    explicit KeyLess(const std::string& keys) : m_keys(keys) {}
+
+    struct Entry
+    {
+	size_t offset;
+	size_t size;
+    };
+
+    bool operator()(const Entry& a, const Entry& b) const
+    {
+	int rc = memcmp(m_keys.data() + a.offset, m_keys.data() + b.offset,
+			std::min(a.size, b.size));
+	return rc ? (rc < 0) : (a.size < b.size);
+    }
+};
+
+/** Sorts recnos by the ORDER BY fields, or, given a LIMIT, just finds the
+ * first few and drops the rest.
+ *
+ * Each record's key is built once and ends with its record number, so
+ * that ties stay in record-number order and every comparison is a
+ * memcmp. Collated fields, if indexed, use the ranks of their values
+ * (see Database::Ranks) -- if there are enough records to be worth it.
+ */
+void Query::Sort(const Database::Version& v, bool snapshot,
+		 std::vector<unsigned int> *recnos) const
+{
+    std::vector<Database::RanksPtr> ranks;
+    for (orderby_t::const_iterator i = m_orderby.begin();
+	 i != m_orderby.end();
+	 ++i)
+    {
+	unsigned int flags = m_db->m_fields[*i].flags;
+	if ((flags & (FIELD_TYPEMASK|FIELD_INDEXED|FIELD_COLLATE))
+	    == (FIELD_STRING|FIELD_INDEXED|FIELD_COLLATE)
+	    && recnos->size() >= v.StringIndex(*i).size())
+	    ranks.push_back(m_db->Ranks(v, *i, snapshot));
+	else
+	    ranks.push_back(Database::RanksPtr());
+    }
+
+    std::string keys;
+    std::vector<KeyLess::Entry> entries(recnos->size());
+
+    for (size_t i=0; i<recnos->size(); ++i)
+    {
+	entries[i].offset = keys.size();
+	AppendSortKey(*v.Find((*recnos)[i]), (*recnos)[i], ranks, &keys);
+	AppendKeyInt((*recnos)[i], false, &keys);
+	entries[i].size = keys.size() - entries[i].offset;
+    }
+
+    KeyLess less(keys);
+    if (m_limit && m_limit < entries.size())
+    {
+	std::partial_sort(entries.begin(), entries.begin() + m_limit,
+			  entries.end(), less);
+	entries.resize(m_limit);
+    }
+    else
+	std::sort(entries.begin(), entries.end(), less);
+
+    // The record number is the last four bytes of each key
+    recnos->resize(entries.size());
+    for (size_t i=0; i<entries.size(); ++i)
+    {
+	const unsigned char *p = (const unsigned char*)keys.data()
+	    + entries[i].offset + entries[i].size - 4;
+	(*recnos)[i] = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16)
+	    | ((unsigned int)p[2] << 8) | p[3];
+    }
+}
+
+db::RecordsetPtr Query::Execute()
+{
+    if (!m_restrictions.empty())
+	assert(m_root != 0);
+
+    CompileLikes();
+
+    if (m_collateby.size() > 1)
+    {
+	TRACE << "Can't do multiple collate-by yet\n";
+	return db::RecordsetPtr();
+    }
+
+    Database::VersionPtr snapshot;
+    if (m_use_snapshot)
+	snapshot = m_db->Snapshot();
+
+    VersionLock v(m_db, snapshot);
+
+    Plan plan = MakePlan(*v, m_root);
+
+    switch (Choose(plan))
+    {
+    case LAZY_SCAN:
+	return db::RecordsetPtr(new SimpleRecordset(m_db, snapshot,
+						    QueryPtr(this)));
+
+    case LIST:
+    {
+	std::vector<unsigned int> recnos;
+	Candidates(*v, plan, &recnos);
+	size_t count = recnos.size();
+	if (m_limit && m_limit < recnos.size())
+	    recnos.resize(m_limit);
+	return db::RecordsetPtr(new ListRecordset(m_db, snapshot,
+						  std::move(recnos), count));
+    }
+
+    case SORT:
+    {
+	std::vector<unsigned int> recnos;
+	Candidates(*v, plan, &recnos);
+	size_t count = recnos.size();
+	Sort(*v, (bool)snapshot, &recnos);
+	return db::RecordsetPtr(new ListRecordset(m_db, snapshot,
+						  std::move(recnos), count));
+    }
+
+    case INDEX_COLLATE:
+	return db::RecordsetPtr(new CollateRecordset(m_db, snapshot,
+						     m_collateby.front(),
+						     m_root ? QueryPtr(this)
+						            : QueryPtr()));
+
+    case VALUE_COLLATE:
+    {
+	std::vector<unsigned int> recnos;
+	Candidates(*v, plan, &recnos);
+
+	unsigned int field = m_collateby.front();
+	if ((m_db->m_fields[field].flags & FIELD_TYPEMASK) == FIELD_INT)
+	{
+	    std::vector<uint32_t> ints;
+	    for (size_t i=0; i<recnos.size(); ++i)
+	    {
+		const Database::FieldValue& fv = (*v->Find(recnos[i]))[field];
+		if (fv.ivalid || fv.svalid)
+		    ints.push_back(Database::IntValue(fv));
+	    }
+	    std::sort(ints.begin(), ints.end());
+	    ints.erase(std::unique(ints.begin(), ints.end()), ints.end());
+	    return db::RecordsetPtr(new ValuesRecordset(std::move(ints)));
+	}
+
+	std::vector<std::string> strings;
+	for (size_t i=0; i<recnos.size(); ++i)
+	{
+	    const Database::FieldValue& fv = (*v->Find(recnos[i]))[field];
+	    if (fv.ivalid || fv.svalid || fv.avalid)
+		strings.push_back(Database::StringValue(fv));
+	}
+	std::sort(strings.begin(), strings.end());
+	strings.erase(std::unique(strings.begin(), strings.end()),
+		      strings.end());
+	return db::RecordsetPtr(new ValuesRecordset(std::move(strings)));
+    }
+    }
+
+    return db::RecordsetPtr();
+}
+
+std::string Query::Describe(const Plan& plan) const
+{
+    std::ostringstream os;
+
+    switch (plan.type)
+    {
+    case Plan::SCAN:
+	os << "scan";
+	break;
+    case Plan::EMPTY:
+	return "empty";
+    case Plan::LOOKUP:
+    case Plan::RANGE:
+    case Plan::TEXT:
+    {
+	std::string s = ToStringElement(plan.elem);
+	if (!s.empty() && s[s.size()-1] == ' ')
+	    s.erase(s.size()-1);
+	os << (plan.type == Plan::LOOKUP ? "lookup "
+	       : plan.type == Plan::RANGE ? "range " : "text ") << s;
+	break;
+    }
+    case Plan::UNION:
+    case Plan::INTERSECT:
+	os << (plan.type == Plan::UNION ? "union(" : "intersect(");
+	for (size_t i=0; i<plan.children.size(); ++i)
+	{
+	    if (i)
+		os << ", ";
+	    os << Describe(plan.children[i]);
+	}
+	os << ")";
+	break;
+    }
+
+    os << " [" << plan.cost << "]";
+    return os.str();
+}
+
+std::string Query::Explain()
+{
+    Database::VersionPtr snapshot;
+    if (m_use_snapshot)
+	snapshot = m_db->Snapshot();
+
+    CompileLikes();
+
+    VersionLock v(m_db, snapshot);
+
+    Plan plan = MakePlan(*v, m_root);
+    Strategy strategy = Choose(plan);
+
+    std::ostringstream os;
+    if (strategy == INDEX_COLLATE)
+	os << "walk index #" << m_collateby.front();
+    else
+	os << Describe(plan);
+
+    if ((strategy == INDEX_COLLATE || strategy == LAZY_SCAN)
+	? (m_root != 0) : !plan.exact)
+	os << " | filter " << ToStringElement(m_root);
+
+    if (strategy == SORT)
+    {
+	if (m_limit)
+	    os << " | top " << m_limit;
+	else
+	    os << " | sort";
+	for (orderby_t::const_iterator i = m_orderby.begin();
+	     i != m_orderby.end();
+	     ++i)
+	    os << " #" << *i << (IsDescending(*i) ? " desc" : "");
+    }
+    else if (strategy == INDEX_COLLATE || strategy == VALUE_COLLATE)
+	os << " | distinct #" << m_collateby.front();
+
+    std::string s = os.str();
+    if (!s.empty() && s[s.size()-1] == ' ')
+	s.erase(s.size()-1);
+    return s;
+}
+
+bool Query::Match(const Database::record_t& record) const
 {
     if (!m_root)
 	return true;
-    return MatchElement(rs, m_root);
+    return MatchElement(record, m_root);
+}
+
+static bool MatchInt(db::RestrictionType rt, uint32_t val, uint32_t ival)
+{
+    switch (rt)
+    {
+    case db::EQ:
+	return val == ival;
+    case db::NE:
+	return val != ival;
+    case db::GT:
+	return val > ival;
+    case db::LT:
+	return val < ival;
+    case db::LE:
+	return val <= ival;
+    case db::GE:
+	return val >= ival;
+    default:
+	assert(false);
+	break;
+    }
+    return true;
 }
 
-bool Query::MatchElement(db::Recordset *rs, ssize_t elem)
+bool Query::MatchElement(const Database::record_t& record, ssize_t elem) const
 {
     if (elem > 0)
     {
 	const Restriction& r = m_restrictions[(size_t)(elem-1)];
+	const Database::FieldValue& fv = record[r.which];
 
 	if (r.is_string)
 	{
-	    std::string val = rs->GetString(r.which);
+	    std::string tmp;
+	    const std::string& val = fv.svalid
+		? fv.s : (tmp = Database::StringValue(fv));
 	    switch (r.rt)
 	    {
 	    case db::EQ:
@@ -99,9 +816,13 @@ bool Query::MatchElement(db::Recordset *rs, ssize_t elem)
 		break;
 	    case db::LIKE:
 	    {
-		TRACE << elem-1 << ": '" << val << "' like '" << r.sval << "'\n";
-		bool rc = boost::regex_match(val, 
-					     m_regexes[(unsigned int)(elem-1)]);
+		const Like& like
+		    = m_likes.find((unsigned int)(elem-1))->second;
+		bool rc = like.is_text
+		    ? Database::TextIndex::Matches(like.type,
+						   util::FoldCase(val),
+						   like.folded)
+		    : boost::regex_match(val, like.regex);
 //		TRACE << "'" << val << "' like '" << r.sval << "' : " << rc
 //		      << "\n";
 		if (!rc)
@@ -113,44 +834,24 @@ bool Query::MatchElement(db::Recordset *rs, ssize_t elem)
 		break;
 	    }
 	}
-	else
+	else if (fv.avalid)
 	{
-	    uint32_t val = rs->GetInteger(r.which);
-
-	    switch (r.rt)
-	    {
-	    case db::EQ:
-		return val == r.ival;
-	    case db::NE:
-		return val != r.ival;
-	    case db::GT:
-		if (val <= r.ival)
-		    return false;
-		break;
-	    case db::LT:
-		if (val >= r.ival)
-		    return false;
-		break;
-	    case db::LE:
-		if (val > r.ival)
-		    return false;
-		break;
-	    case db::GE:
-		if (val < r.ival)
-		    return false;
-		break;
-	    default:
-		assert(false);
-		break;
-	    }
+	    // Any element matches (or, for NE, no element is equal)
+	    bool ne = (r.rt == db::NE);
+	    for (size_t i=0; i<fv.ArraySize(); ++i)
+		if (MatchInt(ne ? db::EQ : r.rt, fv.Element(i), r.ival))
+		    return !ne;
+	    return ne;
 	}
+	else
+	    return MatchInt(r.rt, Database::IntValue(fv), r.ival);
     }
     else
     {
 	assert(elem < 0);
-	
+
 	const Relation& r = m_relations[(size_t)(-elem-1)];
-	bool lhs = MatchElement(rs, r.a);
+	bool lhs = MatchElement(record, r.a);
 	if (r.anditive)
 	{
 	    if (!lhs)
@@ -161,7 +862,7 @@ bool Query::MatchElement(db::Recordset *rs, ssize_t elem)
 	    if (lhs)
 		return true;
 	}
-	return MatchElement(rs, r.b);
+	return MatchElement(record, r.b);
     }
 
     return true;
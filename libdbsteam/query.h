@@ -3,31 +3,110 @@
 #define DBSTEAM_QUERY_H 1
 
 #include "libdb/query.h"
+#include "db.h"
 #include <boost/regex.hpp>
 #include <map>
+#include <vector>
+#include <set>
 
 namespace db {
 
 namespace steam {
 
-class Database;
+/** One step of a query plan: a way of finding the records which match
+ * (or might match) one element of a query's WHERE clause.
+ */
+struct Plan
+{
+    enum Type {
+	SCAN,     ///< No index helps: look at every record
+	EMPTY,    ///< No record can match
+	LOOKUP,   ///< One key of an index
+	RANGE,    ///< A range of keys of an integer index
+	TEXT,     ///< Some terms of a text index (LIKE)
+	UNION,    ///< Records found by any child (OR)
+	INTERSECT ///< Records found by every child (AND)
+    };
+
+    Type type;
+    ssize_t elem;  ///< Query element (restriction, for LOOKUP, RANGE, TEXT)
+    size_t cost;   ///< Number of records it produces (or an upper bound)
+    bool exact;    ///< Produces only matching records: no filter needed
+    std::vector<Plan> children; ///< UNION and INTERSECT, cheapest first
+    std::vector<unsigned int> terms; ///< TEXT: the matching terms
+
+    Plan(Type t, ssize_t e, size_t c, bool x)
+	: type(t), elem(e), cost(c), exact(x) {}
+};
 
 class Query: public db::Query
 {
     Database *m_db;
+    bool m_use_snapshot;
+
+    /** How to match a LIKE restriction: as plain text if the pattern is
+     * just a prefix, suffix, substring or whole value -- which is what
+     * user searches send -- else as a regex.
+     */
+    struct Like
+    {
+	bool is_text;
+	Database::TextIndex::MatchType type;
+	std::string folded; ///< The text, case-folded
+	boost::regex regex;
+
+	Like() : is_text(false), type(Database::TextIndex::EXACT) {}
+    };
+
+    typedef std::map<unsigned int, Like> likes_t;
+    likes_t m_likes;
+
+    /** What Execute does once it has a Plan.
+     */
+    enum Strategy {
+	LAZY_SCAN,      ///< Filter records as the recordset is read
+	LIST,           ///< Fetch, filter, and return the matches
+	SORT,           ///< Fetch, filter, sort
+	INDEX_COLLATE,  ///< Walk the COLLATE BY field's index, filtering
+	VALUE_COLLATE   ///< Fetch, filter, gather distinct values
+    };
 
-    typedef std::map<unsigned int, boost::regex> regexes_t;
-    regexes_t m_regexes;
+    class KeyLess;
 
-    bool MatchElement(db::Recordset*, ssize_t);
+    bool MatchElement(const Database::record_t&, ssize_t) const;
+    void CollectElements(ssize_t elem, bool anditive,
+			 std::vector<ssize_t> *elems) const;
+    const Database::recnos_t *Postings(const Database::Version&,
+					   const Plan&) const;
+    Plan MakePlan(const Database::Version&, ssize_t elem) const;
+    Strategy Choose(const Plan&) const;
+    void Fetch(const Database::Version&, const Plan&,
+	       std::vector<unsigned int> *recnos) const;
+    void Candidates(const Database::Version&, const Plan&,
+		    std::vector<unsigned int> *recnos) const;
+    void AppendSortKey(const Database::record_t&, unsigned int recno,
+		       const std::vector<Database::RanksPtr>& ranks,
+		       std::string *key) const;
+    void Sort(const Database::Version&, bool snapshot,
+	      std::vector<unsigned int> *recnos) const;
+    std::string Describe(const Plan&) const;
+    static bool ParseLike(const std::string& pattern,
+			  Database::TextIndex::MatchType*, std::string *text);
+    void CompileLikes();
 
 public:
-    explicit Query(Database*);
+    /** @param use_snapshot Whether recordsets should read the latest
+     *                     published version (see SnapshotView), rather
+     *                     than the live one
+     */
+    Query(Database*, bool use_snapshot);
 
-    bool Match(db::Recordset *rs);
+    /** Call with the record's version locked (or pinned) */
+    bool Match(const Database::record_t&) const;
 
     // Being a db::QueryImpl
-    util::CountedPointer<db::Recordset> Execute();
+    util::CountedPointer<db::Recordset> Execute() override;
+    std::string Explain() override;
 };
 
 typedef util::CountedPointer<db::steam::Query> QueryPtr;
@@ -4,30 +4,33 @@
 #include "libutil/trace.h"
 #include "libutil/printf.h"
 #include <errno.h>
+#include <string.h>
 
 namespace db {
 namespace steam {
 
-Recordset::Recordset(Database *db)
+Recordset::Recordset(Database *db, const Database::VersionPtr& snapshot)
     : m_db(db),
+      m_snapshot(snapshot),
+      m_publish_on_commit(false),
       m_record(0),
       m_eof(false)
 {
-    if (m_db->m_data.empty())
+    VersionLock v(m_db, m_snapshot);
+    unsigned int first = v->NextRecord(0);
+    if (first == Database::NO_RECORD)
 	m_eof = true;
     else
-    {
-	std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
-	m_record = m_db->m_data.begin()->first;
-    }
+	m_record = first;
 }
 
-void Recordset::SetRecordNumber(unsigned int which)
+void Recordset::GoLive()
 {
-    m_record = which;
-
-    // Caller is assumed to know what they're doing
-    m_eof = false;
+    if (m_snapshot)
+    {
+	m_snapshot.reset();
+	m_publish_on_commit = true;
+    }
 }
 
 bool Recordset::IsEOF() const
@@ -40,20 +43,12 @@ uint32_t Recordset::GetInteger(unsigned int which) const
     if (m_eof)
 	return 0;
 
-    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    VersionLock v(m_db, m_snapshot);
 
-    Database::records_t::iterator i = m_db->m_data.find(m_record);
-    if (i == m_db->m_data.end())
+    const Database::record_t *r = v->Find(m_record);
+    if (!r)
 	return 0;
-    Database::FieldValue& v = i->second[which];
-    if (v.ivalid)
-	return v.i;
-    if (v.svalid)
-    {
-	v.ivalid = 1;
-	return v.i = (uint32_t)strtoul(v.s.c_str(), NULL, 10);
-    }
-    return 0;
+    return Database::IntValue((*r)[which]);
 }
 
 std::string Recordset::GetString(unsigned int which) const
@@ -61,21 +56,48 @@ std::string Recordset::GetString(unsigned int which) const
     if (m_eof)
 	return "";
 
-    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    VersionLock v(m_db, m_snapshot);
 
-    Database::records_t::iterator i = m_db->m_data.find(m_record);
-    if (i == m_db->m_data.end())
+    const Database::record_t *r = v->Find(m_record);
+    if (!r)
     {
 	TRACE << "GetString m_record=" << m_record << " not found\n";
 	return "";
     }
-    Database::FieldValue& v = i->second[which];
-    if (v.svalid)
-	return v.s;
-    if (v.ivalid && v.i)
-	return util::Printf() << v.i;
+    return Database::StringValue((*r)[which]);
+}
 
-    return "";
+std::string_view Recordset::GetStringView(unsigned int which,
+					  std::string *scratch) const
+{
+    if (m_eof)
+	return std::string_view();
+
+    VersionLock v(m_db, m_snapshot);
+
+    const Database::record_t *r = v->Find(m_record);
+    if (!r)
+	return std::string_view();
+    return Database::StringView((*r)[which], scratch);
+}
+
+void Recordset::GetStringViews(const unsigned int *fields, size_t n,
+			       std::string_view *views,
+			       std::string *scratch) const
+{
+    const Database::record_t *r = NULL;
+
+    VersionLock v(m_db, m_snapshot);
+    if (!m_eof)
+	r = v->Find(m_record);
+
+    for (size_t i=0; i<n; ++i)
+    {
+	if (r)
+	    views[i] = Database::StringView((*r)[fields[i]], &scratch[i]);
+	else
+	    views[i] = std::string_view();
+    }
 }
 
 unsigned int Recordset::SetString(unsigned int which, const std::string& s)
@@ -86,19 +108,40 @@ unsigned int Recordset::SetString(unsigned int which, const std::string& s)
 	return ENOENT;
     }
 
+    if (IsArray(which))
+    {
+	std::vector<unsigned int> vec;
+	db::DecodeArray(s, &vec);
+	return SetArray(which, vec);
+    }
+
+    GoLive();
+
     std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
 
-    Database::records_t::iterator i = m_db->m_data.find(m_record);
-    if (i == m_db->m_data.end())
+    const Database::record_t *r = m_db->m_current->Find(m_record);
+    if (!r)
     {
 	TRACE << "SetString(" << which << "," << s << ") recno " << m_record << " not found\n";
 	return ENOENT;
     }
-    Database::FieldValue& v = i->second[which];
 
-    if (v.svalid && v.s == s)
+    // Don't copy the record (or indexes) if nothing's changing
+    if ((*r)[which].svalid && (*r)[which].s == s)
 	return 0;
 
+    Database::FieldValue& v = (*m_db->WritableRecord(m_record))[which];
+
+    uint32_t n = (uint32_t)strtoul(s.c_str(), NULL, 10);
+
+    if (m_db->HasTextIndex(which))
+    {
+	Database::TextIndex& text = m_db->WritableTextIndex(which);
+	if (v.svalid || v.ivalid)
+	    text.Remove(Database::StringValue(v), m_record);
+	text.Add(s, m_record);
+    }
+
     // Update indexes
     unsigned int flags = m_db->m_fields[which].flags;
     if (flags & FIELD_INDEXED)
@@ -107,39 +150,39 @@ unsigned int Recordset::SetString(unsigned int which, const std::string& s)
 	{
 	default:
 	case FIELD_STRING:
+	{
+	    Database::stringindex_t& index = m_db->WritableStringIndex(which);
 	    if (v.svalid)
 	    {
-		m_db->m_stringindexes[which][v.s].erase(m_record);
-		if (m_db->m_stringindexes[which][v.s].empty())
-		    m_db->m_stringindexes[which].erase(v.s);
+		index[v.s].erase(m_record);
+		if (index[v.s].empty())
+		    index.erase(v.s);
 	    }
-	    m_db->m_stringindexes[which][s].insert(m_record);
-	    v.ivalid = 0;
+	    index[s].insert(m_record);
 	    break;
+	}
 	case FIELD_INT:
+	{
+	    Database::intindex_t& index = m_db->WritableIntIndex(which);
 	    if (v.ivalid)
 	    {
-		m_db->m_intindexes[which][v.i].erase(m_record);
-		if (m_db->m_intindexes[which][v.i].empty())
-		    m_db->m_intindexes[which].erase(v.i);
+		index[v.i].erase(m_record);
+		if (index[v.i].empty())
+		    index.erase(v.i);
 	    }
-	    v.i = (uint32_t)strtoul(s.c_str(), NULL, 10);
-	    v.ivalid = 1;
-	    m_db->m_intindexes[which][v.i].insert(m_record);
+	    index[n].insert(m_record);
 	    break;
 	}
+	}
     }
-    else
-	v.ivalid = 0;
+
+    // Parse any integer now, as published records can't be changed later
+    v.i = n;
+    v.ivalid = 1;
 
     if ((flags & FIELD_TYPEMASK) == FIELD_INT)
     {
 	// We must throw away things that aren't parseable as ints
-	if (!v.ivalid)
-	{
-	    v.i = (uint32_t)strtoul(s.c_str(), NULL, 10);
-	    v.ivalid = 1;
-	}
 	v.s = util::Printf() << v.i;
     }
     else
@@ -155,85 +198,334 @@ unsigned int Recordset::SetInteger(unsigned int which, uint32_t n)
     if (m_eof)
 	return ENOENT;
 
+    if (IsArray(which))
+	return EINVAL;
+
+    GoLive();
+
     std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
 
-    Database::records_t::iterator i = m_db->m_data.find(m_record);
-    if (i == m_db->m_data.end())
+    const Database::record_t *r = m_db->m_current->Find(m_record);
+    if (!r)
 	return ENOENT;
-    Database::FieldValue& v = i->second[which];
 
-    // Update indexes
     unsigned int flags = m_db->m_fields[which].flags;
+    bool string_index = (flags & FIELD_INDEXED)
+	&& (flags & FIELD_TYPEMASK) == FIELD_STRING;
+
+    // Don't copy the record (or indexes) if nothing's changing
+    const Database::FieldValue& old = (*r)[which];
+    if (old.ivalid && old.i == n)
+    {
+	if (!string_index && !old.svalid)
+	    return 0;
+	if (string_index && old.svalid
+	    && old.s == (std::string)(util::Printf() << n))
+	    return 0;
+    }
+
+    Database::FieldValue& v = (*m_db->WritableRecord(m_record))[which];
+
+    bool text_index = m_db->HasTextIndex(which);
+    if (text_index && (v.svalid || v.ivalid))
+	m_db->WritableTextIndex(which).Remove(Database::StringValue(v),
+					      m_record);
+
+    // Update indexes
     if (flags & FIELD_INDEXED)
     {
 	switch (flags & FIELD_TYPEMASK)
 	{
 	default:
 	case FIELD_INT:
+	{
+	    Database::intindex_t& index = m_db->WritableIntIndex(which);
 	    if (v.ivalid)
 	    {
-		m_db->m_intindexes[which][v.i].erase(m_record);
-		if (m_db->m_intindexes[which][v.i].empty())
-		    m_db->m_intindexes[which].erase(v.i);
+		index[v.i].erase(m_record);
+		if (index[v.i].empty())
+		    index.erase(v.i);
 	    }
-	    m_db->m_intindexes[which][n].insert(m_record);
+	    index[n].insert(m_record);
 	    v.svalid = 0;
 	    break;
+	}
 	case FIELD_STRING:
+	{
+	    Database::stringindex_t& index = m_db->WritableStringIndex(which);
 	    if (v.svalid)
 	    {
-		m_db->m_stringindexes[which][v.s].erase(m_record);
-		if (m_db->m_stringindexes[which][v.s].empty())
-		    m_db->m_stringindexes[which].erase(v.s);
+		index[v.s].erase(m_record);
+		if (index[v.s].empty())
+		    index.erase(v.s);
 	    }
 	    v.s = util::Printf() << n;
 	    v.svalid = 1;
-	    m_db->m_stringindexes[which][v.s].insert(m_record);
+	    index[v.s].insert(m_record);
 	    break;
 	}
+	}
     }
     else
 	v.svalid = 0;
 
     v.i = n;
     v.ivalid = 1;
+
+    if (text_index)
+	m_db->WritableTextIndex(which).Add(Database::StringValue(v),
+					   m_record);
+    return 0;
+}
+
+void Recordset::IndexElements(unsigned int which,
+			      const Database::FieldValue& v, bool add)
+{
+    if ((m_db->m_fields[which].flags & FIELD_INDEXED) == 0
+	|| !v.ArraySize())
+	return;
+
+    Database::intindex_t& index = m_db->WritableIntIndex(which);
+    for (size_t i=0; i<v.ArraySize(); ++i)
+    {
+	uint32_t element = v.Element(i);
+	if (add)
+	    index[element].insert(m_record);
+	else
+	{
+	    if (index.find(element) != index.end())
+	    {
+		Database::recnos_t& recnos = index[element];
+		recnos.erase(m_record);
+		if (recnos.empty())
+		    index.erase(element);
+	    }
+	}
+    }
+}
+
+size_t Recordset::GetArraySize(unsigned int which) const
+{
+    if (!IsArray(which))
+	return db::Recordset::GetArraySize(which);
+    if (m_eof)
+	return 0;
+
+    VersionLock v(m_db, m_snapshot);
+
+    const Database::record_t *r = v->Find(m_record);
+    if (!r)
+	return 0;
+    return (*r)[which].ArraySize();
+}
+
+void Recordset::GetArray(unsigned int which, std::vector<unsigned int> *vec,
+			 size_t start, size_t count) const
+{
+    if (!IsArray(which))
+    {
+	db::Recordset::GetArray(which, vec, start, count);
+	return;
+    }
+
+    vec->clear();
+    if (m_eof)
+	return;
+
+    VersionLock v(m_db, m_snapshot);
+
+    const Database::record_t *r = v->Find(m_record);
+    if (r)
+	Database::ArrayValue((*r)[which], vec, start, count);
+}
+
+unsigned int Recordset::SetArray(unsigned int which,
+				 const std::vector<unsigned int>& vec)
+{
+    if (!IsArray(which))
+	return db::Recordset::SetArray(which, vec);
+    if (m_eof)
+	return ENOENT;
+
+    std::string packed(vec.size() * 4, '\0');
+    for (size_t i=0; i<vec.size(); ++i)
+    {
+	uint32_t element = vec[i];
+	memcpy(&packed[i*4], &element, 4);
+    }
+
+    GoLive();
+
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+
+    const Database::record_t *r = m_db->m_current->Find(m_record);
+    if (!r)
+	return ENOENT;
+
+    // Don't copy the record (or index) if nothing's changing
+    const Database::FieldValue& old = (*r)[which];
+    if (old.s == packed && (old.avalid || packed.empty()))
+	return 0;
+
+    Database::FieldValue& v = (*m_db->WritableRecord(m_record))[which];
+    IndexElements(which, v, false);
+    v.s.swap(packed);
+    v.avalid = 1;
+    v.svalid = 0;
+    v.ivalid = 0;
+    IndexElements(which, v, true);
+    return 0;
+}
+
+unsigned int Recordset::AppendToArray(unsigned int which, unsigned int value)
+{
+    if (!IsArray(which))
+	return db::Recordset::AppendToArray(which, value);
+    if (m_eof)
+	return ENOENT;
+
+    GoLive();
+
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+
+    if (!m_db->m_current->Find(m_record))
+	return ENOENT;
+
+    Database::FieldValue& v = (*m_db->WritableRecord(m_record))[which];
+    if (!v.avalid)
+    {
+	v.s.clear();
+	v.avalid = 1;
+	v.svalid = 0;
+	v.ivalid = 0;
+    }
+    uint32_t element = value;
+    v.s.append((const char*)&element, 4);
+
+    if (m_db->m_fields[which].flags & FIELD_INDEXED)
+	m_db->WritableIntIndex(which)[element].insert(m_record);
+    return 0;
+}
+
+unsigned int Recordset::RemoveFromArray(unsigned int which,
+					unsigned int value)
+{
+    if (!IsArray(which))
+	return db::Recordset::RemoveFromArray(which, value);
+    if (m_eof)
+	return ENOENT;
+
+    GoLive();
+
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+
+    const Database::record_t *r = m_db->m_current->Find(m_record);
+    if (!r)
+	return ENOENT;
+
+    const Database::FieldValue& old = (*r)[which];
+    size_t n = old.ArraySize();
+    size_t first = 0;
+    while (first < n && old.Element(first) != value)
+	++first;
+    if (first == n)
+	return 0;
+
+    // Close up the gaps, in place
+    Database::FieldValue& v = (*m_db->WritableRecord(m_record))[which];
+    size_t out = first;
+    for (size_t i = first+1; i<n; ++i)
+    {
+	uint32_t element = v.Element(i);
+	if (element != value)
+	{
+	    memcpy(&v.s[out*4], &element, 4);
+	    ++out;
+	}
+    }
+    v.s.resize(out*4);
+
+    if (m_db->m_fields[which].flags & FIELD_INDEXED)
+    {
+	Database::intindex_t& index = m_db->WritableIntIndex(which);
+	if (index.find(value) != index.end())
+	{
+	    Database::recnos_t& recnos = index[value];
+	    recnos.erase(m_record);
+	    if (recnos.empty())
+		index.erase(value);
+	}
+    }
     return 0;
 }
 
 unsigned int Recordset::AddRecord()
 {
-//    TRACE << "Adding record " << m_db->m_next_recno << "\n";
+    GoLive();
 
     std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
 
-    m_record = m_db->m_next_recno;
-    m_db->m_data[m_db->m_next_recno++].resize(m_db->m_nfields);
+    Database::Version *v = m_db->Writable();
+    m_record = v->nrecords;
+    m_db->WritableRecordChunk(m_record).push_back(Database::RecordPtr(
+	new Database::Shared<Database::record_t>(
+	    v->epoch, Database::record_t(m_db->m_nfields))));
+    ++v->nrecords;
+    ++v->count;
     m_eof = false;
     return 0;
 }
 
 unsigned int Recordset::Commit()
 {
+    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+
+    if (m_publish_on_commit)
+	m_db->PublishLocked();
+    else
+	m_db->MaybePublish();
     return 0;
 }
 
+uint64_t Recordset::GetRevision() const
+{
+    if (m_eof)
+	return 0;
+
+    VersionLock v(m_db, m_snapshot);
+
+    const Database::Shared<Database::record_t> *r = v->FindShared(m_record);
+    if (!r)
+	return 0;
+    unsigned int epoch = r->epoch;
+    if (!m_snapshot && epoch == v->epoch && !m_db->m_frozen)
+	return 0;
+    return (uint64_t)epoch + 1;
+}
+
 unsigned int Recordset::Delete()
 {
     if (m_eof)
 	return ENOENT;
 
+    GoLive();
+
     {
 	std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
 
-	Database::records_t::iterator iter = m_db->m_data.find(m_record);
-	if (iter == m_db->m_data.end())
+	if (!m_db->m_current->Find(m_record))
 	    return ENOENT;
 
+	// Hold on to it, as the version holding it may be replaced below
+	Database::RecordPtr record = m_db->m_current
+	    ->records[m_record / Database::RECORD_CHUNK]
+	    ->value[m_record % Database::RECORD_CHUNK];
+
 	// Remove from any indexes
 	for (unsigned int i=0; i<m_db->m_nfields; ++i)
 	{
 	    unsigned int flags = m_db->m_fields[i].flags;
-	    Database::FieldValue& v = iter->second[i];
+	    const Database::FieldValue& v = record->value[i];
 	    if (flags & FIELD_INDEXED)
 	    {
 		switch (flags & FIELD_TYPEMASK)
@@ -242,25 +534,37 @@ unsigned int Recordset::Delete()
 		case FIELD_INT:
 		    if (v.ivalid)
 		    {
-			m_db->m_intindexes[i][v.i].erase(m_record);
-			if (m_db->m_intindexes[i][v.i].empty())
-			    m_db->m_intindexes[i].erase(v.i);
+			Database::intindex_t& index = m_db->WritableIntIndex(i);
+			index[v.i].erase(m_record);
+			if (index[v.i].empty())
+			    index.erase(v.i);
 		    }
 		    break;
 		case FIELD_STRING:
 		    if (v.svalid)
 		    {
-			m_db->m_stringindexes[i][v.s].erase(m_record);
-			if (m_db->m_stringindexes[i][v.s].empty())
-			    m_db->m_stringindexes[i].erase(v.s);
+			Database::stringindex_t& index
+			    = m_db->WritableStringIndex(i);
+			index[v.s].erase(m_record);
+			if (index[v.s].empty())
+			    index.erase(v.s);
 		    }
 		    break;
+		case FIELD_ARRAY:
+		    IndexElements(i, v, false);
+		    break;
 		}
 	    }
+	    if (m_db->HasTextIndex(i) && (v.svalid || v.ivalid))
+		m_db->WritableTextIndex(i).Remove(Database::StringValue(v),
+						  m_record);
 	}
 
 	// Delete record itself
-	m_db->m_data.erase(m_record);
+	Database::Version *v = m_db->Writable();
+	m_db->WritableRecordChunk(m_record)[m_record % Database::RECORD_CHUNK]
+	    .reset();
+	--v->count;
     }
 
     MoveNext();
@@ -272,13 +576,19 @@ unsigned int Recordset::Delete()
         /* SimpleRecordset */
 
 
-SimpleRecordset::SimpleRecordset(Database *db, QueryPtr q)
-    : Recordset(db),
+SimpleRecordset::SimpleRecordset(Database *db,
+				 const Database::VersionPtr& snapshot,
+				 QueryPtr q)
+    : Recordset(db, snapshot),
       m_query(q)
 {
 //    TRACE << "SRS constructor, eof=" << m_eof << "\n";
-    if (!m_eof && (m_query && !m_query->Match(this)))
-	MoveNext();
+    if (!m_eof && m_query)
+    {
+	VersionLock v(m_db, m_snapshot);
+	if (!m_query->Match(*v->Find(m_record)))
+	    MoveNext();
+    }
 }
 
 void SimpleRecordset::MoveNext()
@@ -286,283 +596,109 @@ void SimpleRecordset::MoveNext()
     if (m_eof)
 	return;
 
-    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
+    VersionLock v(m_db, m_snapshot);
 
     for (;;)
     {
-	// Finds first item with key greater than m_record
-	Database::records_t::iterator i = m_db->m_data.upper_bound(m_record);
-	if (i == m_db->m_data.end())
+	// Finds first record with number greater than m_record
+	unsigned int next = v->NextRecord(m_record + 1);
+	if (next == Database::NO_RECORD)
 	{
 	    m_eof = true;
 	    return;
 	}
-	m_record = i->first;
-	if (!m_query || m_query->Match(this))
+	m_record = next;
+	if (!m_query || m_query->Match(*v->Find(m_record)))
 	    return;
     }
 }
 
 
-        /* IndexedRecordset */
+        /* ListRecordset */
 
 
-IndexedRecordset::IndexedRecordset(Database *db, unsigned int field, uint32_t intval)
-    : Recordset(db),
-      m_field(field),
-      m_is_int(true),
-      m_intval(intval),
-      m_subrecno(0)
+ListRecordset::ListRecordset(Database *db,
+			     const Database::VersionPtr& snapshot,
+			     std::vector<unsigned int>&& recnos, size_t count)
+    : Recordset(db, snapshot),
+      m_recnos(std::move(recnos)),
+      m_index(0),
+      m_count(count)
 {
-    std::lock_guard<std::recursive_mutex> lock(db->m_mutex);
-    Database::intindex_t& the_index = db->m_intindexes[field];
-    Database::intindex_t::const_iterator i = the_index.find(intval);
-    if (i == the_index.end())
-    {
-	m_eof = true;
-    }
-    else
-    {
-	m_eof = false;
-	m_record = *(i->second.begin());
-    }
-}
-
-IndexedRecordset::IndexedRecordset(Database *db, unsigned int field,
-				   std::string stringval)
-    : Recordset(db),
-      m_field(field),
-      m_is_int(false),
-      m_stringval(stringval),
-      m_intval(0),
-      m_subrecno(0)
-{
-    std::lock_guard<std::recursive_mutex> lock(db->m_mutex);
-    Database::stringindex_t& the_index = db->m_stringindexes[field];
-    Database::stringindex_t::const_iterator i = the_index.find(stringval);
-    if (i == the_index.end())
-    {
-	m_eof = true;
-    }
-    else
-    {
-	m_eof = false;
-	m_record = *(i->second.begin());
-    }
+    MoveFrom(0);
 }
 
-void IndexedRecordset::MoveNext()
+unsigned int ListRecordset::GetCount(size_t *count) const
 {
-    if (m_eof)
-	return;
-
-    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
-    if (m_is_int)
-    {
-	Database::intindex_t& the_index = m_db->m_intindexes[m_field];
-	Database::intindex_t::const_iterator i = the_index.find(m_intval);
-	if (i == the_index.end())
-	    m_eof = true;
-	else
-	{
-	    ++m_subrecno;
-	    if (m_subrecno >= i->second.size())
-		m_eof = true;
-	    else
-	    {
-		std::set<unsigned int>::const_iterator ci = i->second.begin();
-		for (unsigned int j=0; j<m_subrecno; ++j)
-		    ++ci;
-		m_record = *ci;
-	    }
-	}
-    }
-    else
-    {
-	// String case
-	Database::stringindex_t& the_index = m_db->m_stringindexes[m_field];
-	Database::stringindex_t::const_iterator i = the_index.find(m_stringval);
-	if (i == the_index.end())
-	{
-	    m_eof = true;
-	    return;
-	}
-
-	++m_subrecno;
-	if (m_subrecno >= i->second.size())
-	{
-	    m_eof = true;
-	    return;
-	}
-
-	std::set<unsigned int>::const_iterator ci = i->second.begin();
-	for (unsigned int j=0; j<m_subrecno; ++j)
-	    ++ci;
-	m_record = *ci;
-    }
+    *count = m_count;
+    return 0;
 }
 
-
-        /* OrderedRecordset */
-
-
-OrderedRecordset::OrderedRecordset(Database *db, unsigned int field)
-    : Recordset(db),
-      m_field(field),
-      m_is_int(false),
-      m_intval(0),
-      m_subrecno(0)
+void ListRecordset::MoveFrom(size_t index)
 {
-    std::lock_guard<std::recursive_mutex> lock(db->m_mutex);
-    m_is_int = ((db->m_fields[field].flags & FIELD_TYPEMASK)
-		== FIELD_INT);
-    if (m_is_int)
-    {
-	Database::intindex_t& the_index = db->m_intindexes[field];
-	Database::intindex_t::const_iterator i = the_index.begin();
-	if (i == the_index.end())
-	    m_eof = true;
-	else
-	{
-	    m_eof = false;
-	    m_record = *(i->second.begin());
-	    m_subrecno = 0;
-	    m_intval = i->first;
-	}
-    }
-    else
+    VersionLock v(m_db, m_snapshot);
+    for (m_index = index; m_index < m_recnos.size(); ++m_index)
     {
-	Database::stringindex_t& the_index = db->m_stringindexes[field];
-	Database::stringindex_t::const_iterator i = the_index.begin();
-	if (i == the_index.end())
-	    m_eof = true;
-	else
+	if (v->Find(m_recnos[m_index]))
 	{
+	    m_record = m_recnos[m_index];
 	    m_eof = false;
-	    m_record = *(i->second.begin());
-	    m_subrecno = 0;
-	    m_stringval = i->first;
+	    return;
 	}
     }
+    m_eof = true;
 }
 
-void OrderedRecordset::MoveNext()
+void ListRecordset::MoveNext()
 {
-    if (m_eof)
-	return;
-
-    std::lock_guard<std::recursive_mutex> lock(m_db->m_mutex);
-    if (m_is_int)
-    {
-	Database::intindex_t& the_index = m_db->m_intindexes[m_field];
-	Database::intindex_t::const_iterator i = the_index.lower_bound(m_intval);
-	if (i == the_index.end())
-	    m_eof = true;
-	else
-	{
-	    if (i->first != m_intval)
-		m_subrecno = 0;
-	    else
-		++m_subrecno;
-
-	    while (m_subrecno >= i->second.size())
-	    {
-		++i;
-		if (i == the_index.end())
-		{
-		    m_eof = true;
-		    return;
-		}
-		m_subrecno = 0;
-	    }
-
-	    m_intval = i->first;
-	    
-	    std::set<unsigned int>::const_iterator ci = i->second.begin();
-	    for (unsigned int j=0; j<m_subrecno; ++j)
-		++ci;
-	    m_record = *ci;
-	}
-    }
-    else
-    {
-	// String case
-	Database::stringindex_t& the_index = m_db->m_stringindexes[m_field];
-	Database::stringindex_t::const_iterator i = the_index.lower_bound(m_stringval);
-	if (i == the_index.end())
-	{
-	    m_eof = true;
-	}
-	else
-	{
-	    if (i->first != m_stringval)
-		m_subrecno = 0;
-	    else
-		++m_subrecno;
-
-	    while (m_subrecno >= i->second.size())
-	    {
-		++i;
-		if (i == the_index.end())
-		{
-		    m_eof = true;
-		    return; 
-		}
-		m_subrecno = 0;
-	    }
-
-	    m_stringval = i->first;
-	    
-	    std::set<unsigned int>::const_iterator ci = i->second.begin();
-	    for (unsigned int j=0; j<m_subrecno; ++j)
-		++ci;
-	    m_record = *ci;
-	}
-    }
+    if (!m_eof)
+	MoveFrom(m_index + 1);
 }
 
 
         /* CollateRecordset */
 
 
-CollateRecordset::CollateRecordset(Database *db, unsigned int field, QueryPtr query)
+CollateRecordset::CollateRecordset(Database *db,
+				   const Database::VersionPtr& snapshot,
+				   unsigned int field, QueryPtr query)
     : m_parent(db),
+      m_snapshot(snapshot),
       m_field(field), 
       m_is_int(false),
       m_intvalue(0),
       m_eof(false), 
-      m_query(query), 
-      m_rs(db, QueryPtr())
+      m_query(query)
 {
-    std::lock_guard<std::recursive_mutex> lock(m_parent->m_mutex);
+    VersionLock v(m_parent, m_snapshot);
     m_is_int = ((m_parent->m_fields[field].flags & FIELD_TYPEMASK)
 		== FIELD_INT);
     if (m_is_int)
     {
-	if (m_parent->m_intindexes[field].empty())
+	if (v->IntIndex(field).empty())
 	    m_eof = true;
 	else
 	{
-	    m_intvalue = m_parent->m_intindexes[field].begin()->first;
+	    m_intvalue = v->IntIndex(field).begin()->first;
 	    m_eof = false;
 	}
     }
     else
     {
 	// String
-	if (m_parent->m_stringindexes[field].empty())
+	if (v->StringIndex(field).empty())
 	    m_eof = true;
 	else
 	{
-	    const Database::stringindex_t& index
-		= m_parent->m_stringindexes[m_field];
+	    const Database::stringindex_t& index = v->StringIndex(m_field);
 
-	    MoveUntilValid(index.begin(), index.end());
+	    MoveUntilValid(*v, index.begin(), index.end());
 	}
     }
 }
 
-void CollateRecordset::MoveUntilValid(Database::stringindex_t::const_iterator i,
+void CollateRecordset::MoveUntilValid(const Database::Version& v,
+				      Database::stringindex_t::const_iterator i,
 				      Database::stringindex_t::const_iterator end)
 {
     for (;;)
@@ -584,17 +720,13 @@ void CollateRecordset::MoveUntilValid(Database::stringindex_t::const_iterator i,
 	/** @todo Optimisation: if all restrictions are on the collate field,
 	 *        we only need to examine one record.
 	 */
-	for (std::set<unsigned int>::const_iterator ci = i->second.begin();
+	for (Database::recnos_t::const_iterator ci = i->second.begin();
 	     ci != i->second.end();
 	     ++ci)
 	{
-	    m_rs.SetRecordNumber(*ci);
-	    if (m_query->Match(&m_rs))
-	    {
-//		TRACE << m_rs.GetString(1) << " with '" << m_strvalue
-//		      << "' matches " << m_query->ToString() << "\n";
+	    const Database::record_t *r = v.Find(*ci);
+	    if (r && m_query->Match(*r))
 		return; // Found an acceptable one
-	    }
 	}
 
 	++i;
@@ -621,10 +753,10 @@ void CollateRecordset::MoveNext()
     if (m_eof)
 	return;
 
-    std::lock_guard<std::recursive_mutex> lock(m_parent->m_mutex);
+    VersionLock v(m_parent, m_snapshot);
     if (m_is_int)
     {
-	const Database::intindex_t& index = m_parent->m_intindexes[m_field];
+	const Database::intindex_t& index = v->IntIndex(m_field);
 	Database::intindex_t::const_iterator i = index.upper_bound(m_intvalue);
 	if (i == index.end())
 	{
@@ -635,8 +767,7 @@ void CollateRecordset::MoveNext()
     }
     else
     {
-	const Database::stringindex_t& index
-	    = m_parent->m_stringindexes[m_field];
+	const Database::stringindex_t& index = v->StringIndex(m_field);
 	Database::stringindex_t::const_iterator i = index.find(m_strvalue);
 	if (i == index.end())
 	{
@@ -646,10 +777,64 @@ void CollateRecordset::MoveNext()
 
 	++i;
 
-	MoveUntilValid(i, index.end());
+	MoveUntilValid(*v, i, index.end());
     }
 }
 
+
+
+        /* ValuesRecordset */
+
+
+ValuesRecordset::ValuesRecordset(std::vector<uint32_t>&& ints)
+    : m_is_int(true),
+      m_ints(std::move(ints)),
+      m_index(0)
+{
+}
+
+ValuesRecordset::ValuesRecordset(std::vector<std::string>&& strings)
+    : m_is_int(false),
+      m_strings(std::move(strings)),
+      m_index(0)
+{
+}
+
+bool ValuesRecordset::IsEOF() const
+{
+    return m_index >= (m_is_int ? m_ints.size() : m_strings.size());
+}
+
+uint32_t ValuesRecordset::GetInteger(unsigned int) const
+{
+    if (IsEOF())
+	return 0;
+    if (m_is_int)
+	return m_ints[m_index];
+    return (uint32_t)strtoul(m_strings[m_index].c_str(), NULL, 10);
+}
+
+std::string ValuesRecordset::GetString(unsigned int) const
+{
+    if (IsEOF())
+	return "";
+    if (m_is_int)
+	return util::Printf() << m_ints[m_index];
+    return m_strings[m_index];
+}
+
+void ValuesRecordset::MoveNext()
+{
+    if (!IsEOF())
+	++m_index;
+}
+
+unsigned int ValuesRecordset::GetCount(size_t *count) const
+{
+    *count = m_is_int ? m_ints.size() : m_strings.size();
+    return 0;
+}
+
 } // namespace steam
 } // namespace db
 
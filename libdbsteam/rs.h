@@ -8,6 +8,8 @@
 #include "libutil/counted_pointer.h"
 #include "db.h"
 #include <string>
+#include <vector>
+#include <mutex>
 
 namespace db {
 
@@ -16,30 +18,98 @@ namespace steam {
 class Database;
 class Query;
 
+/** The version of the database a recordset reads: its snapshot if it has
+ * one, or else the live version, in which case the lock is held.
+ */
+class VersionLock
+{
+    std::unique_lock<std::recursive_mutex> m_lock;
+    const Database::Version *m_version;
+
+public:
+    VersionLock(Database *db, const Database::VersionPtr& snapshot)
+	: m_lock(db->m_mutex, std::defer_lock),
+	  m_version(snapshot.get())
+    {
+	if (!m_version)
+	{
+	    m_lock.lock();
+	    m_version = db->m_current.get();
+	}
+    }
+
+    const Database::Version *operator->() const { return m_version; }
+    const Database::Version& operator*() const { return *m_version; }
+};
+
 class Recordset: public db::Recordset
 {
 protected:
     Database *m_db;
+    Database::VersionPtr m_snapshot; ///< NULL if reading the live version
+    bool m_publish_on_commit; ///< Wrote through from a SnapshotView
     unsigned int m_record;
     bool m_eof;
 
+    /** Called before any change: a snapshot recordset from then on reads
+     * the live version instead, so that it sees what it wrote.
+     */
+    void GoLive();
+
+    bool IsArray(unsigned int which) const
+    {
+	return (m_db->m_fields[which].flags & FIELD_TYPEMASK) == FIELD_ARRAY;
+    }
+
+    /** Adds the current record to (or removes it from) the index entry
+     * of each element of an array, if the field is indexed. Call with the
+     * lock held.
+     */
+    void IndexElements(unsigned int which, const Database::FieldValue&,
+		       bool add);
+
 public:
-    explicit Recordset(Database *db);
+    Recordset(Database *db, const Database::VersionPtr& snapshot);
 
     bool IsEOF() const;
     uint32_t GetInteger(unsigned int which) const;
     std::string GetString(unsigned int which) const;
 
+    /** Views point into the record itself, so on a snapshot they last as
+     * long as the recordset stays put.
+     */
+    std::string_view GetStringView(unsigned int which,
+				   std::string *scratch) const;
+    void GetStringViews(const unsigned int *fields, size_t n,
+			std::string_view *views,
+			std::string *scratch) const;
+
     unsigned int SetString(unsigned int which, const std::string&);
     unsigned int SetInteger(unsigned int which, uint32_t);
 
+    /** On FIELD_ARRAY fields, slicing costs only what it copies, and
+     * appending and removing don't copy the rest of the array (unless a
+     * snapshot still holds the record). Other fields use the string form.
+     */
+    size_t GetArraySize(unsigned int which) const;
+    void GetArray(unsigned int which, std::vector<unsigned int> *vec,
+		  size_t start = 0, size_t count = (size_t)-1) const;
+    unsigned int SetArray(unsigned int which,
+			  const std::vector<unsigned int>&);
+    unsigned int AppendToArray(unsigned int which, unsigned int value);
+    unsigned int RemoveFromArray(unsigned int which, unsigned int value);
+
     unsigned int AddRecord();
     unsigned int Commit();
     unsigned int Delete();
 
-    void MoveNext() = 0;
+    /** The epoch of the version which last changed the record -- unless
+     * that's the live version, not yet published, which can change it
+     * again without a new epoch.
+     */
+    uint64_t GetRevision() const override;
 
-    void SetRecordNumber(unsigned int recno);
+    void MoveNext() = 0;
 };
 
 class SimpleRecordset: public Recordset
@@ -47,28 +117,54 @@ class SimpleRecordset: public Recordset
     util::CountedPointer<Query> m_query;
 
 public:
-    SimpleRecordset(Database*, util::CountedPointer<Query>);
+    SimpleRecordset(Database*, const Database::VersionPtr& snapshot,
+		    util::CountedPointer<Query>);
     
     void MoveNext();
 };
 
+/** Visits a precomputed list of records, skipping any since deleted.
+ *
+ * The list may be only the first part of the result (see Query::Limit),
+ * but count is always the whole result's size, for GetCount.
+ */
+class ListRecordset: public Recordset
+{
+    std::vector<unsigned int> m_recnos;
+    size_t m_index;
+    size_t m_count;
+
+    void MoveFrom(size_t index);
+
+public:
+    ListRecordset(Database*, const Database::VersionPtr& snapshot,
+		  std::vector<unsigned int>&& recnos, size_t count);
+
+    void MoveNext();
+    unsigned int GetCount(size_t *count) const override;
+};
+
+/** Visits each value of an indexed field, among the records that match a
+ * query, by walking the index.
+ */
 class CollateRecordset: public ReadOnlyRecordset
 {
     Database *m_parent;
+    Database::VersionPtr m_snapshot;
     unsigned int m_field;
     bool m_is_int;
     unsigned int m_intvalue;
     std::string m_strvalue;
     bool m_eof;
     util::CountedPointer<Query> m_query;
-    SimpleRecordset m_rs;
 
-    void MoveUntilValid(Database::stringindex_t::const_iterator i,
+    void MoveUntilValid(const Database::Version&,
+			Database::stringindex_t::const_iterator i,
 			Database::stringindex_t::const_iterator end);
 
 public:
-    CollateRecordset(Database*, unsigned int field,
-		     util::CountedPointer<Query>);
+    CollateRecordset(Database*, const Database::VersionPtr& snapshot,
+		     unsigned int field, util::CountedPointer<Query>);
     
     bool IsEOF() const;
     uint32_t GetInteger(unsigned int which) const;
@@ -76,31 +172,25 @@ public:
     void MoveNext();
 };
 
-class IndexedRecordset: public Recordset
+/** Visits a precomputed, sorted list of distinct values: the result of a
+ * collate that was better answered without walking the whole index.
+ */
+class ValuesRecordset: public ReadOnlyRecordset
 {
-    unsigned int m_field;
     bool m_is_int;
-    std::string m_stringval;
-    uint32_t m_intval;
-    unsigned int m_subrecno;
+    std::vector<uint32_t> m_ints;
+    std::vector<std::string> m_strings;
+    size_t m_index;
 
 public:
-    IndexedRecordset(Database *db, unsigned int field, uint32_t intval);
-    IndexedRecordset(Database *db, unsigned int field, std::string stringval);
-    void MoveNext();
-};
+    explicit ValuesRecordset(std::vector<uint32_t>&& ints);
+    explicit ValuesRecordset(std::vector<std::string>&& strings);
 
-class OrderedRecordset: public Recordset
-{
-    unsigned int m_field;
-    bool m_is_int;
-    std::string m_stringval;
-    uint32_t m_intval;
-    unsigned int m_subrecno;
-
-public:
-    OrderedRecordset(Database *db, unsigned int field);
+    bool IsEOF() const;
+    uint32_t GetInteger(unsigned int which) const;
+    std::string GetString(unsigned int which) const;
     void MoveNext();
+    unsigned int GetCount(size_t *count) const override;
 };
 
 } // namespace steam
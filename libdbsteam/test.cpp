@@ -2,14 +2,724 @@
 #include "libdb/recordset.h"
 #include "libdb/query.h"
 #include <assert.h>
+#include <errno.h>
+#include <map>
 #include "libutil/trace.h"
 #include "libutil/counted_pointer.h"
+#include <boost/regex.hpp>
 
 namespace db {
 namespace steam {
 
+static unsigned int Count(db::QueryPtr qp)
+{
+    unsigned int n = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	++n;
+    return n;
+}
+
+/** Check the planner gets the same answers as brute force would.
+ */
+static void TestPlanner()
+{
+    enum { N = 1000 };
+
+    Database sdb(3);
+    sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(1, db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(2, db::steam::FIELD_INT);
+
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    for (unsigned int i=1; i<=N; ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(0, i);
+	rs->SetString(1, std::string("s") + (char)('0' + (i%10)));
+	rs->SetInteger(2, i%7);
+	rs->Commit();
+    }
+
+    /* Most selective index drives an AND */
+    db::QueryPtr qp = sdb.CreateQuery();
+    qp->Where(qp->And(qp->Restrict(1, db::EQ, "s3"),
+		      qp->Restrict(0, db::GT, 900)));
+    assert(Count(qp) == 10);
+    assert(qp->Explain() == "intersect(lookup #1 = \"s3\" [100], "
+	   "range #0 > 900 [100]) [100]");
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->And(qp->Restrict(1, db::EQ, "s3"),
+		      qp->Restrict(0, db::GT, 990)));
+    assert(Count(qp) == 1);
+    assert(qp->Explain().find("range #0 > 990 [10], lookup") != std::string::npos);
+
+    /* OR is a union */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Or(qp->Restrict(1, db::EQ, "s3"),
+		     qp->Restrict(1, db::EQ, "s4")));
+    assert(Count(qp) == 200);
+    assert(qp->Explain().find("union(") == 0);
+
+    /* ...unless one side can't use an index */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Or(qp->Restrict(1, db::EQ, "s3"),
+		     qp->Restrict(2, db::EQ, 4)));
+    assert(Count(qp) == 229);
+    assert(qp->Explain().find("scan [1000] | filter") == 0);
+
+    /* Unindexed conjuncts become a filter */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->And(qp->Restrict(2, db::EQ, 3),
+		      qp->Restrict(1, db::EQ, "s5")));
+    assert(Count(qp) == 14);
+    assert(qp->Explain().find("lookup #1 = \"s5\" [100] | filter") == 0);
+
+    /* Impossible */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->And(qp->Restrict(2, db::EQ, 3),
+		      qp->Restrict(1, db::EQ, "nope")));
+    assert(Count(qp) == 0);
+    assert(qp->Explain() == "empty");
+
+    /* ORDER BY honours WHERE, and more than one key */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, "s3"));
+    qp->OrderBy(2);
+    qp->OrderBy(0);
+    assert(qp->Explain() == "lookup #1 = \"s3\" [100] | sort #2 #0");
+    unsigned int n = 0, prev2 = 0, prev0 = 0;
+    for (rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+    {
+	assert(rs->GetString(1) == "s3");
+	unsigned int v2 = rs->GetInteger(2);
+	unsigned int v0 = rs->GetInteger(0);
+	assert(v2 > prev2 || (v2 == prev2 && v0 > prev0));
+	prev2 = v2;
+	prev0 = v0;
+	++n;
+    }
+    assert(n == 100);
+
+    /* COLLATE after filtering, even on an unindexed field */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::GT, 994));
+    qp->CollateBy(2);
+    assert(qp->Explain() == "range #0 > 994 [6] | distinct #2");
+    rs = qp->Execute();
+    for (unsigned int i=0; i<6; ++i)
+    {
+	assert(!rs->IsEOF());
+	assert(rs->GetInteger(0) == i+1);
+	rs->MoveNext();
+    }
+    assert(rs->IsEOF());
+
+    /* Zero is special: unset fields read as zero, but aren't indexed */
+    rs = sdb.CreateRecordset();
+    rs->AddRecord();
+    rs->SetString(1, "unset");
+    rs->Commit();
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::GE, 0));
+    assert(Count(qp) == N+1);
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::GT, 0));
+    assert(Count(qp) == N);
+
+    (void)!n;
+}
+
+/** Check LIKE via the text index gets the same answers as a regex would.
+ */
+static void TestTextIndex()
+{
+    static const char *const words[] = {
+	"Love", "the", "THEME", "heat", "Bathe", "Loveless", "mathematics",
+	"gloves", "a", "Ab",
+    };
+    enum { NWORDS = sizeof(words)/sizeof(words[0]) };
+
+    Database sdb(2);
+    sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(1, db::steam::FIELD_STRING|db::steam::FIELD_TEXTINDEX);
+
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    for (unsigned int i=0; i<NWORDS*NWORDS; ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(0, i+1);
+	rs->SetString(1, std::string(words[i/NWORDS]) + " "
+		      + words[i%NWORDS]);
+	rs->Commit();
+    }
+    rs->AddRecord();
+    rs->SetInteger(0, 999); // but no string
+
+    static const char *const patterns[] = {
+	"l.*", "LOVE.*", ".*the.*", ".*THE", "the theme", ".*a.*", ".*ab",
+	"a a", ".*e h.*", ".*\\..*", "zz.*", ".*zzz.*",
+    };
+    for (unsigned int i=0; i<sizeof(patterns)/sizeof(*patterns); ++i)
+    {
+	boost::regex re(patterns[i], boost::regex::icase);
+	unsigned int expected = 0;
+	for (rs = sdb.CreateRecordset(); !rs->IsEOF(); rs->MoveNext())
+	    if (boost::regex_match(rs->GetString(1), re))
+		++expected;
+
+	db::QueryPtr qp = sdb.CreateQuery();
+	qp->Where(qp->Restrict(1, db::LIKE, patterns[i]));
+	assert(Count(qp) == expected);
+	std::string explain = qp->Explain();
+	assert(explain.find("text #1") == 0 || explain == "empty");
+	assert(explain.find("filter") == std::string::npos);
+	(void)!expected;
+    }
+
+    /* Anything else is still a regex */
+    db::QueryPtr qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::LIKE, "l[aeiou]ve.*"));
+    assert(Count(qp) == 2*NWORDS);
+    assert(qp->Explain().find("scan") == 0);
+
+    /* Case-folding isn't just ASCII */
+    rs = sdb.CreateRecordset();
+    rs->AddRecord();
+    rs->SetString(1, "BEYONC\xC3\x89");
+    rs->Commit();
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::LIKE, ".*onc\xC3\xA9"));
+    assert(Count(qp) == 1);
+
+    /* Changes and deletions keep the index up to date */
+    rs->SetString(1, "gone");
+    rs->Commit();
+    assert(Count(qp) == 0);
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::LIKE, "GON.*"));
+    assert(Count(qp) == 1);
+    rs->Delete();
+    assert(Count(qp) == 0);
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::LIKE, ".*heme.*"));
+    unsigned int before = Count(qp);
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::EQ, 1));
+    rs = qp->Execute();
+    assert(rs->GetString(1) == "Love Love");
+    rs->SetString(1, "Theme Park");
+    rs->Commit();
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::LIKE, ".*heme.*"));
+    assert(Count(qp) == before + 1);
+
+    /* Combined with other restrictions, as a receiver search does */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->And(qp->Restrict(1, db::LIKE, "the.*"),
+		      qp->Restrict(0, db::GT, 20)));
+    qp->CollateBy(1);
+    unsigned int n = 0;
+    for (rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+    {
+	assert(rs->GetString(0).find("THEME") == 0);
+	++n;
+    }
+    assert(n == NWORDS);
+    (void)!before;
+}
+
+/** Check ORDER BY: several keys, either direction, and LIMIT.
+ */
+static void TestSort()
+{
+    enum { N = 504 };
+
+    Database sdb(4);
+    sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(1, db::steam::FIELD_STRING|db::steam::FIELD_COLLATE);
+    sdb.SetFieldInfo(2, db::steam::FIELD_STRING);
+    sdb.SetFieldInfo(3, db::steam::FIELD_STRING|db::steam::FIELD_COLLATE
+		     |db::steam::FIELD_INDEXED);
+    SnapshotView view(&sdb);
+
+    static const char *const names[] = {
+	"abba", "ABBA", "Abb\xC3\xA9", "10cc", "808 State", "A-ha", "abb", "",
+    };
+    enum { NNAMES = sizeof(names)/sizeof(names[0]) };
+
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    for (unsigned int i=0; i<N; ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(0, (i * 37) % 101);
+	rs->SetString(1, names[i % NNAMES]);
+	rs->SetString(2, names[i % NNAMES]);
+	if (*names[i % NNAMES])
+	    rs->SetString(3, names[i % NNAMES]); // else leave it unset
+	rs->Commit();
+    }
+
+    /* Collated: numbers by value, then case, accents and punctuation
+     * ignored (but breaking ties)
+     */
+    static const char *const collated[] = {
+	"", "10cc", "808 State", "abb", "ABBA", "abba", "Abb\xC3\xA9", "A-ha",
+    };
+    sdb.Publish();
+    unsigned int n = 0, prev = 0;
+    std::string prevs;
+    for (unsigned int pass = 0; pass < 4; ++pass)
+    {
+	// Unindexed, indexed, indexed from a snapshot (twice, the second
+	// time using the ranks cached by the first)
+	unsigned int field = pass ? 3 : 1;
+	db::QueryPtr qp = (pass < 2) ? sdb.CreateQuery() : view.CreateQuery();
+	qp->OrderBy(field);
+	qp->OrderBy(0, true);
+	n = 0;
+	for (rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext(), ++n)
+	{
+	    std::string s = rs->GetString(field);
+	    unsigned int v = rs->GetInteger(0);
+	    assert(s == collated[n * NNAMES / N]);
+	    if (n && s == prevs)
+		assert(v <= prev);
+	    prev = v;
+	    prevs = s;
+	}
+	assert(n == N);
+    }
+
+    /* Not collated: byte-wise, descending */
+    db::QueryPtr qp = sdb.CreateQuery();
+    qp->OrderBy(2, true);
+    qp->OrderBy(0);
+    n = 0;
+    for (rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext(), ++n)
+    {
+	std::string s = rs->GetString(2);
+	unsigned int v = rs->GetInteger(0);
+	if (n)
+	    assert(s < prevs || (s == prevs && v >= prev));
+	prev = v;
+	prevs = s;
+    }
+    assert(n == N);
+    assert(prevs == "");
+
+    /* Top-N gives the same first records as sorting the lot */
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::GT, 50));
+    qp->OrderBy(0, true);
+    qp->OrderBy(2);
+    std::vector<std::string> all;
+    for (rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+	all.push_back(rs->GetString(0) + "/" + rs->GetString(2));
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(0, db::GT, 50));
+    qp->OrderBy(0, true);
+    qp->OrderBy(2);
+    qp->Limit(20);
+    assert(qp->Explain().find(" | top 20 #0 desc #2") != std::string::npos);
+    n = 0;
+    for (rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext(), ++n)
+	assert(rs->GetString(0) + "/" + rs->GetString(2) == all[n]);
+    assert(n == 20);
+    assert(all[0].find("100/") == 0);
+
+    // Counts include what the limit cut off, but a lazy scan can't count
+    size_t count = 0;
+    unsigned int rc = rs->GetCount(&count);
+    assert(rc == 0);
+    assert(count == all.size());
+    rs = sdb.CreateQuery()->Execute();
+    rc = rs->GetCount(&count);
+    assert(rc == ENOSYS);
+
+    (void)!prev;
+}
+
+/** Integer arrays: slicing, in-place changes, and the element index.
+ */
+static void TestArrays()
+{
+    Database sdb(2);
+    sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(1, db::steam::FIELD_ARRAY|db::steam::FIELD_INDEXED);
+    sdb.SetPublishInterval(1000000);
+    SnapshotView view(&sdb);
+
+    std::vector<unsigned int> vec;
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    for (unsigned int i=1; i<=3; ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(0, i);
+	vec.clear();
+	for (unsigned int j=0; j<i*10; ++j)
+	    vec.push_back(100 + j);
+	rs->SetArray(1, vec);
+    }
+
+    // Last record is 3: 100..129
+    assert(rs->GetArraySize(1) == 30);
+    rs->GetArray(1, &vec, 25, 10);
+    assert(vec.size() == 5);
+    assert(vec[0] == 125);
+    assert(vec[4] == 129);
+    rs->GetArray(1, &vec, 30, 10);
+    assert(vec.empty());
+
+    // The string form is the old encoding, both ways
+    rs->GetArray(1, &vec);
+    std::string s = rs->GetString(1);
+    assert(s == db::EncodeArray(vec));
+    rs->SetString(1, s);
+    assert(rs->GetArraySize(1) == 30);
+
+    rs->AppendToArray(1, 7);
+    rs->AppendToArray(1, 100);
+    assert(rs->GetArraySize(1) == 32);
+    rs->RemoveFromArray(1, 100);
+    assert(rs->GetArraySize(1) == 30);
+    rs->GetArray(1, &vec, 0, 1);
+    assert(vec[0] == 101);
+    rs->GetArray(1, &vec, 29, 1);
+    assert(vec[0] == 7);
+    rs->Commit();
+    sdb.Publish();
+
+    // Child to parents, by the element index
+    db::QueryPtr qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, 115));
+    assert(qp->Explain().find("lookup") == 0);
+    assert(Count(qp) == 2);
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, 100));
+    assert(Count(qp) == 2);
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::GE, 125));
+    assert(Count(qp) == 1);
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::NE, 100));
+    assert(Count(qp) == 1);
+
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, 7));
+    db::RecordsetPtr rs2 = qp->Execute();
+    assert(!rs2->IsEOF());
+    assert(rs2->GetInteger(0) == 3);
+
+    // Snapshot readers don't see changes in place
+    db::RecordsetPtr vrs = view.CreateQuery()->Execute();
+    vrs->MoveNext();
+    vrs->MoveNext();
+    assert(vrs->GetInteger(0) == 3);
+    rs->AppendToArray(1, 8);
+    assert(rs->GetArraySize(1) == 31);
+    assert(vrs->GetArraySize(1) == 30);
+
+    // Deleting takes it out of the index
+    rs->Delete();
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, 7));
+    assert(Count(qp) == 0);
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, 115));
+    assert(Count(qp) == 1);
+}
+
+static void TestFetch()
+{
+    Database sdb(2);
+    sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(1, db::steam::FIELD_INT);
+    sdb.SetPublishInterval(1000000);
+    SnapshotView view(&sdb);
+
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    for (unsigned int i=1; i<=10; ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(0, i*10);
+	rs->SetInteger(1, i);
+	rs->Commit();
+    }
+    sdb.Publish();
+
+    // In the order asked for, skipping the missing ones
+    std::vector<unsigned int> ids = { 70, 20, 55, 100, 20, 0 };
+    rs = sdb.Fetch(0, ids);
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(1) == 7);
+    rs->MoveNext();
+    assert(rs->GetInteger(1) == 2);
+    rs->MoveNext();
+    assert(rs->GetInteger(1) == 10);
+    rs->MoveNext();
+    assert(rs->GetInteger(1) == 2);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    // Unindexed fields get the default, one query per value
+    ids = { 3, 11, 1 };
+    rs = sdb.Fetch(1, ids);
+    assert(rs->GetInteger(0) == 30);
+    rs->MoveNext();
+    assert(rs->GetInteger(0) == 10);
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
+    // Snapshot readers don't see later changes
+    rs = sdb.Fetch(0, std::vector<unsigned int>(1, 50));
+    rs->SetInteger(1, 42);
+    rs->Commit();
+    db::RecordsetPtr vrs = view.Fetch(0, std::vector<unsigned int>(1, 50));
+    assert(vrs->GetInteger(1) == 5);
+    sdb.Publish();
+    vrs = view.Fetch(0, std::vector<unsigned int>(1, 50));
+    assert(vrs->GetInteger(1) == 42);
+}
+
+template <class K, class V>
+static void AssertSame(const ChunkedMap<K,V>& cm, const std::map<K,V>& m)
+{
+    assert(cm.size() == m.size());
+    typename ChunkedMap<K,V>::const_iterator i = cm.begin();
+    for (typename std::map<K,V>::const_iterator j = m.begin();
+	 j != m.end();
+	 ++j, ++i)
+    {
+	assert(i != cm.end());
+	assert(i->first == j->first && i->second == j->second);
+    }
+    assert(i == cm.end());
+}
+
+/** ChunkedMap against std::map, through splits and merges; and copies,
+ * as made for each published version, stay as they were.
+ */
+static void TestChunkedMap()
+{
+    ChunkedMap<unsigned int, unsigned int> cm;
+    std::map<unsigned int, unsigned int> m;
+    assert(cm.empty());
+    assert(cm.begin() == cm.end());
+    assert(cm.find(1) == cm.end());
+    assert(cm.lower_bound(1) == cm.end());
+
+    std::vector<ChunkedMap<unsigned int, unsigned int> > copies;
+    std::vector<std::map<unsigned int, unsigned int> > expected;
+
+    unsigned int seed = 42;
+    for (unsigned int epoch = 1; epoch <= 20; ++epoch)
+    {
+	copies.push_back(cm);
+	expected.push_back(m);
+	cm.SetEpoch(epoch);
+
+	// Grow for a while, then shrink to (nearly) nothing
+	for (unsigned int i=0; i<2000; ++i)
+	{
+	    seed = seed * 1103515245 + 12345;
+	    unsigned int key = (seed >> 8) % 5000;
+	    if (epoch <= 10)
+	    {
+		cm[key] = epoch;
+		m[key] = epoch;
+	    }
+	    else
+	    {
+		cm.erase(key);
+		m.erase(key);
+		cm.erase(key + 5000); // Never there
+	    }
+	}
+	AssertSame(cm, m);
+
+	for (unsigned int key = 0; key < 5010; key += 7)
+	{
+	    ChunkedMap<unsigned int, unsigned int>::const_iterator i
+		= cm.find(key);
+	    assert((i == cm.end()) == (m.find(key) == m.end()));
+	    i = cm.lower_bound(key);
+	    if (m.lower_bound(key) == m.end())
+		assert(i == cm.end());
+	    else
+		assert(i->first == m.lower_bound(key)->first);
+	    i = cm.upper_bound(key);
+	    if (m.upper_bound(key) == m.end())
+		assert(i == cm.end());
+	    else
+		assert(i->first == m.upper_bound(key)->first);
+	}
+    }
+
+    for (size_t i=0; i<copies.size(); ++i)
+	AssertSame(copies[i], expected[i]);
+
+    // Sets inside a map are shared in chunks too, so must be copied too
+    typedef ChunkedMap<unsigned int, ChunkedSet<unsigned int> > index_t;
+    index_t index;
+    index.SetEpoch(1);
+    for (unsigned int i=0; i<1000; ++i)
+	index[i % 3].insert(i);
+    index_t copy = index;
+    index.SetEpoch(2);
+    index[0].erase(0);
+    index[1].insert(5000);
+    index.erase(2);
+    assert(copy.size() == 3);
+    assert(copy.find(0)->second.size() == 334);
+    assert(copy.find(0)->second.count(0));
+    assert(!copy.find(1)->second.count(5000));
+    assert(copy.find(2)->second.size() == 333);
+    assert(index.size() == 2);
+    assert(index.find(0)->second.size() == 333);
+    assert(!index.find(0)->second.count(0));
+    assert(index.find(1)->second.count(5000));
+    assert(*index.find(1)->second.begin() == 1);
+}
+
+static void TestViews()
+{
+    Database sdb(3);
+    sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(1, db::steam::FIELD_STRING);
+    sdb.SetFieldInfo(2, db::steam::FIELD_ARRAY);
+
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(0, 4000000000u);
+    rs->SetString(1, "a string too long to fit inside a std::string");
+    std::vector<unsigned int> vec = { 1, 2, 3 };
+    rs->SetArray(2, vec);
+    rs->Commit();
+    rs->AddRecord();
+    rs->SetInteger(0, 7);
+    rs->Commit();
+
+    rs = sdb.CreateRecordset();
+    std::string scratch[3];
+
+    // Strings aren't copied; integers are formatted into the scratch
+    std::string_view sv = rs->GetStringView(1, &scratch[1]);
+    assert(sv == rs->GetString(1));
+    assert(sv.data() != scratch[1].data());
+    assert(scratch[1].empty());
+    sv = rs->GetStringView(0, &scratch[0]);
+    assert(sv == "4000000000");
+    assert(sv.data() == scratch[0].data());
+    sv = rs->GetStringView(2, &scratch[2]);
+    assert(sv == db::EncodeArray(vec));
+
+    static const unsigned int fields[] = { 2, 1, 0 };
+    std::string_view views[3];
+    rs->GetStringViews(fields, 3, views, scratch);
+    assert(views[0] == db::EncodeArray(vec));
+    assert(views[1] == rs->GetString(1));
+    assert(views[2] == "4000000000");
+
+    rs->MoveNext();
+    rs->GetStringViews(fields, 3, views, scratch);
+    assert(views[0].empty());
+    assert(views[1].empty());
+    assert(views[2] == "7");
+
+    rs->MoveNext();
+    assert(rs->IsEOF());
+    assert(rs->GetStringView(1, &scratch[1]).empty());
+}
+
+/** Records span several chunks of the record list; a change after a
+ * publication copies only the chunk it touches, leaving the snapshot as
+ * it was.
+ */
+static void TestRecordChunks()
+{
+    Database sdb(2);
+    sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb.SetPublishInterval(1000000);
+    SnapshotView view(&sdb);
+
+    db::RecordsetPtr rs = sdb.CreateRecordset();
+    for (unsigned int i=0; i<1000; ++i)
+    {
+	rs->AddRecord();
+	rs->SetInteger(0, i);
+	rs->SetString(1, "old");
+    }
+    rs->Commit();
+    sdb.Publish();
+
+    db::RecordsetPtr vrs = view.CreateRecordset();
+    uint64_t rev = vrs->GetRevision();
+    assert(rev != 0);
+
+    // Delete a whole chunk's worth, and change one record further on
+    rs = sdb.CreateRecordset();
+    for (unsigned int i=0; !rs->IsEOF(); ++i)
+    {
+	if (i >= 256 && i < 512)
+	    rs->Delete();
+	else
+	{
+	    if (i == 700)
+		rs->SetString(1, "new");
+	    rs->MoveNext();
+	}
+    }
+    rs->Commit();
+
+    unsigned int n = 0;
+    for (rs = sdb.CreateRecordset(); !rs->IsEOF(); rs->MoveNext())
+    {
+	unsigned int i = rs->GetInteger(0);
+	assert(i < 256 || i >= 512);
+	assert(rs->GetString(1) == (i == 700 ? "new" : "old"));
+	++n;
+    }
+    assert(n == 744);
+
+    // The snapshot still has them all, as they were
+    n = 0;
+    for (; !vrs->IsEOF(); vrs->MoveNext())
+    {
+	assert(vrs->GetInteger(0) == n);
+	assert(vrs->GetString(1) == "old");
+	++n;
+    }
+    assert(n == 1000);
+
+    sdb.Publish();
+    db::QueryPtr qp = view.CreateQuery();
+    qp->Where(qp->Restrict(0, db::EQ, 700));
+    vrs = qp->Execute();
+    assert(!vrs->IsEOF());
+    assert(vrs->GetString(1) == "new");
+    assert(vrs->GetRevision() > rev);
+    vrs = view.CreateRecordset();
+    assert(vrs->GetInteger(0) == 0);
+    assert(vrs->GetRevision() == rev);
+}
+
 void Test()
 {
+    TestChunkedMap();
+    TestPlanner();
+    TestTextIndex();
+    TestSort();
+    TestArrays();
+    TestFetch();
+    TestViews();
+    TestRecordChunks();
+
     db::steam::Database sdb(2);
     
     sdb.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
@@ -298,6 +1008,104 @@ void Test()
     rs3->SetInteger(2, 110);
     assert(rs3->GetString(2) == "110");
 
+    /* Snapshot readers see only what's been published */
+    Database sdb4(2);
+    sdb4.SetFieldInfo(0, db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb4.SetFieldInfo(1, db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+    sdb4.SetPublishInterval(1000000);
+    SnapshotView view(&sdb4);
+
+    rs = sdb4.CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(0, 1);
+    rs->SetString(1, "one");
+    rs->Commit();
+
+    db::RecordsetPtr vrs = view.CreateRecordset();
+    assert(vrs->IsEOF());
+    sdb4.Publish();
+    vrs = view.CreateRecordset();
+    assert(!vrs->IsEOF());
+    assert(vrs->GetString(1) == "one");
+
+    /* Published records have a revision, even read live */
+    uint64_t rev1 = vrs->GetRevision();
+    assert(rev1 != 0);
+    assert(rs->GetRevision() == rev1);
+
+    /* ...and keep seeing it, whatever happens to the live version */
+    rs->SetString(1, "uno");
+    assert(rs->GetRevision() == 0);
+    rs->AddRecord();
+    rs->SetInteger(0, 2);
+    rs->SetString(1, "two");
+    rs->Commit();
+    assert(vrs->GetString(1) == "one");
+    assert(vrs->GetRevision() == rev1);
+
+    qp = view.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, "one"));
+    db::RecordsetPtr rs4 = qp->Execute();
+    assert(!rs4->IsEOF());
+    assert(rs4->GetInteger(0) == 1);
+
+    sdb4.Publish();
+    assert(vrs->GetString(1) == "one");
+    assert(view.CreateRecordset()->GetRevision() > rev1);
+    vrs->MoveNext();
+    assert(vrs->IsEOF());
+    assert(rs4->GetString(1) == "one");
+
+    qp = view.CreateQuery();
+    qp->Where(qp->Restrict(1, db::EQ, "one"));
+    assert(qp->Execute()->IsEOF());
+
+    qp = view.CreateQuery();
+    qp->OrderBy(1);
+    rs4 = qp->Execute();
+    assert(!rs4->IsEOF());
+    assert(rs4->GetString(1) == "two");
+    rs4->MoveNext();
+    assert(!rs4->IsEOF());
+    assert(rs4->GetString(1) == "uno");
+    rs4->MoveNext();
+    assert(rs4->IsEOF());
+
+    /* Writing through a view goes live, and publishes on Commit */
+    qp = view.CreateQuery();
+    qp->Where(qp->Restrict(0, db::EQ, 1));
+    rs4 = qp->Execute();
+    vrs = view.CreateRecordset();
+    assert(!vrs->IsEOF());
+    vrs->SetString(1, "eins");
+    assert(vrs->GetString(1) == "eins");
+    assert(rs4->GetString(1) == "uno");
+    vrs->Commit();
+    assert(rs4->GetString(1) == "uno");
+
+    qp = view.CreateQuery();
+    qp->CollateBy(1);
+    rs4 = qp->Execute();
+    assert(!rs4->IsEOF());
+    assert(rs4->GetString(1) == "eins");
+    rs4->MoveNext();
+    assert(!rs4->IsEOF());
+    assert(rs4->GetString(1) == "two");
+    rs4->MoveNext();
+    assert(rs4->IsEOF());
+
+    /* Deletion */
+    rs = sdb4.CreateRecordset();
+    rs->Delete();
+    vrs = view.CreateRecordset();
+    assert(vrs->GetString(1) == "eins");
+    sdb4.Publish();
+    vrs = view.CreateRecordset();
+    assert(!vrs->IsEOF());
+    assert(vrs->GetString(1) == "two");
+    vrs->MoveNext();
+    assert(vrs->IsEOF());
+
     (void)!rc;
     (void)!id1;
     (void)!id2;
@@ -16,6 +16,7 @@ Connection::Connection(util::http::Client *client,
       m_msmediareceiver(&m_device_client,
 			::upnp::s_service_id_ms_receiver_registrar, this),
       m_nextid(0x110),
+      m_infomap_parent(0),
       m_search_caps(0),
       m_forbidden(false)
 {
@@ -50,16 +50,19 @@ class Connection: public util::PerObjectRecursiveLocking,
     {
 	unsigned int type;
 	std::string title;
+	unsigned int index; ///< Position among m_infomap_parent's children
     };
     
     typedef std::map<unsigned int, BasicInfo> infomap_t;
     infomap_t m_infomap;
+    unsigned int m_infomap_parent; ///< Whose children are in m_infomap
 
     friend class Query;
     friend class Recordset;
     friend class RecordsetOne;
     friend class SearchRecordset;
     friend class CollateRecordset;
+    friend class FetchRecordset;
 
     /** Bit N set => can search by field N
      *
@@ -43,6 +43,14 @@ db::QueryPtr Database::CreateQuery()
     return db::QueryPtr(new Query(&m_connection));
 }
 
+db::RecordsetPtr Database::Fetch(unsigned int which,
+				 const std::vector<unsigned int>& values)
+{
+    if (which != mediadb::ID)
+	return db::Database::Fetch(which, values);
+    return db::RecordsetPtr(new FetchRecordset(&m_connection, values));
+}
+
 std::string Database::GetURL(unsigned int id)
 {
     RecordsetOne rs(&m_connection, id);
@@ -46,6 +46,8 @@ public:
     // Being a Database
     RecordsetPtr CreateRecordset() override;
     QueryPtr CreateQuery() override;
+    RecordsetPtr Fetch(unsigned int which,
+		       const std::vector<unsigned int>& values) override;
 
     // Being a mediadb::Database
     unsigned int AllocateID() override { return m_connection.AllocateID(); }
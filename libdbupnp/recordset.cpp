@@ -5,8 +5,10 @@
 #include "libmediadb/schema.h"
 #include "libdb/free_rs.h"
 #include "libutil/trace.h"
+#include <algorithm>
 #include <sstream>
 #include <errno.h>
+#include <limits.h>
 
 namespace db {
 namespace upnp {
@@ -107,6 +109,7 @@ void Recordset::GetChildren() const
     Connection::Lock lock(m_parent);
 
     m_parent->m_infomap.clear();
+    m_parent->m_infomap_parent = m_id;
 
     std::string objectid = m_parent->ObjectIdForId(m_id);
 
@@ -161,6 +164,7 @@ void Recordset::GetChildren() const
 		    mediadb::didl::ToRecord(*i, child_rs);
 		    bi.type = child_rs->GetInteger(mediadb::TYPE);
 		    bi.title = child_rs->GetString(mediadb::TITLE);
+		    bi.index = (unsigned int)(childvec.size() - 1);
 		    m_parent->m_infomap[id] = bi;
 		}
 	    }
@@ -215,6 +219,168 @@ bool RecordsetOne::IsEOF() const
 }
 
 
+        /* FetchRecordset */
+
+
+FetchRecordset::FetchRecordset(Connection *parent,
+			       const std::vector<unsigned int>& ids)
+    : Recordset(parent),
+      m_index(0)
+{
+    m_ids.reserve(ids.size());
+    for (unsigned int id: ids)
+	if (id)
+	    m_ids.push_back(id);
+
+    GetAll();
+    SelectThisItem();
+}
+
+void FetchRecordset::GetAll()
+{
+    Connection::Lock lock(m_parent);
+
+    /* Which of the last-listed container's children do we need?
+     */
+    std::vector<unsigned int> indexes;
+    const Connection::infomap_t& infomap = m_parent->m_infomap;
+    for (unsigned int id: m_ids)
+    {
+	Connection::infomap_t::const_iterator ci = infomap.find(id);
+	if (ci != infomap.end())
+	    indexes.push_back(ci->second.index);
+    }
+    if (indexes.empty())
+	return;
+    std::sort(indexes.begin(), indexes.end());
+
+    std::string objectid = m_parent->ObjectIdForId(m_parent->m_infomap_parent);
+
+    /* Only the runs of children we need, so that a few IDs scattered
+     * through a large container don't cost Browses of all of it. Runs
+     * less than a LUMP apart are joined: Browsing the gap costs less than
+     * another round trip.
+     */
+    size_t i = 0;
+    while (i < indexes.size())
+    {
+	unsigned int first = indexes[i];
+	unsigned int last = first;
+	while (++i < indexes.size() && indexes[i] < last + LUMP)
+	    last = indexes[i];
+	GetRun(objectid, first, last);
+    }
+}
+
+/** Browses children first..last of objectid into m_metadata */
+void FetchRecordset::GetRun(const std::string& objectid, unsigned int first,
+			    unsigned int last)
+{
+    unsigned int start = first;
+    while (start <= last)
+    {
+	std::string result;
+	uint32_t nret = 0;
+	uint32_t total = 0;
+	unsigned int rc = m_parent->GetContentDirectory()
+	    ->Browse(objectid,
+		     ::upnp::ContentDirectory::BROWSEFLAG_BROWSE_DIRECT_CHILDREN,
+		     "*", start, std::min(last + 1 - start, (unsigned)LUMP),
+		     "", &result, &nret, &total, NULL);
+	if (rc != 0)
+	    break;
+
+	mediadb::didl::MetadataList ml = mediadb::didl::Parse(result);
+	for (mediadb::didl::MetadataList::iterator i = ml.begin();
+	     i != ml.end();
+	     ++i)
+	{
+	    for (mediadb::didl::Metadata::const_iterator j = i->begin();
+		 j != i->end();
+		 ++j)
+	    {
+		if (j->tag == "id")
+		{
+		    unsigned int id = m_parent->IdForObjectId(j->content);
+		    m_metadata[id].swap(*i);
+		    break;
+		}
+	    }
+	}
+
+	// The server may return fewer than asked for
+	if (nret == 0 || start + nret >= total)
+	    break;
+	start += nret;
+    }
+}
+
+/** Browses the metadata of an ID that GetAll didn't find; returns
+ * m_metadata.end() if there's no such object.
+ */
+FetchRecordset::metadata_t::const_iterator FetchRecordset::GetOne(
+    unsigned int id)
+{
+    std::string objectid = m_parent->ObjectIdForId(id);
+    if (objectid.empty())
+	return m_metadata.end();
+
+    std::string result;
+    unsigned int rc = m_parent->GetContentDirectory()
+	->Browse(objectid,
+		 ::upnp::ContentDirectory::BROWSEFLAG_BROWSE_METADATA,
+		 "*", 0, 0, "", &result, NULL, NULL, NULL);
+    if (rc != 0)
+	return m_metadata.end();
+
+    mediadb::didl::MetadataList ml = mediadb::didl::Parse(result);
+    if (ml.empty())
+	return m_metadata.end();
+
+    mediadb::didl::Metadata& md = m_metadata[id];
+    md.swap(ml.front());
+    return m_metadata.find(id);
+}
+
+/** Moves to the first ID, from m_index on, that has a record */
+void FetchRecordset::SelectThisItem()
+{
+    m_got_what = 0;
+    m_freers = NULL;
+
+    for (; !IsEOF(); ++m_index)
+    {
+	m_id = m_ids[m_index];
+
+	metadata_t::const_iterator ci = m_metadata.find(m_id);
+	if (ci == m_metadata.end())
+	    ci = GetOne(m_id);
+	if (ci != m_metadata.end())
+	{
+	    m_freers = db::FreeRecordset::Create();
+	    mediadb::didl::ToRecord(ci->second, m_freers);
+	    m_got_what = GOT_BASIC|GOT_TAGS;
+	    return;
+	}
+    }
+    m_id = 0;
+}
+
+void FetchRecordset::MoveNext()
+{
+    if (!IsEOF())
+    {
+	++m_index;
+	SelectThisItem();
+    }
+}
+
+bool FetchRecordset::IsEOF() const
+{
+    return m_index >= m_ids.size();
+}
+
+
         /* CollateRecordset */
 
 
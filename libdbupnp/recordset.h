@@ -4,6 +4,7 @@
 #include "libdb/readonly_rs.h"
 #include "libmediadb/didl.h"
 #include "libutil/counted_pointer.h"
+#include <map>
 #include <string>
 #include <vector>
 
@@ -97,6 +98,38 @@ public:
     bool IsEOF() const;
 };
 
+/** The records with a list of IDs (see db::Database::Fetch).
+ *
+ * When the IDs are children of the container last listed by GetChildren --
+ * the usual case, a client fetching the contents of a directory -- their
+ * metadata comes from Browses of just the runs of that container's
+ * children which hold them, instead of one Browse per ID. Any others are
+ * fetched one at a time, as usual; IDs with no such object are skipped.
+ */
+class FetchRecordset: public Recordset
+{
+    std::vector<unsigned int> m_ids;
+    size_t m_index;
+
+    enum { LUMP = 32 };
+
+    typedef std::map<unsigned int, mediadb::didl::Metadata> metadata_t;
+    metadata_t m_metadata;
+
+    void GetAll();
+    void GetRun(const std::string& objectid, unsigned int first,
+		unsigned int last);
+    metadata_t::const_iterator GetOne(unsigned int id);
+    void SelectThisItem();
+
+public:
+    FetchRecordset(Connection *db, const std::vector<unsigned int>& ids);
+
+    // Remaining Recordset methods
+    void MoveNext();
+    bool IsEOF() const;
+};
+
 } // namespace upnpav
 } // namespace db
 
@@ -0,0 +1,532 @@
+#include "config.h"
+#include "binary.h"
+#include "libdb/db.h"
+#include "libdb/recordset.h"
+#include "schema.h"
+#include "libutil/trace.h"
+#include "libutil/errors.h"
+#include "libutil/endian.h"
+#include "libutil/adler32.h"
+#include "libutil/counted_pointer.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace mediadb {
+
+enum {
+    MAGIC = 0x42446843, // "ChDB", little-endian
+    FORMAT_VERSION = 1
+};
+
+/** Header words */
+enum {
+    H_MAGIC,
+    H_VERSION,
+    H_SCHEMA,
+    H_NFIELDS,
+    H_NRECORDS,
+    H_STRINGS,         ///< Offset of string table
+    H_STRINGS_SIZE,    ///< In bytes
+    H_COLUMNS,         ///< Offset of columns (H_NFIELDS * H_NRECORDS words)
+    H_CHILDREN,        ///< Offset of children table
+    H_CHILDREN_SIZE,   ///< In words
+    H_IDS,             ///< Offset of ID index (H_NRECORDS words)
+    H_FILE_SIZE,
+    H_CHECKSUM,        ///< Adler-32 of bytes H_WORDS*4 .. H_FILE_SIZE
+
+    H_WORDS
+};
+
+enum { HEADER_SIZE = H_WORDS * 4 };
+
+/** How each field is stored. These are the fields ReadXML and WriteXML
+ * treat as integers; everything else goes through the string table, so
+ * that (for instance) a missing year stays distinct from year "0".
+ */
+static bool IsIntegerField(unsigned int field)
+{
+    return field == mediadb::ID
+	|| field == mediadb::TYPE
+	|| field == mediadb::AUDIOCODEC
+	|| field == mediadb::VIDEOCODEC
+	|| field == mediadb::CONTAINER;
+}
+
+static bool IsSpecialID(unsigned int id)
+{
+    return id < 0x100;
+}
+
+static void AppendWord(std::string *s, uint32_t w)
+{
+    unsigned char buf[4];
+    write_le32(buf, w);
+    s->append((const char*)buf, 4);
+}
+
+unsigned int WriteBinary(db::Database *db, unsigned int schema, ::FILE *f)
+{
+    std::string strings(1, '\0');
+    typedef std::unordered_map<std::string, uint32_t> offsets_t;
+    offsets_t string_offsets;
+    std::vector<uint32_t> children(1, 0); // Offset 0 is "no children"
+    std::vector<std::vector<uint32_t> > columns(mediadb::FIELD_COUNT);
+    std::vector<std::pair<uint32_t, uint32_t> > ids;
+
+    for (db::RecordsetPtr rs = db->CreateRecordset();
+	 !rs->IsEOF();
+	 rs->MoveNext())
+    {
+	// Same records as WriteXML
+	uint32_t id = rs->GetInteger(mediadb::ID);
+	if (IsSpecialID(id))
+	    continue;
+	if (rs->GetInteger(mediadb::TYPE) == mediadb::RADIO)
+	    continue;
+
+	ids.push_back(std::make_pair(id, (uint32_t)columns[0].size()));
+
+	for (unsigned int i=0; i<mediadb::FIELD_COUNT; ++i)
+	{
+	    uint32_t w = 0;
+	    if (IsIntegerField(i))
+		w = rs->GetInteger(i);
+	    else if (i == mediadb::CHILDREN)
+	    {
+		std::vector<unsigned int> vec;
+		rs->GetArray(i, &vec);
+		vec.erase(std::remove_if(vec.begin(), vec.end(), IsSpecialID),
+			  vec.end());
+		if (!vec.empty())
+		{
+		    w = (uint32_t)children.size();
+		    children.push_back((uint32_t)vec.size());
+		    children.insert(children.end(), vec.begin(), vec.end());
+		}
+	    }
+	    else
+	    {
+		std::string value = rs->GetString(i);
+		if (!value.empty())
+		{
+		    offsets_t::const_iterator it = string_offsets.find(value);
+		    if (it != string_offsets.end())
+			w = it->second;
+		    else
+		    {
+			w = (uint32_t)strings.size();
+			string_offsets[value] = w;
+			strings.append(value.c_str(), value.size() + 1);
+		    }
+		}
+	    }
+	    columns[i].push_back(w);
+	}
+    }
+
+    std::sort(ids.begin(), ids.end());
+
+    uint32_t nrecords = (uint32_t)ids.size();
+    while (strings.size() & 3)
+	strings += '\0';
+
+    uint32_t header[H_WORDS];
+    header[H_MAGIC] = MAGIC;
+    header[H_VERSION] = FORMAT_VERSION;
+    header[H_SCHEMA] = schema;
+    header[H_NFIELDS] = mediadb::FIELD_COUNT;
+    header[H_NRECORDS] = nrecords;
+    header[H_STRINGS] = HEADER_SIZE;
+    header[H_STRINGS_SIZE] = (uint32_t)strings.size();
+    header[H_COLUMNS] = header[H_STRINGS] + header[H_STRINGS_SIZE];
+    header[H_CHILDREN] = header[H_COLUMNS]
+	+ mediadb::FIELD_COUNT * nrecords * 4;
+    header[H_CHILDREN_SIZE] = (uint32_t)children.size();
+    header[H_IDS] = header[H_CHILDREN] + header[H_CHILDREN_SIZE] * 4;
+    header[H_FILE_SIZE] = header[H_IDS] + nrecords * 4;
+
+    std::string body;
+    body.reserve(header[H_FILE_SIZE] - HEADER_SIZE);
+    body += strings;
+    for (unsigned int i=0; i<mediadb::FIELD_COUNT; ++i)
+	for (uint32_t j=0; j<nrecords; ++j)
+	    AppendWord(&body, columns[i][j]);
+    for (size_t j=0; j<children.size(); ++j)
+	AppendWord(&body, children[j]);
+    for (uint32_t j=0; j<nrecords; ++j)
+	AppendWord(&body, ids[j].second);
+
+    header[H_CHECKSUM] = util::Adler32(body.data(), body.size());
+
+    std::string head;
+    for (unsigned int i=0; i<H_WORDS; ++i)
+	AppendWord(&head, header[i]);
+
+    fwrite(head.data(), 1, head.size(), f);
+    fwrite(body.data(), 1, body.size(), f);
+    fflush(f);
+    if (ferror(f))
+	return (unsigned)errno;
+    return 0;
+}
+
+unsigned int ReadBinary(db::Database *db, const char *filename)
+{
+    BinarySnapshot snap;
+    unsigned int rc = snap.Open(filename);
+    if (rc)
+	return rc;
+
+    std::vector<unsigned int> children;
+
+    for (unsigned int recno=0; recno<snap.GetCount(); ++recno)
+    {
+	db::RecordsetPtr rs = db->CreateRecordset();
+	rs->AddRecord();
+
+	for (unsigned int i=0; i<mediadb::FIELD_COUNT; ++i)
+	{
+	    if (i == mediadb::CHILDREN)
+	    {
+		const uint32_t *ids;
+		unsigned int n = snap.GetChildren(recno, &ids);
+		children.resize(n);
+		for (unsigned int j=0; j<n; ++j)
+		    children[j] = le32_to_cpu(ids[j]);
+		rs->SetArray(i, children);
+	    }
+	    else if (IsIntegerField(i))
+		rs->SetInteger(i, snap.GetInteger(recno, i));
+	    else
+		rs->SetString(i, snap.GetString(recno, i));
+	}
+
+	rs->Commit();
+    }
+
+    return 0;
+}
+
+
+        /* BinarySnapshot */
+
+
+BinarySnapshot::BinarySnapshot()
+    : m_base(NULL),
+      m_size(0),
+      m_schema(0),
+      m_count(0),
+      m_columns(NULL),
+      m_strings(NULL),
+      m_strings_size(0),
+      m_children(NULL),
+      m_children_size(0),
+      m_ids(NULL)
+{
+}
+
+BinarySnapshot::~BinarySnapshot()
+{
+    Close();
+}
+
+void BinarySnapshot::Close()
+{
+    if (m_base)
+	::munmap(const_cast<unsigned char*>(m_base), m_size);
+    m_base = NULL;
+    m_size = 0;
+    m_count = 0;
+}
+
+unsigned int BinarySnapshot::Open(const char *filename)
+{
+    Close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+	return (unsigned)errno;
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0)
+    {
+	unsigned int rc = (unsigned)errno;
+	::close(fd);
+	return rc;
+    }
+
+    if (st.st_size < HEADER_SIZE || st.st_size > UINT32_MAX)
+    {
+	::close(fd);
+	TRACE << filename << " is the wrong size for a snapshot\n";
+	return EINVAL;
+    }
+
+    void *ptr = ::mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+		       fd, 0);
+    unsigned int rc = (ptr == MAP_FAILED) ? (unsigned)errno : 0;
+    ::close(fd); // The mapping stays
+    if (rc)
+	return rc;
+
+    m_base = (const unsigned char*)ptr;
+    m_size = (size_t)st.st_size;
+
+    uint32_t header[H_WORDS];
+    for (unsigned int i=0; i<H_WORDS; ++i)
+	header[i] = le32_to_cpu(((const uint32_t*)m_base)[i]);
+
+    if (header[H_MAGIC] != MAGIC
+	|| header[H_VERSION] != FORMAT_VERSION
+	|| header[H_NFIELDS] != mediadb::FIELD_COUNT
+	|| header[H_FILE_SIZE] != m_size)
+    {
+	TRACE << filename << " isn't a snapshot we can read\n";
+	Close();
+	return EINVAL;
+    }
+
+    // Sections must be in order, aligned, and inside the file
+    uint64_t nrecords = header[H_NRECORDS];
+    if (header[H_STRINGS] != HEADER_SIZE
+	|| header[H_STRINGS_SIZE] < 1
+	|| (header[H_STRINGS_SIZE] & 3)
+	|| header[H_COLUMNS] != (uint64_t)header[H_STRINGS]
+	                        + header[H_STRINGS_SIZE]
+	|| header[H_CHILDREN] != header[H_COLUMNS]
+	                         + mediadb::FIELD_COUNT * nrecords * 4
+	|| header[H_IDS] != header[H_CHILDREN]
+	                    + (uint64_t)header[H_CHILDREN_SIZE] * 4
+	|| header[H_FILE_SIZE] != header[H_IDS] + nrecords * 4)
+    {
+	TRACE << filename << " has a corrupt header\n";
+	Close();
+	return EINVAL;
+    }
+
+    if (util::Adler32(m_base + HEADER_SIZE, m_size - HEADER_SIZE)
+	!= header[H_CHECKSUM])
+    {
+	TRACE << filename << " fails its checksum\n";
+	Close();
+	return EINVAL;
+    }
+
+    m_schema = header[H_SCHEMA];
+    m_count = header[H_NRECORDS];
+    m_strings = (const char*)m_base + header[H_STRINGS];
+    m_strings_size = header[H_STRINGS_SIZE];
+    m_columns = (const uint32_t*)(m_base + header[H_COLUMNS]);
+    m_children = (const uint32_t*)(m_base + header[H_CHILDREN]);
+    m_children_size = header[H_CHILDREN_SIZE];
+    m_ids = (const uint32_t*)(m_base + header[H_IDS]);
+
+    // Make sure the string table is terminated, so a bad offset can't
+    // run off the end
+    if (m_strings[m_strings_size - 1] != '\0')
+    {
+	TRACE << filename << " has an unterminated string table\n";
+	Close();
+	return EINVAL;
+    }
+
+    return 0;
+}
+
+uint32_t BinarySnapshot::Word(unsigned int recno, unsigned int field) const
+{
+    if (recno >= m_count || field >= mediadb::FIELD_COUNT)
+	return 0;
+    return le32_to_cpu(m_columns[field * m_count + recno]);
+}
+
+bool BinarySnapshot::Find(uint32_t id, unsigned int *recno) const
+{
+    unsigned int lo = 0, hi = m_count;
+    while (lo < hi)
+    {
+	unsigned int mid = lo + (hi - lo) / 2;
+	uint32_t r = le32_to_cpu(m_ids[mid]);
+	uint32_t midid = Word(r, mediadb::ID);
+	if (midid == id)
+	{
+	    *recno = r;
+	    return true;
+	}
+	if (midid < id)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return false;
+}
+
+uint32_t BinarySnapshot::GetInteger(unsigned int recno,
+				    unsigned int field) const
+{
+    if (IsIntegerField(field))
+	return Word(recno, field);
+    return (uint32_t)strtoul(GetString(recno, field), NULL, 10);
+}
+
+const char *BinarySnapshot::GetString(unsigned int recno,
+				      unsigned int field) const
+{
+    if (IsIntegerField(field) || field == mediadb::CHILDREN)
+	return "";
+    uint32_t offset = Word(recno, field);
+    if (offset >= m_strings_size)
+	return "";
+    return m_strings + offset;
+}
+
+unsigned int BinarySnapshot::GetChildren(unsigned int recno,
+					 const uint32_t **ids) const
+{
+    uint32_t offset = Word(recno, mediadb::CHILDREN);
+    *ids = NULL;
+    if (!offset || offset >= m_children_size)
+	return 0;
+    uint32_t n = le32_to_cpu(m_children[offset]);
+    if (n > m_children_size - offset - 1)
+	return 0;
+    *ids = m_children + offset + 1;
+    return n;
+}
+
+} // namespace mediadb
+
+
+#ifdef TEST
+
+# include "xml.h"
+# include "libdbsteam/db.h"
+
+static std::string ToXML(db::Database *thedb)
+{
+    FILE *f = tmpfile();
+    mediadb::WriteXML(thedb, mediadb::SCHEMA_VERSION, f);
+    std::string s;
+    s.resize((size_t)ftell(f));
+    rewind(f);
+    size_t n = fread(&s[0], 1, s.size(), f);
+    assert(n == s.size());
+    fclose(f);
+    return s;
+}
+
+int main()
+{
+    db::steam::Database sdb(mediadb::FIELD_COUNT);
+    sdb.SetFieldInfo(mediadb::ID,
+		     db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    unsigned int rc = mediadb::ReadXML(&sdb,
+				       SRCROOT "/libmediadb/example.xml");
+    assert(rc == 0);
+
+    // Some things XML has to escape, and a zero-valued string field
+    {
+	db::RecordsetPtr rs = sdb.CreateRecordset();
+	rs->AddRecord();
+	rs->SetInteger(mediadb::ID, 0x7000);
+	rs->SetString(mediadb::TITLE, "X&Y <\xE2\x80\x99>");
+	rs->SetString(mediadb::YEAR, "0");
+	rs->SetInteger(mediadb::TYPE, mediadb::TUNE);
+	rs->SetInteger(mediadb::AUDIOCODEC, mediadb::FLAC);
+	std::vector<unsigned int> cv;
+	cv.push_back(0x7001);
+	cv.push_back(0x20); // Special ID, not written
+	cv.push_back(0x7002);
+	rs->SetString(mediadb::CHILDREN, mediadb::VectorToChildren(cv));
+	rs->Commit();
+    }
+
+    char fname[] = "test.bin.XXXXXX";
+    int fd = mkstemp(fname);
+    FILE *f = fdopen(fd, "w+");
+    assert(f != NULL);
+    rc = mediadb::WriteBinary(&sdb, mediadb::SCHEMA_VERSION, f);
+    fclose(f);
+    assert(rc == 0);
+
+    // Round trip: reads back just as the XML would
+    db::steam::Database sdb2(mediadb::FIELD_COUNT);
+    sdb2.SetFieldInfo(mediadb::ID,
+		      db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    rc = mediadb::ReadBinary(&sdb2, fname);
+    assert(rc == 0);
+    assert(ToXML(&sdb2) == ToXML(&sdb));
+
+    // Direct access
+    {
+	mediadb::BinarySnapshot snap;
+	rc = snap.Open(fname);
+	assert(rc == 0);
+	assert(snap.GetSchema() == mediadb::SCHEMA_VERSION);
+
+	unsigned int n = 0;
+	for (db::RecordsetPtr rs = sdb.CreateRecordset();
+	     !rs->IsEOF();
+	     rs->MoveNext())
+	    ++n;
+	assert(snap.GetCount() == n);
+
+	unsigned int recno;
+	assert(!snap.Find(0x6FFF, &recno));
+	assert(snap.Find(0x7000, &recno));
+	assert(snap.GetInteger(recno, mediadb::ID) == 0x7000);
+	assert(!strcmp(snap.GetString(recno, mediadb::TITLE),
+		       "X&Y <\xE2\x80\x99>"));
+	assert(!strcmp(snap.GetString(recno, mediadb::YEAR), "0"));
+	assert(!strcmp(snap.GetString(recno, mediadb::ARTIST), ""));
+	assert(snap.GetInteger(recno, mediadb::TYPE) == mediadb::TUNE);
+	assert(snap.GetInteger(recno, mediadb::AUDIOCODEC) == mediadb::FLAC);
+
+	const uint32_t *ids;
+	assert(snap.GetChildren(recno, &ids) == 2);
+	assert(le32_to_cpu(ids[0]) == 0x7001);
+	assert(le32_to_cpu(ids[1]) == 0x7002);
+
+	// Every record can be found by ID
+	for (db::RecordsetPtr rs = sdb.CreateRecordset();
+	     !rs->IsEOF();
+	     rs->MoveNext())
+	{
+	    uint32_t id = rs->GetInteger(mediadb::ID);
+	    assert(snap.Find(id, &recno));
+	    assert(rs->GetString(mediadb::PATH)
+		   == snap.GetString(recno, mediadb::PATH));
+	}
+    }
+
+    // Corruption is noticed
+    {
+	FILE *g = fopen(fname, "r+");
+	fseek(g, -5, SEEK_END);
+	int ch = fgetc(g);
+	fseek(g, -5, SEEK_END);
+	fputc(ch ^ 1, g);
+	fclose(g);
+
+	mediadb::BinarySnapshot snap;
+	assert(snap.Open(fname) == EINVAL);
+
+	db::steam::Database sdb3(mediadb::FIELD_COUNT);
+	assert(mediadb::ReadBinary(&sdb3, fname) == EINVAL);
+    }
+
+    assert(mediadb::ReadBinary(&sdb2, "no-such-file.bin") == ENOENT);
+
+    unlink(fname);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,96 @@
+/* libmediadb/binary.h
+ *
+ * Binary snapshots of databases, for quick (mmap, no parsing) reloading
+ */
+#ifndef MEDIADB_BINARY_H
+#define MEDIADB_BINARY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace db { class Database; }
+
+namespace mediadb {
+
+/** Write a db::Database (assumed to be a mediadb::Database) to a file as a
+ * binary snapshot.
+ *
+ * Writes the same records as WriteXML (i.e., not the special IDs or radio
+ * stations). The format is:
+ *
+ *  - A header: magic, format version, schema version, record and field
+ *    counts, the offset and size of each following section, and an
+ *    Adler-32 checksum of everything after the header;
+ *  - A string table of NUL-terminated strings, each distinct value once
+ *    (offset 0 is the empty string);
+ *  - One fixed-width column per field, giving for each record either an
+ *    integer value (ID, TYPE, and the codec/container fields), an offset
+ *    in the string table (most fields), or an offset in the children
+ *    table (CHILDREN);
+ *  - A children table: for each record with children, the count followed
+ *    by the child IDs;
+ *  - An ID index: record numbers in ascending order of ID.
+ *
+ * All words are 32-bit little-endian, and all sections 4-byte aligned, so
+ * that the file can be mapped and used in place.
+ */
+unsigned int WriteBinary(db::Database*, unsigned int schema, ::FILE *f);
+
+/** Read a db::Database (assumed to be a mediadb::Database) from a binary
+ * snapshot file.
+ *
+ * Fields are set as ReadXML would set them, so the results are
+ * indistinguishable.
+ */
+unsigned int ReadBinary(db::Database*, const char *filename);
+
+/** A binary snapshot file, mapped into memory and used read-only.
+ *
+ * Opening it checks the header and checksum; after that, fields are read
+ * straight out of the mapping, with no parsing and no copying.
+ */
+class BinarySnapshot
+{
+    const unsigned char *m_base;
+    size_t m_size;
+    unsigned int m_schema;
+    unsigned int m_count;
+    const uint32_t *m_columns;
+    const char *m_strings;
+    uint32_t m_strings_size;
+    const uint32_t *m_children;
+    uint32_t m_children_size;
+    const uint32_t *m_ids;
+
+    uint32_t Word(unsigned int recno, unsigned int field) const;
+
+public:
+    BinarySnapshot();
+    ~BinarySnapshot();
+
+    unsigned int Open(const char *filename);
+    void Close();
+
+    unsigned int GetSchema() const { return m_schema; }
+    unsigned int GetCount() const { return m_count; }
+
+    /** Finds the record (0..GetCount()-1) with a given ID */
+    bool Find(uint32_t id, unsigned int *recno) const;
+
+    uint32_t GetInteger(unsigned int recno, unsigned int field) const;
+
+    /** Points into the mapping, so valid until Close(). Fields stored as
+     * integers (see WriteBinary), and CHILDREN, read as "".
+     */
+    const char *GetString(unsigned int recno, unsigned int field) const;
+
+    /** Returns the number of children, and points *ids at their IDs
+     * (32-bit little-endian words in the mapping).
+     */
+    unsigned int GetChildren(unsigned int recno, const uint32_t **ids) const;
+};
+
+} // namespace mediadb
+
+#endif
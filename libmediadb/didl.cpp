@@ -14,7 +14,6 @@
 #include <stdio.h>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
-#include <sstream>
 #include <functional>
 
 LOG_DECL(UPNP);
@@ -271,28 +270,38 @@ unsigned int ToRecord(const Metadata& md, db::RecordsetPtr rs)
     return 0;
 }
 
-static std::string IfPresent(const char *tag, const std::string& value)
+/** Appends <tag attr>value</tag>, or nothing if value is empty.
+ */
+static void IfPresent(std::string *s, const char *tag, const char *attr,
+		      std::string_view value)
 {
     if (value.empty())
-	return std::string();
-    return util::SPrintf("<%s>%s</%s>", tag, util::XmlEscape(value).c_str(),
-			 tag);
-}
-
-static std::string IfPresent2(const char *tag, const char *attr,
-			      const std::string& value)
-{
-    if (value.empty())
-	return std::string();
-    return util::SPrintf("<%s %s>%s</%s>", tag, attr, 
-			 util::XmlEscape(value).c_str(), tag);
+	return;
+    *s += '<';
+    *s += tag;
+    if (attr)
+    {
+	*s += ' ';
+	*s += attr;
+    }
+    *s += '>';
+    util::XmlEscape(value, s);
+    *s += "</";
+    *s += tag;
+    *s += '>';
 }
 
-static std::string IfPresent(const char *tag, unsigned int value)
+static void IfPresent(std::string *s, const char *tag, unsigned int value)
 {
     if (!value)
-	return std::string();
-    return util::SPrintf("<%s>%u</%s>", tag, value, tag);
+	return;
+    *s += '<';
+    *s += tag;
+    *s += '>';
+    *s += std::to_string(value);
+    *s += "</";
+    *s += tag;
+    *s += '>';
 }
 
 static std::string ResItem(mediadb::Database *db, db::RecordsetPtr rs,
@@ -357,7 +366,7 @@ static std::string ResItem(mediadb::Database *db, db::RecordsetPtr rs,
 	break;
     }
     unsigned int id = rs->GetInteger(mediadb::ID);
-    std::string url = db->GetURL(id);
+    std::string url;
 
     /** @bug If we always use urlprefix if present, we end up proxying
      *       mediadbs (e.g. dbreceiver) whose native URLs are
@@ -370,6 +379,8 @@ static std::string ResItem(mediadb::Database *db, db::RecordsetPtr rs,
     {
 	url = util::SPrintf("%s%x?_range=1", urlprefix, id);
     }
+    else
+	url = db->GetURL(id); // Can mean a query, so only if needed
 
     url = util::XmlEscape(url);
 
@@ -406,10 +417,38 @@ const char s_footer[] = "</DIDL-Lite>";
 /* FromRecord */
 
 
+/** The string fields FromRecord uses, fetched all at once */
+enum {
+    F_TITLE,
+    F_ARTIST,
+    F_ALBUM,
+    F_GENRE,
+    F_COMPOSER,
+    F_REMIXED,
+    F_ENSEMBLE,
+    F_LYRICIST,
+    F_ORIGINALARTIST,
+    NFIELDS
+};
+
+static const unsigned int s_fields[NFIELDS] = {
+    mediadb::TITLE,
+    mediadb::ARTIST,
+    mediadb::ALBUM,
+    mediadb::GENRE,
+    mediadb::COMPOSER,
+    mediadb::REMIXED,
+    mediadb::ENSEMBLE,
+    mediadb::LYRICIST,
+    mediadb::ORIGINALARTIST,
+};
+
 std::string FromRecord(mediadb::Database *db, db::RecordsetPtr rs,
 		       const char *urlprefix, unsigned int filter)
 {
-    std::ostringstream os;
+    std::string s;
+    s.reserve(1024);
+
     unsigned int id = rs->GetInteger(mediadb::ID);
     int parentid = (int)rs->GetInteger(mediadb::IDPARENT);
     if (id == 0x100)
@@ -420,49 +459,55 @@ std::string FromRecord(mediadb::Database *db, db::RecordsetPtr rs,
     if (parentid == 0x100)
 	parentid = 0;
 
+    std::string_view field[NFIELDS];
+    std::string scratch[NFIELDS];
+
     unsigned int type = rs->GetInteger(mediadb::TYPE);
     if (type == mediadb::DIR || type == mediadb::PLAYLIST)
     {
-	std::vector<unsigned int> children;
-	mediadb::ChildrenToVector(rs->GetString(mediadb::CHILDREN), &children);
+	size_t nchildren = rs->GetArraySize(mediadb::CHILDREN);
 
-	LOG(UPNP) << "id " << id << " has " << children.size() << " children:"
-		  << children;
+	LOG(UPNP) << "id " << id << " has " << nchildren << " children\n";
 
-	os << "<container id=\"" << id << "\" parentID=\"" << parentid
-	   << "\" restricted=\"true\" childCount=\"" << children.size() << "\"";
+	s += "<container id=\"";
+	s += std::to_string(id);
+	s += "\" parentID=\"";
+	s += std::to_string(parentid);
+	s += "\" restricted=\"true\" childCount=\"";
+	s += std::to_string(nchildren);
+	s += '"';
 
 	/** IDs <= 0x100 are "magic" root ids: browse root, radio root, epg
 	 * root. Unlike everything else, they're searchable.
 	 */
 	if (id <= 0x100)
-	    os << " searchable=\"true\"";
+	    s += " searchable=\"true\"";
 	
-	os << ">"
-	    "<dc:title>" << util::XmlEscape(rs->GetString(mediadb::TITLE))
-	   << "</dc:title>"
+	s += "><dc:title>";
+	util::XmlEscape(rs->GetStringView(mediadb::TITLE, &scratch[0]), &s);
+	s += "</dc:title>"
 	    "<upnp:class>";
 
 	if (type == mediadb::DIR)
 	{
 	    if (id == mediadb::RADIO_ROOT)
-		os << "object.container.channelGroup";
+		s += "object.container.channelGroup";
 	    else if (id == mediadb::BROWSE_ROOT)
-		os << "object.container";
+		s += "object.container";
 	    else
-		os << "object.container.storageFolder";
+		s += "object.container.storageFolder";
 	}
 	else
-	    os << "object.container.playlistContainer";
+	    s += "object.container.playlistContainer";
 
-	os << "</upnp:class>";
+	s += "</upnp:class>";
 
 	if (filter & STORAGEUSED)
-	    os << "<upnp:storageUsed>-1</upnp:storageUsed>";
+	    s += "<upnp:storageUsed>-1</upnp:storageUsed>";
 
 	if (id == 0 && (filter & SEARCHCLASS))
 	{
-	    os << "<upnp:searchClass includeDerived=\"0\">"
+	    s += "<upnp:searchClass includeDerived=\"0\">"
 		"object.container.album.musicAlbum"
 		"</upnp:searchClass>"
 		"<upnp:searchClass includeDerived=\"0\">"
@@ -473,7 +518,7 @@ std::string FromRecord(mediadb::Database *db, db::RecordsetPtr rs,
 		"</upnp:searchClass>";
 	}
 
-	os << "</container>";
+	s += "</container>";
     }
     else
     {
@@ -497,41 +542,52 @@ std::string FromRecord(mediadb::Database *db, db::RecordsetPtr rs,
 	    break;
 	}
 
-	os << "<item id=\"" << id << "\" parentID=\"" << parentid
-	   << "\" restricted=\"true\">"
+	rs->GetStringViews(s_fields, NFIELDS, field, scratch);
 
-	    "<dc:title>" << util::XmlEscape(rs->GetString(mediadb::TITLE)) <<
-	    "</dc:title>"
-	    "<upnp:class>" << upnpclass << "</upnp:class>";
+	s += "<item id=\"";
+	s += std::to_string(id);
+	s += "\" parentID=\"";
+	s += std::to_string(parentid);
+	s += "\" restricted=\"true\">"
+	    "<dc:title>";
+	util::XmlEscape(field[F_TITLE], &s);
+	s += "</dc:title>"
+	    "<upnp:class>";
+	s += upnpclass;
+	s += "</upnp:class>";
 
 	if (filter & ARTIST)
-	    os << IfPresent("upnp:artist", rs->GetString(mediadb::ARTIST));
+	    IfPresent(&s, "upnp:artist", NULL, field[F_ARTIST]);
 	if (filter & ALBUM)
-	    os << IfPresent("upnp:album", rs->GetString(mediadb::ALBUM));
+	    IfPresent(&s, "upnp:album", NULL, field[F_ALBUM]);
 	if (filter & TRACKNUMBER)
-	    os << IfPresent("upnp:originalTrackNumber",
-			    rs->GetInteger(mediadb::TRACKNUMBER));
+	    IfPresent(&s, "upnp:originalTrackNumber",
+		      rs->GetInteger(mediadb::TRACKNUMBER));
 	if (filter & GENRE)
-	    os << IfPresent("upnp:genre", rs->GetString(mediadb::GENRE));
+	    IfPresent(&s, "upnp:genre", NULL, field[F_GENRE]);
 	if (filter & DATE)
 	{
 	    unsigned int y = rs->GetInteger(mediadb::YEAR);
 	    if (y)
-		os << "<dc:date>" << y << "-01-01</dc:date>";
+	    {
+		s += "<dc:date>";
+		s += std::to_string(y);
+		s += "-01-01</dc:date>";
+	    }
 	}
 
 	if (filter & AUTHOR)
 	{
-	    os << IfPresent2("upnp:author", "role=\"Composer\"", 
-			     rs->GetString(mediadb::COMPOSER));
-	    os << IfPresent2("upnp:author", "role=\"Remix\"", 
-			     rs->GetString(mediadb::REMIXED));
-	    os << IfPresent2("upnp:author", "role=\"Ensemble\"", 
-			     rs->GetString(mediadb::ENSEMBLE));
-	    os << IfPresent2("upnp:author", "role=\"Lyricist\"", 
-			     rs->GetString(mediadb::LYRICIST));
-	    os << IfPresent2("upnp:author", "role=\"OriginalArtist\"", 
-			     rs->GetString(mediadb::ORIGINALARTIST));
+	    IfPresent(&s, "upnp:author", "role=\"Composer\"",
+		      field[F_COMPOSER]);
+	    IfPresent(&s, "upnp:author", "role=\"Remix\"",
+		      field[F_REMIXED]);
+	    IfPresent(&s, "upnp:author", "role=\"Ensemble\"",
+		      field[F_ENSEMBLE]);
+	    IfPresent(&s, "upnp:author", "role=\"Lyricist\"",
+		      field[F_LYRICIST]);
+	    IfPresent(&s, "upnp:author", "role=\"OriginalArtist\"",
+		      field[F_ORIGINALARTIST]);
 	}
 
 	if (type == mediadb::RADIO && (filter & CHANNELID))
@@ -539,8 +595,9 @@ std::string FromRecord(mediadb::Database *db, db::RecordsetPtr rs,
 	    unsigned int service_id = rs->GetInteger(mediadb::PATH);
 	    if (service_id)
 	    {
-		os << "<upnp:channelID type=\"SI\">0,0," << service_id
-		   << "</upnp:channelID>";
+		s += "<upnp:channelID type=\"SI\">0,0,";
+		s += std::to_string(service_id);
+		s += "</upnp:channelID>";
 	    }
 	}
 
@@ -551,7 +608,7 @@ std::string FromRecord(mediadb::Database *db, db::RecordsetPtr rs,
 
 	if (filter & RES)
 	{
-	    os << ResItem(db, rs, urlprefix, filter);
+	    s += ResItem(db, rs, urlprefix, filter);
 	    unsigned int idhigh = rs->GetInteger(mediadb::IDHIGH);
 	    if (idhigh)
 	    {
@@ -559,13 +616,13 @@ std::string FromRecord(mediadb::Database *db, db::RecordsetPtr rs,
 		qp->Where(qp->Restrict(mediadb::ID, db::EQ, idhigh));
 		rs = qp->Execute();
 		if (rs && !rs->IsEOF())
-		    os << ResItem(db, rs, urlprefix, filter);
+		    s += ResItem(db, rs, urlprefix, filter);
 	    }
 	}
-	os << "</item>";
+	s += "</item>";
     }
 
-    return os.str();
+    return s;
 }
 
 } // namespace didl
@@ -0,0 +1,180 @@
+#include "config.h"
+#include "didl_cache.h"
+#include "didl.h"
+#include "schema.h"
+#include "libdb/recordset.h"
+#include "libutil/counted_pointer.h"
+
+namespace mediadb {
+namespace didl {
+
+enum {
+    MAX_PREFIXES = 64 ///< Each server address, so we don't expect many
+};
+
+Cache::Cache(mediadb::Database *db, size_t max_entries)
+    : m_db(db),
+      m_max_entries(max_entries),
+      m_hits(0),
+      m_misses(0),
+      m_uncacheable(0)
+{
+}
+
+/** The key is the ID, then the filter, then the prefix's index in
+ * m_prefixes. Call with m_mutex held.
+ */
+bool Cache::Key(unsigned int id, const std::string& urlprefix,
+		unsigned int filter, uint64_t *key)
+{
+    size_t prefix = 0;
+    while (prefix < m_prefixes.size() && m_prefixes[prefix] != urlprefix)
+	++prefix;
+    if (prefix == m_prefixes.size())
+    {
+	if (prefix == MAX_PREFIXES)
+	    return false;
+	m_prefixes.push_back(urlprefix);
+    }
+
+    *key = ((uint64_t)id << 32) | ((filter & ALL) << 16) | prefix;
+    return true;
+}
+
+void Cache::Append(const db::RecordsetPtr& rs, const std::string& urlprefix,
+		   unsigned int filter, std::string *s)
+{
+    uint64_t revision = rs->GetRevision();
+    if (revision && (filter & RES) && rs->GetInteger(mediadb::IDHIGH))
+	revision = 0;
+
+    uint64_t key = 0;
+    if (revision)
+    {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!Key(rs->GetInteger(mediadb::ID), urlprefix, filter, &key))
+	    revision = 0;
+	else
+	{
+	    std::unordered_map<uint64_t, Entry>::const_iterator i
+		= m_map.find(key);
+	    if (i != m_map.end() && i->second.revision == revision)
+	    {
+		++m_hits;
+		*s += i->second.fragment;
+		return;
+	    }
+	    ++m_misses;
+	}
+    }
+
+    std::string fragment = FromRecord(m_db, rs, urlprefix.c_str(), filter);
+    *s += fragment;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!revision)
+    {
+	++m_uncacheable;
+	return;
+    }
+    if (m_map.size() >= m_max_entries && !m_map.count(key))
+	m_map.erase(m_map.begin());
+    Entry& e = m_map[key];
+    e.revision = revision;
+    e.fragment = std::move(fragment);
+}
+
+Cache::Stats Cache::GetStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.uncacheable = m_uncacheable;
+    stats.entries = m_map.size();
+    return stats;
+}
+
+} // namespace didl
+} // namespace mediadb
+
+#ifdef TEST
+
+# include "fake_database.h"
+# include "libdb/query.h"
+# include <assert.h>
+
+static db::RecordsetPtr Find(mediadb::Database *db, unsigned int id)
+{
+    db::QueryPtr qp = db->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+    return qp->Execute();
+}
+
+int main()
+{
+    mediadb::FakeDatabase fdb;
+
+    db::RecordsetPtr rs = fdb.CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(mediadb::ID, 0x120);
+    rs->SetInteger(mediadb::TYPE, mediadb::TUNE);
+    rs->SetString(mediadb::TITLE, "Fools Gold & <More>");
+    rs->SetString(mediadb::ARTIST, "The Stone Roses");
+    rs->Commit();
+    fdb.Publish(); // Until then, the record could change under us
+
+    mediadb::didl::Cache cache(&fdb, 2);
+    const std::string prefix = "http://127.0.0.1:12078/content/";
+
+    std::string s1, s2;
+    cache.Append(Find(&fdb, 0x120), prefix, mediadb::didl::ALL, &s1);
+    assert(s1 == mediadb::didl::FromRecord(&fdb, Find(&fdb, 0x120),
+					   prefix.c_str()));
+    cache.Append(Find(&fdb, 0x120), prefix, mediadb::didl::ALL, &s2);
+    assert(s2 == s1);
+    mediadb::didl::Cache::Stats stats = cache.GetStats();
+    assert(stats.hits == 1);
+    assert(stats.misses == 1);
+    assert(stats.entries == 1);
+
+    // Filter and prefix are part of the key
+    std::string s3;
+    cache.Append(Find(&fdb, 0x120), prefix, mediadb::didl::RES, &s3);
+    assert(s3 != s1);
+    assert(s3.find("The Stone Roses") == std::string::npos);
+    s3.clear();
+    cache.Append(Find(&fdb, 0x120), "http://10.0.0.1/content/",
+		 mediadb::didl::ALL, &s3);
+    assert(s3.find("http://10.0.0.1/") != std::string::npos);
+    stats = cache.GetStats();
+    assert(stats.hits == 1);
+    assert(stats.misses == 3);
+    assert(stats.entries == 2); // Full
+
+    // Committing a change means a miss, even though the cache was warm
+    rs = Find(&fdb, 0x120);
+    rs->SetString(mediadb::ARTIST, "Ian Brown");
+    rs->Commit();
+    s2.clear();
+    cache.Append(Find(&fdb, 0x120), prefix, mediadb::didl::ALL, &s2);
+    assert(s2.find("Ian Brown") != std::string::npos);
+    fdb.Publish();
+    s2.clear();
+    cache.Append(Find(&fdb, 0x120), prefix, mediadb::didl::ALL, &s2);
+    assert(s2.find("Ian Brown") != std::string::npos);
+    assert(s2.find("The Stone Roses") == std::string::npos);
+
+    stats = cache.GetStats();
+    unsigned int hits = stats.hits;
+    s2.clear();
+    cache.Append(Find(&fdb, 0x120), prefix, mediadb::didl::ALL, &s2);
+    assert(s2.find("Ian Brown") != std::string::npos);
+    stats = cache.GetStats();
+    assert(stats.hits == hits + 1);
+    assert(stats.entries <= 2);
+
+    return 0;
+}
+
+#endif
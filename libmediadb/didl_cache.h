@@ -0,0 +1,77 @@
+#ifndef LIBMEDIADB_DIDL_CACHE_H
+#define LIBMEDIADB_DIDL_CACHE_H 1
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+namespace util { template<class> class CountedPointer; }
+namespace db { class Recordset; }
+namespace db { typedef util::CountedPointer<Recordset> RecordsetPtr; }
+
+namespace mediadb {
+
+class Database;
+
+namespace didl {
+
+/** A cache of FromRecord's results, so that browsing the same folders
+ * over and over (as control points and renderers do) needn't escape
+ * every field of every item again.
+ *
+ * Fragments are kept per record, filter and URL prefix, and are only
+ * good for as long as the record's db::Recordset::GetRevision stays the
+ * same -- so any Commit which changes the record invalidates them.
+ * Records whose engine has no revisions aren't cached, nor are items
+ * whose DIDL comes partly from another record (mediadb::IDHIGH).
+ *
+ * When full, an arbitrary fragment makes way for each new one.
+ */
+class Cache
+{
+    struct Entry
+    {
+	uint64_t revision;
+	std::string fragment;
+    };
+
+    mediadb::Database *m_db;
+    size_t m_max_entries;
+
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, Entry> m_map; ///< See Key
+    std::vector<std::string> m_prefixes; ///< Interned, for the key
+    unsigned int m_hits;
+    unsigned int m_misses;
+    unsigned int m_uncacheable;
+
+    /** Returns false if the fragment can't have a key */
+    bool Key(unsigned int id, const std::string& urlprefix,
+	     unsigned int filter, uint64_t *key);
+
+public:
+    explicit Cache(mediadb::Database*, size_t max_entries = 16384);
+
+    /** Appends FromRecord(db, rs, urlprefix, filter) to *s.
+     */
+    void Append(const db::RecordsetPtr& rs, const std::string& urlprefix,
+		unsigned int filter, std::string *s);
+
+    struct Stats
+    {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int uncacheable;
+	size_t entries;
+    };
+
+    /** For tuning: the hit rate is hits/(hits+misses+uncacheable) */
+    Stats GetStats();
+};
+
+} // namespace didl
+} // namespace mediadb
+
+#endif
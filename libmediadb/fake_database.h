@@ -67,6 +67,8 @@ public:
     {
 	return std::unique_ptr<util::Stream>(new util::StringStream(""));
     }
+
+    void Publish() { m_db.Publish(); }
 };
 
 } // namespace mediadb
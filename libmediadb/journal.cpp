@@ -0,0 +1,1002 @@
+#include "config.h"
+#include "journal.h"
+#include "schema.h"
+#include "libdb/query.h"
+#include "libdb/recordset.h"
+#include "libdb/delegating_rs.h"
+#include "libdb/delegating_query.h"
+#include "libutil/adler32.h"
+#include "libutil/endian.h"
+#include "libutil/errors.h"
+#include "libutil/file.h"
+#include "libutil/trace.h"
+#include "libutil/counted_pointer.h"
+#include <chrono>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace mediadb {
+
+/* The file is a header (magic, version), then entries. Each entry is its
+ * payload length, the Adler-32 of its payload, and the payload: an
+ * operation, a record ID, a count of changes, and the changes (field,
+ * type, then value or length-and-bytes). All words are 32-bit
+ * little-endian.
+ */
+
+enum {
+    MAGIC = 0x6C4A6843, // "ChJl", little-endian
+    VERSION = 1,
+    HEADER_SIZE = 8,
+    ENTRY_HEADER_SIZE = 8
+};
+
+/** How often to retry after a failed write, if nobody's waiting */
+enum { RETRY_MS = 1000 };
+
+enum {
+    OP_ADD = 1,
+    OP_AMEND,
+    OP_DELETE
+};
+
+static bool IsSpecialID(uint32_t id)
+{
+    return id < 0x100;
+}
+
+static void AppendWord(std::string *s, uint32_t w)
+{
+    unsigned char buf[4];
+    write_le32(buf, w);
+    s->append((const char*)buf, 4);
+}
+
+static uint32_t ReadWord(const std::string& s, size_t offset)
+{
+    uint32_t w;
+    memcpy(&w, s.data() + offset, 4);
+    return le32_to_cpu(w);
+}
+
+static std::string MakeEntry(unsigned int op, uint32_t id,
+			     const Journal::changes_t& changes)
+{
+    std::string payload;
+    payload += (char)op;
+    AppendWord(&payload, id);
+    AppendWord(&payload, (uint32_t)changes.size());
+    for (Journal::changes_t::const_iterator i = changes.begin();
+	 i != changes.end();
+	 ++i)
+    {
+	payload += (char)i->field;
+	payload += (char)i->is_string;
+	if (i->is_string)
+	{
+	    AppendWord(&payload, (uint32_t)i->sval.size());
+	    payload += i->sval;
+	}
+	else
+	    AppendWord(&payload, i->ival);
+    }
+
+    std::string entry;
+    entry.reserve(ENTRY_HEADER_SIZE + payload.size());
+    AppendWord(&entry, (uint32_t)payload.size());
+    AppendWord(&entry, util::Adler32(payload.data(), payload.size()));
+    entry += payload;
+    return entry;
+}
+
+/** Parses one entry at "offset"; returns its total size, or 0 if it's
+ * truncated or corrupt.
+ */
+static size_t ParseEntry(const std::string& data, size_t offset,
+			 unsigned int *op, uint32_t *id,
+			 Journal::changes_t *changes)
+{
+    if (data.size() - offset < ENTRY_HEADER_SIZE)
+	return 0;
+    uint32_t len = ReadWord(data, offset);
+    uint32_t sum = ReadWord(data, offset + 4);
+    offset += ENTRY_HEADER_SIZE;
+    if (len < 9 || data.size() - offset < len
+	|| util::Adler32(data.data() + offset, len) != sum)
+	return 0;
+
+    size_t end = offset + len;
+    *op = (unsigned char)data[offset];
+    *id = ReadWord(data, offset + 1);
+    uint32_t n = ReadWord(data, offset + 5);
+    offset += 9;
+
+    changes->clear();
+    for (uint32_t i=0; i<n; ++i)
+    {
+	if (end - offset < 6)
+	    return 0;
+	unsigned int field = (unsigned char)data[offset];
+	bool is_string = data[offset+1] != 0;
+	uint32_t w = ReadWord(data, offset + 2);
+	offset += 6;
+	if (is_string)
+	{
+	    if (end - offset < w)
+		return 0;
+	    changes->push_back(Journal::Change(field,
+					       data.substr(offset, w)));
+	    offset += w;
+	}
+	else
+	    changes->push_back(Journal::Change(field, w));
+    }
+    if (offset != end)
+	return 0;
+
+    return ENTRY_HEADER_SIZE + len;
+}
+
+static unsigned int ReadFile(const char *filename, std::string *data)
+{
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+	return (unsigned)errno;
+
+    char buf[65536];
+    for (;;)
+    {
+	ssize_t rc = ::read(fd, buf, sizeof(buf));
+	if (rc < 0)
+	{
+	    unsigned int err = (unsigned)errno;
+	    ::close(fd);
+	    return err;
+	}
+	if (rc == 0)
+	    break;
+	data->append(buf, (size_t)rc);
+    }
+    ::close(fd);
+    return 0;
+}
+
+static unsigned int WriteAll(int fd, const char *data, size_t len)
+{
+    while (len)
+    {
+	ssize_t rc = ::write(fd, data, len);
+	if (rc < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    return (unsigned)errno;
+	}
+	data += rc;
+	len -= (size_t)rc;
+    }
+    return 0;
+}
+
+static std::string MakeHeader()
+{
+    std::string header;
+    AppendWord(&header, MAGIC);
+    AppendWord(&header, VERSION);
+    return header;
+}
+
+/** Returns the length of the valid part of a journal file (or 0 if even
+ * the header's wrong).
+ */
+static size_t ValidLength(const std::string& data)
+{
+    if (data.size() < HEADER_SIZE || data.compare(0, HEADER_SIZE,
+						  MakeHeader()) != 0)
+	return 0;
+
+    size_t offset = HEADER_SIZE;
+    unsigned int op;
+    uint32_t id;
+    Journal::changes_t changes;
+    for (;;)
+    {
+	size_t len = ParseEntry(data, offset, &op, &id, &changes);
+	if (!len)
+	    return offset;
+	offset += len;
+    }
+}
+
+
+        /* Journal */
+
+
+Journal::Journal(unsigned int delay_ms)
+    : m_fd(-1),
+      m_delay_ms(delay_ms),
+      m_appended(0),
+      m_written(0),
+      m_base(0),
+      m_attempts(0),
+      m_error(0),
+      m_broken(false),
+      m_sync_requests(0),
+      m_sync_waiters(0),
+      m_stopping(false)
+{
+}
+
+Journal::~Journal()
+{
+    Close();
+}
+
+unsigned int Journal::Open(const char *filename)
+{
+    Close();
+
+    std::string data;
+    unsigned int rc = ReadFile(filename, &data);
+    if (rc && rc != ENOENT)
+	return rc;
+
+    int fd = ::open(filename, O_WRONLY|O_CREAT, 0644);
+    if (fd < 0)
+	return (unsigned)errno;
+
+    // Lose any torn entry at the end, or new ones would go after it and
+    // never be replayed
+    size_t valid = ValidLength(data);
+    if (valid < data.size())
+	TRACE << "Truncating journal " << filename << " from " << data.size()
+	      << " to " << valid << " bytes\n";
+    if (valid == 0)
+    {
+	std::string header = MakeHeader();
+	rc = WriteAll(fd, header.data(), header.size());
+	valid = header.size();
+    }
+    if (!rc && ::ftruncate(fd, (off_t)valid) < 0)
+	rc = (unsigned)errno;
+    if (!rc && ::lseek(fd, (off_t)valid, SEEK_SET) < 0)
+	rc = (unsigned)errno;
+    if (!rc && ::fsync(fd) < 0)
+	rc = (unsigned)errno;
+    if (rc)
+    {
+	::close(fd);
+	return rc;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_filename = filename;
+    m_fd = fd;
+    m_buffer.clear();
+    m_appended = m_written = valid - HEADER_SIZE;
+    m_base = 0;
+    m_error = 0;
+    m_broken = false;
+    m_stopping = false;
+    m_thread = std::thread(&Journal::Run, this);
+    return 0;
+}
+
+void Journal::Close()
+{
+    {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_fd < 0)
+	    return;
+	m_stopping = true;
+	m_wakeup.notify_all();
+    }
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ::close(m_fd);
+    m_fd = -1;
+    m_synced.notify_all();
+}
+
+void Journal::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t tried_for = 0; // Value of m_sync_requests at last attempt
+    for (;;)
+    {
+	while (m_buffer.empty() && !m_stopping)
+	    m_wakeup.wait(lock);
+	if (m_buffer.empty())
+	    break; // Stopping, and all written
+
+	if (m_error)
+	{
+	    // Retry a failed write now and then, or for a new Sync, but not
+	    // in a tight loop
+	    m_wakeup.wait_for(lock, std::chrono::milliseconds(RETRY_MS),
+			      [this, tried_for] {
+				  return m_stopping
+				      || m_sync_requests != tried_for;
+			      });
+	}
+	else if (!m_stopping && !m_sync_waiters)
+	{
+	    // Gather more changes, unless someone's waiting for these
+	    m_wakeup.wait_for(lock, std::chrono::milliseconds(m_delay_ms),
+			      [this] { return m_stopping || m_sync_waiters; });
+	}
+
+	tried_for = m_sync_requests;
+	std::string batch;
+	batch.swap(m_buffer);
+	int fd = m_fd;
+	off_t good = (off_t)(HEADER_SIZE + (m_written - m_base));
+	lock.unlock();
+
+	unsigned int rc = WriteAll(fd, batch.data(), batch.size());
+	if (!rc && ::fdatasync(fd) < 0)
+	    rc = (unsigned)errno;
+
+	// Lose any part-written entry, or later ones would go after it and
+	// never be replayed
+	bool broken = rc && (::ftruncate(fd, good) < 0
+			     || ::lseek(fd, good, SEEK_SET) < 0);
+
+	lock.lock();
+	++m_attempts;
+	m_error = rc;
+	if (!rc)
+	    m_written += batch.size();
+	else
+	{
+	    TRACE << "Can't write journal: " << rc << "\n";
+	    m_buffer.insert(0, batch);
+	    if (broken || m_stopping)
+	    {
+		TRACE << "Giving up on journal " << m_filename << "\n";
+		m_broken = true;
+		m_buffer.clear();
+	    }
+	}
+	m_synced.notify_all();
+	if (m_broken)
+	    break;
+    }
+}
+
+void Journal::Append(const std::string& entry)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fd < 0 || m_broken)
+	return;
+    bool was_empty = m_buffer.empty();
+    m_buffer += entry;
+    m_appended += entry.size();
+    if (was_empty)
+	m_wakeup.notify_all();
+}
+
+void Journal::Add(uint32_t id, const changes_t& changes)
+{
+    if (!IsSpecialID(id))
+	Append(MakeEntry(OP_ADD, id, changes));
+}
+
+void Journal::Amend(uint32_t id, const changes_t& changes)
+{
+    if (!IsSpecialID(id) && !changes.empty())
+	Append(MakeEntry(OP_AMEND, id, changes));
+}
+
+void Journal::Delete(uint32_t id)
+{
+    if (!IsSpecialID(id))
+	Append(MakeEntry(OP_DELETE, id, changes_t()));
+}
+
+unsigned int Journal::Sync()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t target = m_appended;
+    uint64_t attempts = m_attempts;
+    ++m_sync_requests;
+    ++m_sync_waiters;
+    m_wakeup.notify_all();
+
+    // An earlier failure doesn't count, only one after this was called
+    while (m_fd >= 0 && m_written < target && !m_broken
+	   && (!m_error || m_attempts == attempts))
+	m_synced.wait(lock);
+    --m_sync_waiters;
+    if (m_broken)
+	return m_error;
+    return m_written < target ? m_error : 0;
+}
+
+uint64_t Journal::GetSize()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_appended - m_base;
+}
+
+Journal::checkpoint_t Journal::Checkpoint()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_appended;
+}
+
+unsigned int Journal::Discard(checkpoint_t checkpoint)
+{
+    unsigned int rc = Sync();
+    if (rc)
+	return rc;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0)
+	return 0;
+
+    // Hold off the writer while the file's replaced: wait for it to be
+    // idle, and keep the lock (so it can't start again) until done.
+    while (m_written != m_appended - m_buffer.size() && !m_broken)
+	m_synced.wait(lock);
+    if (m_broken)
+	return m_error;
+    if (checkpoint <= m_base)
+	return 0;
+
+    std::string data;
+    rc = ReadFile(m_filename.c_str(), &data);
+    if (rc)
+	return rc;
+    size_t keep_from = HEADER_SIZE + (size_t)(checkpoint - m_base);
+    if (keep_from > data.size())
+	return EINVAL;
+
+    std::string tmpname = m_filename + ".new";
+    int fd = ::open(tmpname.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0)
+	return (unsigned)errno;
+    std::string header = MakeHeader();
+    rc = WriteAll(fd, header.data(), header.size());
+    if (!rc)
+	rc = WriteAll(fd, data.data() + keep_from, data.size() - keep_from);
+    if (!rc && ::fsync(fd) < 0)
+	rc = (unsigned)errno;
+    if (!rc && ::rename(tmpname.c_str(), m_filename.c_str()) < 0)
+	rc = (unsigned)errno;
+    if (rc)
+    {
+	::close(fd);
+	::unlink(tmpname.c_str());
+	return rc;
+    }
+
+    ::close(m_fd);
+    m_fd = fd;
+    m_base = checkpoint;
+
+    // Until the directory's synced, a crash could bring back the old one
+    return util::SyncDirectoryOf(m_filename.c_str());
+}
+
+static void ApplyChanges(db::RecordsetPtr rs,
+			 const Journal::changes_t& changes)
+{
+    for (Journal::changes_t::const_iterator i = changes.begin();
+	 i != changes.end();
+	 ++i)
+    {
+	if (i->is_string)
+	    rs->SetString(i->field, i->sval);
+	else
+	    rs->SetInteger(i->field, i->ival);
+    }
+}
+
+unsigned int Journal::Replay(db::Database *thedb, const char *filename,
+			     unsigned int *nentries)
+{
+    if (nentries)
+	*nentries = 0;
+
+    std::string data;
+    unsigned int rc = ReadFile(filename, &data);
+    if (rc == ENOENT)
+	return 0;
+    if (rc)
+	return rc;
+
+    size_t valid = ValidLength(data);
+    if (valid == 0)
+    {
+	TRACE << filename << " isn't a journal\n";
+	return EINVAL;
+    }
+
+    size_t offset = HEADER_SIZE;
+    unsigned int op;
+    uint32_t id;
+    changes_t changes;
+    while (offset < valid)
+    {
+	offset += ParseEntry(data, offset, &op, &id, &changes);
+
+	db::QueryPtr qp = thedb->CreateQuery();
+	qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+	db::RecordsetPtr rs = qp->Execute();
+	bool found = rs && !rs->IsEOF();
+
+	switch (op)
+	{
+	case OP_ADD:
+	    if (!found)
+	    {
+		rs = thedb->CreateRecordset();
+		rs->AddRecord();
+	    }
+	    ApplyChanges(rs, changes);
+	    rs->Commit();
+	    break;
+	case OP_AMEND:
+	    if (found)
+	    {
+		ApplyChanges(rs, changes);
+		rs->Commit();
+	    }
+	    break;
+	case OP_DELETE:
+	    if (found)
+		rs->Delete();
+	    break;
+	default:
+	    TRACE << "Unknown journal operation " << op << "\n";
+	    break;
+	}
+
+	if (nentries)
+	    ++*nentries;
+    }
+
+    return 0;
+}
+
+
+        /* JournalingDatabase::Recordset */
+
+
+class JournalingDatabase::Recordset: public db::DelegatingRecordset
+{
+    Journal *m_journal;
+    bool m_added;
+    uint32_t m_id; ///< Of an existing record, before any change to it
+    Journal::changes_t m_changes;
+
+    void Before();
+    void Record(const Journal::Change&);
+    void Flush();
+
+public:
+    Recordset(db::RecordsetPtr rs, Journal *journal)
+	: db::DelegatingRecordset(rs, true),
+	  m_journal(journal),
+	  m_added(false),
+	  m_id(0)
+    {
+    }
+    ~Recordset();
+
+    // Being a Recordset
+    unsigned int SetInteger(unsigned int which, uint32_t value) override;
+    unsigned int SetString(unsigned int which,
+			   const std::string& value) override;
+    unsigned int SetArray(unsigned int which,
+			  const std::vector<unsigned int>& vec) override;
+    unsigned int AppendToArray(unsigned int which,
+			       unsigned int value) override;
+    unsigned int RemoveFromArray(unsigned int which,
+				 unsigned int value) override;
+    void MoveNext() override;
+    unsigned int AddRecord() override;
+    unsigned int Commit() override;
+    unsigned int Delete() override;
+};
+
+JournalingDatabase::Recordset::~Recordset()
+{
+    Flush();
+}
+
+/** Called before each change: notes the ID the record had before it.
+ */
+void JournalingDatabase::Recordset::Before()
+{
+    if (!m_added && m_changes.empty())
+	m_id = m_rs->GetInteger(mediadb::ID);
+}
+
+void JournalingDatabase::Recordset::Record(const Journal::Change& change)
+{
+    for (Journal::changes_t::iterator i = m_changes.begin();
+	 i != m_changes.end();
+	 ++i)
+    {
+	if (i->field == change.field)
+	{
+	    *i = change;
+	    return;
+	}
+    }
+    m_changes.push_back(change);
+}
+
+void JournalingDatabase::Recordset::Flush()
+{
+    if (m_added)
+	m_journal->Add(m_rs->GetInteger(mediadb::ID), m_changes);
+    else if (!m_changes.empty())
+	m_journal->Amend(m_id, m_changes);
+    m_added = false;
+    m_changes.clear();
+}
+
+unsigned int JournalingDatabase::Recordset::SetInteger(unsigned int which,
+						       uint32_t value)
+{
+    Before();
+    unsigned int rc = m_rs->SetInteger(which, value);
+    if (!rc)
+	Record(Journal::Change(which, value));
+    return rc;
+}
+
+unsigned int JournalingDatabase::Recordset::SetString(unsigned int which,
+						      const std::string& value)
+{
+    Before();
+    unsigned int rc = m_rs->SetString(which, value);
+    if (!rc)
+	Record(Journal::Change(which, value));
+    return rc;
+}
+
+// The journal holds arrays in their string form, as Replay sets them
+
+unsigned int JournalingDatabase::Recordset::SetArray(
+    unsigned int which, const std::vector<unsigned int>& vec)
+{
+    Before();
+    unsigned int rc = m_rs->SetArray(which, vec);
+    if (!rc)
+	Record(Journal::Change(which, db::EncodeArray(vec)));
+    return rc;
+}
+
+unsigned int JournalingDatabase::Recordset::AppendToArray(unsigned int which,
+							  unsigned int value)
+{
+    Before();
+    unsigned int rc = m_rs->AppendToArray(which, value);
+    if (!rc)
+	Record(Journal::Change(which, m_rs->GetString(which)));
+    return rc;
+}
+
+unsigned int JournalingDatabase::Recordset::RemoveFromArray(
+    unsigned int which, unsigned int value)
+{
+    Before();
+    unsigned int rc = m_rs->RemoveFromArray(which, value);
+    if (!rc)
+	Record(Journal::Change(which, m_rs->GetString(which)));
+    return rc;
+}
+
+void JournalingDatabase::Recordset::MoveNext()
+{
+    Flush();
+    m_rs->MoveNext();
+}
+
+unsigned int JournalingDatabase::Recordset::AddRecord()
+{
+    Flush();
+    unsigned int rc = m_rs->AddRecord();
+    if (!rc)
+	m_added = true;
+    return rc;
+}
+
+unsigned int JournalingDatabase::Recordset::Commit()
+{
+    unsigned int rc = m_rs->Commit();
+    Flush();
+    return rc;
+}
+
+unsigned int JournalingDatabase::Recordset::Delete()
+{
+    Flush();
+    uint32_t id = m_rs->GetInteger(mediadb::ID);
+    unsigned int rc = m_rs->Delete();
+    if (!rc)
+	m_journal->Delete(id);
+    return rc;
+}
+
+
+        /* JournalingDatabase::Query */
+
+
+class JournalingDatabase::Query: public db::DelegatingQuery
+{
+    Journal *m_journal;
+
+public:
+    Query(db::QueryPtr qp, Journal *journal)
+	: db::DelegatingQuery(qp), m_journal(journal)
+    {
+    }
+
+    // Being a Query
+    db::RecordsetPtr Execute() override;
+};
+
+db::RecordsetPtr JournalingDatabase::Query::Execute()
+{
+    db::RecordsetPtr rs = m_qp->Execute();
+    if (!rs)
+	return rs;
+    return db::RecordsetPtr(new Recordset(rs, m_journal));
+}
+
+
+        /* JournalingDatabase itself */
+
+
+db::RecordsetPtr JournalingDatabase::CreateRecordset()
+{
+    return db::RecordsetPtr(new Recordset(m_db->CreateRecordset(),
+					  m_journal));
+}
+
+db::QueryPtr JournalingDatabase::CreateQuery()
+{
+    return db::QueryPtr(new Query(m_db->CreateQuery(), m_journal));
+}
+
+db::RecordsetPtr JournalingDatabase::Fetch(
+    unsigned int which, const std::vector<unsigned int>& values)
+{
+    db::RecordsetPtr rs = m_db->Fetch(which, values);
+    if (!rs)
+	return rs;
+    return db::RecordsetPtr(new Recordset(rs, m_journal));
+}
+
+} // namespace mediadb
+
+
+#ifdef TEST
+
+# include "binary.h"
+# include "xml.h"
+# include "libdbsteam/db.h"
+# include <boost/format.hpp>
+# include <stdio.h>
+# include <assert.h>
+# include <signal.h>
+# include <sys/resource.h>
+
+static void InitDB(db::steam::Database *sdb)
+{
+    sdb->SetFieldInfo(mediadb::ID,
+		      db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+    sdb->SetFieldInfo(mediadb::PATH,
+		      db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+}
+
+static std::string ToXML(db::Database *thedb)
+{
+    FILE *f = tmpfile();
+    mediadb::WriteXML(thedb, mediadb::SCHEMA_VERSION, f);
+    std::string s;
+    s.resize((size_t)ftell(f));
+    rewind(f);
+    size_t n = fread(&s[0], 1, s.size(), f);
+    assert(n == s.size());
+    fclose(f);
+    return s;
+}
+
+static void AddTune(db::Database *thedb, uint32_t id, const char *path)
+{
+    db::RecordsetPtr rs = thedb->CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(mediadb::ID, id);
+    rs->SetString(mediadb::PATH, path);
+    rs->SetString(mediadb::TITLE, path);
+    rs->SetInteger(mediadb::TYPE, mediadb::TUNE);
+    rs->Commit();
+}
+
+static void SetTitle(db::Database *thedb, uint32_t id, const char *title)
+{
+    db::QueryPtr qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+    db::RecordsetPtr rs = qp->Execute();
+    assert(!rs->IsEOF());
+    rs->SetString(mediadb::TITLE, title);
+    rs->Commit();
+}
+
+static void DeleteID(db::Database *thedb, uint32_t id)
+{
+    db::QueryPtr qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+    db::RecordsetPtr rs = qp->Execute();
+    assert(!rs->IsEOF());
+    rs->Delete();
+}
+
+/** Replays snapshot + journal into a fresh database */
+static std::string Reload(const char *snapname, const char *journalname)
+{
+    db::steam::Database sdb(mediadb::FIELD_COUNT);
+    InitDB(&sdb);
+    unsigned int rc = mediadb::ReadBinary(&sdb, snapname);
+    assert(rc == 0 || rc == ENOENT);
+    rc = mediadb::Journal::Replay(&sdb, journalname);
+    assert(rc == 0);
+    return ToXML(&sdb);
+}
+
+static void WriteSnapshot(db::Database *thedb, const char *snapname)
+{
+    FILE *f = fopen(snapname, "wb");
+    unsigned int rc = mediadb::WriteBinary(thedb, mediadb::SCHEMA_VERSION, f);
+    fclose(f);
+    assert(rc == 0);
+}
+
+static uint64_t FileSize(const char *filename)
+{
+    struct stat st;
+    if (::stat(filename, &st) < 0)
+	return 0;
+    return (uint64_t)st.st_size;
+}
+
+int main()
+{
+    const char *snapname = "test.journal.snapshot";
+    const char *journalname = "test.journal";
+    unlink(snapname);
+    unlink(journalname);
+
+    db::steam::Database sdb(mediadb::FIELD_COUNT);
+    InitDB(&sdb);
+
+    mediadb::Journal journal(5);
+    mediadb::JournalingDatabase jdb(&sdb, &journal);
+    unsigned int rc = journal.Open(journalname);
+    assert(rc == 0);
+
+    for (uint32_t id=0x200; id<0x300; ++id)
+	AddTune(&jdb, id, (boost::format("tune%u.mp3") % id).str().c_str());
+    SetTitle(&jdb, 0x210, "Retitled");
+    DeleteID(&jdb, 0x211);
+
+    // Changing the ID itself is recorded against the old one
+    {
+	db::QueryPtr qp = jdb.CreateQuery();
+	qp->Where(qp->Restrict(mediadb::ID, db::EQ, 0x212));
+	db::RecordsetPtr rs = qp->Execute();
+	rs->SetInteger(mediadb::ID, 0x400);
+	rs->Commit();
+    }
+
+    // Changes without Commit still count, as steam has made them
+    {
+	db::RecordsetPtr rs = jdb.CreateRecordset();
+	rs->SetString(mediadb::ARTIST, "Uncommitted");
+	rs->MoveNext();
+	rs->SetString(mediadb::ARTIST, "Uncommitted");
+    }
+
+    // Special IDs aren't persisted (same as snapshots)
+    AddTune(&jdb, 0x20, "special");
+
+    rc = journal.Sync();
+    assert(rc == 0);
+    assert(journal.GetSize() + 8 == FileSize(journalname));
+
+    std::string expected = ToXML(&sdb);
+    assert(Reload(snapname, journalname) == expected);
+
+    // Compaction: a checkpoint, a snapshot, and some changes in between
+    mediadb::Journal::checkpoint_t cp = journal.Checkpoint();
+    WriteSnapshot(&sdb, snapname);
+    SetTitle(&jdb, 0x220, "After checkpoint");
+    rc = journal.Discard(cp);
+    assert(rc == 0);
+    SetTitle(&jdb, 0x221, "After discard");
+    journal.Sync();
+    assert(journal.GetSize() < 200);
+    assert(journal.GetSize() + 8 == FileSize(journalname));
+    expected = ToXML(&sdb);
+    assert(Reload(snapname, journalname) == expected);
+
+    // Replaying the whole journal over a snapshot that already has it
+    // changes nothing
+    journal.Close();
+    assert(Reload(snapname, journalname) == expected);
+
+    // A torn final entry is ignored, and truncated on reopening
+    {
+	uint64_t size = FileSize(journalname);
+	rc = journal.Open(journalname);
+	assert(rc == 0);
+	SetTitle(&jdb, 0x222, "Torn");
+	journal.Close();
+	int r = truncate(journalname, (off_t)(FileSize(journalname) - 3));
+	assert(r == 0);
+	assert(Reload(snapname, journalname) == expected);
+
+	rc = journal.Open(journalname);
+	assert(rc == 0);
+	assert(FileSize(journalname) == size);
+	SetTitle(&jdb, 0x223, "After tear");
+	journal.Sync();
+	journal.Close();
+
+	// 0x222's "Torn" is in sdb but was lost from the journal
+	SetTitle(&sdb, 0x222, "tune546.mp3");
+	expected = ToXML(&sdb);
+	assert(Reload(snapname, journalname) == expected);
+    }
+
+    // A failed write is truncated away, and retried at the next Sync,
+    // without any torn entry being left in the middle
+    {
+	rc = journal.Open(journalname);
+	assert(rc == 0);
+	uint64_t size = FileSize(journalname);
+
+	signal(SIGXFSZ, SIG_IGN);
+	struct rlimit old_limit, limit;
+	getrlimit(RLIMIT_FSIZE, &old_limit);
+	limit = old_limit;
+	limit.rlim_cur = (rlim_t)size + 10;
+	setrlimit(RLIMIT_FSIZE, &limit);
+
+	SetTitle(&jdb, 0x224, "Too big for the disk");
+	rc = journal.Sync();
+	assert(rc == EFBIG);
+	assert(FileSize(journalname) == size);
+	SetTitle(&jdb, 0x225, "Also too big");
+	rc = journal.Sync();
+	assert(rc == EFBIG);
+
+	setrlimit(RLIMIT_FSIZE, &old_limit);
+	SetTitle(&jdb, 0x226, "Fits now");
+	rc = journal.Sync();
+	assert(rc == 0);
+	assert(journal.GetSize() + 8 == FileSize(journalname));
+	journal.Close();
+
+	expected = ToXML(&sdb);
+	assert(Reload(snapname, journalname) == expected);
+    }
+
+    // Not a journal
+    assert(mediadb::Journal::Replay(&sdb, snapname) == EINVAL);
+
+    unlink(snapname);
+    unlink(journalname);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,154 @@
+/* libmediadb/journal.h
+ *
+ * Write-ahead journal of database changes, between binary snapshots
+ */
+#ifndef MEDIADB_JOURNAL_H
+#define MEDIADB_JOURNAL_H
+
+#include "libdb/db.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace mediadb {
+
+/** An append-only log of record-level changes to a db::Database (assumed
+ * to be a mediadb::Database), so that persisting a change costs in
+ * proportion to the change, not to the size of the database.
+ *
+ * Records are identified by ID, not by record number (which needn't
+ * survive a reload). Entries are buffered, and a background thread writes
+ * and fsyncs them in batches ("group commit"): a burst of changes, such
+ * as a rescan, costs one fsync per batch rather than one per record.
+ *
+ * On startup, load the last snapshot (see WriteBinary) and Replay the
+ * journal over it. Now and then, compact: take a Checkpoint, write a
+ * fresh snapshot, and Discard the journal up to the checkpoint.
+ *
+ * Replay is idempotent -- adding an existing ID amends it, deleting or
+ * amending a missing one does nothing -- so it doesn't matter if a crash
+ * leaves a snapshot which already includes some of the journal. A torn
+ * final entry (from a crash mid-write) fails its checksum and is ignored.
+ */
+class Journal
+{
+public:
+    /** One field set by SetInteger or SetString */
+    struct Change
+    {
+	unsigned int field;
+	bool is_string;
+	uint32_t ival;
+	std::string sval;
+
+	Change(unsigned int f, uint32_t i)
+	    : field(f), is_string(false), ival(i) {}
+	Change(unsigned int f, const std::string& s)
+	    : field(f), is_string(true), ival(0), sval(s) {}
+    };
+    typedef std::vector<Change> changes_t;
+
+private:
+    std::string m_filename;
+    int m_fd;
+    unsigned int m_delay_ms;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup; ///< For the writer thread
+    std::condition_variable m_synced; ///< For Sync() callers
+    std::string m_buffer;   ///< Not yet written
+    uint64_t m_appended;    ///< Bytes appended, ever (including m_buffer)
+    uint64_t m_written;     ///< Bytes written and fsynced, ever
+    uint64_t m_base;        ///< Value of m_written at start of file
+    uint64_t m_attempts;    ///< Batches the writer has tried to write
+    unsigned int m_error;   ///< From the last attempt; retried until it works
+    bool m_broken;          ///< Couldn't undo a failed write, so gave up
+    uint64_t m_sync_requests; ///< Calls to Sync, ever
+    unsigned int m_sync_waiters;
+    bool m_stopping;
+    std::thread m_thread;
+
+    void Append(const std::string& entry);
+    void Run();
+
+public:
+    /** @param delay_ms How long to gather changes before writing them
+     */
+    explicit Journal(unsigned int delay_ms = 100);
+    ~Journal();
+
+    /** Open (creating if needed) the journal for appending.
+     */
+    unsigned int Open(const char *filename);
+
+    /** Write anything pending, and stop the writer thread.
+     */
+    void Close();
+
+    /** Apply a journal file's changes to a database. Missing file is
+     * not an error.
+     */
+    static unsigned int Replay(db::Database*, const char *filename,
+			       unsigned int *nentries = NULL);
+
+    void Add(uint32_t id, const changes_t&);
+    void Amend(uint32_t id, const changes_t&);
+    void Delete(uint32_t id);
+
+    /** Wait until everything so far is on disk.
+     *
+     * If a write fails, the part-written batch is truncated away and kept
+     * for another attempt, made every so often or at the next Sync; this
+     * returns the error if that attempt fails too. If even the truncation
+     * fails, the journal stops for good, and every Sync fails: take a
+     * snapshot instead.
+     */
+    unsigned int Sync();
+
+    /** Bytes of journal on disk or pending -- what Replay would read */
+    uint64_t GetSize();
+
+    typedef uint64_t checkpoint_t;
+
+    /** Marks the point at which a snapshot is about to be taken; changes
+     * after this point may or may not be in the snapshot.
+     */
+    checkpoint_t Checkpoint();
+
+    /** Drops all entries up to the checkpoint, once the snapshot taken
+     * after it is safely written.
+     */
+    unsigned int Discard(checkpoint_t);
+};
+
+/** A db::Database wrapper which records every change made through it in a
+ * Journal.
+ *
+ * Changes are captured per record at Commit (or when the recordset moves
+ * on, as some engines don't need a Commit to apply them).
+ */
+class JournalingDatabase: public db::Database
+{
+    db::Database *m_db;
+    Journal *m_journal;
+
+    class Recordset;
+    class Query;
+
+public:
+    JournalingDatabase(db::Database *thedb, Journal *journal)
+	: m_db(thedb), m_journal(journal) {}
+
+    // Being a db::Database
+    db::RecordsetPtr CreateRecordset() override;
+    db::QueryPtr CreateQuery() override;
+    db::RecordsetPtr Fetch(unsigned int which,
+			   const std::vector<unsigned int>& values) override;
+};
+
+} // namespace mediadb
+
+#endif
@@ -43,7 +43,7 @@ enum {
     ENSEMBLE,
     LYRICIST,
 
-    CHILDREN, ///< {nchildren, child-id, child-id...} as UTF-8 string
+    CHILDREN, ///< Array of child IDs: see db::Recordset::GetArray
     IDHIGH,   ///< High-quality (FLAC) version of the file, or 0
     IDPARENT, ///< (An arbitrary one of) the parent directories of this file
     VIDEOCODEC,
@@ -129,7 +129,8 @@ enum {
     CONTAINER_COUNT
 };
 
-/** Turn the internal representation of a "children" field into a vector.
+/** Turn the string form (db::EncodeArray) of a "children" field into a
+ * vector. Prefer db::Recordset::GetArray, which needn't decode all of it.
  */
 void ChildrenToVector(const std::string& children_field,
 		      std::vector<unsigned int> *vec_out);
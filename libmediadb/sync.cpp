@@ -60,14 +60,15 @@ static unsigned int GetNames(db::Database *db,
 {
     names->clear();
     names->reserve(ids->size());
+
+    /* Fetch skips missing records, so walk the results alongside the IDs
+     */
+    db::RecordsetPtr rs = db->Fetch(mediadb::ID, *ids);
     for (std::vector<unsigned int>::iterator i = ids->begin();
 	 i != ids->end();
 	 ++i)
     {
-	db::QueryPtr qp = db->CreateQuery();
-	qp->Where(qp->Restrict(mediadb::ID, db::EQ, *i));
-	db::RecordsetPtr rs = qp->Execute();
-	if (!rs || rs->IsEOF())
+	if (!rs || rs->IsEOF() || rs->GetInteger(mediadb::ID) != *i)
 	{
 	    TRACE << "Expected record " << *i << " not found\n";
 	    *i = 0; // Mark as unwanted
@@ -86,6 +87,7 @@ static unsigned int GetNames(db::Database *db,
 				    || type == mediadb::DIR);
 		names->push_back(nat);
 	    }
+	    rs->MoveNext();
 	}
     }
     ids->erase(std::remove(ids->begin(), ids->end(), 0), ids->end());
@@ -0,0 +1,501 @@
+#include "config.h"
+#include "update_tracker.h"
+#include "schema.h"
+#include "libdb/recordset.h"
+#include "libdb/query.h"
+#include "libdb/delegating_rs.h"
+#include "libdb/delegating_query.h"
+#include "libutil/counted_pointer.h"
+
+namespace mediadb {
+
+
+        /* UpdateTracker */
+
+
+UpdateTracker::UpdateTracker()
+    : m_system_update_id(INITIAL_UPDATE_ID),
+      m_have_playlists(false)
+{
+}
+
+void UpdateTracker::LoadPlaylists(db::Database *thedb)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_have_playlists)
+	return;
+    m_have_playlists = true;
+
+    db::QueryPtr qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::TYPE, db::EQ, mediadb::PLAYLIST));
+    std::vector<unsigned int> children;
+    for (db::RecordsetPtr rs = qp->Execute(); rs && !rs->IsEOF();
+	 rs->MoveNext())
+    {
+	rs->GetArray(mediadb::CHILDREN, &children);
+	SetPlaylistLocked(rs->GetInteger(mediadb::ID), children);
+    }
+}
+
+void UpdateTracker::SetPlaylistLocked(
+    unsigned int id, const std::vector<unsigned int>& children)
+{
+    std::vector<unsigned int>& old = m_playlists[id];
+    for (std::vector<unsigned int>::const_iterator i = old.begin();
+	 i != old.end();
+	 ++i)
+    {
+	auto range = m_listed_in.equal_range(*i);
+	for (auto j = range.first; j != range.second; ++j)
+	{
+	    if (j->second == id)
+	    {
+		m_listed_in.erase(j);
+		break;
+	    }
+	}
+    }
+
+    if (children.empty())
+    {
+	m_playlists.erase(id);
+	return;
+    }
+
+    old = children;
+    for (std::vector<unsigned int>::const_iterator i = children.begin();
+	 i != children.end();
+	 ++i)
+	m_listed_in.insert(std::make_pair(*i, id));
+}
+
+void UpdateTracker::SetPlaylist(unsigned int id,
+				const std::vector<unsigned int>& children)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    SetPlaylistLocked(id, children);
+}
+
+void UpdateTracker::Changed(unsigned int id,
+			    const std::vector<unsigned int>& containers)
+{
+    {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++m_system_update_id;
+	for (std::vector<unsigned int>::const_iterator i = containers.begin();
+	     i != containers.end();
+	     ++i)
+	{
+	    if (*i)
+		m_containers[*i] = m_system_update_id;
+	}
+	auto range = m_listed_in.equal_range(id);
+	for (auto i = range.first; i != range.second; ++i)
+	    m_containers[i->second] = m_system_update_id;
+    }
+
+    Fire(&UpdateObserver::OnUpdate);
+}
+
+uint32_t UpdateTracker::GetSystemUpdateID()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_system_update_id;
+}
+
+uint32_t UpdateTracker::GetContainerUpdateID(unsigned int id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    containers_t::const_iterator i = m_containers.find(id);
+    return i == m_containers.end() ? (uint32_t)INITIAL_UPDATE_ID : i->second;
+}
+
+void UpdateTracker::GetChangedContainers(uint32_t since,
+					 containers_t *changed)
+{
+    changed->clear();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (containers_t::const_iterator i = m_containers.begin();
+	 i != m_containers.end();
+	 ++i)
+    {
+	if (i->second > since)
+	    changed->insert(*i);
+    }
+}
+
+
+        /* TrackingDatabase::Recordset */
+
+
+class TrackingDatabase::Recordset: public db::DelegatingRecordset
+{
+    db::Database *m_db;
+    UpdateTracker *m_tracker;
+    bool m_changed;
+    bool m_children_changed;
+    unsigned int m_parent; ///< Before any change to the record
+
+    void Before(unsigned int which);
+    void Flush();
+
+public:
+    Recordset(db::RecordsetPtr rs, db::Database *thedb,
+	      UpdateTracker *tracker)
+	: db::DelegatingRecordset(rs, true),
+	  m_db(thedb),
+	  m_tracker(tracker),
+	  m_changed(false),
+	  m_children_changed(false),
+	  m_parent(0)
+    {
+    }
+    ~Recordset();
+
+    // Being a Recordset
+    unsigned int SetInteger(unsigned int which, uint32_t value) override;
+    unsigned int SetString(unsigned int which,
+			   const std::string& value) override;
+    unsigned int SetArray(unsigned int which,
+			  const std::vector<unsigned int>& vec) override;
+    unsigned int AppendToArray(unsigned int which,
+			       unsigned int value) override;
+    unsigned int RemoveFromArray(unsigned int which,
+				 unsigned int value) override;
+    void MoveNext() override;
+    unsigned int AddRecord() override;
+    unsigned int Commit() override;
+    unsigned int Delete() override;
+};
+
+TrackingDatabase::Recordset::~Recordset()
+{
+    Flush();
+}
+
+/** Called before each change: notes the parent the record had before it,
+ * as a record which moves changes both listings.
+ */
+void TrackingDatabase::Recordset::Before(unsigned int which)
+{
+    if (!m_changed)
+	m_parent = m_rs->GetInteger(mediadb::IDPARENT);
+    m_changed = true;
+    if (which == mediadb::CHILDREN)
+	m_children_changed = true;
+}
+
+void TrackingDatabase::Recordset::Flush()
+{
+    if (!m_changed)
+	return;
+
+    m_tracker->LoadPlaylists(m_db);
+
+    unsigned int id = m_rs->GetInteger(mediadb::ID);
+    std::vector<unsigned int> containers;
+    containers.push_back(m_parent);
+    unsigned int parent = m_rs->GetInteger(mediadb::IDPARENT);
+    if (parent != m_parent)
+	containers.push_back(parent);
+    if (m_children_changed)
+    {
+	containers.push_back(id);
+	if (m_rs->GetInteger(mediadb::TYPE) == mediadb::PLAYLIST)
+	{
+	    std::vector<unsigned int> children;
+	    m_rs->GetArray(mediadb::CHILDREN, &children);
+	    m_tracker->SetPlaylist(id, children);
+	}
+    }
+    m_changed = m_children_changed = false;
+
+    m_tracker->Changed(id, containers);
+}
+
+unsigned int TrackingDatabase::Recordset::SetInteger(unsigned int which,
+						     uint32_t value)
+{
+    Before(which);
+    return m_rs->SetInteger(which, value);
+}
+
+unsigned int TrackingDatabase::Recordset::SetString(unsigned int which,
+						    const std::string& value)
+{
+    Before(which);
+    return m_rs->SetString(which, value);
+}
+
+unsigned int TrackingDatabase::Recordset::SetArray(
+    unsigned int which, const std::vector<unsigned int>& vec)
+{
+    Before(which);
+    return m_rs->SetArray(which, vec);
+}
+
+unsigned int TrackingDatabase::Recordset::AppendToArray(unsigned int which,
+							unsigned int value)
+{
+    Before(which);
+    return m_rs->AppendToArray(which, value);
+}
+
+unsigned int TrackingDatabase::Recordset::RemoveFromArray(
+    unsigned int which, unsigned int value)
+{
+    Before(which);
+    return m_rs->RemoveFromArray(which, value);
+}
+
+void TrackingDatabase::Recordset::MoveNext()
+{
+    Flush();
+    m_rs->MoveNext();
+}
+
+unsigned int TrackingDatabase::Recordset::AddRecord()
+{
+    Flush();
+    return m_rs->AddRecord();
+}
+
+unsigned int TrackingDatabase::Recordset::Commit()
+{
+    unsigned int rc = m_rs->Commit();
+    Flush();
+    return rc;
+}
+
+unsigned int TrackingDatabase::Recordset::Delete()
+{
+    Flush();
+    m_tracker->LoadPlaylists(m_db);
+    unsigned int id = m_rs->GetInteger(mediadb::ID);
+    unsigned int parent = m_rs->GetInteger(mediadb::IDPARENT);
+    bool playlist = m_rs->GetInteger(mediadb::TYPE) == mediadb::PLAYLIST;
+    unsigned int rc = m_rs->Delete();
+    if (!rc)
+    {
+	if (playlist)
+	    m_tracker->SetPlaylist(id, std::vector<unsigned int>());
+	m_tracker->Changed(id, std::vector<unsigned int>(1, parent));
+    }
+    return rc;
+}
+
+
+        /* TrackingDatabase::Query */
+
+
+class TrackingDatabase::Query: public db::DelegatingQuery
+{
+    db::Database *m_db;
+    UpdateTracker *m_tracker;
+
+public:
+    Query(db::QueryPtr qp, db::Database *thedb, UpdateTracker *tracker)
+	: db::DelegatingQuery(qp), m_db(thedb), m_tracker(tracker)
+    {
+    }
+
+    // Being a Query
+    db::RecordsetPtr Execute() override;
+};
+
+db::RecordsetPtr TrackingDatabase::Query::Execute()
+{
+    db::RecordsetPtr rs = m_qp->Execute();
+    if (!rs)
+	return rs;
+    return db::RecordsetPtr(new Recordset(rs, m_db, m_tracker));
+}
+
+
+        /* TrackingDatabase itself */
+
+
+db::RecordsetPtr TrackingDatabase::CreateRecordset()
+{
+    return db::RecordsetPtr(new Recordset(m_db->CreateRecordset(), m_db,
+					  m_tracker));
+}
+
+db::QueryPtr TrackingDatabase::CreateQuery()
+{
+    return db::QueryPtr(new Query(m_db->CreateQuery(), m_db, m_tracker));
+}
+
+db::RecordsetPtr TrackingDatabase::Fetch(
+    unsigned int which, const std::vector<unsigned int>& values)
+{
+    db::RecordsetPtr rs = m_db->Fetch(which, values);
+    if (!rs)
+	return rs;
+    return db::RecordsetPtr(new Recordset(rs, m_db, m_tracker));
+}
+
+} // namespace mediadb
+
+
+#ifdef TEST
+
+# include "libdbsteam/db.h"
+# include <assert.h>
+
+class CountingObserver: public mediadb::UpdateObserver
+{
+public:
+    unsigned int updates;
+
+    CountingObserver() : updates(0) {}
+
+    void OnUpdate() override { ++updates; }
+};
+
+static db::RecordsetPtr Find(db::Database *thedb, unsigned int id)
+{
+    db::QueryPtr qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+    db::RecordsetPtr rs = qp->Execute();
+    assert(rs && !rs->IsEOF());
+    return rs;
+}
+
+static void Add(db::Database *thedb, unsigned int id, unsigned int type,
+		unsigned int parent)
+{
+    db::RecordsetPtr rs = thedb->CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(mediadb::ID, id);
+    rs->SetInteger(mediadb::TYPE, type);
+    rs->SetInteger(mediadb::IDPARENT, parent);
+    rs->Commit();
+}
+
+int main()
+{
+    db::steam::Database sdb(mediadb::FIELD_COUNT);
+    sdb.SetFieldInfo(mediadb::ID,
+		     db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
+
+    mediadb::UpdateTracker tracker;
+    mediadb::TrackingDatabase tdb(&sdb, &tracker);
+    CountingObserver obs;
+    tracker.AddObserver(&obs);
+
+    const uint32_t initial = mediadb::UpdateTracker::INITIAL_UPDATE_ID;
+    assert(tracker.GetSystemUpdateID() == initial);
+    assert(tracker.GetContainerUpdateID(0x100) == initial);
+
+    // Writes straight to the underlying database aren't noticed
+    Add(&sdb, 0x100, mediadb::DIR, 0);
+    assert(tracker.GetSystemUpdateID() == initial);
+
+    // ...but playlists already there are, once something changes
+    Add(&sdb, 0x400, mediadb::PLAYLIST, 0x100);
+    {
+	db::RecordsetPtr rs = Find(&sdb, 0x400);
+	rs->AppendToArray(mediadb::CHILDREN, 0x201);
+	rs->Commit();
+    }
+
+    // A new folder changes its parent's listing
+    Add(&tdb, 0x200, mediadb::DIR, 0x100);
+    uint32_t id = tracker.GetSystemUpdateID();
+    assert(id == initial + 1);
+    assert(obs.updates == 1);
+    assert(tracker.GetContainerUpdateID(0x100) == id);
+    assert(tracker.GetContainerUpdateID(0x200) == initial);
+
+    // Adding a tune to it changes the tune's record and the folder's
+    Add(&tdb, 0x201, mediadb::TUNE, 0x200);
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x200);
+	rs->AppendToArray(mediadb::CHILDREN, 0x201);
+	rs->Commit();
+    }
+    assert(tracker.GetSystemUpdateID() == id + 2);
+    assert(tracker.GetContainerUpdateID(0x200) == id + 2);
+    assert(tracker.GetContainerUpdateID(0x100) == id + 2);
+    assert(obs.updates == 3);
+
+    // Only what's changed since then is reported
+    id = tracker.GetSystemUpdateID();
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x201);
+	rs->SetString(mediadb::TITLE, "Retitled");
+	rs->SetString(mediadb::ARTIST, "Reartisted");
+	rs->Commit();
+    }
+    assert(tracker.GetSystemUpdateID() == id + 1);
+    mediadb::UpdateTracker::containers_t changed;
+    tracker.GetChangedContainers(id, &changed);
+    assert(changed.size() == 2);
+    assert(changed[0x200] == id + 1);
+    assert(changed[0x400] == id + 1); // The playlist listing it
+    tracker.GetChangedContainers(initial, &changed);
+    assert(changed.size() == 3);
+
+    // A playlist made through the tracker is noticed too
+    Add(&tdb, 0x500, mediadb::PLAYLIST, 0x100);
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x500);
+	rs->AppendToArray(mediadb::CHILDREN, 0x201);
+	rs->Commit();
+    }
+    id = tracker.GetSystemUpdateID();
+    assert(tracker.GetContainerUpdateID(0x500) == id);
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x201);
+	rs->SetString(mediadb::TITLE, "Re-retitled");
+	rs->Commit();
+    }
+    assert(tracker.GetContainerUpdateID(0x400) == id + 1);
+    assert(tracker.GetContainerUpdateID(0x500) == id + 1);
+
+    // Once it no longer lists the record, it doesn't change with it
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x500);
+	rs->RemoveFromArray(mediadb::CHILDREN, 0x201);
+	rs->Commit();
+    }
+    id = tracker.GetSystemUpdateID();
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x201);
+	rs->SetString(mediadb::TITLE, "Re-re-retitled");
+	rs->Commit();
+    }
+    assert(tracker.GetContainerUpdateID(0x400) == id + 1);
+    assert(tracker.GetContainerUpdateID(0x500) == id);
+
+    // Changes without Commit still count, as steam has made them
+    id = tracker.GetSystemUpdateID();
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x201);
+	rs->SetString(mediadb::TITLE, "Uncommitted");
+    }
+    assert(tracker.GetSystemUpdateID() == id + 1);
+
+    // Moving a record changes both folders
+    Add(&tdb, 0x300, mediadb::DIR, 0x100);
+    {
+	db::RecordsetPtr rs = Find(&tdb, 0x201);
+	rs->SetInteger(mediadb::IDPARENT, 0x300);
+	rs->Commit();
+    }
+    id = tracker.GetSystemUpdateID();
+    assert(tracker.GetContainerUpdateID(0x200) == id);
+    assert(tracker.GetContainerUpdateID(0x300) == id);
+
+    // So does deleting one, for its parent
+    Find(&tdb, 0x201)->Delete();
+    assert(tracker.GetSystemUpdateID() == id + 1);
+    assert(tracker.GetContainerUpdateID(0x300) == id + 1);
+    assert(tracker.GetContainerUpdateID(0x200) == id);
+
+    tracker.RemoveObserver(&obs);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,121 @@
+/* libmediadb/update_tracker.h
+ *
+ * Update IDs for the whole database and for each container, as evented
+ * by a UPnP ContentDirectory
+ */
+#ifndef MEDIADB_UPDATE_TRACKER_H
+#define MEDIADB_UPDATE_TRACKER_H
+
+#include "libdb/db.h"
+#include "libutil/observable.h"
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace mediadb {
+
+class UpdateObserver
+{
+public:
+    virtual ~UpdateObserver() {}
+
+    /** Called, on the writer's thread, after each change; expect many of
+     * these during a rescan, so moderate anything expensive.
+     */
+    virtual void OnUpdate() = 0;
+};
+
+/** Counts changes to a mediadb::Database.
+ *
+ * The system update ID goes up by one for each changed record. Each
+ * container whose listing was affected -- its children changed, or one of
+ * them was added, amended or deleted -- takes the new system update ID as
+ * its own container update ID. Containers untouched since startup have
+ * INITIAL_UPDATE_ID, as does the system before any change.
+ *
+ * A record's folder is found from its IDPARENT, but playlists list records
+ * from elsewhere, so the tracker keeps an index of which playlists list
+ * which records. It's read from the database when the first change is
+ * reported, and kept up to date from then on by the TrackingDatabases.
+ *
+ * Changes are noticed by writing through a TrackingDatabase; there may be
+ * several of those, for different writers, sharing one UpdateTracker.
+ */
+class UpdateTracker: public util::Observable<UpdateObserver>
+{
+public:
+    typedef std::map<unsigned int, uint32_t> containers_t;
+
+    enum { INITIAL_UPDATE_ID = 1 };
+
+private:
+    std::mutex m_mutex;
+    uint32_t m_system_update_id;
+    containers_t m_containers; ///< Only those changed since startup
+    bool m_have_playlists;
+    std::multimap<unsigned int, unsigned int> m_listed_in; ///< Record->list
+    std::map<unsigned int, std::vector<unsigned int> > m_playlists;
+
+    void SetPlaylistLocked(unsigned int id,
+			   const std::vector<unsigned int>& children);
+
+public:
+    UpdateTracker();
+
+    /** Reads which playlists list which records, unless that's been done
+     * already. Called by TrackingDatabase before it reports a change.
+     */
+    void LoadPlaylists(db::Database*);
+
+    /** Playlist "id" now lists these records (none, if it's been deleted).
+     */
+    void SetPlaylist(unsigned int id,
+		     const std::vector<unsigned int>& children);
+
+    /** Record "id" has changed, affecting the listings of these containers
+     * (which may be empty, and in which zero IDs are ignored), and those
+     * of any playlists which list it.
+     */
+    void Changed(unsigned int id, const std::vector<unsigned int>& containers);
+
+    uint32_t GetSystemUpdateID();
+    uint32_t GetContainerUpdateID(unsigned int id);
+
+    /** Those containers which have changed since the system update ID was
+     * "since", with their update IDs.
+     */
+    void GetChangedContainers(uint32_t since, containers_t*);
+};
+
+/** A db::Database wrapper which tells an UpdateTracker about every change
+ * made through it.
+ *
+ * Changes are reported per record at Commit (or when the recordset moves
+ * on, as some engines don't need a Commit to apply them), as for
+ * JournalingDatabase. Container IDs are those of the wrapped database, so
+ * if it's part of a db::merge::Database, it should be the first one there,
+ * whose IDs aren't remapped.
+ */
+class TrackingDatabase: public db::Database
+{
+    db::Database *m_db;
+    UpdateTracker *m_tracker;
+
+    class Recordset;
+    class Query;
+
+public:
+    TrackingDatabase(db::Database *thedb, UpdateTracker *tracker)
+	: m_db(thedb), m_tracker(tracker) {}
+
+    // Being a db::Database
+    db::RecordsetPtr CreateRecordset() override;
+    db::QueryPtr CreateQuery() override;
+    db::RecordsetPtr Fetch(unsigned int which,
+			   const std::vector<unsigned int>& values) override;
+};
+
+} // namespace mediadb
+
+#endif
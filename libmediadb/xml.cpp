@@ -126,6 +126,23 @@ unsigned int WriteXML(db::Database *db, unsigned int schema, ::FILE *f)
     fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
     fprintf(f, "<db schema=\"%u\">\n", schema);
 
+    /* The fields written as strings, all fetched in one go
+     */
+    unsigned int fields[mediadb::FIELD_COUNT];
+    size_t nfields = 0;
+    for (unsigned int i=0; i<mediadb::FIELD_COUNT; ++i)
+    {
+	if (i != mediadb::TYPE && i != mediadb::AUDIOCODEC
+	    && i != mediadb::VIDEOCODEC && i != mediadb::CONTAINER
+	    && i != mediadb::CHILDREN)
+	    fields[nfields++] = i;
+    }
+    std::string_view views[mediadb::FIELD_COUNT];
+    std::string scratch[mediadb::FIELD_COUNT];
+
+    std::string out;
+    std::vector<unsigned int> vec;
+
     for (db::RecordsetPtr rs = db->CreateRecordset();
 	 !rs->IsEOF();
 	 rs->MoveNext())
@@ -138,10 +155,14 @@ unsigned int WriteXML(db::Database *db, unsigned int schema, ::FILE *f)
 	if (rs->GetInteger(mediadb::TYPE) == mediadb::RADIO)
 	    continue;
 
-	fprintf(f, "<record>\n");
+	rs->GetStringViews(fields, nfields, views, scratch);
+
+	out.clear();
+	out += "<record>\n";
+	size_t n = 0;
 	for (unsigned int i=0; i<mediadb::FIELD_COUNT; ++i)
 	{
-	    std::string value;
+	    std::string_view value;
 
 	    /** Yes, i know this is a for-switch loop, but only a very few
 	     * i's need any special treatment.
@@ -161,34 +182,42 @@ unsigned int WriteXML(db::Database *db, unsigned int schema, ::FILE *f)
 		value = containermap[rs->GetInteger(i)];
 		break;
 	    case mediadb::CHILDREN:
-		value = rs->GetString(i);
-		if (!value.empty())
+	    {
+		rs->GetArray(i, &vec);
+		if (!vec.empty())
 		{
-		    fprintf(f, "<children>\n");
-		    std::vector<unsigned int> vec;
-		    mediadb::ChildrenToVector(value, &vec);
+		    out += "<children>\n";
 		    for (unsigned int j=0; j<vec.size(); ++j)
 		    {
 			if (vec[j] >= 0x100)
-			    fprintf(f, "  <child>%u</child>\n", vec[j]);
+			{
+			    out += "  <child>";
+			    out += std::to_string(vec[j]);
+			    out += "</child>\n";
+			}
 		    }
-		    fprintf(f, "</children>\n");
-		    value.clear();
+		    out += "</children>\n";
 		}
 		break;
+	    }
 	    default:
-		value = rs->GetString(i);
+		value = views[n++];
 		break;
 	    }
 
 	    if (!value.empty())
 	    {
-		value = util::XmlEscape(value);
-		fprintf(f, "<%s>%s</%s>\n", tagmap[i], value.c_str(),
-			tagmap[i]);
+		out += '<';
+		out += tagmap[i];
+		out += '>';
+		util::XmlEscape(value, &out);
+		out += "</";
+		out += tagmap[i];
+		out += ">\n";
 	    }
 	}
-	fprintf(f, "</record>\n\n");
+	out += "</record>\n\n";
+	fwrite(out.data(), 1, out.size(), f);
     }
 
     fprintf(f, "</db>\n");
@@ -294,8 +323,7 @@ public:
 		    else if (i == mediadb::CONTAINER)
 			rs->SetInteger(i, m_rev_containermap[value]);
 		    else if (i == mediadb::CHILDREN)
-			rs->SetString(i, 
-				      mediadb::VectorToChildren(m_children));
+			rs->SetArray(i, m_children);
 		    else
 			rs->SetString(i, value);
 		}
@@ -10,7 +10,9 @@ namespace mediatree {
 
 Directory::Directory(db::Database *thedb, unsigned int id)
     : m_db(thedb),
-      m_id(id)
+      m_id(id),
+      m_have_summary(false),
+      m_type(0)
 {
 }
 
@@ -18,7 +20,19 @@ Directory::Directory(db::Database *thedb, unsigned int id,
 		     db::RecordsetPtr info)
     : m_db(thedb),
       m_id(id),
-      m_info(info)
+      m_info(info),
+      m_have_summary(false),
+      m_type(0)
+{
+}
+
+Directory::Directory(db::Database *thedb, unsigned int id,
+		     const std::string& name, unsigned int type)
+    : m_db(thedb),
+      m_id(id),
+      m_have_summary(true),
+      m_name(name),
+      m_type(type)
 {
 }
 
@@ -39,16 +53,15 @@ NodePtr Directory::Create(db::Database *thedb, unsigned int id,
 
 std::string Directory::GetName()
 {
-    if (!m_info)
-	GetInfo();
-    return m_info->GetString(mediadb::TITLE);
+    if (m_have_summary)
+	return m_name;
+    return GetInfo()->GetString(mediadb::TITLE);
 }
 
 bool Directory::IsCompound()
 {
-    if (!m_info)
-	GetInfo();
-    unsigned int type = m_info->GetInteger(mediadb::TYPE);
+    unsigned int type = m_have_summary ? m_type
+	: GetInfo()->GetInteger(mediadb::TYPE);
     return type == mediadb::DIR || type == mediadb::PLAYLIST;
 }
 
@@ -63,10 +76,26 @@ Node::EnumeratorPtr Directory::GetChildren()
     {
 	GetInfo();
 	std::vector<unsigned int> vec;
-	mediadb::ChildrenToVector(m_info->GetString(mediadb::CHILDREN), &vec);
-	m_children.resize(vec.size());
-	for (unsigned int i=0; i<vec.size(); ++i)
-	    m_children[i] = NodePtr(new Directory(m_db, vec[i]));
+	m_info->GetArray(mediadb::CHILDREN, &vec);
+	m_children.reserve(vec.size());
+
+	/* One Fetch gets all the children's names and types. It skips
+	 * missing records, so walk the results alongside the IDs.
+	 */
+	db::RecordsetPtr rs = m_db->Fetch(mediadb::ID, vec);
+	for (unsigned int id: vec)
+	{
+	    if (rs && !rs->IsEOF() && rs->GetInteger(mediadb::ID) == id)
+	    {
+		m_children.push_back(
+		    NodePtr(new Directory(m_db, id,
+					  rs->GetString(mediadb::TITLE),
+					  rs->GetInteger(mediadb::TYPE))));
+		rs->MoveNext();
+	    }
+	    else
+		m_children.push_back(NodePtr(new Directory(m_db, id)));
+	}
     }
 
     return Node::EnumeratorPtr(new ContainerEnumerator<std::vector<NodePtr> >(m_children));
@@ -1,6 +1,7 @@
 #ifndef MEDIATREE_DIRECTORY_H
 #define MEDIATREE_DIRECTORY_H 1
 
+#include <string>
 #include <vector>
 #include "node.h"
 #include "libutil/counted_pointer.h"
@@ -15,8 +16,17 @@ class Directory: public Node
     unsigned int m_id;
     util::CountedPointer<db::Recordset> m_info;
 
+    /** Name and type, as fetched along with the parent's other children,
+     * so that listing them needn't query each one.
+     */
+    bool m_have_summary;
+    std::string m_name;
+    unsigned int m_type;
+
     Directory(db::Database*, unsigned int id);
     Directory(db::Database*, unsigned int id, util::CountedPointer<db::Recordset>);
+    Directory(db::Database*, unsigned int id, const std::string& name,
+	      unsigned int type);
 
     std::vector<NodePtr> m_children;
     
@@ -45,7 +45,7 @@ static const char tagstring[] =
     "lyricist\n";
 
 static void StreamAddString(std::string *st, int receiver_tag, 
-			    const std::string& s)
+			    std::string_view s)
 {
     if (!s.empty())
     {
@@ -58,11 +58,7 @@ static void StreamAddString(std::string *st, int receiver_tag,
 static void StreamAddInt(std::string *s, int receiver_tag, unsigned int n)
 {
     if (n)
-    {
-	std::ostringstream os;
-	os << n;
-	StreamAddString(s, receiver_tag, os.str());
-    }
+	StreamAddString(s, receiver_tag, std::to_string(n));
 }
 
 #if 0
@@ -136,10 +132,22 @@ std::unique_ptr<util::Stream> TagsStream(mediadb::Database *db, unsigned int id)
 	return ss;
     }
 
+    enum {
+	F_TITLE, F_ARTIST, F_ALBUM, F_GENRE, F_MOOD, F_ORIGINALARTIST,
+	F_REMIXED, NFIELDS
+    };
+    static const unsigned int fields[NFIELDS] = {
+	mediadb::TITLE, mediadb::ARTIST, mediadb::ALBUM, mediadb::GENRE,
+	mediadb::MOOD, mediadb::ORIGINALARTIST, mediadb::REMIXED
+    };
+    std::string_view field[NFIELDS];
+    std::string scratch[NFIELDS];
+    rs->GetStringViews(fields, NFIELDS, field, scratch);
+
     std::string s;
 
     StreamAddInt(&s, receiver::FID, id);
-    StreamAddString(&s, receiver::TITLE, rs->GetString(mediadb::TITLE));
+    StreamAddString(&s, receiver::TITLE, field[F_TITLE]);
     unsigned int mtype = rs->GetInteger(mediadb::TYPE);
     const char *type = "tune";
     switch (mtype)
@@ -175,21 +183,18 @@ std::unique_ptr<util::Stream> TagsStream(mediadb::Database *db, unsigned int id)
 	StreamAddInt(&s, receiver::LENGTH, rs->GetInteger(mediadb::SIZEBYTES));
 	StreamAddInt(&s, receiver::SAMPLERATE,
 		     rs->GetInteger(mediadb::SAMPLERATE));
-	std::ostringstream os;
-	os << "vs" << (rs->GetInteger(mediadb::BITSPERSEC)/1000);
-	StreamAddString(&s, receiver::BITRATE, os.str());
+	unsigned int kbps = rs->GetInteger(mediadb::BITSPERSEC) / 1000;
+	StreamAddString(&s, receiver::BITRATE, "vs" + std::to_string(kbps));
 	
-	StreamAddString(&s, receiver::ARTIST, rs->GetString(mediadb::ARTIST));
-	StreamAddString(&s, receiver::SOURCE, rs->GetString(mediadb::ALBUM));
+	StreamAddString(&s, receiver::ARTIST, field[F_ARTIST]);
+	StreamAddString(&s, receiver::SOURCE, field[F_ALBUM]);
 	StreamAddInt(&s, receiver::TRACKNR,
 		     rs->GetInteger(mediadb::TRACKNUMBER));
-	StreamAddString(&s, receiver::GENRE, rs->GetString(mediadb::GENRE));
+	StreamAddString(&s, receiver::GENRE, field[F_GENRE]);
 	StreamAddInt(&s, receiver::YEAR, rs->GetInteger(mediadb::YEAR));
-	StreamAddString(&s, receiver::MOOD, rs->GetString(mediadb::MOOD));
-	StreamAddString(&s, receiver::ORIGINALARTIST,
-			rs->GetString(mediadb::ORIGINALARTIST));
-	StreamAddString(&s, receiver::REMIXED,
-			rs->GetString(mediadb::REMIXED));
+	StreamAddString(&s, receiver::MOOD, field[F_MOOD]);
+	StreamAddString(&s, receiver::ORIGINALARTIST, field[F_ORIGINALARTIST]);
+	StreamAddString(&s, receiver::REMIXED, field[F_REMIXED]);
 	// ... CONDUCTOR COMPOSER ENSEMBLE LYRICIST
     }
 
@@ -571,13 +576,10 @@ public:
     virtual void OnItem(unsigned int id, db::RecordsetPtr rs) = 0;
 };
 
-static void Flatten(mediadb::Database *db, unsigned int id, bool upgrade,
-                    Flattener *f)
+static void Flatten(mediadb::Database *db, db::RecordsetPtr rs,
+		    bool upgrade, Flattener *f)
 {
-    db::QueryPtr qp = db->CreateQuery();
-    qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
-    db::RecordsetPtr rs = qp->Execute();  
-
+    unsigned int id = rs->GetInteger(mediadb::ID);
     unsigned int type = rs->GetInteger(mediadb::TYPE);
     switch (type)
     {
@@ -585,9 +587,11 @@ static void Flatten(mediadb::Database *db, unsigned int id, bool upgrade,
     case mediadb::PLAYLIST:
     {	
 	std::vector<unsigned int> vec;
-	mediadb::ChildrenToVector(rs->GetString(mediadb::CHILDREN), &vec);
-	for (unsigned int i=0; i<vec.size(); ++i)
-	    Flatten(db, vec[i], upgrade, f);
+	rs->GetArray(mediadb::CHILDREN, &vec);
+	for (db::RecordsetPtr crs = db->Fetch(mediadb::ID, vec);
+	     crs && !crs->IsEOF();
+	     crs->MoveNext())
+	    Flatten(db, crs, upgrade, f);
 	break;
     }
     case mediadb::TUNE:
@@ -598,11 +602,14 @@ static void Flatten(mediadb::Database *db, unsigned int id, bool upgrade,
 	    unsigned int newid = rs->GetInteger(mediadb::IDHIGH);
 	    if (newid)
 	    {
-		qp = db->CreateQuery();
+		db::QueryPtr qp = db->CreateQuery();
 		qp->Where(qp->Restrict(mediadb::ID, db::EQ, newid));
-		rs = qp->Execute();
-		if (rs && !rs->IsEOF())
+		db::RecordsetPtr nrs = qp->Execute();
+		if (nrs && !nrs->IsEOF())
+		{
 		    id = newid;
+		    rs = nrs;
+		}
 	    }
 	}
 	f->OnItem(id, rs);
@@ -613,6 +620,16 @@ static void Flatten(mediadb::Database *db, unsigned int id, bool upgrade,
     }
 }
 
+static void Flatten(mediadb::Database *db, unsigned int id, bool upgrade,
+                    Flattener *f)
+{
+    db::QueryPtr qp = db->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+    db::RecordsetPtr rs = qp->Execute();  
+    if (rs && !rs->IsEOF())
+	Flatten(db, rs, upgrade, f);
+}
+
 struct PlaylistReplyExtended
 {
     uint32_t fid;
@@ -681,8 +698,9 @@ static std::unique_ptr<util::Stream> ListStream(mediadb::Database *db,
     return ms;
 }
 
-ContentFactory::ContentFactory(mediadb::Database *db)
-    : m_db(db)
+ContentFactory::ContentFactory(mediadb::Database *db, bool db_in_memory)
+    : m_db(db),
+      m_db_in_memory(db_in_memory)
 {
     std::vector<uint32_t> random_data(624); // enough for Mersenne-19937
     std::random_device source;
@@ -738,6 +756,24 @@ bool ContentFactory::StreamForPath(const util::http::Request *rq,
     return false;
 }
 
+bool ContentFactory::IsNonBlocking(const util::http::Request *rq)
+{
+    const char *path = rq->path.c_str();
+
+    if (rq->path == "/tags")
+	return true;
+
+    /* Queries and tags are answered from the database alone. Not /content
+     * (which opens the media files), nor /list (which flattens a whole
+     * tree of playlists, and can take a while).
+     */
+    if (!m_db_in_memory)
+	return false;
+    return !strncmp(path, "/tags/", 6)
+	|| !strncmp(path, "/query?", 7)
+	|| !strncmp(path, "/results?", 9);
+}
+
 } // namespace receiverd
 
 #ifdef TEST
@@ -1010,6 +1046,18 @@ static void DoTests(mediadb::Database *mdb)
 
 	assert(ss.str() == expected);
     }
+
+    util::http::Request rq;
+    receiverd::ContentFactory rcf_in_memory(mdb, true);
+    rq.path = "/tags";
+    assert(rcf.IsNonBlocking(&rq));
+    rq.path = "/tags/100";
+    assert(!rcf.IsNonBlocking(&rq));
+    assert(rcf_in_memory.IsNonBlocking(&rq));
+    rq.path = "/content/100";
+    assert(!rcf_in_memory.IsNonBlocking(&rq));
+    rq.path = "/list/100";
+    assert(!rcf_in_memory.IsNonBlocking(&rq));
 }
 
 int main()
@@ -13,14 +13,20 @@ namespace receiverd {
 class ContentFactory: public util::http::ContentFactory
 {
     mediadb::Database *m_db;
+    bool m_db_in_memory;
     std::default_random_engine m_random;
 
 public:
-    explicit ContentFactory(mediadb::Database *db);
+    /** @param db_in_memory Whether queries on db never block (eg it's a
+     *                     steam database), so metadata requests can be
+     *                     served inline (see http::Server::SetInline)
+     */
+    explicit ContentFactory(mediadb::Database *db, bool db_in_memory = false);
 
     // Being a ContentFactory
     bool StreamForPath(const util::http::Request *rq, 
 		       util::http::Response *rs) override;
+    bool IsNonBlocking(const util::http::Request *rq) override;
 };
 
 } // namespace receiverd
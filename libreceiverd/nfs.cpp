@@ -269,6 +269,7 @@ unsigned int NFSServer::OnRPC(uint32_t proc, const void *args,
 # include "tarfs.h"
 # include "libutil/scheduler.h"
 # include "libutil/file_stream.h"
+# include "libutil/readahead_stream.h"
 
 int main(int argc, char *argv[])
 {
@@ -287,6 +288,7 @@ int main(int argc, char *argv[])
 	    return 1;
 	}
 
+	stm = util::CreateReadAheadStream(std::move(stm));
 	receiverd::TarFS tarfs(stm.get());
 
 	receiverd::NFSServer::Create(&poller, NULL, pmap.get(), &tarfs);
@@ -161,18 +161,22 @@ unsigned int TarFS::Read(unsigned int fh, unsigned int offset,
 
     *nread = 0;
 
+    /* The whole span in one read, not a sector at a time: the data is
+     * contiguous in the tar file, and NFS reads are typically 8K.
+     */
+    uint64_t pos = fh + 512 + (uint64_t)offset;
     while (count > 0)
     {
-	unsigned int rc = LoadSector(fh + 512 + (offset & ~511));
+	size_t n;
+	unsigned int rc = m_stm->ReadAt(buffer, pos, count, &n);
 	if (rc != 0)
 	    return rc;
-	unsigned int lump = std::min(512-(offset & 511), count);
-	
-	memcpy(buffer, m_sector + (offset & 511), lump);
-	*nread += lump;
-	count -= lump;
-	offset += lump;
-	buffer = ((char*)buffer) + lump;
+	if (n == 0)
+	    return EIO;
+	*nread += (unsigned int)n;
+	count -= (unsigned int)n;
+	pos += n;
+	buffer = ((char*)buffer) + n;
     }
     return 0;
 }
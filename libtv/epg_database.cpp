@@ -88,7 +88,7 @@ class Recordset final: public db::DelegatingRecordset
 
 public:
     Recordset(db::RecordsetPtr rs, Database *parent)
-	: DelegatingRecordset(rs),
+	: DelegatingRecordset(rs, true),
 	  m_parent(parent)
     {}
 
@@ -408,6 +408,12 @@ std::unique_ptr<util::Stream> WebEPG::CancelStream(unsigned int id)
     return std::unique_ptr<util::Stream>(new util::StringStream(s));
 }
 
+bool WebEPG::IsNonBlocking(const util::http::Request *rq)
+{
+    // Not ours, so declined without blocking
+    return strncmp(rq->path.c_str(), "/epg", 4) != 0;
+}
+
 bool WebEPG::StreamForPath(const util::http::Request *rq, 
 			   util::http::Response *rs)
 {
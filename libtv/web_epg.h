@@ -38,6 +38,7 @@ public:
     // Being a ContentFactory
     bool StreamForPath(const util::http::Request *rq, 
 		       util::http::Response *rs) override;
+    bool IsNonBlocking(const util::http::Request *rq) override;
 };
 
 } // namespace tv
@@ -5,6 +5,8 @@
 #include "libutil/http_fetcher.h"
 #include "libutil/http_server.h"
 #include "libutil/http_client.h"
+#include "libutil/http_await.h"
+#include "libutil/coroutine.h"
 #include "libutil/socket.h"
 #include "libutil/string_stream.h"
 #include "libutil/xml.h"
@@ -49,7 +51,6 @@ class DeviceClient::Impl: public util::http::ContentFactory
     class EventXMLObserver;
     class Response;
     class AsyncSoapHandler;
-    class AsyncInitHandler;
     class AsyncSubscribeHandler;
     class SyncSoapHandler;
 
@@ -68,6 +69,10 @@ public:
 
     void SetLocalIPAddress(util::IPAddress a) { m_local_address = a; }
 
+    util::CoTask AsyncInit(std::string descurl, std::string udn,
+			   DeviceClient::InitCallback callback,
+			   unsigned int *prc);
+
     unsigned int RegisterClient(const char *service_id, ServiceClient*);
     unsigned int RegisterClient(const char *service_id, ServiceClient*,
 				ServiceClient::InitCallback);
@@ -133,67 +138,43 @@ unsigned int DeviceClient::Init(const std::string& descurl,
     return 0;
 }
 
-class DeviceClient::Impl::AsyncInitHandler: public util::http::Recipient
-{
-    DeviceClient::Impl *m_dci;
-    DeviceClient::InitCallback m_callback;
-    std::string m_description;
-    std::string m_descurl;
-    std::string m_udn;
-
-public:
-    AsyncInitHandler(DeviceClient::Impl *dci, const std::string& descurl,
-		     const std::string& udn,
-		     DeviceClient::InitCallback callback)
-	: m_dci(dci), m_callback(callback), m_descurl(descurl), m_udn(udn)
+/** Asynchronous initialisation, as a coroutine
+ *
+ * The callback is only called if the fetch gets started, in which case
+ * *prc (which the caller must only look at when we first return) is 0.
+ */
+util::CoTask DeviceClient::Impl::AsyncInit(std::string descurl,
+					   std::string udn,
+					   DeviceClient::InitCallback callback,
+					   unsigned int *prc)
+{
+    util::http::AwaitFetch fetch(m_client, m_scheduler, descurl);
+    *prc = fetch.Start();
+    if (*prc)
     {
+	TRACE << "Failed to init connection\n";
+	co_return;
     }
 
-    // Being a util::http::Recipient
-    unsigned OnData(const void*, size_t);
-    void OnEndPoint(const util::IPEndPoint&);
-    void OnDone(unsigned int rc);
-};
-
-unsigned DeviceClient::Impl::AsyncInitHandler::OnData(const void *buffer,
-						      size_t len)
-{
-    m_description.append((const char*)buffer, len);
-    return 0;
-}
-
-void DeviceClient::Impl::AsyncInitHandler::OnEndPoint(const util::IPEndPoint& endpoint)
-{
-    m_dci->SetLocalIPAddress(endpoint.addr);
-}
-
-void DeviceClient::Impl::AsyncInitHandler::OnDone(unsigned int rc)
-{
-    TRACE << "aih" << this << " in OnDone(" << rc << ")\n";
+    util::http::FetchResult reply = co_await fetch;
+    unsigned int rc = reply.error;
     if (!rc)
     {
-	TRACE << "Description: " << m_description << "\n";
-	rc = m_dci->m_desc.Parse(m_description, m_descurl, m_udn);
+	TRACE << "Description: " << reply.body << "\n";
+	SetLocalIPAddress(reply.local_endpoint.addr);
+	rc = m_desc.Parse(reply.body, descurl, udn);
     }
 
-    TRACE << "aih" << this << " calls callback(" << rc << ")\n";
-    m_callback(rc);
+    TRACE << "AsyncInit calls callback(" << rc << ")\n";
+    callback(rc);
 }
 
 unsigned int DeviceClient::Init(const std::string& descurl,
 				const std::string& udn,
 				DeviceClient::InitCallback callback)
 {
-    util::http::RecipientPtr hcp(new Impl::AsyncInitHandler(m_impl, 
-							    descurl, udn,
-							    callback));
-
-    unsigned int rc = m_impl->m_client->Connect(m_impl->m_scheduler, hcp,
-						descurl);
-    if (rc)
-	TRACE << "Failed to init connection";
-//    TRACE << "HTTP running asynchronously\n";
-
+    unsigned int rc;
+    m_impl->AsyncInit(descurl, udn, callback, &rc);
     return rc;
 }
 
@@ -448,7 +429,7 @@ unsigned int DeviceClient::Impl::RegisterClient(const char *service_id,
 					"SUBSCRIBE");
 
     if (rc)
-	TRACE << "Failed to init connection";
+	TRACE << "Failed to init connection\n";
     return rc;
 }
 
@@ -652,7 +633,7 @@ unsigned int DeviceClient::Impl::SoapAction(const char *service_id,
 					headers.c_str(),
 					body.c_str());
     if (rc)
-	TRACE << "Failed to init connection";
+	TRACE << "Failed to init connection\n";
 
     return rc;
 }
@@ -366,6 +366,19 @@ static bool prefixcmp(const char *haystack, const char *needle,
     return false;
 }
 
+/** Bigger responses than this (in unescaped string parameters) aren't
+ * assembled in memory, but streamed (and so not logged).
+ */
+enum { STREAM_THRESHOLD = 32*1024 };
+
+static size_t StringBytes(const soap::Params& params)
+{
+    size_t n = 0;
+    for (unsigned int i=0; i<soap::Params::MAX_PARAMS; ++i)
+	n += params.strings[i].size();
+    return n;
+}
+
 class Server::Impl::SoapReplier: public util::Stream
 {
     Service *m_service;
@@ -426,6 +439,15 @@ public:
 	
                 m_response->body_source.reset(new util::StringStream(body));
             }
+            else if (StringBytes(result) > STREAM_THRESHOLD)
+            {
+                LOG(SOAP) << "Soap response is streamed\n";
+
+                m_response->body_source = soap::CreateResponseStream(
+                    m_service->GetData(), m_action,
+                    m_service->GetServiceType(), &result,
+                    &m_response->length);
+            }
             else
             {
                 std::string body = soap::CreateBody(m_service->GetData(),
@@ -3,6 +3,9 @@
 #include "libutil/trace.h"
 #include "libutil/printf.h"
 #include "libutil/xmlescape.h"
+#include "libutil/stream.h"
+#include <algorithm>
+#include <vector>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
@@ -45,9 +48,18 @@ Params::~Params()
 {
 }
 
-std::string CreateBody(const upnp::Data *data, unsigned int action,
-		       bool response, const char *service_type,
-		       const Params& params)
+/** The body as a series of pieces: XML text, each (but perhaps the last)
+ * followed by a string parameter which is still to be escaped.
+ */
+struct Piece
+{
+    std::string text;
+    const std::string *escape;
+};
+
+static void CreatePieces(const upnp::Data *data, unsigned int action,
+			 bool response, const char *service_type,
+			 const Params& params, std::vector<Piece> *pieces)
 {
     std::string s = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
 	"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\""
@@ -78,7 +90,10 @@ std::string CreateBody(const upnp::Data *data, unsigned int action,
 	s += ">";
 	if (type == Data::STRING)
 	{
-	    s += util::XmlEscape(*ptrstr++);
+	    Piece piece;
+	    piece.text.swap(s);
+	    piece.escape = ptrstr++;
+	    pieces->push_back(std::move(piece));
 	}
 	else if (type >= Data::ENUM)
 	{
@@ -127,8 +142,199 @@ std::string CreateBody(const upnp::Data *data, unsigned int action,
     if (response)
 	s += "Response";
     s += ">\r\n</s:Body>\r\n</s:Envelope>\r\n";
+
+    Piece piece;
+    piece.text.swap(s);
+    piece.escape = NULL;
+    pieces->push_back(std::move(piece));
+}
+
+std::string CreateBody(const upnp::Data *data, unsigned int action,
+		       bool response, const char *service_type,
+		       const Params& params)
+{
+    std::vector<Piece> pieces;
+    CreatePieces(data, action, response, service_type, params, &pieces);
+
+    std::string s;
+    for (size_t i=0; i<pieces.size(); ++i)
+    {
+	s += pieces[i].text;
+	if (pieces[i].escape)
+	    util::XmlEscape(*pieces[i].escape, &s);
+    }
     return s;
 }
 
+/** Escapes each string parameter a slice at a time, as it's read.
+ */
+class BodyStream final: public util::Stream
+{
+    Params m_params;
+    std::vector<Piece> m_pieces;
+    size_t m_piece;
+    bool m_in_text; ///< Else in the escaped string following the text
+    size_t m_offset; ///< Into the text, or the unescaped string
+    std::string m_escaped; ///< Escaped but not yet read
+    size_t m_escaped_offset;
+
+    enum { SLICE = 4096 };
+
+public:
+    BodyStream(const upnp::Data *data, unsigned int action,
+	       const char *service_type, Params *params)
+	: m_piece(0), m_in_text(true), m_offset(0), m_escaped_offset(0)
+    {
+	for (unsigned int i=0; i<Params::MAX_PARAMS; ++i)
+	{
+	    m_params.bytes[i] = params->bytes[i];
+	    m_params.shorts[i] = params->shorts[i];
+	    m_params.ints[i] = params->ints[i];
+	    m_params.strings[i].swap(params->strings[i]);
+	}
+	CreatePieces(data, action, true, service_type, m_params, &m_pieces);
+    }
+
+    /** The total that Read will produce */
+    uint64_t CountLength() const
+    {
+	uint64_t n = 0;
+	for (const Piece& piece: m_pieces)
+	{
+	    n += piece.text.size();
+	    if (piece.escape)
+		n += util::XmlEscapedLength(*piece.escape);
+	}
+	return n;
+    }
+
+    // Being a Stream
+    unsigned GetStreamFlags() const override { return READABLE; }
+    unsigned Read(void *buffer, size_t len, size_t *pread) override;
+};
+
+unsigned BodyStream::Read(void *buffer, size_t len, size_t *pread)
+{
+    char *out = (char*)buffer;
+    size_t done = 0;
+
+    while (done < len && m_piece < m_pieces.size())
+    {
+	const Piece& piece = m_pieces[m_piece];
+
+	if (m_escaped_offset < m_escaped.size())
+	{
+	    size_t n = std::min(len - done,
+				m_escaped.size() - m_escaped_offset);
+	    memcpy(out + done, m_escaped.data() + m_escaped_offset, n);
+	    m_escaped_offset += n;
+	    done += n;
+	}
+	else if (m_in_text)
+	{
+	    size_t n = std::min(len - done, piece.text.size() - m_offset);
+	    memcpy(out + done, piece.text.data() + m_offset, n);
+	    m_offset += n;
+	    done += n;
+	    if (m_offset == piece.text.size())
+	    {
+		m_in_text = false;
+		m_offset = 0;
+	    }
+	}
+	else if (piece.escape && m_offset < piece.escape->size())
+	{
+	    size_t n = std::min((size_t)SLICE, piece.escape->size() - m_offset);
+	    m_escaped.clear();
+	    m_escaped_offset = 0;
+	    util::XmlEscape(std::string_view(*piece.escape).substr(m_offset, n),
+			    &m_escaped);
+	    m_offset += n;
+	}
+	else
+	{
+	    ++m_piece;
+	    m_in_text = true;
+	    m_offset = 0;
+	}
+    }
+
+    *pread = done;
+    return 0;
+}
+
+std::unique_ptr<util::Stream> CreateResponseStream(const upnp::Data *data,
+						   unsigned int action,
+						   const char *service_type,
+						   Params *result,
+						   uint64_t *length)
+{
+    BodyStream *stm = new BodyStream(data, action, service_type, result);
+    *length = stm->CountLength();
+    return std::unique_ptr<util::Stream>(stm);
+}
+
 } // namespace soap
 } // namespace upnp
+
+#ifdef TEST
+
+# include <assert.h>
+
+static const char *const s_params[] = { "Count", "Result" };
+static const unsigned char s_types[] = { upnp::Data::UI32,
+					 upnp::Data::STRING };
+static const char *const s_actions[] = { "Browse" };
+static const unsigned char s_browse_args[] = "";
+static const unsigned char s_browse_results[] = "10";
+static const unsigned char *const s_args[] = { s_browse_args };
+static const unsigned char *const s_results[] = { s_browse_results };
+
+static const upnp::Data s_data = {
+    { 2, s_params },
+    s_types,
+    { 1, s_actions },
+    s_args,
+    s_results,
+    NULL
+};
+
+int main()
+{
+    std::string result;
+    for (unsigned int i=0; i<2000; ++i)
+	result += "<item id=\"" + std::to_string(i) + "\">Tom & Jerry</item>";
+
+    upnp::soap::Params params;
+    params.ints[0] = 2000;
+    params.strings[0] = result;
+    std::string expected = upnp::soap::CreateBody(&s_data, 0, true, "urn:test",
+					    params);
+    assert(expected.find("<Count>2000</Count>") != std::string::npos);
+    assert(expected.find("&lt;item id=&quot;1999&quot;&gt;Tom &amp; Jerry")
+	   != std::string::npos);
+
+    // Odd-sized reads, so as to straddle every boundary
+    uint64_t length = 0;
+    std::unique_ptr<util::Stream> stm
+	= upnp::soap::CreateResponseStream(&s_data, 0, "urn:test", &params,
+					   &length);
+    assert(params.strings[0].empty());
+    assert(length == expected.size());
+    std::string actual;
+    for (;;)
+    {
+	char buffer[1000];
+	size_t nread;
+	unsigned int rc = stm->Read(buffer, sizeof(buffer) - 7, &nread);
+	assert(rc == 0);
+	if (!nread)
+	    break;
+	actual.append(buffer, nread);
+    }
+    assert(actual == expected);
+
+    return 0;
+}
+
+#endif
@@ -2,8 +2,11 @@
 #define LIBUPNP_SOAP_H
 
 #include <string>
+#include <memory>
 #include <stdint.h>
 
+namespace util { class Stream; }
+
 /** Classes implementing UPnP.
  */
 namespace upnp {
@@ -32,6 +35,21 @@ struct Params
 std::string CreateBody(const upnp::Data*, unsigned int action, bool response,
 		       const char *service_type, const Params& params);
 
+/** CreateBody(response=true) as a stream, for replies too big to want
+ * in memory twice over: string parameters are escaped a slice at a time,
+ * as the stream is read.
+ *
+ * Takes the strings out of *result, rather than copying them. The stream
+ * isn't seekable, but its length is counted up front (without escaping
+ * anything) into *length, for http::Response::length -- UDA 1.0 control
+ * points can't be relied on to understand a chunked reply.
+ */
+std::unique_ptr<util::Stream> CreateResponseStream(const upnp::Data*,
+						   unsigned int action,
+						   const char *service_type,
+						   Params *result,
+						   uint64_t *length);
+
 /** A SOAP server.
  *
  * For the client implementation, see upnp::Client.
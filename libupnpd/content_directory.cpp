@@ -5,7 +5,9 @@
 #include "libmediadb/db.h"
 #include "libdb/query.h"
 #include "libdb/recordset.h"
+#include "libutil/scheduler.h"
 #include "libutil/scheduler_task.h"
+#include "libutil/task.h"
 #include "libutil/counted_pointer.h"
 #include "libutil/trace.h"
 #include "libutil/xmlescape.h"
@@ -14,7 +16,7 @@
 #include "libutil/bind.h"
 #include "libupnp/soap_info_source.h"
 #include "search.h"
-#include <sstream>
+#include <algorithm>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
@@ -94,11 +96,128 @@ public:
     }
 };
 
+class ContentDirectoryImpl::EventTask: public util::Task
+{
+    ContentDirectoryImpl *m_parent;
+
+public:
+    explicit EventTask(ContentDirectoryImpl *parent) : m_parent(parent) {}
+
+    unsigned OnTimer() { m_parent->OnEventTimer(); return 0; }
+    unsigned Run() { return 0; }
+};
+
 ContentDirectoryImpl::ContentDirectoryImpl(mediadb::Database *db,
-					   upnp::soap::InfoSource *info_source)
+					   upnp::soap::InfoSource *info_source,
+					   mediadb::UpdateTracker *tracker,
+					   util::Scheduler *scheduler)
     : m_db(db),
-      m_info_source(info_source)
+      m_info_source(info_source),
+      m_didl_cache(db),
+      m_tracker(tracker),
+      m_scheduler(scheduler),
+      m_event_task(new EventTask(this)),
+      m_event_pending(false),
+      m_evented_id(tracker ? tracker->GetSystemUpdateID()
+		   : (uint32_t)mediadb::UpdateTracker::INITIAL_UPDATE_ID)
+{
+    if (m_tracker && m_scheduler)
+	m_tracker->AddObserver(this);
+}
+
+ContentDirectoryImpl::~ContentDirectoryImpl()
+{
+    if (m_tracker && m_scheduler)
+    {
+	m_tracker->RemoveObserver(this);
+	m_scheduler->Remove(m_event_task);
+    }
+}
+
+void ContentDirectoryImpl::OnUpdate()
+{
+    {
+	std::lock_guard<std::mutex> lock(m_event_mutex);
+	if (m_event_pending)
+	    return;
+	m_event_pending = true;
+    }
+    m_scheduler->WaitFor(util::Bind(m_event_task).To<&EventTask::OnTimer>(),
+			 EVENT_MS);
+}
+
+/** Object IDs as they are in DIDL (see mediadb::didl::FromRecord) */
+static std::string ObjectID(unsigned int id)
+{
+    return std::to_string(id == mediadb::BROWSE_ROOT ? 0 : id);
+}
+
+void ContentDirectoryImpl::OnEventTimer()
+{
+    uint32_t since;
+    {
+	std::lock_guard<std::mutex> lock(m_event_mutex);
+	m_event_pending = false;
+	since = m_evented_id;
+    }
+
+    // Anything changing from here on gets another event
+    uint32_t system_update_id = m_tracker->GetSystemUpdateID();
+    mediadb::UpdateTracker::containers_t changed;
+    m_tracker->GetChangedContainers(since, &changed);
+
+    std::string container_update_ids;
+    for (mediadb::UpdateTracker::containers_t::const_iterator i
+	     = changed.begin();
+	 i != changed.end();
+	 ++i)
+    {
+	if (!container_update_ids.empty())
+	    container_update_ids += ',';
+	container_update_ids += ObjectID(i->first);
+	container_update_ids += ',';
+	container_update_ids += std::to_string(i->second);
+    }
+
+    {
+	std::lock_guard<std::mutex> lock(m_event_mutex);
+	m_evented_id = system_update_id;
+	m_container_update_ids = container_update_ids;
+    }
+
+    LOG(CDS) << "SystemUpdateID " << system_update_id
+	     << " ContainerUpdateIDs " << container_update_ids << "\n";
+
+    Fire(&upnp::ContentDirectoryObserver::OnSystemUpdateID,
+	 system_update_id);
+    if (!container_update_ids.empty())
+	Fire(&upnp::ContentDirectoryObserver::OnContainerUpdateIDs,
+	     container_update_ids);
+}
+
+/** The UpdateID for a Browse: the container update ID of the object (or
+ * of its parent, for an item), as its listing is what the control point
+ * will be caching.
+ */
+static uint32_t BrowseUpdateID(mediadb::UpdateTracker *tracker,
+			       const db::RecordsetPtr& rs)
 {
+    if (!tracker)
+	return mediadb::UpdateTracker::INITIAL_UPDATE_ID;
+    unsigned int type = rs->GetInteger(mediadb::TYPE);
+    unsigned int id = rs->GetInteger(mediadb::ID);
+    if (type != mediadb::DIR && type != mediadb::PLAYLIST
+	&& rs->GetInteger(mediadb::IDPARENT))
+	id = rs->GetInteger(mediadb::IDPARENT);
+    return tracker->GetContainerUpdateID(id);
+}
+
+void ContentDirectoryImpl::LogCacheStats()
+{
+    mediadb::didl::Cache::Stats stats = m_didl_cache.GetStats();
+    LOG(CDS) << "DIDL cache: " << stats.hits << " hits, " << stats.misses
+	     << " misses, " << stats.uncacheable << " uncacheable, "
+	     << stats.entries << " entries\n";
 }
 
 static unsigned int DIDLFilter(const std::string& filter)
@@ -138,12 +257,45 @@ static unsigned int DIDLFilter(const std::string& filter)
     return didl_filter;
 }
 
+/** A page of a container's children, sorted by a query on IDPARENT: so
+ * the database's indexes do the work, and each page doesn't cost a fetch
+ * and sort of every child.
+ *
+ * That only works if the children are just the records whose IDPARENT is
+ * the container, which the counts agreeing is taken to mean. A playlist's
+ * aren't, nor are those of a db::merge::Database's merged root, or of
+ * containers in any but its first database; then it returns NULL, and the
+ * caller sorts them itself.
+ */
+static db::RecordsetPtr QuerySortedChildren(mediadb::Database *db,
+					    unsigned int id,
+					    size_t nchildren,
+					    const std::string& sort_criteria,
+					    uint32_t starting_index,
+					    uint32_t requested_count)
+{
+    db::QueryPtr qp = db->CreateQuery();
+    if (qp->Where(qp->Restrict(mediadb::IDPARENT, db::EQ, id))
+	|| ApplySortCriteria(qp.get(), sort_criteria)
+	|| qp->Limit(starting_index + requested_count))
+	return db::RecordsetPtr();
+
+    db::RecordsetPtr rs = qp->Execute();
+    size_t count;
+    if (!rs || rs->GetCount(&count) || count != nchildren)
+	return db::RecordsetPtr();
+
+    for (uint32_t i=0; i<starting_index && !rs->IsEOF(); ++i)
+	rs->MoveNext();
+    return rs;
+}
+
 unsigned int ContentDirectoryImpl::Browse(const std::string& object_id,
 					  BrowseFlag browse_flag,
 					  const std::string& filter,
 					  uint32_t starting_index,
 					  uint32_t requested_count,
-					  const std::string& /*sort_criteria*/,
+					  const std::string& sort_criteria,
 					  std::string *result,
 					  uint32_t *number_returned,
 					  uint32_t *total_matches,
@@ -170,13 +322,9 @@ unsigned int ContentDirectoryImpl::Browse(const std::string& object_id,
 	return ENOENT;
     }
 
-    std::vector<unsigned int> children;
-    mediadb::ChildrenToVector(rs->GetString(mediadb::CHILDREN), &children);
-
     unsigned int didl_filter = DIDLFilter(filter);
 
-    std::ostringstream ss;
-    ss << mediadb::didl::s_header;
+    std::string s = mediadb::didl::s_header;
 
     std::string urlprefix;
     if (m_info_source)
@@ -185,50 +333,103 @@ unsigned int ContentDirectoryImpl::Browse(const std::string& object_id,
 	urlprefix = "http://" + ipe.ToString() + "/content/";
     }
 
+    *update_id = BrowseUpdateID(m_tracker, rs);
+
     if (browse_flag == BROWSEFLAG_BROWSE_METADATA)
     {
-	ss << mediadb::didl::FromRecord(m_db, rs, urlprefix.c_str(), 
-					didl_filter);
+	m_didl_cache.Append(rs, urlprefix, didl_filter, &s);
 	*number_returned = 1;
 	*total_matches = 1;
-	*update_id = 1;
     }
     else if (browse_flag == BROWSEFLAG_BROWSE_DIRECT_CHILDREN)
     {
-	if (starting_index > children.size())
+	size_t nchildren = rs->GetArraySize(mediadb::CHILDREN);
+	if (starting_index > nchildren)
 	{
 	    TRACE << "starting_index " << starting_index << " off the end ("
-		  << children.size() << ")\n";
+		  << nchildren << ")\n";
 	    return ENOENT;
 	}
 
 	if (requested_count == 0)
-	    requested_count = (uint32_t)children.size();
+	    requested_count = (uint32_t)nchildren;
 	
-	if (starting_index + requested_count > children.size())
-	    requested_count = (uint32_t)(children.size() - starting_index);
+	if (starting_index + requested_count > nchildren)
+	    requested_count = (uint32_t)(nchildren - starting_index);
 
 	LOG(CDS) << "Returning children " << starting_index << ".."
 		 << (starting_index+requested_count) << "/"
-		 << children.size() << "\n";
+		 << nchildren << "\n";
+
+	std::vector<unsigned int> children;
+	size_t nfound = 0;
+	db::RecordsetPtr crs;
 
-	for (unsigned int i = 0; i < requested_count; ++i)
+	if (!sort_criteria.empty() && requested_count)
+	    crs = QuerySortedChildren(m_db, id ? id : mediadb::BROWSE_ROOT,
+				      nchildren, sort_criteria,
+				      starting_index, requested_count);
+
+	if (crs)
+	{
+	    for (; nfound < requested_count && !crs->IsEOF(); crs->MoveNext())
+	    {
+		m_didl_cache.Append(crs, urlprefix, didl_filter, &s);
+		++nfound;
+	    }
+	}
+	else if (!sort_criteria.empty() && requested_count)
 	{
-	    qp = m_db->CreateQuery();
-	    qp->Where(qp->Restrict(mediadb::ID, db::EQ, 
-				   children[starting_index+i]));
-	    rs = qp->Execute();
-	    if (rs && !rs->IsEOF())
-		ss << mediadb::didl::FromRecord(m_db, rs, urlprefix.c_str(),
-					     didl_filter);
+	    /* Sorted here, then: the children may be in several databases
+	     * (see db::merge::Database), and a playlist may list one more
+	     * than once, which a query would only return once.
+	     */
+	    std::vector<SortKey> keys;
+	    rc = ParseSortCriteria(sort_criteria, &keys);
+	    if (rc)
+		return rc;
+	    rs->GetArray(mediadb::CHILDREN, &children);
+	    std::vector<unsigned int> sorted;
+	    SortRecords(m_db->Fetch(mediadb::ID, children), keys, &sorted);
+
+	    if (starting_index < sorted.size())
+		children.assign(sorted.begin() + starting_index,
+				sorted.begin() + std::min(
+				    sorted.size(),
+				    (size_t)starting_index + requested_count));
 	    else
+		children.clear();
+
+	    for (rs = m_db->Fetch(mediadb::ID, children);
+		 rs && !rs->IsEOF();
+		 rs->MoveNext())
+	    {
+		m_didl_cache.Append(rs, urlprefix, didl_filter, &s);
+		++nfound;
+	    }
+	}
+	else
+	{
+	    // Only the requested slice, not the whole (perhaps huge) list
+	    rs->GetArray(mediadb::CHILDREN, &children, starting_index,
+			 requested_count);
+
+	    // All at once, not one query per child
+	    for (rs = m_db->Fetch(mediadb::ID, children);
+		 rs && !rs->IsEOF();
+		 rs->MoveNext())
 	    {
-		TRACE << "Child " << children[starting_index+i] << " not found\n";
+		m_didl_cache.Append(rs, urlprefix, didl_filter, &s);
+		++nfound;
 	    }
 	}
+	if (nfound != requested_count)
+	{
+	    TRACE << (requested_count - nfound) << " children of " << id
+		  << " not found\n";
+	}
 	*number_returned = requested_count;
-	*total_matches = (uint32_t)children.size();
-	*update_id = 1;
+	*total_matches = (uint32_t)nchildren;
     }
     else
     {
@@ -236,20 +437,79 @@ unsigned int ContentDirectoryImpl::Browse(const std::string& object_id,
 	return EINVAL;
     }
 
-    ss << mediadb::didl::s_footer;
+    s += mediadb::didl::s_footer;
 
-    LOG(CDS) << "Browse result is " << ss.str() << "\n\n";
+    LOG(CDS) << "Browse result is " << s << "\n\n";
+    LogCacheStats();
 
-    *result = ss.str();
+    *result = std::move(s);
     return 0;
 }
 
+/** Runs a search, ordered as asked for (unless it's a collation).
+ */
+static unsigned int RunSearch(mediadb::Database *db,
+			      const std::string& search_criteria,
+			      const std::string& sort_criteria,
+			      db::RecordsetPtr *prs, unsigned int *collate)
+{
+    db::QueryPtr qp = db->CreateQuery();
+
+    unsigned int rc = ApplySearchCriteria(qp.get(), search_criteria, collate);
+    if (rc != 0)
+	return rc;
+
+    // Collations come back in order of the collated field anyway
+    if (!*collate)
+    {
+	rc = ApplySortCriteria(qp.get(), sort_criteria);
+	if (rc != 0)
+	    return rc;
+    }
+
+    *prs = qp->Execute();
+    return 0;
+}
+
+bool ContentDirectoryImpl::TakeContinuation(const std::string& key,
+					    uint32_t position,
+					    Continuation *pc)
+{
+    time_t now = time(NULL);
+    std::lock_guard<std::mutex> lock(m_continuations_mutex);
+    for (std::list<Continuation>::iterator i = m_continuations.begin();
+	 i != m_continuations.end();
+	 )
+    {
+	if (i->expires < now)
+	    i = m_continuations.erase(i);
+	else if (i->key == key && i->position == position)
+	{
+	    *pc = std::move(*i);
+	    m_continuations.erase(i);
+	    return true;
+	}
+	else
+	    ++i;
+    }
+    return false;
+}
+
+void ContentDirectoryImpl::SaveContinuation(Continuation&& c)
+{
+    c.expires = time(NULL) + CONTINUATION_SECS;
+    std::lock_guard<std::mutex> lock(m_continuations_mutex);
+    m_continuations.push_front(std::move(c));
+    if (m_continuations.size() > MAX_CONTINUATIONS)
+	m_continuations.pop_back();
+}
+
 unsigned int ContentDirectoryImpl::Search(const std::string& container_id,
 					  const std::string& search_criteria,
 					  const std::string& filter,
 					  uint32_t starting_index,
 					  uint32_t requested_count,
-					  const std::string& /*sort_criteria*/,
+					  const std::string& sort_criteria,
 					  std::string *result,
 					  uint32_t *number_returned,
 					  uint32_t *total_matches,
@@ -258,20 +518,39 @@ unsigned int ContentDirectoryImpl::Search(const std::string& container_id,
     LOG(CDS) << "Search(" << search_criteria
 	     << "," << starting_index << "," << requested_count << ")\n";
 
-    db::QueryPtr qp = m_db->CreateQuery();
-
-    unsigned int collate = 0;
-
-    unsigned int rc = ApplySearchCriteria(qp.get(), search_criteria, &collate);
-    if (rc != 0)
-	return rc;
+    // Results from before a change to the database aren't carried on with
+    // -- which, without a tracker to say there's been none, means never
+    uint32_t system_update_id;
+    GetSystemUpdateID(&system_update_id);
+    bool resumable = (m_tracker != NULL);
+
+    Continuation c;
+    c.key = container_id + "\n" + search_criteria + "\n" + sort_criteria
+	+ "\n" + std::to_string(system_update_id);
+    c.collate = 0;
+    c.position = 0;
+    c.total = 0;
+
+    if (resumable && starting_index
+	&& TakeContinuation(c.key, starting_index, &c))
+    {
+	LOG(CDS) << "Resuming at " << starting_index << "/" << c.total
+		 << "\n";
+    }
+    else
+    {
+	unsigned int rc = RunSearch(m_db, search_criteria, sort_criteria,
+				    &c.rs, &c.collate);
+	if (rc != 0)
+	    return rc;
+    }
 
-    db::RecordsetPtr rs = qp->Execute();
+    db::RecordsetPtr rs = c.rs;
+    unsigned int collate = c.collate;
 
     unsigned int didl_filter = DIDLFilter(filter);
 
-    std::ostringstream ss;
-    ss << mediadb::didl::s_header;
+    std::string s = mediadb::didl::s_header;
 
     std::string urlprefix;
     if (m_info_source)
@@ -280,7 +559,7 @@ unsigned int ContentDirectoryImpl::Search(const std::string& container_id,
 	urlprefix = "http://" + ipe.ToString() + "/content/";
     }
 
-    unsigned int n = 0;
+    unsigned int n = c.position;
     unsigned int nok = 0;
 
     if (requested_count == 0)
@@ -292,14 +571,20 @@ unsigned int ContentDirectoryImpl::Search(const std::string& container_id,
 	{
 	    if (collate)
 	    {
+		std::string value = util::XmlEscape(rs->GetString(0));
+
 		/** These object IDs never come back to us in Browse, so it's
 		 * OK to use fictitious ones.
 		 */
-		ss << "<container id=\"" << collate << ":" << n
-		   << "\" parentID=\"" << container_id << "\" restricted=\"true\""
-		    " searchable=\"true\">"
-		   << "<dc:title>" << util::XmlEscape(rs->GetString(0))
-		   << "</dc:title>";
+		s += "<container id=\"";
+		s += std::to_string(collate);
+		s += ':';
+		s += std::to_string(n);
+		s += "\" parentID=\"";
+		s += container_id;
+		s += "\" restricted=\"true\" searchable=\"true\"><dc:title>";
+		s += value;
+		s += "</dc:title>";
 
 		/** Note that the searchClass values here are what decide the
 		 * menu hierarchy on the client. Artist leads to Album,
@@ -310,62 +595,87 @@ unsigned int ContentDirectoryImpl::Search(const std::string& container_id,
 		switch (collate)
 		{
 		case mediadb::ARTIST:
-		    ss << "<upnp:class>object.container.person.musicArtist"
+		    s += "<upnp:class>object.container.person.musicArtist"
 			"</upnp:class>"
-			"<upnp:artist>" << util::XmlEscape(rs->GetString(0))
-		       << "</upnp:artist>"
+			"<upnp:artist>";
+		    s += value;
+		    s += "</upnp:artist>"
 			"<upnp:searchClass includeDerived=\"0\">"
 			"object.container.album.musicAlbum"
 			"</upnp:searchClass>";
 		    break;
 		case mediadb::ALBUM:
-		    ss << "<upnp:class>object.container.album.musicAlbum"
+		    s += "<upnp:class>object.container.album.musicAlbum"
 			"</upnp:class>"
-			"<upnp:album>" << util::XmlEscape(rs->GetString(0))
-		       << "</upnp:album>"
+			"<upnp:album>";
+		    s += value;
+		    s += "</upnp:album>"
 			"<upnp:searchClass includeDerived=\"0\">"
 			"object.item.audioItem.musicTrack"
 			"</upnp:searchClass>";
 		    break;
 		case mediadb::GENRE:
-		    ss << "<upnp:class>object.container.genre.musicGenre"
+		    s += "<upnp:class>object.container.genre.musicGenre"
 			"</upnp:class>"
-			"<upnp:genre>" << util::XmlEscape(rs->GetString(0))
-		       << "</upnp:genre>"
+			"<upnp:genre>";
+		    s += value;
+		    s += "</upnp:genre>"
 			"<upnp:searchClass includeDerived=\"0\">"
 			"object.item.audioItem.musicTrack"
 			"</upnp:searchClass>";
 		    break;
 		}
-		ss << "</container>";
+		s += "</container>";
 	    }
 	    else
-	    {
-		ss << mediadb::didl::FromRecord(m_db, rs, urlprefix.c_str(),
-					     didl_filter);
-	    }
+		m_didl_cache.Append(rs, urlprefix, didl_filter, &s);
 	    ++nok;
 	}
 
 	rs->MoveNext();
 	++n;
     }
-    ss << mediadb::didl::s_footer;
+    s += mediadb::didl::s_footer;
 
-    LOG(CDS) << "Returned " << n << " now scanning for more\n";
-
-    while (rs && !rs->IsEOF())
+    size_t count;
+    if (!rs || rs->IsEOF())
+	c.total = n;
+    else if (!c.total && rs->GetCount(&count) == 0)
+	c.total = (uint32_t)count;
+    else if (!c.total)
     {
-	rs->MoveNext();
-	++n;
+	/* Only counting them all will tell -- but with another query, so
+	 * that the next page can carry on from this one. That query scans
+	 * the whole result, so this first page costs twice what the later
+	 * ones do; the order doesn't change the count, so at least it
+	 * needn't be sorted.
+	 */
+	LOG(CDS) << "Returned " << n << " now counting the rest\n";
+
+	db::RecordsetPtr counter;
+	unsigned int counter_collate = 0;
+	unsigned int rc = RunSearch(m_db, search_criteria, std::string(),
+				    &counter, &counter_collate);
+	if (rc == 0)
+	    for (; counter && !counter->IsEOF(); counter->MoveNext())
+		++c.total;
     }
 
-    LOG(CDS) << "Search result is " << ss.str() << " (" << nok << "/" << n << " items)\n";
+    LOG(CDS) << "Search result is " << s << " (" << nok << "/" << c.total
+	     << " items)\n";
+    LogCacheStats();
+
+    if (resumable && rs && !rs->IsEOF())
+    {
+	c.rs = rs;
+	c.position = n;
+	SaveContinuation(std::move(c));
+    }
 
-    *result = ss.str();
+    *result = std::move(s);
     *number_returned = nok;
-    *total_matches = (!rs || rs->IsEOF()) ? n : 0;
-    *update_id = 1;
+    *total_matches = c.total;
+    *update_id = system_update_id;
 
     return 0;
 }
@@ -383,13 +693,21 @@ unsigned int ContentDirectoryImpl::GetSearchCapabilities(std::string *ps)
 
 unsigned int ContentDirectoryImpl::GetSortCapabilities(std::string *ps)
 {
-    *ps = std::string();
+    *ps = upnpd::GetSortCapabilities();
     return 0;
 }
 
 unsigned int ContentDirectoryImpl::GetSystemUpdateID(uint32_t *pui)
 {
-    *pui = 1;
+    *pui = m_tracker ? m_tracker->GetSystemUpdateID()
+	: (uint32_t)mediadb::UpdateTracker::INITIAL_UPDATE_ID;
+    return 0;
+}
+
+unsigned int ContentDirectoryImpl::GetContainerUpdateIDs(std::string *ps)
+{
+    std::lock_guard<std::mutex> lock(m_event_mutex);
+    *ps = m_container_update_ids;
     return 0;
 }
 
@@ -437,6 +755,8 @@ unsigned int ContentDirectoryImpl::GetServiceResetToken(std::string *srt)
 # include "libupnp/server.h"
 # include "libupnp/ContentDirectory_client.h"
 # include "libmediadb/xml.h"
+# include "libmediadb/fake_database.h"
+# include "libdbmerge/db.h"
 # include "media_server.h"
 # include <boost/format.hpp>
 
@@ -641,6 +961,42 @@ static const struct {
       " duration=\"0:07:34.00\">12e?_range=1</res>"
       "</item></DIDL-Lite>",
       1, 1 },
+
+    // Second page of a sorted playlist
+    { "291", upnp::ContentDirectory::BROWSEFLAG_BROWSE_DIRECT_CHILDREN,
+      "dc:title", 1, 2, "-dc:title",
+
+      "<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\""
+      " xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+      " xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">"
+      "<item id=\"331\" parentID=\"0\" restricted=\"true\">"
+      "<dc:title>Blue Dress</dc:title>"
+      "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+      "</item>"
+      "<item id=\"297\" parentID=\"0\" restricted=\"true\">"
+      "<dc:title>Bigmouth</dc:title>"
+      "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+      "</item></DIDL-Lite>",
+      2, 4 },
+
+    // Second page of a sorted folder, which comes from a query
+    { "0", upnp::ContentDirectory::BROWSEFLAG_BROWSE_DIRECT_CHILDREN,
+      "dc:title", 1, 2, "-dc:title",
+
+      "<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\""
+      " xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+      " xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">"
+      "<container id=\"293\" parentID=\"0\" restricted=\"true\""
+      " childCount=\"13\">"
+      "<dc:title>The Garden</dc:title>"
+      "<upnp:class>object.container.storageFolder</upnp:class>"
+      "</container>"
+      "<container id=\"291\" parentID=\"0\" restricted=\"true\""
+      " childCount=\"4\">"
+      "<dc:title>SongsStartingWithB</dc:title>"
+      "<upnp:class>object.container.playlistContainer</upnp:class>"
+      "</container></DIDL-Lite>",
+      2, 5 },
 };
 
 enum { BROWSETESTS = sizeof(browsetests)/sizeof(browsetests[0]) };
@@ -861,6 +1217,98 @@ static const struct {
 enum { SEARCHTESTS = sizeof(searchtests)/sizeof(searchtests[0]) };
 
 
+class UpdateIDObserver: public upnp::ContentDirectoryObserver
+{
+public:
+    unsigned int events;
+    uint32_t system_update_id;
+    std::string container_update_ids;
+
+    UpdateIDObserver() : events(0), system_update_id(0) {}
+
+    void OnSystemUpdateID(uint32_t id) override
+    {
+	++events;
+	system_update_id = id;
+    }
+    void OnContainerUpdateIDs(const std::string& ids) override
+    {
+	container_update_ids = ids;
+    }
+};
+
+static void SetTitle(db::Database *thedb, unsigned int id,
+		     const char *title)
+{
+    db::QueryPtr qp = thedb->CreateQuery();
+    qp->Where(qp->Restrict(mediadb::ID, db::EQ, id));
+    db::RecordsetPtr rs = qp->Execute();
+    assert(rs && !rs->IsEOF());
+    rs->SetString(mediadb::TITLE, title);
+    rs->Commit();
+}
+
+static void AddRecord(db::Database *thedb, unsigned int id,
+		      unsigned int type, const char *title,
+		      const std::vector<unsigned int>& children = {})
+{
+    db::RecordsetPtr rs = thedb->CreateRecordset();
+    rs->AddRecord();
+    rs->SetInteger(mediadb::ID, id);
+    rs->SetInteger(mediadb::TYPE, type);
+    rs->SetString(mediadb::TITLE, title);
+    if (!children.empty())
+	rs->SetArray(mediadb::CHILDREN, children);
+    rs->Commit();
+}
+
+/** Sorted browsing of a merged root, whose children are in several
+ * databases, and which lists one of them twice.
+ */
+static void TestSortedMerge()
+{
+    mediadb::FakeDatabase db1, db2;
+    AddRecord(&db1, mediadb::BROWSE_ROOT, mediadb::DIR, "root1",
+	      { 0x120, 0x121, 0x120 });
+    AddRecord(&db1, 0x120, mediadb::TUNE, "Zebra");
+    AddRecord(&db1, 0x121, mediadb::TUNE, "Aardvark");
+    AddRecord(&db2, mediadb::BROWSE_ROOT, mediadb::DIR, "root2", { 0x200 });
+    AddRecord(&db2, 0x200, mediadb::DIR, "Middle");
+
+    db::merge::Database merged;
+    merged.AddDatabase(&db1);
+    merged.AddDatabase(&db2);
+    upnpd::ContentDirectoryImpl cd(&merged, NULL);
+
+    std::string result;
+    uint32_t n, total, updateid;
+    unsigned int rc = cd.Browse("0", cd.BROWSEFLAG_BROWSE_DIRECT_CHILDREN,
+				"dc:title", 0, 0, "+dc:title", &result, &n,
+				&total, &updateid);
+    assert(rc == 0);
+    assert(n == 4);
+    assert(total == 4);
+    size_t aardvark = result.find("Aardvark");
+    size_t middle = result.find("Middle");
+    size_t zebra = result.find("Zebra");
+    assert(aardvark != std::string::npos);
+    assert(middle != std::string::npos);
+    assert(zebra != std::string::npos);
+    assert(aardvark < middle && middle < zebra);
+    assert(result.find("Zebra", zebra + 1) != std::string::npos);
+
+    rc = cd.Browse("0", cd.BROWSEFLAG_BROWSE_DIRECT_CHILDREN, "dc:title",
+		   1, 2, "-dc:title", &result, &n, &total, &updateid);
+    assert(rc == 0);
+    assert(n == 2);
+    assert(total == 4);
+    zebra = result.find("Zebra");
+    middle = result.find("Middle");
+    assert(zebra != std::string::npos && middle != std::string::npos);
+    assert(zebra < middle);
+    assert(result.find("Aardvark") == std::string::npos);
+}
+
 int main(int, char**)
 {
     db::steam::Database sdb(mediadb::FIELD_COUNT);
@@ -876,6 +1324,8 @@ int main(int, char**)
 		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
     sdb.SetFieldInfo(mediadb::TITLE,
 		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(mediadb::IDPARENT,
+		     db::steam::FIELD_INT|db::steam::FIELD_INDEXED);
 
     mediadb::ReadXML(&sdb, SRCROOT "/libmediadb/example.xml");
 
@@ -939,13 +1389,59 @@ int main(int, char**)
 	assert(total  == searchtests[i].total);
     }
 
+    // Paging (which carries on where the last page left off) gives the
+    // same results as asking for them all at once
+    for (unsigned int sorted=0; sorted<2; ++sorted)
+    {
+	const char *criteria = "dc:title contains \"e\"";
+	const char *sortby = sorted ? "-dc:title" : "";
+	std::string all, page, pages;
+	uint32_t n, total, pagetotal, updateid;
+	unsigned int rc = cd.Search("0", criteria, "*", 0, 0, sortby,
+				    &all, &n, &total, &updateid);
+	assert(rc == 0);
+	assert(n == total);
+	pages = mediadb::didl::s_header;
+	for (uint32_t start = 0; start < total; start += 5)
+	{
+	    rc = cd.Search("0", criteria, "*", start, 5, sortby,
+			   &page, &n, &pagetotal, &updateid);
+	    assert(rc == 0);
+	    assert(pagetotal == total);
+	    pages.append(page, strlen(mediadb::didl::s_header),
+			 page.size() - strlen(mediadb::didl::s_header)
+			 - strlen(mediadb::didl::s_footer));
+	}
+	pages += mediadb::didl::s_footer;
+	assert(pages == all);
+    }
+
+    // With no update tracker, a change between pages can't be noticed, so
+    // every page runs the search afresh
+    {
+	const char *criteria = "dc:title contains \"e\"";
+	std::string page;
+	uint32_t n, total, pagetotal, updateid;
+	unsigned int rc = cd.Search("0", criteria, "*", 0, 2, "",
+				    &page, &n, &total, &updateid);
+	assert(rc == 0);
+	assert(n == 2);
+	SetTitle(&sdb, 302, "Born Slippy Nuxx (Remastered)");
+	rc = cd.Search("0", criteria, "*", 2, 2, "",
+		       &page, &n, &pagetotal, &updateid);
+	assert(rc == 0);
+	assert(pagetotal == total + 1);
+	SetTitle(&sdb, 302, "Born Slippy Nuxx");
+    }
+
     std::string caps;
     unsigned int rc = cd.GetSearchCapabilities(&caps);
     assert(rc == 0);
     assert(caps == "*");
     rc = cd.GetSortCapabilities(&caps);
     assert(rc == 0);
-    assert(caps == "" );
+    assert(caps == "dc:title,upnp:album,upnp:artist,dc:creator,upnp:genre,"
+	   "upnp:originalTrackNumber,dc:date");
     rc = cd.GetFeatureList(&caps);
     assert(caps ==
 	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
@@ -958,6 +1454,68 @@ int main(int, char**)
 	" </Feature>"
 	"</Features>");
 
+    TestSortedMerge();
+
+    // Update IDs: a burst of changes is one event
+    {
+	mediadb::UpdateTracker tracker;
+	mediadb::TrackingDatabase tdb(&sdb, &tracker);
+	util::BackgroundScheduler scheduler;
+	upnpd::ContentDirectoryImpl tcd(&mdb, NULL, &tracker, &scheduler);
+	UpdateIDObserver obs;
+	tcd.AddObserver(&obs);
+
+	uint32_t before;
+	tcd.GetSystemUpdateID(&before);
+	SetTitle(&tdb, 302, "Born Slippy");
+	SetTitle(&tdb, 302, "Born Slippy (Nuxx)");
+	SetTitle(&tdb, 302, "Born Slippy Nuxx");
+	uint32_t after;
+	tcd.GetSystemUpdateID(&after);
+	assert(after == before + 3);
+
+	std::string result;
+	uint32_t n, total, updateid;
+	rc = tcd.Browse("289", tcd.BROWSEFLAG_BROWSE_DIRECT_CHILDREN, "*",
+			0, 0, "", &result, &n, &total, &updateid);
+	assert(rc == 0);
+	assert(updateid == after);
+	rc = tcd.Browse("291", tcd.BROWSEFLAG_BROWSE_DIRECT_CHILDREN, "*",
+			0, 0, "", &result, &n, &total, &updateid);
+	assert(rc == 0);
+	assert(updateid == after); // A playlist listing it
+	rc = tcd.Browse("0", tcd.BROWSEFLAG_BROWSE_METADATA, "*",
+			0, 0, "", &result, &n, &total, &updateid);
+	assert(rc == 0);
+	assert(updateid == before); // Untouched
+
+	time_t finish = time(NULL) + 5;
+	while (!obs.events && time(NULL) < finish)
+	    scheduler.Poll(100);
+	assert(obs.events == 1);
+	assert(obs.system_update_id == after);
+	assert(obs.container_update_ids
+	       == (boost::format("289,%u,291,%u") % after % after).str());
+
+	// A change between pages starts the search afresh, rather than
+	// carrying on through results which are now out of date
+	const char *criteria = "dc:title contains \"e\"";
+	uint32_t pagetotal;
+	rc = tcd.Search("0", criteria, "*", 0, 2, "", &result, &n, &total,
+			&updateid);
+	assert(rc == 0);
+	assert(n == 2);
+	SetTitle(&tdb, 302, "Born Slippy Nuxx (Remastered)");
+	rc = tcd.Search("0", criteria, "*", 2, 2, "", &result, &n,
+			&pagetotal, &updateid);
+	assert(rc == 0);
+	assert(pagetotal == total + 1);
+	assert(updateid == after + 1);
+	SetTitle(&tdb, 302, "Born Slippy Nuxx");
+
+	tcd.RemoveObserver(&obs);
+    }
+
     // Now again via UPnP
 
     util::WorkerThreadPool wtp(util::WorkerThreadPool::NORMAL);
@@ -1039,7 +1597,8 @@ int main(int, char**)
     assert(caps == "*");
     rc = cdc.GetSortCapabilities(&caps);
     assert(rc == 0);
-    assert(caps == "" );
+    assert(caps == "dc:title,upnp:album,upnp:artist,dc:creator,upnp:genre,"
+	   "upnp:originalTrackNumber,dc:date");
     rc = cdc.GetFeatureList(&caps);
     TRACE << "caps='" << caps << "'\n";
     assert(caps ==
@@ -1072,6 +1631,23 @@ int main(int, char**)
     mediadb::ChildrenToVector(rs->GetString(mediadb::CHILDREN), &children);
     assert(children.size() == 5);
 
+    // Fetch skips IDs with no record, and keeps the order asked for
+    std::vector<unsigned int> wanted = { children[4], 0xDEADBEEu,
+					 children[1], 0x100 };
+    rs = udb.Fetch(mediadb::ID, wanted);
+    assert(rs);
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(mediadb::ID) == children[4]);
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(mediadb::ID) == children[1]);
+    rs->MoveNext();
+    assert(!rs->IsEOF());
+    assert(rs->GetInteger(mediadb::ID) == 0x100);
+    assert(rs->GetString(mediadb::TITLE) == "mp3");
+    rs->MoveNext();
+    assert(rs->IsEOF());
+
     qp = udb.CreateQuery();
     rc = qp->CollateBy(mediadb::ARTIST);
     assert(rc == 0);
@@ -2,22 +2,89 @@
 #define UPNPD_CONTENT_DIRECTORY_H 1
 
 #include "libupnp/ContentDirectory.h"
+#include "libmediadb/didl_cache.h"
+#include "libmediadb/update_tracker.h"
+#include "libutil/counted_pointer.h"
+#include <list>
+#include <mutex>
+#include <time.h>
 
 namespace mediadb { class Database; }
 namespace upnp { namespace soap { class InfoSource; } }
+namespace util { class Scheduler; }
 
 namespace upnpd {
 
 /** Actual implementation of upnp::ContentDirectory base class in terms of
  * a mediadb::Database.
+ *
+ * Given a mediadb::UpdateTracker, the update IDs are real ones, and
+ * changes are evented -- but no more often than every EVENT_MS, so that
+ * a rescan's thousands of changes become a handful of events.
  */
-class ContentDirectoryImpl final: public upnp::ContentDirectory
+class ContentDirectoryImpl final: public upnp::ContentDirectory,
+				  public mediadb::UpdateObserver
 {
     mediadb::Database *m_db;
     upnp::soap::InfoSource *m_info_source;
+    mediadb::didl::Cache m_didl_cache;
+    mediadb::UpdateTracker *m_tracker;
+    util::Scheduler *m_scheduler;
+
+    enum { EVENT_MS = 2000 }; ///< The minimum the CDS spec allows
+
+    class EventTask;
+    typedef util::CountedPointer<EventTask> EventTaskPtr;
+    EventTaskPtr m_event_task;
+
+    std::mutex m_event_mutex;
+    bool m_event_pending;
+    uint32_t m_evented_id; ///< SystemUpdateID as of the last event
+    std::string m_container_update_ids; ///< As last evented
+
+    /** Sends the events for all the changes since the last ones */
+    void OnEventTimer();
+
+    // Being a mediadb::UpdateObserver
+    void OnUpdate() override;
+
+    /** Where a Search left off, so that the next page can carry on from
+     * there, rather than re-running the query and skipping to it. Only
+     * kept with an update tracker, whose system update ID (part of the
+     * key) says whether the database has changed since.
+     */
+    struct Continuation
+    {
+	std::string key; ///< Container, criteria, and system update ID
+	db::RecordsetPtr rs;
+	unsigned int collate;
+	uint32_t position; ///< Index of rs's current record in the results
+	uint32_t total;
+	time_t expires;
+    };
+
+    enum {
+	MAX_CONTINUATIONS = 8,
+	CONTINUATION_SECS = 60 ///< Stale results are only kept so long
+    };
+
+    std::mutex m_continuations_mutex;
+    std::list<Continuation> m_continuations; ///< Most recent first
+
+    /** Removes and returns the continuation for that query and page, if
+     * there is one.
+     */
+    bool TakeContinuation(const std::string& key, uint32_t position,
+			  Continuation*);
+    void SaveContinuation(Continuation&&);
+
+    void LogCacheStats();
 
 public:
-    ContentDirectoryImpl(mediadb::Database*, upnp::soap::InfoSource*);
+    ContentDirectoryImpl(mediadb::Database*, upnp::soap::InfoSource*,
+			 mediadb::UpdateTracker* = NULL,
+			 util::Scheduler* = NULL);
+    ~ContentDirectoryImpl();
     
     // Being a ContentDirectory
     unsigned int Browse(const std::string& object_id,
@@ -44,6 +111,7 @@ public:
     unsigned int GetSortCapabilities(std::string *sort_caps) override;
     unsigned int GetFeatureList(std::string *feature_list) override;
     unsigned int GetSystemUpdateID(uint32_t*) override;
+    unsigned int GetContainerUpdateIDs(std::string*) override;
     unsigned int GetServiceResetToken(std::string*) override;
 };
 
@@ -4,9 +4,11 @@
 namespace upnpd {
 
 MediaServer::MediaServer(mediadb::Database *db,
-			 upnp::soap::InfoSource *info_source)
+			 upnp::soap::InfoSource *info_source,
+			 mediadb::UpdateTracker *tracker,
+			 util::Scheduler *scheduler)
     : upnp::Device("urn:schemas-upnp-org:device:MediaServer:1"),
-      m_contentdirectory(db, info_source),
+      m_contentdirectory(db, info_source, tracker, scheduler),
       m_contentdirectoryserver(this,
 			       upnp::s_service_id_content_directory,
 			       "urn:schemas-upnp-org:service:ContentDirectory:1",
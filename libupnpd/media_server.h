@@ -8,6 +8,8 @@
 #include "connection_manager.h"
 
 namespace mediadb { class Database; }
+namespace mediadb { class UpdateTracker; }
+namespace util { class Scheduler; }
 namespace upnp { namespace soap { class InfoSource; } }
 
 namespace upnpd {
@@ -24,7 +26,9 @@ class MediaServer: public upnp::Device
     upnp::ConnectionManagerServer m_connection_manager_server;
 
 public:
-    MediaServer(mediadb::Database*, upnp::soap::InfoSource*);
+    /** See ContentDirectoryImpl for the tracker and scheduler */
+    MediaServer(mediadb::Database*, upnp::soap::InfoSource*,
+		mediadb::UpdateTracker* = NULL, util::Scheduler* = NULL);
 };
 
 } // namespace upnpd
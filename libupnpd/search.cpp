@@ -1,10 +1,15 @@
 #include "config.h"
 #include "search.h"
 #include "libutil/trace.h"
+#include "libutil/compare.h"
+#include "libutil/counted_pointer.h"
 #include "libdb/query.h"
+#include "libdb/recordset.h"
 #include "libmediadb/schema.h"
+#include <algorithm>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 
 // #define BOOST_SPIRIT_DEBUG 1
 
@@ -339,6 +344,176 @@ unsigned int ApplySearchCriteria(db::Query *qp, const std::string& s,
     return 0;
 }
 
+static const struct {
+    const char *property;
+    unsigned int field;
+    bool numeric;
+} s_sortable[] = {
+    { "dc:title", mediadb::TITLE, false },
+    { "upnp:album", mediadb::ALBUM, false },
+    { "upnp:artist", mediadb::ARTIST, false },
+    { "dc:creator", mediadb::ARTIST, false },
+    { "upnp:genre", mediadb::GENRE, false },
+    { "upnp:originalTrackNumber", mediadb::TRACKNUMBER, true },
+    { "dc:date", mediadb::YEAR, true },
+};
+
+enum { SORTABLE = sizeof(s_sortable)/sizeof(s_sortable[0]) };
+
+unsigned int ParseSortCriteria(const std::string& s,
+			       std::vector<SortKey> *keys)
+{
+    keys->clear();
+    size_t pos = 0;
+    while (pos < s.size())
+    {
+	size_t comma = s.find(',', pos);
+	if (comma == std::string::npos)
+	    comma = s.size();
+
+	size_t begin = pos;
+	size_t end = comma;
+	pos = comma + 1;
+	while (begin < end && isspace((unsigned char)s[begin]))
+	    ++begin;
+	while (end > begin && isspace((unsigned char)s[end-1]))
+	    --end;
+	if (begin == end)
+	    continue;
+
+	bool descending = false;
+	if (s[begin] == '+' || s[begin] == '-')
+	    descending = (s[begin++] == '-');
+	std::string property(s, begin, end - begin);
+
+	unsigned int i = 0;
+	while (i < SORTABLE && property != s_sortable[i].property)
+	    ++i;
+	if (i == SORTABLE)
+	{
+	    TRACE << "Can't sort by '" << property << "'\n";
+	    return EINVAL;
+	}
+
+	SortKey key;
+	key.field = s_sortable[i].field;
+	key.descending = descending;
+	key.numeric = s_sortable[i].numeric;
+	keys->push_back(key);
+    }
+    return 0;
+}
+
+unsigned int ApplySortCriteria(db::Query *qp, const std::string& s)
+{
+    std::vector<SortKey> keys;
+    unsigned int rc = ParseSortCriteria(s, &keys);
+    if (rc)
+	return rc;
+
+    for (std::vector<SortKey>::const_iterator i = keys.begin();
+	 i != keys.end();
+	 ++i)
+    {
+	rc = qp->OrderBy(i->field, i->descending);
+	if (rc)
+	{
+	    TRACE << "DB refuses sort by field " << i->field << "\n";
+	    return rc;
+	}
+    }
+    return 0;
+}
+
+namespace {
+
+/** One record's values of the sort fields, made once rather than at each
+ * comparison.
+ */
+struct SortEntry
+{
+    unsigned int id;
+    std::vector<std::string> strings;
+    std::vector<uint32_t> ints;
+};
+
+class SortLess
+{
+    const std::vector<SortKey>& m_keys;
+
+public:
+    explicit SortLess(const std::vector<SortKey>& keys) : m_keys(keys) {}
+
+    bool operator()(const SortEntry& a, const SortEntry& b) const
+    {
+	size_t si = 0, ii = 0;
+	for (std::vector<SortKey>::const_iterator i = m_keys.begin();
+	     i != m_keys.end();
+	     ++i)
+	{
+	    int rc;
+	    if (i->numeric)
+	    {
+		rc = (a.ints[ii] > b.ints[ii]) - (a.ints[ii] < b.ints[ii]);
+		++ii;
+	    }
+	    else
+	    {
+		rc = a.strings[si].compare(b.strings[si]);
+		++si;
+	    }
+	    if (rc)
+		return i->descending ? (rc > 0) : (rc < 0);
+	}
+	return false;
+    }
+};
+
+} // anon namespace
+
+void SortRecords(db::RecordsetPtr rs, const std::vector<SortKey>& keys,
+		 std::vector<unsigned int> *ids)
+{
+    std::vector<SortEntry> entries;
+    for (; rs && !rs->IsEOF(); rs->MoveNext())
+    {
+	entries.push_back(SortEntry());
+	SortEntry& e = entries.back();
+	e.id = rs->GetInteger(mediadb::ID);
+	for (std::vector<SortKey>::const_iterator i = keys.begin();
+	     i != keys.end();
+	     ++i)
+	{
+	    if (i->numeric)
+		e.ints.push_back(rs->GetInteger(i->field));
+	    else
+		e.strings.push_back(
+		    util::SortKey(rs->GetString(i->field).c_str()));
+	}
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), SortLess(keys));
+
+    ids->clear();
+    ids->reserve(entries.size());
+    for (std::vector<SortEntry>::const_iterator i = entries.begin();
+	 i != entries.end();
+	 ++i)
+	ids->push_back(i->id);
+}
+
+std::string GetSortCapabilities()
+{
+    std::string caps;
+    for (unsigned int i=0; i<SORTABLE; ++i)
+    {
+	if (i)
+	    caps += ",";
+	caps += s_sortable[i].property;
+    }
+    return caps;
+}
+
 } // namespace upnpd
 
 #ifdef TEST
@@ -352,6 +527,7 @@ using namespace boost::spirit;
 # include "libdbsteam/db.h"
 # include "libutil/counted_pointer.h"
 # include "libmediadb/xml.h"
+# include <limits.h>
 
 static void Test(db::Database *db, const char *s)
 {
@@ -395,6 +571,8 @@ int main()
 		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
     sdb.SetFieldInfo(mediadb::TITLE,
 		     db::steam::FIELD_STRING|db::steam::FIELD_INDEXED);
+    sdb.SetFieldInfo(mediadb::TRACKNUMBER, db::steam::FIELD_INT);
+    sdb.SetFieldInfo(mediadb::YEAR, db::steam::FIELD_INT);
 
     mediadb::ReadXML(&sdb, SRCROOT "/libmediadb/example.xml");
 
@@ -404,6 +582,73 @@ int main()
     Test(&sdb, "(upnp:artist=\"Sting\" or upnp:album=\"Gold\") and upnp:genre exists false");
     Test(&sdb, "(dc:date <= \"1999-12-31\" and dc:date >= \"1990-01-01\")");
 
+    // Numbers sort as numbers (1, 2 ... 10), not as strings (1, 10, 11, 2)
+    db::QueryPtr qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(mediadb::TYPE, db::EQ, mediadb::TUNE));
+    unsigned int rc = upnpd::ApplySortCriteria(qp.get(),
+					       "+upnp:originalTrackNumber");
+    assert(rc == 0);
+    unsigned int n = 0;
+    uint32_t prev = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+    {
+	uint32_t track = rs->GetInteger(mediadb::TRACKNUMBER);
+	assert(track >= prev);
+	prev = track;
+	++n;
+    }
+    assert(n > 10);
+    assert(prev >= 10);
+
+    // Descending year, then ascending track number
+    qp = sdb.CreateQuery();
+    qp->Where(qp->Restrict(mediadb::TYPE, db::EQ, mediadb::TUNE));
+    rc = upnpd::ApplySortCriteria(qp.get(), "-dc:date, "
+				  "upnp:originalTrackNumber");
+    assert(rc == 0);
+    uint32_t prev_year = UINT_MAX;
+    prev = 0;
+    for (db::RecordsetPtr rs = qp->Execute(); !rs->IsEOF(); rs->MoveNext())
+    {
+	uint32_t year = rs->GetInteger(mediadb::YEAR);
+	uint32_t track = rs->GetInteger(mediadb::TRACKNUMBER);
+	assert(year <= prev_year);
+	assert(year < prev_year || track >= prev);
+	prev_year = year;
+	prev = track;
+    }
+
+    rc = upnpd::ApplySortCriteria(sdb.CreateQuery().get(), "");
+    assert(rc == 0);
+    rc = upnpd::ApplySortCriteria(sdb.CreateQuery().get(), "+upnp:wurdle");
+    assert(rc == EINVAL);
+
+    // In memory: descending year, then ascending title; duplicates stay
+    std::vector<upnpd::SortKey> keys;
+    rc = upnpd::ParseSortCriteria("-dc:date,+dc:title", &keys);
+    assert(rc == 0);
+    assert(keys.size() == 2);
+    std::vector<unsigned int> ids = { 302, 331, 297, 302 };
+    std::vector<unsigned int> sorted;
+    upnpd::SortRecords(sdb.Fetch(mediadb::ID, ids), keys, &sorted);
+    assert(sorted.size() == 4);
+    for (size_t i=1; i<sorted.size(); ++i)
+    {
+	db::QueryPtr qa = sdb.CreateQuery();
+	qa->Where(qa->Restrict(mediadb::ID, db::EQ, sorted[i-1]));
+	db::RecordsetPtr a = qa->Execute();
+	db::QueryPtr qb = sdb.CreateQuery();
+	qb->Where(qb->Restrict(mediadb::ID, db::EQ, sorted[i]));
+	db::RecordsetPtr b = qb->Execute();
+	uint32_t ya = a->GetInteger(mediadb::YEAR);
+	uint32_t yb = b->GetInteger(mediadb::YEAR);
+	assert(ya > yb || (ya == yb && util::Compare(
+			       a->GetString(mediadb::TITLE).c_str(),
+			       b->GetString(mediadb::TITLE).c_str()) <= 0));
+    }
+    assert(upnpd::GetSortCapabilities().find("dc:title,upnp:album")
+	   == 0);
+
     return 0;
 }
 
@@ -2,8 +2,12 @@
 #define LIBUPNPD_SEARCH_H 1
 
 #include <string>
+#include <vector>
 
 namespace db { class Query; }
+namespace db { class Recordset; }
+namespace util { template<class> class CountedPointer; }
+namespace db { typedef util::CountedPointer<Recordset> RecordsetPtr; }
 
 namespace upnpd {
 
@@ -12,6 +16,35 @@ namespace upnpd {
 unsigned int ApplySearchCriteria(db::Query *qp, const std::string& s,
 				 unsigned int *collatefield);
 
+/** Parse UPnP ContentDirectory sort criteria (CDSv2 s2.3.16), such as
+ * "+upnp:album,+upnp:originalTrackNumber", into Query::OrderBy calls.
+ * Returns EINVAL for properties we can't sort by.
+ */
+unsigned int ApplySortCriteria(db::Query *qp, const std::string& s);
+
+struct SortKey
+{
+    unsigned int field;
+    bool descending;
+    bool numeric; ///< Compare as integers, not collated strings
+};
+
+/** As ApplySortCriteria, but just returns the keys.
+ */
+unsigned int ParseSortCriteria(const std::string& s,
+			       std::vector<SortKey> *keys);
+
+/** Sorts the records in rs (by those keys, and otherwise keeping their
+ * order), returning their IDs. For when the database can't sort them
+ * itself -- because they're from several databases, say.
+ */
+void SortRecords(db::RecordsetPtr rs, const std::vector<SortKey>& keys,
+		 std::vector<unsigned int> *ids);
+
+/** The properties ApplySortCriteria understands, for GetSortCapabilities
+ */
+std::string GetSortCapabilities();
+
 } // namespace upnpd
 
 #endif
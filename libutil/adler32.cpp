@@ -0,0 +1,51 @@
+#include "adler32.h"
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+namespace util {
+
+uint32_t Adler32(const void *data, size_t len, uint32_t adler)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (len)
+    {
+	// 5552 is the largest n such that the sums can't overflow
+	size_t n = std::min(len, (size_t)5552);
+	len -= n;
+	while (n--)
+	{
+	    a += *p++;
+	    b += a;
+	}
+	a %= 65521;
+	b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+} // namespace util
+
+#ifdef TEST
+
+int main()
+{
+    assert(util::Adler32("", 0) == 1);
+    assert(util::Adler32("Wikipedia", 9) == 0x11E60398);
+
+    // In pieces
+    uint32_t a = util::Adler32("Wiki", 4);
+    assert(util::Adler32("pedia", 5, a) == 0x11E60398);
+
+    // Long enough to need the modulo
+    static unsigned char buf[100000];
+    memset(buf, 0xFF, sizeof(buf));
+    uint32_t whole = util::Adler32(buf, sizeof(buf));
+    a = util::Adler32(buf, 12345);
+    assert(util::Adler32(buf + 12345, sizeof(buf) - 12345, a) == whole);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef LIBUTIL_ADLER32_H
+#define LIBUTIL_ADLER32_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace util {
+
+/** Adler-32 checksum (RFC1950), as used by zlib.
+ *
+ * Pass the previous result as "adler" to checksum data in pieces.
+ */
+uint32_t Adler32(const void *data, size_t len, uint32_t adler = 1);
+
+} // namespace util
+
+#endif
@@ -1,4 +1,5 @@
 #include "async_write_buffer.h"
+#include "io_uring.h"
 #include <errno.h>
 #include <string.h>
 #include <stdint.h>
@@ -28,6 +29,11 @@ class AsyncWriteBuffer::Impl
     std::condition_variable m_buffree;
     bool m_busy[2];
 
+    /** Whether a busy buffer's write went to the ring, rather than to the
+     * queue; set only on the writing thread.
+     */
+    bool m_on_ring[2];
+
     /** Which buffer we're currently filling
      */
     int  m_filling;
@@ -39,6 +45,16 @@ class AsyncWriteBuffer::Impl
     uint64_t m_current_buffer_offset; // Offset in the destination file of curently-filling buffer
     unsigned int m_error;
 
+    /** If the backing stream is a plain file, full buffers are written
+     * through an io_uring, with no thread involved; m_fd is -1 otherwise.
+     */
+    IOUring m_ring;
+    int m_fd;
+    uint64_t m_fd_base;
+
+    void StartWrite(int which);
+    void WaitForWrites(bool all);
+    void ReapWrites();
     void SynchronousFlush();
 
 public:
@@ -102,25 +118,108 @@ AsyncWriteBuffer::Impl::Impl(Stream *stream, TaskQueue *queue)
       m_filling(0),
       m_bufpos(0),
       m_current_buffer_offset(0),
-      m_error(0)
+      m_error(0),
+      m_fd(-1),
+      m_fd_base(0)
 {
-    m_busy[0] = false;
-    m_busy[1] = false;
+    m_busy[0] = m_busy[1] = false;
+    m_on_ring[0] = m_on_ring[1] = false;
     m_buf[0] = new unsigned char[BUFSIZE];
     m_buf[1] = new unsigned char[BUFSIZE];
     m_writetask[0] = Task::Create(this, 0);
     m_writetask[1] = Task::Create(this, 1);
+
+    if (stream->GetFileExtent(&m_fd, &m_fd_base) != 0 || m_ring.Init(2) != 0)
+	m_fd = -1;
 }
 
-void AsyncWriteBuffer::Impl::SynchronousFlush()
+void AsyncWriteBuffer::Impl::StartWrite(int which)
+{
+    m_on_ring[which] = m_fd >= 0
+	&& m_ring.QueueWrite(m_fd, m_buf[which], BUFSIZE,
+			     m_fd_base + m_buffer_offset[which],
+			     (uint64_t)which) == 0;
+    if (!m_on_ring[which])
+    {
+	m_queue->PushTask(Bind(m_writetask[which]).To<&Task::Run>());
+	return;
+    }
+
+    // Once queued, the write can't be taken back, so it mustn't go to the
+    // queue as well; if this fails, WaitForWrites submits it again.
+    unsigned int rc = m_ring.Submit();
+    if (rc)
+	TRACE << "warning, async write not submitted yet (" << rc << ")\n";
+}
+
+/** Collects finished io_uring writes. Short ones are finished off
+ * synchronously.
+ */
+void AsyncWriteBuffer::Impl::ReapWrites()
 {
-    // Wait for tasks
+    uint64_t tag;
+    int result;
+    while (m_ring.GetCompletion(&tag, &result))
     {
-	std::unique_lock<std::mutex> lock(m_mutex);
+	int which = (int)tag;
+	if (result < 0)
+	{
+	    TRACE << "warning, async write failed (" << -result << ")\n";
+	    m_error = (unsigned)-result;
+	}
+	else if ((size_t)result < BUFSIZE)
+	{
+	    unsigned int rc = m_stream->WriteAllAt(
+		m_buf[which] + result, m_buffer_offset[which] + result,
+		BUFSIZE - (size_t)result);
+	    if (rc)
+		m_error = rc;
+	}
 
-	while (m_busy[0] || m_busy[1])
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_busy[which] = false;
+    }
+}
+
+/** Waits until a buffer is free or, if "all", until both are.
+ */
+void AsyncWriteBuffer::Impl::WaitForWrites(bool all)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (all ? (m_busy[0] || m_busy[1]) : (m_busy[0] && m_busy[1]))
+    {
+	if (!(m_busy[0] && m_on_ring[0]) && !(m_busy[1] && m_on_ring[1]))
+	{
 	    m_buffree.wait_for(lock, std::chrono::seconds(60));
+	    continue;
+	}
+
+	// Ring writes are only ever collected on this thread
+	lock.unlock();
+	unsigned int rc = m_ring.Submit(1);
+	if (rc && rc != EAGAIN && rc != EBUSY)
+	{
+	    // The ring's broken, so its writes will never finish: give them
+	    // up, and stop using it (so any left queued never get submitted
+	    // once their buffers are reused).
+	    TRACE << "warning, async write failed (" << rc << ")\n";
+	    m_error = rc;
+	    m_fd = -1;
+	    lock.lock();
+	    for (int i=0; i<2; ++i)
+		if (m_on_ring[i])
+		    m_busy[i] = m_on_ring[i] = false;
+	    continue;
+	}
+	ReapWrites();
+	lock.lock();
     }
+}
+
+void AsyncWriteBuffer::Impl::SynchronousFlush()
+{
+    WaitForWrites(true);
 
     // Anything left, write synchronously
     if (m_bufpos)
@@ -174,11 +273,9 @@ unsigned AsyncWriteBuffer::Impl::WriteAt(const void *buffer, uint64_t pos,
 
     if (m_bufpos == 0)
     {
-	std::unique_lock<std::mutex> lock(m_mutex);
-
-	while (m_busy[0] && m_busy[1])
-	    m_buffree.wait_for(lock, std::chrono::seconds(60));
+	WaitForWrites(false);
 
+	std::lock_guard<std::mutex> lock(m_mutex);
 	if (!m_busy[0])
 	    m_filling = 0;
 	else
@@ -200,7 +297,7 @@ unsigned AsyncWriteBuffer::Impl::WriteAt(const void *buffer, uint64_t pos,
 	m_busy[m_filling] = true;
 	m_buffer_offset[m_filling] = m_current_buffer_offset;
 	m_current_buffer_offset += m_bufpos;
-	m_queue->PushTask(Bind(m_writetask[m_filling]).To<&Task::Run>());
+	StartWrite(m_filling);
 	m_bufpos = 0;
     }
     return 0;
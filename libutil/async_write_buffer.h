@@ -7,7 +7,9 @@ namespace util {
 
 class TaskQueue;
 
-/** Buffers writes into big lumps and does them on a background thread
+/** Buffers writes into big lumps and does them in the background: through
+ * an io_uring if the backing stream is a plain file and the kernel has
+ * io_uring, otherwise on a background thread.
  *
  * Non-streaming (non-consecutive) writes still work, but are less efficient
  * (probably synchronous).
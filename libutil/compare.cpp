@@ -2,6 +2,7 @@
 #include "utf8.h"
 
 #include "simplify_tables.h"
+#include <algorithm>
 
 namespace util {
 
@@ -207,6 +208,54 @@ int Compare(const char *s1, const char *s2, bool total)
     return 0;
 }
 
+/* Keys are the simplified characters, then a NUL, then the original string
+ * as the tie-breaker. A sequence of digits becomes DIGITS, its length (so
+ * that longer numbers sort later), then the digits themselves.
+ */
+enum { DIGITS = 1 };
+
+std::string SortKey(const char *s)
+{
+    std::string key;
+    const char *ptr = s;
+    utf32_t ch = GetChar(&ptr);
+
+    while (ch)
+    {
+	utf32_t sc = Simplify(ch);
+	if (!sc)
+	{
+	    ch = GetChar(&ptr);
+	    continue;
+	}
+
+	if (ch >= '0' && ch <= '9')
+	{
+	    std::string digits(1, (char)ch);
+	    for (;;)
+	    {
+		ch = GetChar(&ptr);
+		if (ch == ',')
+		    continue;
+		if (ch < '0' || ch > '9')
+		    break;
+		digits += (char)ch;
+	    }
+	    key += (char)DIGITS;
+	    key += (char)(std::min(digits.size(), (size_t)254) + 1);
+	    key += digits;
+	    continue;
+	}
+
+	key += (char)sc;
+	ch = GetChar(&ptr);
+    }
+
+    key += '\0';
+    key += s;
+    return key;
+}
+
 } // namespace util
 
 #ifdef TEST
@@ -249,6 +298,9 @@ int main()
 	const char *s1 = tests[i].s1;
 	const char *s2 = tests[i].s2;
 	int how = tests[i].how;
+
+	int keyrc = util::SortKey(s1).compare(util::SortKey(s2));
+	assert(how < 0 ? keyrc < 0 : how > 0 ? keyrc > 0 : keyrc == 0);
 	
 	switch (how)
 	{
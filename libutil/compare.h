@@ -1,6 +1,8 @@
 #ifndef LIBUTIL_COMPARE_H
 #define LIBUTIL_COMPARE_H 1
 
+#include <string>
+
 namespace util {
 
 /** Like strcoll, but is UTF-8 everywhere.
@@ -10,6 +12,14 @@ namespace util {
  */
 int Compare(const char *s1, const char *s2, bool total = false);
 
+/** A key for s, such that comparing two keys byte-wise (memcmp) orders
+ * the strings as Compare(s1, s2, true) would.
+ *
+ * Worth it when sorting many strings: each string is only decoded and
+ * simplified once, rather than once per comparison. Keys contain NULs.
+ */
+std::string SortKey(const char *s);
+
 } // namespace util
 
 #endif
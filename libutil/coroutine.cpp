@@ -0,0 +1,157 @@
+#include "config.h"
+#include "coroutine.h"
+#include "scheduler.h"
+#include "stream.h"
+
+namespace util {
+
+/* In each of these, the callback may resume the coroutine (on another
+ * thread) before the call that sets it up has even returned; by then the
+ * awaiter may be gone, so nothing touches it afterwards.
+ */
+
+void AwaitReadable::await_suspend(CoTask::Handle h)
+{
+    m_scheduler->WaitForReadable(h.promise().Callback(), m_poll_handle);
+}
+
+void AwaitWritable::await_suspend(CoTask::Handle h)
+{
+    m_scheduler->WaitForWritable(h.promise().Callback(), m_poll_handle);
+}
+
+void AwaitTime::await_suspend(CoTask::Handle h)
+{
+    m_scheduler->Wait(h.promise().Callback(), m_when, 0);
+}
+
+bool AwaitStream::await_suspend(CoTask::Handle h)
+{
+    unsigned int rc = m_stream->Wait(h.promise().Callback());
+    if (!rc)
+	return true;
+    m_error = rc;
+    return false;
+}
+
+void ResumeOn::await_suspend(CoTask::Handle h)
+{
+    m_queue->PushTask(h.promise().Callback());
+}
+
+} // namespace util
+
+#ifdef TEST
+
+# include "worker_thread_pool.h"
+# include "errors.h"
+# include "string_stream.h"
+# include <assert.h>
+# include <atomic>
+# include <thread>
+# include <unistd.h>
+
+static std::atomic<int> s_step;
+
+/** Passes a byte through a pipe and back again, waiting each way */
+static util::CoTask Relay(util::Scheduler *s, int in, int out)
+{
+    s_step = 1;
+    co_await util::AwaitReadable(s, in);
+    char c;
+    ssize_t rc = ::read(in, &c, 1);
+    assert(rc == 1);
+    s_step = 2;
+    co_await util::AwaitWritable(s, out);
+    ++c;
+    rc = ::write(out, &c, 1);
+    assert(rc == 1);
+    s_step = 3;
+}
+
+static util::CoTask Timers(util::Scheduler *s, util::TaskQueue *pool)
+{
+    std::thread::id me = std::this_thread::get_id();
+    for (unsigned int i=0; i<100; ++i)
+	co_await util::AwaitTime(s, 0);
+    s_step = 4;
+    co_await util::ResumeOn(pool);
+    assert(std::this_thread::get_id() != me);
+    s_step = 5;
+}
+
+/** Calls back on Wait, when told to */
+class WaitableStream: public util::Stream
+{
+public:
+    util::TaskCallback callback;
+
+    unsigned GetStreamFlags() const override { return WAITABLE; }
+    unsigned Wait(const util::TaskCallback& cb) override
+    {
+	callback = cb;
+	return 0;
+    }
+};
+
+static util::CoTask Streams(util::Stream *waitable, util::Stream *plain)
+{
+    unsigned int rc = co_await util::AwaitStream(plain);
+    assert(rc == ENOSYS);
+    s_step = 6;
+    rc = co_await util::AwaitStream(waitable);
+    assert(rc == 0);
+    s_step = 7;
+}
+
+static void PollUntil(util::BackgroundScheduler *s, int step)
+{
+    for (unsigned int i=0; i<1000 && s_step < step; ++i)
+	s->Poll(10);
+    assert(s_step >= step);
+}
+
+int main()
+{
+    util::BackgroundScheduler poller;
+    util::WorkerThreadPool pool(util::WorkerThreadPool::NORMAL, 1);
+
+    int fds[2];
+    int rc = ::pipe(fds);
+    assert(rc == 0);
+
+    // Runs as far as the first wait, then stays there
+    Relay(&poller, fds[0], fds[1]);
+    assert(s_step == 1);
+    poller.Poll(0);
+    assert(s_step == 1);
+
+    char c = 'a';
+    rc = (int)::write(fds[1], &c, 1);
+    assert(rc == 1);
+    PollUntil(&poller, 3);
+    rc = (int)::read(fds[0], &c, 1);
+    assert(rc == 1);
+    assert(c == 'b');
+
+    // The pool thread may get to step 5 before Poll returns
+    Timers(&poller, &pool);
+    PollUntil(&poller, 4);
+    for (unsigned int i=0; i<1000 && s_step != 5; ++i)
+	usleep(1000);
+    assert(s_step == 5);
+
+    WaitableStream ws;
+    util::StringStream plain;
+    Streams(&ws, &plain);
+    assert(s_step == 6);
+    assert(ws.callback.IsValid());
+    ws.callback();
+    assert(s_step == 7);
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return 0;
+}
+
+#endif
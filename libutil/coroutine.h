@@ -0,0 +1,159 @@
+#ifndef LIBUTIL_COROUTINE_H
+#define LIBUTIL_COROUTINE_H 1
+
+#include "bind.h"
+#include "counted_pointer.h"
+#include "task.h"
+#include "task_queue.h"
+#include <coroutine>
+#include <stdlib.h>
+#include <time.h>
+
+namespace util {
+
+class Scheduler;
+class Stream;
+
+/** The return type of a coroutine which waits on a Scheduler, instead of
+ * being a chain of callbacks:
+ *
+ *   util::CoTask Echo(util::Scheduler *s, int fd)
+ *   {
+ *       co_await util::AwaitReadable(s, fd);
+ *       ...
+ *   }
+ *
+ * A CoTask starts running straight away, on the caller's stack, until it
+ * first has to wait; thereafter it's resumed from whichever thread the
+ * awaited thing happens on (typically the Scheduler's). It's detached: it
+ * runs to completion and then frees itself, so there's no handle to keep
+ * hold of, and any arguments the caller must outlive it should be passed
+ * by value.
+ *
+ * Each CoTask has a single Task which the Scheduler calls back, however
+ * many times it waits, so that each wait costs no allocation. Waiting on
+ * more than one thing at once isn't allowed.
+ */
+class CoTask
+{
+public:
+    /** The Task that the Scheduler calls to resume the coroutine */
+    class Resumer final: public Task
+    {
+	std::coroutine_handle<> m_handle;
+
+    public:
+	explicit Resumer(std::coroutine_handle<> h) : m_handle(h) {}
+
+	unsigned int Run() override
+	{
+	    TaskPtr self(this); // The coroutine may finish, and drop us
+	    m_handle.resume();
+	    return 0;
+	}
+    };
+
+    struct promise_type
+    {
+	CountedPointer<Resumer> resumer; ///< Made at the first wait
+
+	CoTask get_return_object() { return CoTask(); }
+	std::suspend_never initial_suspend() noexcept { return {}; }
+	std::suspend_never final_suspend() noexcept { return {}; }
+	void return_void() {}
+	void unhandled_exception() { abort(); } // -fno-exceptions anyway
+
+	TaskCallback Callback()
+	{
+	    if (!resumer)
+		resumer.reset(new Resumer(
+		    std::coroutine_handle<promise_type>::from_promise(*this)));
+	    return Bind(resumer).To<&Resumer::Run>();
+	}
+    };
+
+    typedef std::coroutine_handle<promise_type> Handle;
+};
+
+/** co_await this to wait (once) for Scheduler::WaitForReadable */
+class AwaitReadable
+{
+    Scheduler *m_scheduler;
+    int m_poll_handle;
+
+public:
+    AwaitReadable(Scheduler *scheduler, int poll_handle)
+	: m_scheduler(scheduler), m_poll_handle(poll_handle) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(CoTask::Handle);
+    void await_resume() const {}
+};
+
+/** co_await this to wait (once) for Scheduler::WaitForWritable */
+class AwaitWritable
+{
+    Scheduler *m_scheduler;
+    int m_poll_handle;
+
+public:
+    AwaitWritable(Scheduler *scheduler, int poll_handle)
+	: m_scheduler(scheduler), m_poll_handle(poll_handle) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(CoTask::Handle);
+    void await_resume() const {}
+};
+
+/** co_await this to wait until a time, as Scheduler::Wait (with no
+ * repeat). A time in the past still goes round the Scheduler once, which
+ * lets other tasks run.
+ */
+class AwaitTime
+{
+    Scheduler *m_scheduler;
+    time_t m_when;
+
+public:
+    AwaitTime(Scheduler *scheduler, time_t when)
+	: m_scheduler(scheduler), m_when(when) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(CoTask::Handle);
+    void await_resume() const {}
+};
+
+/** co_await this to wait for Stream::Wait; the result is 0, or the error
+ * from Stream::Wait (eg ENOSYS), in which case there was no waiting.
+ */
+class AwaitStream
+{
+    Stream *m_stream;
+    unsigned int m_error;
+
+public:
+    explicit AwaitStream(Stream *stream) : m_stream(stream), m_error(0) {}
+
+    bool await_ready() const { return false; }
+    bool await_suspend(CoTask::Handle);
+    unsigned int await_resume() const { return m_error; }
+};
+
+/** co_await this to carry on in a TaskQueue (eg a WorkerThreadPool), for
+ * work that would hold up the Scheduler's thread.
+ */
+class ResumeOn
+{
+    TaskQueue *m_queue;
+
+public:
+    explicit ResumeOn(TaskQueue *queue) : m_queue(queue) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(CoTask::Handle);
+    void await_resume() const {}
+};
+
+} // namespace util
+
+#endif
@@ -311,6 +311,10 @@ int main()
     assert(util::posix::GetExtension("foo/bar.txt") == "txt");
     assert(util::posix::GetExtension("foo.bar/txt") == "");
 
+    assert(util::SyncDirectoryOf("/tmp/nosuchfile") == 0);
+    assert(util::SyncDirectoryOf("nosuchfile") == 0);
+    assert(util::SyncDirectoryOf("/nosuchdir/nosuchfile") == ENOENT);
+
     TestRelativePaths();
 
     assert(util::IsInRoot("/zootle/", "/zootle/frink"));
@@ -22,6 +22,7 @@ using fileapi::Canonicalise;
 using fileapi::GetExtension;
 using fileapi::ReadDirectory;
 using fileapi::StripExtension;
+using fileapi::SyncDirectoryOf;
 
 /** Create all the parent directories needed so that file "leafname" can be
  * created.
@@ -10,6 +10,7 @@
 #include <string>
 #include <assert.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 namespace util {
@@ -54,6 +55,21 @@ std::string StripExtension(const char *filename)
     return std::string(filename, dot);
 }
 
+unsigned int SyncDirectoryOf(const char *filename)
+{
+    std::string dirname = GetDirName(filename);
+    if (dirname.empty())
+	dirname = (*filename == '/') ? "/" : ".";
+
+    int fd = ::open(dirname.c_str(), O_RDONLY|O_DIRECTORY);
+    if (fd < 0)
+	return (unsigned)errno;
+    unsigned int rc = 0;
+    if (::fsync(fd) < 0)
+	rc = (unsigned)errno;
+    ::close(fd);
+    return rc;
+}
 
 unsigned int Mkdir(const char *dirname)
 {
@@ -40,6 +40,11 @@ std::string GetExtension(const char *filename);
 
 std::string StripExtension(const char *filename);
 
+/** Makes the creation, or renaming into place, of a file durable, by
+ * fsyncing the directory it's in.
+ */
+unsigned int SyncDirectoryOf(const char *filename);
+
 } // namespace posix
 
 } // namespace util
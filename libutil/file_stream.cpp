@@ -1,6 +1,8 @@
 #include "file_stream.h"
 #include "file_stream_posix.h"
+#include "file_stream_uring.h"
 #include "counted_pointer.h"
+#include <errno.h>
 
 namespace util {
 
@@ -9,6 +11,21 @@ using posix::FileStream;
 unsigned int OpenFileStream(const char *filename, unsigned int mode,
 			    std::unique_ptr<Stream> *pstm)
 {
+    if (mode & ASYNC)
+    {
+	uring::FileStream *uf = new uring::FileStream();
+	unsigned int rc = uf->Open(filename, mode);
+	if (!rc)
+	{
+	    pstm->reset(uf);
+	    return 0;
+	}
+	delete uf;
+	if (rc != ENOSYS)
+	    return rc;
+	// No io_uring; fall back to the ordinary, blocking sort
+    }
+
     FileStream *f = new FileStream();
 
     unsigned int rc = f->Open(filename, mode);
@@ -19,7 +19,14 @@ enum FileMode {
 
     // Additional flags
 
-    SEQUENTIAL = 4
+    SEQUENTIAL = 4,
+
+    /** Reads may return EWOULDBLOCK: wait for GetHandle() to be readable,
+     * eg with a Scheduler. Done with io_uring (see uring::FileStream);
+     * where that's not available, you get an ordinary file, which never
+     * says EWOULDBLOCK.
+     */
+    ASYNC = 8
 };
 
 unsigned int OpenFileStream(const char *filename, unsigned int mode,
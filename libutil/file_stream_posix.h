@@ -30,6 +30,13 @@ public:
     unsigned SetLength(uint64_t) override;
 
     int GetHandle() override { return m_fd; }
+
+    unsigned GetFileExtent(int *pfd, uint64_t *poffset) override
+    {
+	*pfd = m_fd;
+	*poffset = 0;
+	return 0;
+    }
 };
 
 } // namespace posix
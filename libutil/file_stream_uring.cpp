@@ -0,0 +1,387 @@
+#include "config.h"
+#include "file_stream_uring.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+namespace util {
+
+namespace uring {
+
+FileStream::FileStream()
+    : m_fd(-1)
+{
+    for (unsigned int i=0; i<BUFFERS; ++i)
+    {
+	m_buffers[i].pos = 0;
+	m_buffers[i].len = 0;
+	m_buffers[i].error = 0;
+	m_buffers[i].valid = false;
+	m_buffers[i].in_flight = false;
+    }
+}
+
+unsigned FileStream::Open(const char *filename, unsigned int mode)
+{
+    unsigned int rc = m_ring.Init(BUFFERS*2);
+    if (rc)
+	return rc;
+
+    // Register the eventfd now, so no completion can come before it
+    if (m_ring.GetHandle() < 0)
+	return ENOSYS;
+
+    unsigned flags = 0;
+
+    switch (mode & TYPE_MASK)
+    {
+    case READ:   flags = O_RDONLY; break;
+    case WRITE:  flags = O_RDWR|O_CREAT|O_TRUNC; break;
+    case UPDATE: flags = O_RDWR; break;
+    case TEMP:   flags = O_RDWR|O_CREAT|O_TRUNC; break;
+    }
+
+    m_fd = open(filename, flags, 0644);
+    if (m_fd < 0)
+	return (unsigned)errno;
+
+    if ((mode & TYPE_MASK) == TEMP)
+	unlink(filename);
+
+#if HAVE_POSIX_FADVISE
+    if (mode & SEQUENTIAL)
+	posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    for (unsigned int i=0; i<BUFFERS; ++i)
+	m_buffers[i].data.reset(new char[BUFFER_SIZE]);
+
+    return 0;
+}
+
+FileStream::~FileStream()
+{
+    if (m_fd >= 0)
+    {
+	WaitIdle(); // The kernel is still writing into our buffers
+	close(m_fd);
+    }
+}
+
+void FileStream::Reap()
+{
+    m_ring.ClearHandle();
+
+    uint64_t tag;
+    int result;
+    while (m_ring.GetCompletion(&tag, &result))
+    {
+	Buffer *b = &m_buffers[tag];
+	b->in_flight = false;
+	b->valid = true;
+	if (result < 0)
+	{
+	    b->error = (unsigned)-result;
+	    b->len = 0;
+	}
+	else
+	{
+	    b->error = 0;
+	    b->len = (size_t)result;
+	}
+    }
+}
+
+FileStream::Buffer *FileStream::Find(uint64_t pos)
+{
+    for (unsigned int i=0; i<BUFFERS; ++i)
+    {
+	Buffer *b = &m_buffers[i];
+	if ((b->valid || b->in_flight)
+	    && pos >= b->pos && pos < b->pos + BUFFER_SIZE)
+	    return b;
+    }
+    return NULL;
+}
+
+/** Queues a read of the window at pos, into any buffer that isn't busy and
+ * isn't "keep"; returns false if there isn't one.
+ */
+bool FileStream::Start(uint64_t pos, const Buffer *keep)
+{
+    Buffer *victim = NULL;
+    for (unsigned int i=0; i<BUFFERS; ++i)
+    {
+	Buffer *b = &m_buffers[i];
+	if (b == keep || b->in_flight)
+	    continue;
+	if (!victim || !b->valid)
+	    victim = b;
+    }
+    if (!victim)
+	return false;
+
+    if (m_ring.QueueRead(m_fd, victim->data.get(), BUFFER_SIZE, pos,
+			 (uint64_t)(victim - m_buffers)))
+	return false;
+    victim->pos = pos;
+    victim->valid = false;
+    victim->in_flight = true;
+    return true;
+}
+
+void FileStream::WaitIdle()
+{
+    for (;;)
+    {
+	Reap();
+	bool busy = false;
+	for (unsigned int i=0; i<BUFFERS; ++i)
+	    busy = busy || m_buffers[i].in_flight;
+	if (!busy)
+	    break;
+	if (m_ring.Submit(1))
+	    break;
+    }
+
+    for (unsigned int i=0; i<BUFFERS; ++i)
+	m_buffers[i].valid = false;
+}
+
+unsigned FileStream::ReadAt(void *buffer, uint64_t pos, size_t len,
+			    size_t *pnread)
+{
+    *pnread = 0;
+    Reap();
+
+    Buffer *b = Find(pos);
+    if (!b)
+    {
+	// This window and the next, in one system call
+	uint64_t window = pos - (pos % BUFFER_SIZE);
+	if (Start(window, NULL))
+	    Start(window + BUFFER_SIZE, Find(window));
+	unsigned int rc = m_ring.Submit();
+	if (rc)
+	    return rc;
+	return EWOULDBLOCK;
+    }
+
+    if (b->in_flight)
+	return EWOULDBLOCK;
+
+    if (b->error)
+    {
+	b->valid = false;
+	return b->error;
+    }
+
+    size_t offset = (size_t)(pos - b->pos);
+    if (offset >= b->len)
+    {
+	/* EOF -- but forget it, so that if the file grows (eg a recording
+	 * in progress) the next read looks again.
+	 */
+	b->valid = false;
+	return 0;
+    }
+
+    size_t n = std::min(len, b->len - offset);
+    memcpy(buffer, b->data.get() + offset, n);
+    *pnread = n;
+
+    // Keep a window ahead of the reader
+    uint64_t next = b->pos + BUFFER_SIZE;
+    if (b->len == BUFFER_SIZE && !Find(next) && Start(next, b))
+	m_ring.Submit();
+
+    return 0;
+}
+
+unsigned FileStream::WriteAt(const void *buffer, uint64_t pos, size_t len,
+			     size_t *pwrote)
+{
+    WaitIdle();
+
+#if HAVE_PWRITE64
+    ssize_t rc = ::pwrite64(m_fd, buffer, len, pos);
+#else
+    ssize_t rc = ::pwrite(m_fd, buffer, len, pos);
+#endif
+    if (rc < 0)
+    {
+	*pwrote = 0;
+	TRACE << "FS::Write failed " << errno << "\n";
+	return (unsigned)errno;
+    }
+    *pwrote = (size_t)rc;
+    return 0;
+}
+
+uint64_t FileStream::GetLength()
+{
+    struct stat st;
+    int rc = fstat(m_fd, &st);
+    if (rc < 0)
+	return 0;
+    return (uint64_t)st.st_size;
+}
+
+unsigned FileStream::SetLength(uint64_t len)
+{
+    WaitIdle();
+    int rc = ftruncate(m_fd, (off_t)len);
+    if (rc<0)
+	return (unsigned)errno;
+    if (Tell() > len)
+	Seek(len);
+    return 0;
+}
+
+} // namespace uring
+
+} // namespace util
+
+#ifdef TEST
+
+# include "scheduler.h"
+# include "bind.h"
+# include "counted_pointer.h"
+# include "task.h"
+# include <assert.h>
+# include <poll.h>
+# include <stdio.h>
+
+/** Reads a whole ASYNC stream, waiting on the Scheduler as it goes */
+class ReadTask: public util::Task
+{
+    util::Scheduler *m_scheduler;
+    util::Stream *m_stream;
+
+public:
+    std::string contents;
+    bool done;
+    unsigned int waits;
+
+    ReadTask(util::Scheduler *scheduler, util::Stream *stream)
+	: m_scheduler(scheduler), m_stream(stream), done(false), waits(0) {}
+
+    unsigned int Run() override
+    {
+	for (;;)
+	{
+	    char buffer[10000];
+	    size_t nread;
+	    unsigned int rc = m_stream->Read(buffer, sizeof(buffer), &nread);
+	    if (rc == EWOULDBLOCK)
+	    {
+		++waits;
+		m_scheduler->WaitForReadable(
+		    util::Bind(util::TaskPtr(this)).To<&util::Task::Run>(),
+		    m_stream->GetHandle());
+		return 0;
+	    }
+	    assert(rc == 0);
+	    if (!nread)
+	    {
+		done = true;
+		return 0;
+	    }
+	    contents.append(buffer, nread);
+	}
+    }
+};
+
+int main()
+{
+    std::unique_ptr<util::Stream> msp;
+
+    unsigned int rc = util::OpenFileStream("test3.tmp", util::WRITE,
+					   &msp);
+    assert(rc == 0);
+    std::string expected;
+    for (unsigned int i=0; i<50000; ++i)
+    {
+	char line[20];
+	int n = snprintf(line, sizeof(line), "%u\n", i);
+	expected.append(line, (size_t)n);
+    }
+    rc = msp->WriteAll(expected.data(), expected.size());
+    assert(rc == 0);
+
+    util::uring::FileStream fs;
+    rc = fs.Open("test3.tmp", util::UPDATE);
+    unlink("test3.tmp");
+    if (rc == ENOSYS)
+    {
+	fprintf(stderr, "No io_uring here, nothing to test\n");
+	return 0;
+    }
+    assert(rc == 0);
+
+    // Synchronous callers can poll() the handle
+    char buffer[100];
+    size_t nread;
+    rc = fs.ReadAt(buffer, 100000, sizeof(buffer), &nread);
+    assert(rc == EWOULDBLOCK);
+    struct pollfd pfd;
+    pfd.fd = fs.GetHandle();
+    pfd.events = POLLIN;
+    assert(::poll(&pfd, 1, 5000) == 1);
+    rc = fs.ReadAt(buffer, 100000, sizeof(buffer), &nread);
+    assert(rc == 0);
+    assert(nread == sizeof(buffer));
+    assert(!memcmp(buffer, expected.data() + 100000, sizeof(buffer)));
+
+    // Off the end
+    rc = fs.ReadAt(buffer, expected.size(), sizeof(buffer), &nread);
+    if (rc == EWOULDBLOCK)
+    {
+	assert(::poll(&pfd, 1, 5000) == 1);
+	rc = fs.ReadAt(buffer, expected.size(), sizeof(buffer), &nread);
+    }
+    assert(rc == 0);
+    assert(nread == 0);
+
+    // Sequentially through a Scheduler, which mostly shouldn't wait
+    util::BackgroundScheduler poller;
+    fs.Seek(0);
+    util::CountedPointer<ReadTask> rt(new ReadTask(&poller, &fs));
+    rt->Run();
+    while (!rt->done)
+	poller.Poll(5000);
+    assert(rt->contents == expected);
+    assert(rt->waits <= (expected.size() / 65536) + 2);
+
+    // Reads see writes
+    rc = fs.WriteAt("hello", 10, 5, &nread);
+    assert(rc == 0);
+    do {
+	rc = fs.ReadAt(buffer, 8, 10, &nread);
+    } while (rc == EWOULDBLOCK && ::poll(&pfd, 1, 5000) == 1);
+    assert(rc == 0);
+    assert(nread == 10);
+    assert(!memcmp(buffer, "4\nhello\n8\n", 10));
+
+    // OpenFileStream gives out the same thing
+    rc = util::OpenFileStream("test3.tmp", util::TEMP|util::ASYNC, &msp);
+    assert(rc == 0);
+    assert(dynamic_cast<util::uring::FileStream*>(msp.get()) != NULL);
+    rc = msp->WriteAll(expected.data(), 1000);
+    assert(rc == 0);
+    pfd.fd = msp->GetHandle();
+    do {
+	rc = msp->ReadAt(buffer, 900, sizeof(buffer), &nread);
+    } while (rc == EWOULDBLOCK && ::poll(&pfd, 1, 5000) == 1);
+    assert(rc == 0);
+    assert(nread == sizeof(buffer));
+    assert(!memcmp(buffer, expected.data() + 900, sizeof(buffer)));
+
+    return 0;
+}
+
+#endif
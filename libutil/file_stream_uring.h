@@ -0,0 +1,74 @@
+#ifndef FILE_STREAM_URING_H
+#define FILE_STREAM_URING_H
+
+#include "file_stream.h"
+#include "io_uring.h"
+
+#include <boost/noncopyable.hpp>
+
+namespace util {
+
+namespace uring {
+
+/** A file whose reads never block, done through an io_uring.
+ *
+ * If the data isn't in yet, ReadAt starts reading it and returns
+ * EWOULDBLOCK; GetHandle becomes readable when it's worth asking again, so
+ * the stream can be waited-for by a Scheduler. Each read also starts
+ * reading the following BUFFER_SIZE bytes, in the same system call, so a
+ * sequential reader mostly finds its data already there. Writes are
+ * synchronous.
+ *
+ * Opened by OpenFileStream(..., util::ASYNC) where io_uring is available.
+ */
+class FileStream final: public SeekableStream, private boost::noncopyable
+{
+    enum { BUFFERS = 2, BUFFER_SIZE = 64*1024 };
+
+    struct Buffer
+    {
+	std::unique_ptr<char[]> data;
+	uint64_t pos;
+	size_t len;
+	unsigned int error;
+	bool valid;
+	bool in_flight;
+    };
+
+    int m_fd;
+    IOUring m_ring;
+    Buffer m_buffers[BUFFERS];
+
+    void Reap();
+    Buffer *Find(uint64_t pos);
+    bool Start(uint64_t pos, const Buffer *keep);
+    void WaitIdle();
+
+public:
+    FileStream();
+    ~FileStream();
+
+    /** Returns ENOSYS if there's no io_uring; use posix::FileStream then.
+     */
+    unsigned Open(const char *filename, unsigned int mode);
+
+    // Being a SeekableStream
+    unsigned GetStreamFlags() const override
+    {
+	return READABLE|WRITABLE|SEEKABLE|POLLABLE;
+    }
+    unsigned ReadAt(void *buffer, uint64_t pos, size_t len,
+                    size_t *pread) override;
+    unsigned WriteAt(const void *buffer, uint64_t pos, size_t len,
+		     size_t *pwrote) override;
+    uint64_t GetLength() override;
+    unsigned SetLength(uint64_t) override;
+
+    int GetHandle() override { return m_ring.GetHandle(); }
+};
+
+} // namespace uring
+
+} // namespace util
+
+#endif
@@ -0,0 +1,172 @@
+#include "config.h"
+#include "http_await.h"
+#include "http_client.h"
+#include "counted_pointer.h"
+
+namespace util {
+
+namespace http {
+
+class AwaitFetch::Task: public Recipient
+{
+    AwaitFetch *m_fetch;
+
+public:
+    explicit Task(AwaitFetch *fetch) : m_fetch(fetch) {}
+
+    // Being a util::http::Recipient
+    unsigned OnData(const void *buffer, size_t len) override
+    {
+	m_fetch->m_result.body.append((const char*)buffer, len);
+	return 0;
+    }
+
+    void OnHeader(const std::string& key, const std::string& value) override
+    {
+	m_fetch->m_result.headers[key] = value;
+    }
+
+    void OnEndPoint(const IPEndPoint& endpoint) override
+    {
+	m_fetch->m_result.local_endpoint = endpoint;
+    }
+
+    void OnDone(unsigned int rc) override
+    {
+	AwaitFetch *fetch = m_fetch;
+	m_fetch = NULL;
+	fetch->m_result.error = rc;
+	if (fetch->m_rendezvous.exchange(true))
+	    fetch->m_handle.resume();
+    }
+};
+
+AwaitFetch::AwaitFetch(Client *client, Scheduler *scheduler,
+		       const std::string& url,
+		       const std::string& extra_headers,
+		       const std::string& body, const char *verb)
+    : m_client(client),
+      m_scheduler(scheduler),
+      m_url(url),
+      m_extra_headers(extra_headers),
+      m_body(body),
+      m_verb(verb),
+      m_started(false),
+      m_rendezvous(false)
+{
+}
+
+unsigned int AwaitFetch::Start()
+{
+    m_started = true;
+    unsigned int rc = m_client->Connect(m_scheduler,
+					RecipientPtr(new Task(this)), m_url,
+					m_extra_headers, m_body, m_verb);
+    if (rc)
+    {
+	// OnDone won't be called, so we mustn't wait for it
+	m_result.error = rc;
+	m_rendezvous = true;
+    }
+    return rc;
+}
+
+bool AwaitFetch::await_suspend(std::coroutine_handle<> h)
+{
+    m_handle = h;
+    if (!m_started)
+	Start();
+
+    /* If OnDone has already been (perhaps during Connect itself), carry
+     * straight on; if not, OnDone resumes us -- perhaps before we've even
+     * returned, so nothing may touch "this" after the exchange.
+     */
+    return !m_rendezvous.exchange(true);
+}
+
+} // namespace http
+
+} // namespace util
+
+#ifdef TEST
+
+# include "coroutine.h"
+# include "http_server.h"
+# include "scheduler.h"
+# include "string_stream.h"
+# include "worker_thread_pool.h"
+# include <assert.h>
+# include <boost/format.hpp>
+
+class EchoContentFactory: public util::http::ContentFactory
+{
+public:
+    bool StreamForPath(const util::http::Request *rq,
+		       util::http::Response *rs) override
+    {
+	rs->body_source.reset(new util::StringStream(rq->path));
+	return true;
+    }
+};
+
+static bool s_done = false;
+
+/** Several requests in turn, each on the last one's stack frame */
+static util::CoTask Fetches(util::http::Client *client,
+			    util::Scheduler *scheduler, std::string base)
+{
+    util::http::FetchResult r
+	= co_await util::http::AwaitFetch(client, scheduler, base + "/one");
+    assert(r.error == 0);
+    assert(r.body == "/one");
+    assert(r.local_endpoint.port != 0);
+
+    for (unsigned int i=0; i<10; ++i)
+    {
+	std::string path = "/" + std::to_string(i);
+	r = co_await util::http::AwaitFetch(client, scheduler, base + path);
+	assert(r.error == 0);
+	assert(r.body == path);
+    }
+
+    util::http::AwaitFetch bad(client, scheduler, "http://wurdle.invalid/");
+    unsigned int rc = bad.Start();
+    assert(rc != 0);
+    r = co_await bad;
+    assert(r.error == rc);
+
+    s_done = true;
+}
+
+int main(int, char*[])
+{
+    util::WorkerThreadPool wtp(util::WorkerThreadPool::NORMAL);
+    util::BackgroundScheduler scheduler;
+
+    util::http::Server ws(&scheduler, &wtp);
+    unsigned rc = ws.Init(0);
+    assert(rc == 0);
+
+    EchoContentFactory ecf;
+    ws.AddContentFactory("/", &ecf);
+
+    std::string base = (boost::format("http://127.0.0.1:%u") % ws.GetPort())
+	.str();
+
+    util::http::Client client;
+
+    Fetches(&client, &scheduler, base);
+
+    time_t finish = time(NULL) + 12;
+    while (!s_done && time(NULL) < finish)
+	scheduler.Poll(1000);
+    assert(s_done);
+
+    util::http::Client::Stats stats = client.GetStats();
+    assert(stats.requests == 12); // Including the bad one
+    assert(stats.reused == 10);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef LIBUTIL_HTTP_AWAIT_H
+#define LIBUTIL_HTTP_AWAIT_H 1
+
+#include <atomic>
+#include <coroutine>
+#include <map>
+#include <string>
+#include "ip.h"
+
+namespace util {
+
+class Scheduler;
+
+namespace http {
+
+class Client;
+
+struct FetchResult
+{
+    unsigned int error;
+    std::string body;
+    std::map<std::string, std::string> headers;
+    IPEndPoint local_endpoint; ///< As Recipient::OnEndPoint
+
+    FetchResult() : error(0), local_endpoint() {}
+};
+
+/** An HTTP transaction for a coroutine (see util::CoTask) to co_await:
+ *
+ *   util::http::FetchResult r
+ *       = co_await util::http::AwaitFetch(client, scheduler, url);
+ *
+ * The coroutine is resumed on whichever thread the Client calls
+ * Recipient::OnDone on, with the whole body, or with the error.
+ *
+ * Start() may be called first, to find out straight away whether the
+ * transaction could be started (as with Client::Connect), rather than
+ * from the result; once started, it must be awaited.
+ */
+class AwaitFetch
+{
+    class Task;
+
+    Client *m_client;
+    Scheduler *m_scheduler;
+    std::string m_url;
+    std::string m_extra_headers;
+    std::string m_body;
+    const char *m_verb;
+    bool m_started;
+    FetchResult m_result;
+    std::coroutine_handle<> m_handle;
+
+    /** Set by whichever of await_suspend and OnDone comes first; the
+     * second resumes the coroutine.
+     */
+    std::atomic<bool> m_rendezvous;
+
+public:
+    /** Parameters as for Client::Connect */
+    AwaitFetch(Client *client, Scheduler *scheduler, const std::string& url,
+	       const std::string& extra_headers = std::string(),
+	       const std::string& body = std::string(),
+	       const char *verb = NULL);
+    AwaitFetch(const AwaitFetch&) = delete;
+    AwaitFetch& operator=(const AwaitFetch&) = delete;
+
+    unsigned int Start();
+
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<>);
+    FetchResult await_resume() { return std::move(m_result); }
+};
+
+} // namespace http
+
+} // namespace util
+
+#endif
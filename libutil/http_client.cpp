@@ -16,6 +16,7 @@
 #include "line_reader.h"
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 #include <boost/format.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/scoped_array.hpp>
@@ -34,6 +35,12 @@ namespace http {
         /* util::http::Client::Task */
 
 
+/** One connection, and the transaction currently using it.
+ *
+ * Once a transaction is done, the Task goes back to the Client, which
+ * either gives it the next transaction to the same host, or keeps it idle
+ * until there is one.
+ */
 class Client::Task: public util::Task
 {
     Client *m_parent;
@@ -49,6 +56,21 @@ class Client::Task: public util::Task
     std::string m_path;
     std::string m_headers;
 
+    /** Bytes of m_headers then m_body written so far; they stay intact
+     * until the transaction's over, in case it needs retrying.
+     */
+    size_t m_sent;
+
+    /** Whether this Task is counted in its Host's connections */
+    bool m_counted;
+
+    /** Whether this transaction is on a connection that's been used
+     * before (which the server might have closed meanwhile)
+     */
+    bool m_reused;
+
+    time_t m_idle_since;
+
     enum { BUFFER_SIZE = 8192 };
     boost::scoped_array<char> m_buffer;
     size_t m_buffer_fill;
@@ -67,22 +89,35 @@ class Client::Task: public util::Task
 	IDLE
     } m_state;
 
+    enum ChunkState { CHUNK_HEADER, CHUNK_DATA, CHUNK_TRAILER };
+
     struct {
 	size_t transfer_length;
 	size_t total_length;
 	bool is_range;
 	bool got_length;
 	bool connection_close;
+	bool no_body;
+
+	/** For Transfer-Encoding: chunked, transfer_length counts down
+	 * the current chunk
+	 */
+	bool chunked;
+	ChunkState chunk_state;
 
 	void Clear()
 	{
 	    transfer_length = total_length = 0;
-	    is_range = got_length = connection_close = false;
+	    is_range = got_length = connection_close = no_body = chunked
+		= false;
+	    chunk_state = CHUNK_HEADER;
 	}
     } m_entity;
 
     typedef CountedPointer<Client::Task> TaskPtr;
 
+    unsigned int RecvChunkHeader();
+
     void WaitForWritable()
     {
 	m_scheduler->WaitForWritable(
@@ -122,48 +157,163 @@ class Client::Task: public util::Task
 	    Bind(util::TaskPtr(new CallbackTask(m_target,rc))).To<&util::Task::Run>(), 0, 0);
     }
 
+    void BuildHeaders();
+    bool IsIdempotent() const;
+    unsigned int Retry(unsigned int rc);
+
 public:
-    Task(Client *parent,
-	 util::Scheduler *scheduler,
-	 RecipientPtr target,
-	 const std::string& url,
-	 const std::string& extra_headers,
-	 const std::string& body,
-	 const char *verb);
+    Task(Client *parent, const std::string& host,
+	 const util::IPEndPoint& remote_endpoint);
     ~Task();
 
+    void SetRequest(util::Scheduler *scheduler,
+		    RecipientPtr target,
+		    const std::string& path,
+		    const std::string& extra_headers,
+		    const std::string& body,
+		    const char *verb);
+
+    /** Takes over the transaction of a Task which never got a connection
+     */
+    void TakeRequest(Task *other)
+    {
+	SetRequest(other->m_scheduler, other->m_target, other->m_path,
+		   other->m_extra_headers, other->m_body, other->m_verb);
+    }
+
+    const std::string& GetHost() const { return m_host; }
+
     unsigned int Run();
 
     unsigned int Init();
+
+    /** Start the transaction on this, already-connected, Task */
+    void Reuse();
+
+    /** Idle connections aren't watched -- the scheduler they were last
+     * used with might not be around any more (see Fetcher) -- but are
+     * checked before reuse.
+     */
+    void SetIdle() { m_idle_since = ::time(NULL); }
+    time_t GetIdleSince() const { return m_idle_since; }
+
+    /** Whether the server has closed the idle connection (or, wrongly,
+     * sent something on it)
+     */
+    bool IsStale() { return m_socket.WaitForRead(0) == 0; }
+
+    void Close() { m_socket.Close(); }
+
+    void SetCounted(bool counted) { m_counted = counted; }
+
+    void Fail(unsigned int rc) { SendDone(rc); }
 };
  
-Client::Task::Task(Client *parent,
-		   util::Scheduler *scheduler,
-		   RecipientPtr target,
-		   const std::string& url,
-		   const std::string& extra_headers,
-		   const std::string& body,
-		   const char *verb)
+Client::Task::Task(Client *parent, const std::string& host,
+		   const util::IPEndPoint& remote_endpoint)
     : m_parent(parent),
-      m_target(target),
-      m_extra_headers(extra_headers),
-      m_body(body),
-      m_verb(verb),
-      m_scheduler(scheduler),
+      m_verb(NULL),
+      m_remote_endpoint(remote_endpoint),
+      m_scheduler(NULL),
       m_socket(),
+      m_host(host),
+      m_sent(0),
+      m_counted(false),
+      m_reused(false),
+      m_idle_since(0),
       m_buffer_fill(0),
       m_line_reader(&m_socket),
       m_parser(&m_line_reader),
       m_state(UNINITIALISED)
 {
-    std::string host; // "http://ip:port"
-    ParseURL(url, &host, &m_path);
-    std::string hostonly;
-    ParseHost(host, 80, &hostonly, &m_remote_endpoint.port);
-    std::stringstream ss;
-    ss << hostonly << ":" << m_remote_endpoint.port;
-    m_host = ss.str();
-    m_remote_endpoint.addr = util::IPAddress::Resolve(hostonly.c_str());
+}
+
+void Client::Task::SetRequest(util::Scheduler *scheduler,
+			      RecipientPtr target,
+			      const std::string& path,
+			      const std::string& extra_headers,
+			      const std::string& body,
+			      const char *verb)
+{
+    m_scheduler = scheduler;
+    m_target = target;
+    m_path = path;
+    m_extra_headers = extra_headers;
+    m_body = body;
+    m_verb = verb;
+}
+
+void Client::Task::BuildHeaders()
+{
+    m_headers = m_verb ? m_verb : (m_body.empty() ? "GET" : "POST");
+    m_headers += " " + m_path + " HTTP/1.1\r\n"
+	"Host: " + m_host + "\r\n";
+    m_headers += m_parent->m_useragent_header;
+    m_headers += "Accept: */*\r\n";
+    m_headers += m_extra_headers;
+    if (!m_body.empty()) {
+	m_headers += util::Printf() << "Content-Length: " << m_body.size()
+				    << "\r\n";
+    }
+    m_headers += "\r\n";
+    m_sent = 0;
+}
+
+void Client::Task::Reuse()
+{
+    LOG(HTTP_CLIENT) << "ct" << this << ": reusing connection to "
+		     << m_host << " for " << m_path << "\n";
+    m_reused = true;
+    m_target->OnEndPoint(m_socket.GetLocalEndPoint());
+    BuildHeaders();
+    m_state = SEND_HEADERS;
+    WaitForWritable();
+}
+
+/** Whether the request can safely be sent twice (RFC7231 s4.2.2). GENA
+ * NOTIFYs count, as they carry a sequence number.
+ */
+bool Client::Task::IsIdempotent() const
+{
+    const char *verb = m_verb ? m_verb : (m_body.empty() ? "GET" : "POST");
+    return !strcmp(verb, "GET") || !strcmp(verb, "HEAD")
+	|| !strcmp(verb, "NOTIFY");
+}
+
+/** The server closed a kept-alive connection just as we reused it, so
+ * start again on a new one; or, if it wasn't reused, fail.
+ *
+ * A server timing out an idle connection can close it after our request
+ * is written but before it's read, so often the first we hear of it is
+ * the connection closing with no response at all. Idempotent requests are
+ * then sent again; others (a SOAP action, say) only if none of the
+ * request got written, as otherwise the server might have carried it out.
+ *
+ * @return rc, or 0 if the transaction's been restarted
+ */
+unsigned int Client::Task::Retry(unsigned int rc)
+{
+    if (!m_reused || m_line_reader.GetBuffered()
+	|| (m_sent && !IsIdempotent()))
+    {
+	m_target->OnDone(rc);
+	return rc;
+    }
+
+    LOG(HTTP_CLIENT) << "ct" << this << ": reused connection went away ("
+		     << rc << "), reconnecting\n";
+    {
+	Lock lock(m_parent);
+	++m_parent->m_stats.retried;
+    }
+
+    m_reused = false;
+    m_socket.Close();
+    m_socket.Open();
+    rc = Init();
+    if (rc)
+	m_target->OnDone(rc);
+    return rc;
 }
 
 /** Start connecting the socket.
@@ -196,6 +346,8 @@ Client::Task::~Task()
 {
     LOG(HTTP_CLIENT) << "ct" << this << ": ~Client::Task(" << m_path << ") in state "
 		     << m_state << "\n";
+    if (m_counted)
+	m_parent->ClosedConnection(m_host);
 //    m_scheduler->Remove(m_socket.get());
     LOG(HTTP_CLIENT) << "~Client::Task" << " done\n";
 }
@@ -248,18 +400,7 @@ unsigned int Client::Task::Run()
 	 */
 	m_target->OnEndPoint(m_socket.GetLocalEndPoint());
 
-	m_headers = m_verb ? m_verb : (m_body.empty() ? "GET" : "POST");
-	m_headers += " " + m_path + " HTTP/1.1\r\n"
-	    "Host: " + m_host + "\r\n"
-	    "Connection: close\r\n";
-	m_headers += m_parent->m_useragent_header;
-	m_headers += "Accept: */*\r\n";
-	m_headers += m_extra_headers;
-	if (!m_body.empty()) {
-	    m_headers += util::Printf() << "Content-Length: " << m_body.size()
-					<< "\r\n";
-        }
-	m_headers += "\r\n";
+	BuildHeaders();
 	m_state = SEND_HEADERS;
 
 	LOG(HTTP_CLIENT) << "Sending headers:\n" << m_headers << "\n";
@@ -271,33 +412,22 @@ unsigned int Client::Task::Run()
 	LOG(HTTP_CLIENT) << "Sending headers and body\n";
 
 	Socket::Buffer iovec[2];
-	iovec[0].ptr = m_headers.c_str();
-	iovec[0].len = m_headers.size();
+	iovec[0].ptr = m_headers.c_str() + m_sent;
+	iovec[0].len = m_headers.size() - m_sent;
 	iovec[1].ptr = m_body.c_str();
 	iovec[1].len = m_body.size();
 
 	size_t nwrote;
 	rc = m_socket.WriteV(iovec, 2, &nwrote);
 	if (rc == 0)
-	{
-	    if (nwrote < m_headers.size())
-	    {
-		m_headers.erase(0,nwrote);
-	    }
-	    else
-	    {
-		m_body.erase(0, nwrote - m_headers.size());
-		m_headers.clear();
-	    }
-	}
+	    m_sent += nwrote;
 	else if (rc != EWOULDBLOCK)
 	{
 	    TRACE << "Write error " << rc << "\n";
-	    m_target->OnDone(rc);
-	    return rc;
+	    return Retry(rc);
 	}
 
-	if (!m_headers.empty())
+	if (m_sent < m_headers.size())
 	{
 	    TRACE << "EWOULDBLOCK(sendheaders), waiting for write\n";
 	    WaitForWritable();
@@ -311,20 +441,21 @@ unsigned int Client::Task::Run()
     /* fall through */
 
     case SEND_BODY:
-	if (!m_body.empty()) /// @todo writev(headers, body)
+	if (m_sent < m_headers.size() + m_body.size())
 	{
+	    size_t offset = m_sent - m_headers.size();
 	    size_t nwrote;
-	    rc = m_socket.Write(m_body.c_str(), m_body.size(), &nwrote);
+	    rc = m_socket.Write(m_body.c_str() + offset,
+				m_body.size() - offset, &nwrote);
 	    if (rc == 0)
-		m_body.erase(0, nwrote);
+		m_sent += nwrote;
 	    else if (rc != EWOULDBLOCK)
 	    {
 		TRACE << "Write error(body) " << rc << "\n";
-		m_target->OnDone(rc);
-		return rc;
+		return Retry(rc);
 	    }
 
-	    if (!m_body.empty())
+	    if (m_sent < m_headers.size() + m_body.size())
 	    {
 		WaitForWritable();
 		return 0;
@@ -344,8 +475,9 @@ unsigned int Client::Task::Run()
     case WAITING:
     {
 	unsigned int http_code;
+	std::string version;
 
-	rc = m_parser.GetResponseLine(&http_code, NULL);
+	rc = m_parser.GetResponseLine(&http_code, &version);
 	LOG(HTTP) << "GRL returned " << rc << "\n";
 	if (rc)
 	{
@@ -354,11 +486,20 @@ unsigned int Client::Task::Run()
 		WaitForReadable();
 		return 0;
 	    }
-	    m_target->OnDone(rc);
-	    return rc;
+	    return Retry(rc);
 	}
 
 	m_entity.Clear();
+	if (version == "HTTP/1.0")
+	    m_entity.connection_close = true;
+
+	/* These have no body, whatever their Content-Length says
+	 * (RFC2616 s4.3)
+	 */
+	m_entity.no_body = (m_verb && !strcmp(m_verb, "HEAD"))
+	    || http_code == 204 || http_code == 304
+	    || (http_code >= 100 && http_code < 200);
+
 	m_state = RECV_HEADERS;
     }
     /* fall through */
@@ -421,10 +562,27 @@ unsigned int Client::Task::Run()
 	    {
 		if (strstr(value.c_str(), "close"))
 		    m_entity.connection_close = true;
+		else if (!strcasecmp(value.c_str(), "Keep-Alive"))
+		    m_entity.connection_close = false;
+	    }
+	    else if (!strcasecmp(key.c_str(), "Transfer-Encoding"))
+	    {
+		if (strstr(value.c_str(), "chunked"))
+		    m_entity.chunked = true;
 	    }
 	}
 
-	if (!m_entity.got_length)
+	if (m_entity.no_body)
+	{
+	    m_entity.chunked = false;
+	    m_entity.transfer_length = 0;
+	}
+	else if (m_entity.chunked)
+	{
+	    // Chunking overrides any Content-Length (RFC2616 s4.4)
+	    m_entity.transfer_length = 0;
+	}
+	else if (!m_entity.got_length)
 	{
 	    m_entity.connection_close = true;
 	    m_entity.transfer_length = UINT_MAX;
@@ -440,6 +598,7 @@ unsigned int Client::Task::Run()
 	          somehow?
 	 */
 
+      next_chunk:
 	while (m_entity.transfer_length || m_buffer_fill)
 	{
 	    LOG(HTTP_CLIENT) << "transfer_length=" << m_entity.transfer_length
@@ -506,25 +665,43 @@ unsigned int Client::Task::Run()
 	    m_buffer_fill = 0;
 	}
 
+	if (m_entity.chunked)
+	{
+	    rc = RecvChunkHeader();
+	    if (rc == EWOULDBLOCK)
+	    {
+		WaitForReadable();
+		return 0;
+	    }
+	    if (rc)
+	    {
+		TRACE << "Bad chunk (" << rc << ")\n";
+		m_target->OnDone(rc);
+		return rc;
+	    }
+	    if (m_entity.transfer_length)
+		goto next_chunk;
+	}
+
 	LOG(HTTP_CLIENT) << "Done\n";
 
 	SendDone(0);
-	m_socket.Close();
 	m_target.reset(NULL);
+	bool reusable = !m_entity.connection_close;
+	if (!reusable)
+	    m_socket.Close();
 	m_entity.Clear();
 
 	m_state = IDLE;
-	/* fall through */
-    }
-    case IDLE:
-//	TRACE << "HttpConnection going idle\n";
-//	m_scheduler->Remove(m_socket.get());
 
-	// -- When fixing, remove unconditional connection:close from headers
-	//
-	// if (!m_entity.connection_close)
-	//     m_parent->PoolMe(this)
+	/* This might start the next transaction straight away, so must be
+	 * the last thing we do.
+	 */
+	m_parent->Pool(this, reusable);
+	break;
+    }
 
+    case IDLE:
 	break;
 
     case UNINITIALISED:
@@ -535,6 +712,60 @@ unsigned int Client::Task::Run()
     return 0;
 }
 
+/** Reads up to the start of the next chunk's data, setting
+ * m_entity.transfer_length to its size; or, after the last chunk, to
+ * zero.
+ */
+unsigned int Client::Task::RecvChunkHeader()
+{
+    unsigned int rc;
+
+    switch (m_entity.chunk_state)
+    {
+    case CHUNK_DATA:
+	rc = m_parser.GetChunkEnd();
+	if (rc)
+	    return rc;
+	m_entity.chunk_state = CHUNK_HEADER;
+	/* fall through */
+
+    case CHUNK_HEADER:
+    {
+	uint64_t size;
+	rc = m_parser.GetChunkHeader(&size);
+	if (rc)
+	    return rc;
+	LOG(HTTP_CLIENT) << "Chunk of " << size << " bytes\n";
+	if (size > SIZE_MAX)
+	    return EINVAL;
+	if (size)
+	{
+	    m_entity.transfer_length = (size_t)size;
+	    m_entity.chunk_state = CHUNK_DATA;
+	    return 0;
+	}
+	m_entity.chunk_state = CHUNK_TRAILER;
+    }
+	/* fall through */
+
+    case CHUNK_TRAILER:
+	for (;;)
+	{
+	    std::string key, value;
+	    rc = m_parser.GetHeaderLine(&key, &value);
+	    if (rc)
+		return rc;
+	    if (key.empty())
+		break;
+	    m_target->OnHeader(key, value);
+	}
+	break;
+    }
+
+    m_entity.transfer_length = 0;
+    return 0;
+}
+
 #if 0
 unsigned int Client::Task::Read(void *buffer, size_t len, size_t *pread)
 {
@@ -579,7 +810,8 @@ unsigned int Client::Task::Read(void *buffer, size_t len, size_t *pread)
         /* util::http::Client */
 
 
-Client::Client()
+Client::Client(unsigned int max_per_host)
+    : m_max_per_host(max_per_host)
 {
     struct utsname ubuf;
 
@@ -589,6 +821,26 @@ Client::Client()
 	= util::Printf() << "User-Agent: "
 			 << ubuf.sysname << "/" << ubuf.release
 			 << " UPnP/1.0 " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n";
+
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+Client::~Client()
+{
+    for (hosts_t::iterator i = m_hosts.begin(); i != m_hosts.end(); ++i)
+    {
+	std::list<TaskPtr>& idle = i->second.idle;
+	for (std::list<TaskPtr>::iterator j = idle.begin(); j != idle.end();
+	     ++j)
+	{
+	    (*j)->SetCounted(false);
+	    (*j)->Close();
+	}
+    }
+    m_hosts.clear();
+
+    LOG(HTTP_CLIENT) << m_stats.reused << "/" << m_stats.requests
+		     << " requests on kept-alive connections\n";
 }
 
 unsigned int Client::Connect(util::Scheduler *scheduler,
@@ -598,10 +850,165 @@ unsigned int Client::Connect(util::Scheduler *scheduler,
 			     const std::string& body,
 			     const char *verb)
 {
-    util::CountedPointer<Task> ptr(new Client::Task(this, scheduler, target,
-						    url, extra_headers, body,
-						    verb));
-    return ptr->Init();
+    std::string host, path; // "http://ip:port", "/path"
+    ParseURL(url, &host, &path);
+    std::string hostonly;
+    util::IPEndPoint ipe;
+    ParseHost(host, 80, &hostonly, &ipe.port);
+    std::string key = util::Printf() << hostonly << ":" << ipe.port;
+
+    TaskPtr task;
+    std::list<TaskPtr> stale;
+    {
+	Lock lock(this);
+	++m_stats.requests;
+
+	/* Idle connections aren't watched, so this is where they time out
+	 * (for all hosts, so they don't hang about forever).
+	 */
+	time_t expiry = ::time(NULL) - IDLE_SECONDS;
+	for (hosts_t::iterator i = m_hosts.begin(); i != m_hosts.end(); ++i)
+	{
+	    std::list<TaskPtr>& idle = i->second.idle;
+	    while (!idle.empty() && idle.front()->GetIdleSince() < expiry)
+	    {
+		stale.push_back(idle.front());
+		idle.pop_front();
+	    }
+	}
+
+	// Most recently used first, as least likely to have been closed
+	hosts_t::iterator i = m_hosts.find(key);
+	if (i != m_hosts.end())
+	{
+	    std::list<TaskPtr>& idle = i->second.idle;
+	    while (!task && !idle.empty())
+	    {
+		if (idle.back()->IsStale())
+		    stale.push_back(idle.back());
+		else
+		    task = idle.back();
+		idle.pop_back();
+	    }
+	}
+
+	if (task)
+	{
+	    ++m_stats.reused;
+	    LOG(HTTP_CLIENT) << "Pool hit, " << m_stats.reused << "/"
+			     << m_stats.requests << " requests reused\n";
+	}
+    }
+
+    // Closing these might start queued transactions, so not under the lock
+    for (std::list<TaskPtr>::iterator i = stale.begin(); i != stale.end(); ++i)
+	(*i)->Close();
+    stale.clear();
+
+    if (task)
+    {
+	task->SetRequest(scheduler, target, path, extra_headers, body, verb);
+	task->Reuse();
+	return 0;
+    }
+
+    ipe.addr = util::IPAddress::Resolve(hostonly.c_str());
+    if (ipe.addr.addr == 0)
+	return ENOENT;
+
+    task.reset(new Task(this, key, ipe));
+    task->SetRequest(scheduler, target, path, extra_headers, body, verb);
+
+    {
+	Lock lock(this);
+	Host& h = m_hosts[key];
+	if (h.connections >= m_max_per_host)
+	{
+	    LOG(HTTP_CLIENT) << key << " has " << h.connections
+			     << " connections, queueing " << path << "\n";
+	    h.waiting.push_back(task);
+	    ++m_stats.waited;
+	    return 0;
+	}
+	++h.connections;
+	task->SetCounted(true);
+    }
+
+    return task->Init();
+}
+
+/** Called when a Task has finished its transaction.
+ *
+ * If its connection can be kept alive, it either gets the next waiting
+ * transaction for its host, or goes idle.
+ */
+void Client::Pool(Task *task, bool reusable)
+{
+    if (!reusable)
+	return; // Closing it lets the next one start, see ClosedConnection
+
+    TaskPtr next;
+    {
+	Lock lock(this);
+	Host& h = m_hosts[task->GetHost()];
+	if (h.waiting.empty())
+	{
+	    task->SetIdle();
+	    h.idle.push_back(TaskPtr(task));
+	    return;
+	}
+	next = h.waiting.front();
+	h.waiting.pop_front();
+	++m_stats.reused;
+    }
+
+    task->TakeRequest(next.get());
+    task->Reuse();
+}
+
+/** Called from ~Task when a connection goes away; starts the next waiting
+ * transaction for the host, if any.
+ */
+void Client::ClosedConnection(const std::string& host)
+{
+    for (;;)
+    {
+	TaskPtr next;
+	{
+	    Lock lock(this);
+	    hosts_t::iterator i = m_hosts.find(host);
+	    if (i == m_hosts.end())
+		return;
+	    Host& h = i->second;
+	    --h.connections;
+	    if (h.waiting.empty())
+	    {
+		if (!h.connections)
+		    m_hosts.erase(i);
+		return;
+	    }
+	    next = h.waiting.front();
+	    h.waiting.pop_front();
+	    ++h.connections;
+	    next->SetCounted(true);
+	}
+
+	unsigned int rc = next->Init();
+	if (!rc)
+	    return;
+
+	/* Connect() has already returned, so report the error the
+	 * asynchronous way; and give up the slot again.
+	 */
+	next->Fail(rc);
+	next->SetCounted(false);
+    }
+}
+
+Client::Stats Client::GetStats()
+{
+    Lock lock(this);
+    return m_stats;
 }
 
 } // namespace http
@@ -614,6 +1021,7 @@ unsigned int Client::Connect(util::Scheduler *scheduler,
 # include "poll.h"
 # include "string_stream.h"
 # include "worker_thread_pool.h"
+# include <thread>
 
 class EchoContentFactory: public util::http::ContentFactory
 {
@@ -625,6 +1033,40 @@ public:
     }
 };
 
+/** A stream of unknown length, so the server sends it chunked */
+class LiveStream: public util::Stream
+{
+    size_t m_pos;
+    size_t m_len;
+
+public:
+    explicit LiveStream(size_t len) : m_pos(0), m_len(len) {}
+
+    unsigned GetStreamFlags() const { return READABLE; }
+
+    unsigned Read(void *buffer, size_t len, size_t *pread)
+    {
+	len = std::min(len, m_len - m_pos);
+	for (size_t i=0; i<len; ++i)
+	    ((char*)buffer)[i] = (char)('a' + (m_pos+i) % 26);
+	m_pos += len;
+	*pread = len;
+	return 0;
+    }
+};
+
+class LiveContentFactory: public util::http::ContentFactory
+{
+public:
+    bool StreamForPath(const util::http::Request *rq, util::http::Response *rs)
+    {
+	if (rq->path != "/live")
+	    return false;
+	rs->body_source.reset(new LiveStream(20000)); // Several chunks
+	return true;
+    }
+};
+
 class TestObserver: public util::http::Recipient
 {
     std::string m_reply;
@@ -661,6 +1103,62 @@ public:
     bool IsDone() const { return m_done; }
 };
 
+/** Reads one request (with no body) from the socket */
+static void ReadRequest(util::StreamSocket *s)
+{
+    std::string rq;
+    while (rq.find("\r\n\r\n") == std::string::npos)
+    {
+	char buf[256];
+	size_t nread;
+	unsigned int rc = s->Read(buf, sizeof(buf), &nread);
+	assert(rc == 0);
+	assert(nread > 0);
+	rq.append(buf, nread);
+    }
+}
+
+/** Answers one request on a kept-alive connection, then times it out just
+ * as the next request arrives: so that one goes unanswered, and has to be
+ * sent again on a new connection.
+ */
+static void IdleTimeoutServer(util::StreamSocket *listener)
+{
+    static const char reply[] = "HTTP/1.1 200 OK\r\n"
+	"Content-Length: 2\r\n"
+	"\r\n"
+	"ok";
+
+    for (unsigned int i=0; i<2; ++i)
+    {
+	std::unique_ptr<util::StreamSocket> s;
+	unsigned int rc = listener->Accept(&s);
+	assert(rc == 0);
+	ReadRequest(s.get());
+	size_t nwrote;
+	rc = s->Write(reply, sizeof(reply)-1, &nwrote);
+	assert(rc == 0);
+	if (i == 0)
+	    ReadRequest(s.get());
+    }
+}
+
+static void WaitFor(util::BackgroundScheduler *scheduler,
+		    util::CountedPointer<TestObserver> *tobs, unsigned int n)
+{
+    time_t finish = time(NULL) + 12;
+    time_t now;
+    bool done;
+    do {
+	now = time(NULL);
+	if (now < finish)
+	    scheduler->Poll((unsigned)(finish-now)*1000);
+	done = true;
+	for (unsigned int i=0; i<n; ++i)
+	    done = done && tobs[i]->IsDone();
+    } while (now < finish && !done);
+}
+
 int main(int, char*[])
 {
     util::WorkerThreadPool wtp(util::WorkerThreadPool::NORMAL);
@@ -670,42 +1168,104 @@ int main(int, char*[])
 
     unsigned rc = ws.Init(0);
 
+    LiveContentFactory lcf;
     EchoContentFactory ecf;
+    ws.AddContentFactory("/live", &lcf);
     ws.AddContentFactory("/", &ecf);
 
     assert(rc == 0);
 
-    std::string url = (boost::format("http://127.0.0.1:%u/zootle/wurdle.html")
-		       % ws.GetPort()
-	).str();
+    std::string base = (boost::format("http://127.0.0.1:%u") % ws.GetPort())
+	.str();
 
     util::http::Client client;
 
     util::CountedPointer<TestObserver> tobs(new TestObserver);
 
-    rc = client.Connect(&scheduler, tobs, url);
+    rc = client.Connect(&scheduler, tobs, base + "/zootle/wurdle.html");
     assert(rc == 0);
+    WaitFor(&scheduler, &tobs, 1);
+    assert(tobs->GetReply() == "/zootle/wurdle.html");
 
-    time_t start = time(NULL);
-    time_t finish = start+12; // Long enough for the worker thread to time out
-    time_t now;
+    // Chunked, and on the same connection
+    tobs.reset(new TestObserver);
+    rc = client.Connect(&scheduler, tobs, base + "/live");
+    assert(rc == 0);
+    WaitFor(&scheduler, &tobs, 1);
 
-    do {
-	now = time(NULL);
-	if (now < finish)
+    const std::string& reply = tobs->GetReply();
+    assert(reply.size() == 20000);
+    for (size_t i=0; i<reply.size(); ++i)
+	assert(reply[i] == (char)('a' + i % 26));
+
+    util::http::Client::Stats stats = client.GetStats();
+    assert(stats.requests == 2);
+    assert(stats.reused == 1);
+
+    // The server closes this one, but we don't find out until later
+    tobs.reset(new TestObserver);
+    rc = client.Connect(&scheduler, tobs, base + "/closing",
+			"Connection: close\r\n");
+    assert(rc == 0);
+    WaitFor(&scheduler, &tobs, 1);
+    assert(tobs->GetReply() == "/closing");
+
+    tobs.reset(new TestObserver);
+    rc = client.Connect(&scheduler, tobs, base + "/reopened");
+    assert(rc == 0);
+    WaitFor(&scheduler, &tobs, 1);
+    assert(tobs->GetReply() == "/reopened");
+
+    // The server times out an idle connection just as it's reused
+    {
+	util::StreamSocket listener;
+	util::IPEndPoint ep = { util::IPAddress::ANY, 0 };
+	rc = listener.Bind(ep);
+	assert(rc == 0);
+	rc = listener.Listen();
+	assert(rc == 0);
+	std::string url = util::Printf() << "http://127.0.0.1:"
+					 << listener.GetLocalEndPoint().port
+					 << "/";
+	std::thread server(IdleTimeoutServer, &listener);
+
+	util::http::Client client3;
+	for (unsigned int i=0; i<2; ++i)
 	{
-//	    TRACE << "polling for " << (finish-now)*1000 << "ms\n";
-	    scheduler.Poll((unsigned)(finish-now)*1000);
+	    tobs.reset(new TestObserver);
+	    rc = client3.Connect(&scheduler, tobs, url);
+	    assert(rc == 0);
+	    WaitFor(&scheduler, &tobs, 1);
+	    assert(tobs->GetReply() == "ok");
 	}
-    } while (now < finish && !tobs->IsDone());
+	server.join();
 
-//    TRACE << "Got '" << tobs.GetReply() << "' (len "
-//	  << strlen(tobs.GetReply().c_str()) << " sz "
-//	  << tobs.GetReply().length() << ")\n";
-    assert(tobs->GetReply() == "/zootle/wurdle.html");
+	stats = client3.GetStats();
+	assert(stats.reused == 1);
+	assert(stats.retried == 1);
+    }
+
+    // More at once than the limit per host
+    enum { N = 10 };
+    util::http::Client client2(2);
+    util::CountedPointer<TestObserver> tobs2[N];
+    for (unsigned int i=0; i<N; ++i)
+    {
+	tobs2[i].reset(new TestObserver);
+	rc = client2.Connect(&scheduler, tobs2[i],
+			     base + "/" + std::to_string(i));
+	assert(rc == 0);
+    }
+    WaitFor(&scheduler, tobs2, N);
+    for (unsigned int i=0; i<N; ++i)
+	assert(tobs2[i]->GetReply() == "/" + std::to_string(i));
+
+    stats = client2.GetStats();
+    assert(stats.requests == N);
+    assert(stats.waited == N-2);
+    assert(stats.reused == N-2);
 
     return 0;
 }
 
 #endif
-
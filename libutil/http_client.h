@@ -2,6 +2,10 @@
 #define HTTP_CLIENT_H 1
 
 #include "counted_object.h"
+#include "counted_pointer.h"
+#include "locking.h"
+#include <list>
+#include <map>
 #include <string>
 
 namespace util {
@@ -13,7 +17,8 @@ namespace http {
 
 /** A recipient of data from an asynchronous HTTP client connection.
  *
- * For a simple, synchronous fetcher, see util::http::Fetcher. To use
+ * For a simple, synchronous fetcher, see util::http::Fetcher; for use
+ * from a coroutine, see util::http::AwaitFetch. To use
  * the asynchronous API, inherit from Connection and override (some or
  * all of) Write(), OnHeader(), OnEndPoint(), and OnDone(), all of
  * which are called as necessary by the implementation.
@@ -47,15 +52,54 @@ typedef CountedPointer<Recipient> RecipientPtr;
 /** A central pool of HTTP connections.
  *
  * Declare one somewhere centrally and pass it to everyone who needs
- * an HTTP client.
+ * an HTTP client. It must outlive all the transactions started on it.
+ *
+ * Connections are kept alive after each transaction (unless the server
+ * says otherwise), and reused for the next one to the same host:port,
+ * for up to IDLE_SECONDS. No more than a set number of connections are
+ * made to any one host at once; further transactions wait their turn.
  */
-class Client
+class Client: private util::PerObjectLocking
 {
     class Task;
+    typedef CountedPointer<Task> TaskPtr;
+
     std::string m_useragent_header;
+    unsigned int m_max_per_host;
+
+    struct Host
+    {
+	unsigned int connections = 0; ///< Open, whether busy or idle
+	std::list<TaskPtr> idle;
+	std::list<TaskPtr> waiting; ///< Not yet started, for want of a slot
+    };
+    typedef std::map<std::string, Host> hosts_t; ///< By "host:port"
+    hosts_t m_hosts;
+
+public:
+    struct Stats
+    {
+	unsigned int requests;
+	unsigned int reused;   ///< Sent on an already-open connection
+	unsigned int waited;   ///< Queued because the host was at its limit
+	unsigned int retried;  ///< Reused connection had gone away meanwhile
+    };
+
+private:
+    Stats m_stats;
+
+    void Pool(Task*, bool reusable);
+    void ClosedConnection(const std::string& host);
 
 public:
-    Client();
+    /** Less than the commonest server keep-alive timeout (Apache's five
+     * seconds), as a POST can't be retried if the server closes the
+     * connection as we send it.
+     */
+    enum { IDLE_SECONDS = 4 };
+
+    explicit Client(unsigned int max_per_host = 4);
+    ~Client();
 
     /** Passing a NULL verb means POST (if body != NULL) or GET (otherwise).
      *
@@ -72,6 +116,9 @@ public:
 			 const std::string& extra_headers = std::string(),
 			 const std::string& body = std::string(),
 			 const char *verb = NULL);
+
+    /** The pool hit rate is reused/requests */
+    Stats GetStats();
 };
 
 } // namespace http
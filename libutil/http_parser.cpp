@@ -3,6 +3,9 @@
 #include "trace.h"
 #include "errors.h"
 #include <boost/tokenizer.hpp>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
 
 namespace util {
 
@@ -108,6 +111,79 @@ unsigned int Parser::GetHeaderLine(std::string *pkey, std::string *pvalue)
     return 0;
 }
 
+unsigned int Parser::GetChunkHeader(uint64_t *size)
+{
+    std::string line;
+    unsigned int rc = m_line_reader->GetLine(&line);
+    if (rc)
+	return rc;
+
+    const char *ptr = line.c_str();
+    char *end;
+    errno = 0;
+    unsigned long long ull = strtoull(ptr, &end, 16);
+    if (end == ptr || (*end && *end != ';' && *end != ' ' && *end != '\t')
+	|| !isxdigit((unsigned char)*ptr) || errno == ERANGE)
+    {
+	TRACE << "Don't like chunk header '" << line << "'\n";
+	return EINVAL;
+    }
+    *size = ull;
+    return 0;
+}
+
+unsigned int Parser::GetChunkEnd()
+{
+    std::string line;
+    unsigned int rc = m_line_reader->GetLine(&line);
+    if (rc)
+	return rc;
+
+    if (!line.empty())
+    {
+	TRACE << "Chunk overran its size: '" << line << "'\n";
+	return EINVAL;
+    }
+    return 0;
+}
+
 } // namespace http
 
 } // namespace util
+
+
+#ifdef TEST
+
+# include "string_stream.h"
+# include "line_reader.h"
+# include <assert.h>
+
+static void TestChunkHeader(const char *line, unsigned int expected_rc,
+			    uint64_t expected_size = 0)
+{
+    util::StringStream ss(line);
+    util::GreedyLineReader lr(&ss);
+    util::http::Parser hp(&lr);
+    uint64_t size = 12345;
+    unsigned int rc = hp.GetChunkHeader(&size);
+    assert(rc == expected_rc);
+    if (!rc)
+	assert(size == expected_size);
+}
+
+int main()
+{
+    TestChunkHeader("0\r\n", 0, 0);
+    TestChunkHeader("1f4\r\n", 0, 500);
+    TestChunkHeader("1F4;name=value\r\n", 0, 500);
+    TestChunkHeader("ffffffffffffffff\r\n", 0, UINT64_MAX);
+    TestChunkHeader("\r\n", EINVAL);
+    TestChunkHeader("zz\r\n", EINVAL);
+    TestChunkHeader("-1\r\n", EINVAL);
+
+    // Too big for strtoull, which would otherwise give ULLONG_MAX
+    TestChunkHeader("10000000000000000\r\n", EINVAL);
+    return 0;
+}
+
+#endif
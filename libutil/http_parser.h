@@ -2,6 +2,7 @@
 #define LIBUTIL_HTTP_PARSER_H 1
 
 #include <string>
+#include <stdint.h>
 
 namespace util {
 
@@ -23,6 +24,17 @@ public:
     /** Returns an empty "key" and no error for final, blank line.
      */
     unsigned int GetHeaderLine(std::string *key, std::string *value);
+
+    /** Reads the line introducing each chunk of a "Transfer-Encoding:
+     * chunked" body (RFC2616 s3.6.1), giving the chunk's size; any
+     * chunk-extension is ignored. A size of zero marks the last chunk,
+     * after which come trailer lines, as for GetHeaderLine.
+     */
+    unsigned int GetChunkHeader(uint64_t *size);
+
+    /** Reads the CRLF which ends each chunk's data.
+     */
+    unsigned int GetChunkEnd();
 };
 
 } // namespace http
@@ -10,6 +10,7 @@
 #include "errors.h"
 #include "printf.h"
 #include "scanf64.h"
+#include "io_uring.h"
 #include "scheduler.h"
 #include "ip_filter.h"
 #include "http_parser.h"
@@ -25,6 +26,8 @@
 #endif
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <atomic>
 #include <boost/format.hpp>
 #include <boost/scoped_array.hpp>
 
@@ -79,15 +82,34 @@ class Server::DataTask final: public util::Task
     std::unique_ptr<util::Stream> m_response_stream;
     bool m_reuse_stream;
 
+    /** Whether Run() must be called on the worker pool: always, unless
+     * the server is inline; then, only while handling a request whose
+     * content might block.
+     */
+    bool m_on_pool;
+
+    /** Whether m_rs.body_source came from a factory which might block */
+    bool m_source_blocking;
+
     std::string m_headers;
 
     enum { BUFFER_SIZE = 8192 };
     boost::scoped_array<char> m_buffer;
     size_t m_buffer_fill;
 
+    /** Each chunk is "%04x\r\n", up to BUFFER_SIZE-CHUNK_OVERHEAD bytes
+     * of data, then "\r\n"; the leading zeroes are allowed, and mean the
+     * header is always the same size.
+     */
+    enum { CHUNK_HEADER = 6, CHUNK_OVERHEAD = CHUNK_HEADER + 2 };
+
     struct {
 	bool closing;
+	bool http10;
 	bool do_range;
+	bool buffered; ///< Body isn't a file, so can't use SendFile
+	bool chunked;  ///< Length unknown, so Transfer-Encoding: chunked
+	bool last_chunk; ///< The zero-length chunk is in m_buffer
 	uint64_t range_min;
 	uint64_t range_max;
 	uint64_t post_body_length;
@@ -95,7 +117,8 @@ class Server::DataTask final: public util::Task
 
 	void Clear()
         {
-	    closing = do_range = false; 
+	    closing = http10 = do_range = buffered = chunked = last_chunk
+		= false;
 	    range_min = range_max = post_body_length = total_written = 0;
 	}
     } m_entity;
@@ -104,6 +127,7 @@ class Server::DataTask final: public util::Task
 	CHECKING,
 	WAITING,
 	RECV_HEADERS,
+	FINDING_CONTENT,
 	RECV_BODY,
 	SEND_HEADERS,
 	SEND_BODY
@@ -125,30 +149,47 @@ class Server::DataTask final: public util::Task
 	    sock->GetHandle());
     }
 
-    /** Called from polling thread; punts work to background thread */
+    unsigned SendFileBody();
+    size_t FrameChunk(size_t len);
+
+    /** Called from polling thread; punts work to background thread,
+     * unless the server is inline and the request doesn't need it.
+     */
     unsigned OnActivity()
     {
-	m_parent->m_pool->PushTask(
-	    Bind(DataTaskPtr(this)).To<&DataTask::Run>());
+	if (m_on_pool)
+	    m_parent->m_pool->PushTask(
+		Bind(DataTaskPtr(this)).To<&DataTask::Run>(),
+		util::WorkerThreadPool::INTERACTIVE);
+	else
+	    Run();
 	return 0;
     }
 
+    /** Carry on with this request on the worker pool */
+    unsigned PuntToPool()
+    {
+	m_on_pool = true;
+	return OnActivity();
+    }
+
     DataTask(Server *parent, std::unique_ptr<StreamSocket> client);
 
 public:
     ~DataTask();
 
-    static TaskCallback Create(Server*, std::unique_ptr<StreamSocket>);
+    /** Called from polling thread on accepting a connection */
+    static void Start(Server*, std::unique_ptr<StreamSocket>);
 
     /** Called on background thread */
     unsigned int Run() override;
 };
 
-TaskCallback Server::DataTask::Create(Server *parent,
-				      std::unique_ptr<StreamSocket> client)
+void Server::DataTask::Start(Server *parent,
+			     std::unique_ptr<StreamSocket> client)
 {
     DataTaskPtr ptr(new DataTask(parent, std::move(client)));
-    return util::Bind(ptr).To<&DataTask::Run>();
+    ptr->OnActivity();
 }
 
 Server::DataTask::DataTask(Server *parent, std::unique_ptr<StreamSocket> client)
@@ -158,6 +199,9 @@ Server::DataTask::DataTask(Server *parent, std::unique_ptr<StreamSocket> client)
       m_line_reader(m_socket.get()),
       m_parser(&m_line_reader),
       m_reuse_stream(false),
+      // Checking an IPFilter might block (eg on DNS)
+      m_on_pool(!parent->m_inline || parent->m_filter),
+      m_source_blocking(false),
       m_buffer_fill(0),
       m_state(CHECKING)
 {
@@ -175,6 +219,94 @@ Server::DataTask::~DataTask()
 //    TRACE << "~DataTask in state " << m_state << "\n";
 }
 
+/** Sends the body straight from its file, if it's got one, so it needn't
+ * be copied through m_buffer.
+ *
+ * @return 0 when the body is sent, EWOULDBLOCK to wait for writability, or
+ *         ENOSYS to send it with Read and Write instead
+ */
+unsigned int Server::DataTask::SendFileBody()
+{
+    int fd;
+    uint64_t base;
+    if (!(m_response_stream->GetStreamFlags() & Stream::SEEKABLE)
+	|| m_response_stream->GetFileExtent(&fd, &base) != 0)
+	return ENOSYS;
+
+    if (!m_headers.empty())
+    {
+	// Cork so that the headers share a packet with the start of the body
+	m_socket->SetCork(true);
+	do {
+	    size_t nwrote;
+	    unsigned int rc = m_socket->Write(m_headers.c_str(),
+					      m_headers.length(), &nwrote);
+	    if (rc)
+		return rc;
+	    m_headers.erase(0, nwrote);
+	} while (!m_headers.empty());
+    }
+
+    /* Keep the stream's position up to date, so that if we have to fall
+     * back to Read, it carries on from the right place.
+     */
+    uint64_t pos = m_response_stream->Tell();
+    uint64_t len = m_response_stream->GetLength();
+    while (pos < len)
+    {
+	uint64_t filepos = base + pos;
+	size_t lump = (size_t)std::min(len - pos, (uint64_t)(1u<<30));
+	size_t nwrote;
+	unsigned int rc = m_socket->SendFile(fd, &filepos, lump, &nwrote);
+	if (rc)
+	{
+	    if (rc != EWOULDBLOCK)
+		m_socket->SetCork(false);
+	    if (rc == EINVAL)
+		rc = ENOSYS; // Not a file sendfile can do
+	    return rc;
+	}
+	if (!nwrote)
+	    break; // File's been truncated
+	pos += nwrote;
+	m_response_stream->Seek(pos);
+	m_entity.total_written += nwrote;
+    }
+
+    m_socket->SetCork(false);
+
+    LOG(HTTP) << "st" << this << ": sent file, "
+	      << m_entity.total_written << " bytes\n";
+    return 0;
+}
+
+/** Wraps the len bytes of data read into m_buffer+CHUNK_HEADER as a
+ * chunk; or, if len is zero, puts the last chunk in m_buffer instead.
+ *
+ * @return Size of the chunk, including its header and trailing CRLF
+ */
+size_t Server::DataTask::FrameChunk(size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *buffer = m_buffer.get();
+
+    if (!len)
+    {
+	static const char last_chunk[] = "0\r\n\r\n";
+	memcpy(buffer, last_chunk, sizeof(last_chunk) - 1);
+	m_entity.last_chunk = true;
+	return sizeof(last_chunk) - 1;
+    }
+
+    buffer[0] = hex[(len >> 12) & 15];
+    buffer[1] = hex[(len >> 8) & 15];
+    buffer[2] = hex[(len >> 4) & 15];
+    buffer[3] = hex[len & 15];
+    buffer[4] = buffer[CHUNK_HEADER + len] = '\r';
+    buffer[5] = buffer[CHUNK_HEADER + len + 1] = '\n';
+    return len + CHUNK_OVERHEAD;
+}
+
 unsigned int Server::DataTask::Run()
 {
     if (!m_socket->IsOpen())
@@ -240,7 +372,7 @@ again:
 	m_entity.Clear();
 
 	if (version == "HTTP/1.0")
-	    m_entity.closing = true;
+	    m_entity.closing = m_entity.http10 = true;
 
 	m_state = RECV_HEADERS;
     }
@@ -328,13 +460,21 @@ again:
 //	else
 //	    TRACE << "No body\n";
 
+	m_state = FINDING_CONTENT;
+	/* fall through */
+
+    case FINDING_CONTENT:
 	if (!m_reuse_stream || !m_rs.body_source.get())
 	{
 	    m_rs.Clear();
 	    LOG(HTTP) << "st" << this << " calling SFP\n";
-	    m_parent->StreamForPath(&m_rq, &m_rs);
+	    if (!m_parent->StreamForPath(&m_rq, &m_rs, !m_on_pool))
+		return PuntToPool();
 	    LOG(HTTP) << "st" << this << " SFP returned\n";
+	    m_source_blocking = m_on_pool;
 	}
+	else if (m_source_blocking && !m_on_pool)
+	    return PuntToPool();
 
 	m_state = RECV_BODY;
 	/* fall through */
@@ -445,7 +585,8 @@ again:
 	m_rs.body_sink.reset(NULL);
 	m_headers.clear();
 
-	uint64_t len;
+	uint64_t len, whole_len = 0;
+	bool rangeable = true;
 
 	if (!m_rs.body_source.get())
 	{
@@ -463,6 +604,22 @@ again:
 	else
 	{
 	    len = m_rs.length ? m_rs.length : m_rs.body_source->GetLength();
+	    whole_len = len;
+
+	    if (!len
+		&& !(m_rs.body_source->GetStreamFlags() & Stream::SEEKABLE))
+	    {
+		/* No idea how long it is until it runs out, so send it as
+		 * it comes: chunked, or for HTTP/1.0, just close the
+		 * connection at the end.
+		 */
+		if (m_entity.http10)
+		    m_entity.closing = true;
+		else
+		    m_entity.chunked = true;
+		m_entity.do_range = false;
+		rangeable = false;
+	    }
 
 	    if (m_entity.do_range)
 	    {
@@ -512,7 +669,8 @@ again:
 	m_headers += timebuf;
 
 	m_headers += m_parent->GetServerHeader();
-	m_headers += "Accept-Ranges: bytes\r\n";
+	if (rangeable)
+	    m_headers += "Accept-Ranges: bytes\r\n";
 	m_headers += "Content-Type: ";
 	    
 	if (m_rs.content_type)
@@ -550,10 +708,10 @@ again:
                 m_headers += util::Printf() << "Content-Range: bytes "
                                             << m_entity.range_min << "-"
                                             << (m_entity.range_max-1) << "/"
-                                            << len << "\r\n";
+                                            << whole_len << "\r\n";
             }
 
-	    if (m_entity.range_min > 0 || m_entity.range_max != len)
+	    if (m_entity.range_min > 0 || m_entity.range_max != whole_len)
 		m_response_stream = util::CreatePartialStream(m_rs.body_source.get(), 
 							      m_entity.range_min,
 							      m_entity.range_max);
@@ -565,8 +723,17 @@ again:
 
 	m_response_stream->Seek(0);
 
-	m_headers += util::Printf() << "Content-Length: " << len
-				    << "\r\n" "\r\n";
+	// So that keep-alive clients know not to reuse the connection
+	if (m_entity.closing)
+	    m_headers += "Connection: close\r\n";
+
+	if (m_entity.chunked)
+	    m_headers += "Transfer-Encoding: chunked\r\n";
+	else if (len
+		 || (m_response_stream->GetStreamFlags() & Stream::SEEKABLE))
+	    m_headers += util::Printf() << "Content-Length: " << len
+					<< "\r\n";
+	m_headers += "\r\n";
 
 	LOG(HTTP) << "Response headers:\n" << m_headers;
 
@@ -610,7 +777,28 @@ again:
 
     case SEND_BODY:
 
-	if (m_response_stream.get() && m_rq.verb != "HEAD")
+	if (m_response_stream.get() && m_rq.verb != "HEAD"
+	    && !m_entity.buffered)
+	{
+	    unsigned int rc = SendFileBody();
+	    if (rc == EWOULDBLOCK)
+	    {
+		LOG(HTTP_SERVER) << "Waiting for file writability "
+				 << m_socket << "\n";
+		WaitForWritable(m_socket.get());
+		return 0;
+	    }
+	    if (rc == ENOSYS)
+		m_entity.buffered = true;
+	    else if (rc)
+	    {
+		TRACE << "Sending file failed " << rc << "\n";
+		return rc;
+	    }
+	}
+
+	if (m_response_stream.get() && m_rq.verb != "HEAD"
+	    && m_entity.buffered)
 	{
 	    if (!m_buffer)
 	    {
@@ -618,21 +806,44 @@ again:
 		m_buffer_fill = 0;
 	    }
 
-	    bool eof = false;
+	    /* A file goes out in whole packets, as with SendFileBody, not
+	     * with a short one every BUFFER_SIZE bytes (which Nagle would
+	     * hold up until the client's delayed ACK). Live streams aren't
+	     * corked, as each piece should go as soon as it's read.
+	     */
+	    bool file = (m_response_stream->GetStreamFlags() & Stream::SEEKABLE)
+		&& !m_entity.chunked;
+	    if (file && !m_headers.empty())
+		m_socket->SetCork(true);
+
+	    bool eof = m_entity.last_chunk;
 	    do {
-		if (m_buffer_fill < BUFFER_SIZE)
+		/* Chunks are sent whole, each as soon as it's read, so that
+		 * a slow source isn't held up waiting to fill the buffer.
+		 */
+		if (!eof && (m_entity.chunked ? m_buffer_fill == 0
+			     : m_buffer_fill < BUFFER_SIZE))
 		{
+		    char *ptr = m_buffer.get() + m_buffer_fill;
+		    size_t lump = BUFFER_SIZE - m_buffer_fill;
+		    if (m_entity.chunked)
+		    {
+			ptr += CHUNK_HEADER;
+			lump -= CHUNK_OVERHEAD;
+		    }
+
 		    size_t nread;
-		    unsigned int rc = m_response_stream->Read(
-			m_buffer.get() + m_buffer_fill,
-			BUFFER_SIZE - m_buffer_fill, &nread);
+		    unsigned int rc = m_response_stream->Read(ptr, lump,
+							      &nread);
 
 //		    TRACE << "st" << this << ": Read(" << (BUFFER_SIZE-m_buffer_fill) << ")=" << rc << "\n";
 
 		    if (rc)
 		    {
-			if (rc == EWOULDBLOCK && m_buffer_fill == 0
-			    && m_headers.empty())
+			// A file's data is only moments away: wait for it
+			if (rc == EWOULDBLOCK
+			    && (file || (m_buffer_fill == 0
+					 && m_headers.empty())))
 			{
 			    // Quickly check for socket death first
 			    rc = m_socket->Write(m_buffer.get(), 0, &nread);
@@ -660,6 +871,11 @@ again:
 			    return rc;
 			}
 		    }
+		    else if (m_entity.chunked)
+		    {
+			m_buffer_fill = FrameChunk(nread);
+			eof = m_entity.last_chunk;
+		    }
 		    else
 		    {
 			m_buffer_fill += nread;
@@ -727,12 +943,14 @@ again:
 
 	    } while (!eof || m_buffer_fill || !m_headers.empty());
 
+	    if (file)
+		m_socket->SetCork(false);
 	    m_buffer.reset(NULL);
 
 	    LOG(HTTP) << "st" << this << ": wrote stream, "
 		      << m_entity.total_written << " bytes\n";
 	}
-	else
+	else if (!m_response_stream.get() || m_rq.verb == "HEAD")
 	{
 	    LOG(HTTP) << "st" << this << ": no body\n";
 	}
@@ -748,6 +966,10 @@ again:
 
 	m_rq.Clear();
 
+	// Any blocking is over with, so back to the scheduler thread
+	if (m_parent->m_inline)
+	    m_on_pool = false;
+
 	m_state = WAITING;
 	goto again;
 
@@ -765,12 +987,23 @@ again:
 class Server::AcceptorTask: public util::Task
 {
     Server *m_parent;
+    Scheduler *m_scheduler;
     StreamSocket m_socket;
+    std::atomic<bool> m_retry_pending;
 
     explicit AcceptorTask(Server *parent)
-	: m_parent(parent)
+	: m_parent(parent),
+	  m_scheduler(NULL),
+	  m_retry_pending(false)
     {}
 
+    /** Timer callback after running out of file descriptors */
+    unsigned Retry()
+    {
+	m_retry_pending = false;
+	return Run();
+    }
+
 public:
     typedef util::CountedPointer<AcceptorTask> AcceptorTaskPtr;
 
@@ -797,8 +1030,10 @@ public:
 	m_socket.SetNonBlocking(true);
 	m_socket.Listen();
 
-	scheduler->WaitForReadable(util::Bind(AcceptorTaskPtr(this)).To<&AcceptorTask::Run>(),
-				   m_socket.GetHandle(), false);
+	m_scheduler = scheduler;
+	scheduler->WaitForReadableEdge(
+	    util::Bind(AcceptorTaskPtr(this)).To<&AcceptorTask::Run>(),
+	    m_socket.GetHandle());
 	return 0;
     }
 
@@ -812,20 +1047,38 @@ public:
     {
 //	TRACE << "Got activity, trying to accept\n";
 
-	std::unique_ptr<StreamSocket> ssp;
-	unsigned int rc = m_socket.Accept(&ssp);
-	if (rc == 0)
-	{
-	    m_parent->m_pool->PushTask(DataTask::Create(m_parent,
-                                                        std::move(ssp)));
-	}
-	else
+	/* Accept until there's no more, as (being edge-triggered) we won't
+	 * be called again for connections already waiting.
+	 */
+	for (;;)
 	{
-	    TRACE << "Accept failed " << rc << "\n";
-	    if (rc != EWOULDBLOCK)
+	    std::unique_ptr<StreamSocket> ssp;
+	    unsigned int rc = m_socket.Accept(&ssp);
+	    if (rc == EWOULDBLOCK)
+		return 0;
+	    if (rc == ECONNABORTED || rc == EINTR)
+		continue; // Only that one's gone
+	    if (rc == EMFILE || rc == ENFILE || rc == ENOBUFS || rc == ENOMEM)
+	    {
+		/* Connections are still waiting, but there won't be another
+		 * edge for them, so come back when some have been closed.
+		 */
+		TRACE << "Accept failed " << rc << ", will retry\n";
+		if (!m_retry_pending.exchange(true))
+		{
+		    TaskCallback tc = util::Bind(AcceptorTaskPtr(this))
+			.To<&AcceptorTask::Retry>();
+		    m_scheduler->Wait(tc, ::time(NULL) + 1, 0);
+		}
+		return rc;
+	    }
+	    if (rc)
+	    {
+		TRACE << "Accept failed " << rc << "\n";
 		return rc;
+	    }
+	    DataTask::Start(m_parent, std::move(ssp));
 	}
-	return 0;
     }
 };
 
@@ -840,7 +1093,8 @@ Server::Server(util::Scheduler *scheduler,
     : m_scheduler(scheduler),
       m_pool(pool),
       m_filter(filter),
-      m_port(0)
+      m_port(0),
+      m_inline(false)
 {
     struct utsname ubuf;
 
@@ -881,6 +1135,12 @@ unsigned short Server::GetPort()
 }
 
 void Server::StreamForPath(const Request *rq, Response *rs)
+{
+    StreamForPath(rq, rs, false);
+}
+
+bool Server::StreamForPath(const Request *rq, Response *rs,
+			   bool nonblocking_only)
 {
     /// @bug Locking vs AddContentFactory
 
@@ -888,9 +1148,11 @@ void Server::StreamForPath(const Request *rq, Response *rs)
 	 i != m_content.end();
 	 ++i)
     {
+	if (nonblocking_only && !(*i)->IsNonBlocking(rq))
+	    return false;
 	bool taken = (*i)->StreamForPath(rq, rs);
 	if (taken)
-	    return;
+	    return true;
     }
 
     if (rq->verb == "OPTIONS")
@@ -900,6 +1162,7 @@ void Server::StreamForPath(const Request *rq, Response *rs)
 	 */
 	rs->body_source.reset(new util::StringStream());
     }
+    return true;
 }
 
 void Server::AddContentFactory(const std::string&, ContentFactory *cf)
@@ -935,6 +1198,11 @@ static const char *ContentType(const std::string& path)
     return NULL;
 }
 
+bool FileContentFactory::IsNonBlocking(const Request*)
+{
+    return m_async && util::IOUring::IsAvailable();
+}
+
 bool FileContentFactory::StreamForPath(const Request *rq, Response *rs)
 {
 //    TRACE << "Request for page '" << rq->path << "'\n";
@@ -969,7 +1237,9 @@ bool FileContentFactory::StreamForPath(const Request *rq, Response *rs)
 	return false;
     }
 
-    unsigned int rc = util::OpenFileStream(path2.c_str(), util::READ,
+    unsigned int rc = util::OpenFileStream(path2.c_str(),
+					   m_async ? util::READ|util::ASYNC
+					           : util::READ,
 					   &rs->body_source);
     if (rc != 0)
     {
@@ -995,6 +1265,7 @@ bool FileContentFactory::StreamForPath(const Request *rq, Response *rs)
 # include "worker_thread_pool.h"
 # include "http_client.h"
 # include "http_fetcher.h"
+# include <sys/resource.h>
 
 class FetchTask: public util::Task
 {
@@ -1039,6 +1310,65 @@ public:
 	rs->body_source.reset(new util::StringStream(rq->path));
 	return true;
     }
+
+    bool IsNonBlocking(const util::http::Request*) { return true; }
+};
+
+/** Serves a real file, so the body goes by SendFile, and (in an inline
+ * server) on the pool
+ */
+class FileTestContentFactory: public util::http::ContentFactory
+{
+public:
+    bool StreamForPath(const util::http::Request *rq, util::http::Response *rs)
+    {
+	return rq->path == "/file"
+	    && util::OpenFileStream("http_server.tmp", util::READ,
+				    &rs->body_source) == 0;
+    }
+
+    bool IsNonBlocking(const util::http::Request *rq)
+    {
+	return rq->path != "/file";
+    }
+};
+
+/** A stream of unknown length, as from a live source, which dribbles out
+ * its contents a few bytes at a time
+ */
+class DribbleStream: public util::Stream
+{
+    std::string m_contents;
+
+public:
+    explicit DribbleStream(const std::string& contents)
+	: m_contents(contents) {}
+
+    unsigned GetStreamFlags() const { return READABLE; }
+
+    unsigned Read(void *buffer, size_t len, size_t *pread)
+    {
+	len = std::min(len, std::min(m_contents.size(), (size_t)4));
+	memcpy(buffer, m_contents.data(), len);
+	m_contents.erase(0, len);
+	*pread = len;
+	return 0;
+    }
+};
+
+/** Serves /live, which has no length, so goes chunked */
+class LiveTestContentFactory: public util::http::ContentFactory
+{
+public:
+    bool StreamForPath(const util::http::Request *rq, util::http::Response *rs)
+    {
+	if (rq->path != "/live")
+	    return false;
+	rs->body_source.reset(new DribbleStream("/live"));
+	return true;
+    }
+
+    bool IsNonBlocking(const util::http::Request*) { return true; }
 };
 
 static bool EqualButForStars(const char *got, const char *pattern)
@@ -1056,8 +1386,11 @@ static bool EqualButForStars(const char *got, const char *pattern)
     return !*got && !*pattern;
 }
 
+/** If no_fds is set, the server first gets to try accepting the connection
+ * with no file descriptors free.
+ */
 static void HttpTest(util::BackgroundScheduler *poller, unsigned short port,
-		     const char *tx, const char *rx)
+		     const char *tx, const char *rx, bool no_fds = false)
 {
     util::StreamSocket ss;
     util::IPEndPoint ipe;
@@ -1070,6 +1403,20 @@ static void HttpTest(util::BackgroundScheduler *poller, unsigned short port,
 
     ss.SetNonBlocking(true);
 
+    if (no_fds)
+    {
+	struct rlimit old_limit, limit;
+	getrlimit(RLIMIT_NOFILE, &old_limit);
+	limit = old_limit;
+	int next_fd = ::open("/dev/null", O_RDONLY);
+	::close(next_fd);
+	limit.rlim_cur = (rlim_t)next_fd;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	rc = poller->Poll(100);
+	assert(rc == 0);
+	setrlimit(RLIMIT_NOFILE, &old_limit);
+    }
+
     std::string rxs;
     time_t start = time(NULL);
     time_t finish = start + 10;
@@ -1101,30 +1448,12 @@ static void HttpTest(util::BackgroundScheduler *poller, unsigned short port,
     assert(ok);
 }
 
-int main(int, char*[])
+static void RequestTests(util::BackgroundScheduler *poller,
+			 unsigned short port)
 {
-    enum { NUM_CLIENTS = 100,
-	   NUM_THREADS = 50     // Note Wine (maybe Windows too) can't select() on more than 64 fds
-    };
-
-    util::WorkerThreadPool server_threads(util::WorkerThreadPool::NORMAL, 4);
-    util::WorkerThreadPool client_threads(util::WorkerThreadPool::NORMAL,
-					  NUM_THREADS);
-
-    util::http::Client hc;
-    util::BackgroundScheduler poller;
-    util::http::Server ws(&poller,&server_threads);
-
-    unsigned rc = ws.Init();
-
-    EchoContentFactory ecf;
-    ws.AddContentFactory("/", &ecf);
-
-    assert(rc == 0);
-
     // Simple test
-    HttpTest(&poller,
-	     ws.GetPort(),
+    HttpTest(poller,
+	     port,
 	     "GET / HTTP/1.1\r\n"
 	     "\r\n",
 	     "HTTP/1.1 200 OK\r\n"
@@ -1136,9 +1465,24 @@ int main(int, char*[])
 	     "\r\n"
 	     "/");
 
+    // Running out of file descriptors only delays things
+    HttpTest(poller,
+	     port,
+	     "GET /emfile HTTP/1.1\r\n"
+	     "\r\n",
+	     "HTTP/1.1 200 OK\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Accept-Ranges: bytes\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Content-Length: 7\r\n"
+	     "\r\n"
+	     "/emfile",
+	     true);
+
     // Pipelining test
-    HttpTest(&poller,
-	     ws.GetPort(),
+    HttpTest(poller,
+	     port,
 	     "GET /foo HTTP/1.1\r\n"
 	     "\r\n"
 	     "GET /bar HTTP/1.1\r\n"
@@ -1164,8 +1508,8 @@ int main(int, char*[])
 	);
 
     // Pipelining test with bodies
-    HttpTest(&poller,
-	     ws.GetPort(),
+    HttpTest(poller,
+	     port,
 	     "POST /foo HTTP/1.1\r\n"
 	     "Content-Length: 6\r\n"
 	     "\r\n"
@@ -1194,6 +1538,194 @@ int main(int, char*[])
 	     "/bar"
 	);
 
+    // Files, including ranges, over one connection
+    {
+	FILE *f = fopen("http_server.tmp", "wb");
+	assert(f);
+	fputs("0123456789", f);
+	fclose(f);
+    }
+    HttpTest(poller,
+	     port,
+	     "GET /file HTTP/1.1\r\n"
+	     "\r\n"
+	     "GET /file HTTP/1.1\r\n"
+	     "Range: bytes=2-5\r\n"
+	     "\r\n"
+	     "GET /file HTTP/1.1\r\n"
+	     "Range: bytes=7-\r\n"
+	     "\r\n",
+
+	     "HTTP/1.1 200 OK\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Accept-Ranges: bytes\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Content-Length: 10\r\n"
+	     "\r\n"
+	     "0123456789"
+
+	     "HTTP/1.1 206 OK But A Bit Partial\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Accept-Ranges: bytes\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Content-Range: bytes 2-5/10\r\n"
+	     "Content-Length: 4\r\n"
+	     "\r\n"
+	     "2345"
+
+	     "HTTP/1.1 206 OK But A Bit Partial\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Accept-Ranges: bytes\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Content-Range: bytes 7-9/10\r\n"
+	     "Content-Length: 3\r\n"
+	     "\r\n"
+	     "789"
+	);
+    unlink("http_server.tmp");
+
+    // Files read through io_uring (if any), including across read-ahead
+    // windows
+    {
+	std::string body;
+	for (unsigned int i=0; i<100000; ++i)
+	    body += (char)('a' + (i % 23));
+	FILE *f = fopen("http_server.dir/big", "wb");
+	assert(f);
+	fwrite(body.data(), 1, body.size(), f);
+	fclose(f);
+
+	std::string rx =
+	    "HTTP/1.1 200 OK\r\n"
+	    "Date: *\r\n"
+	    "Server: * UPnP/1.0 chorale/*\r\n"
+	    "Accept-Ranges: bytes\r\n"
+	    "Content-Type: text/html\r\n"
+	    "Content-Length: 100000\r\n"
+	    "\r\n"
+	    + body +
+	    "HTTP/1.1 206 OK But A Bit Partial\r\n"
+	    "Date: *\r\n"
+	    "Server: * UPnP/1.0 chorale/*\r\n"
+	    "Accept-Ranges: bytes\r\n"
+	    "Content-Type: text/html\r\n"
+	    "Content-Range: bytes 65530-65545/100000\r\n"
+	    "Content-Length: 16\r\n"
+	    "\r\n"
+	    + body.substr(65530, 16);
+	HttpTest(poller,
+		 port,
+		 "GET /async/big HTTP/1.1\r\n"
+		 "\r\n"
+		 "GET /async/big HTTP/1.1\r\n"
+		 "Range: bytes=65530-65545\r\n"
+		 "\r\n",
+		 rx.c_str());
+	unlink("http_server.dir/big");
+    }
+
+    // Unknown length, chunked, then keep-alive for the next request
+    HttpTest(poller,
+	     port,
+	     "GET /live HTTP/1.1\r\n"
+	     "\r\n"
+	     "HEAD /live HTTP/1.1\r\n"
+	     "\r\n"
+	     "GET /foo HTTP/1.1\r\n"
+	     "\r\n",
+
+	     "HTTP/1.1 200 OK\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Transfer-Encoding: chunked\r\n"
+	     "\r\n"
+	     "0004\r\n"
+	     "/liv\r\n"
+	     "0001\r\n"
+	     "e\r\n"
+	     "0\r\n"
+	     "\r\n"
+
+	     "HTTP/1.1 200 OK\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Transfer-Encoding: chunked\r\n"
+	     "\r\n"
+
+	     "HTTP/1.1 200 OK\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Accept-Ranges: bytes\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Content-Length: 4\r\n"
+	     "\r\n"
+	     "/foo"
+	);
+
+    // Unknown length, to an HTTP/1.0 client: no length, then close
+    HttpTest(poller,
+	     port,
+	     "GET /live HTTP/1.0\r\n"
+	     "Connection: Keep-Alive\r\n"
+	     "\r\n",
+
+	     "HTTP/1.1 200 OK\r\n"
+	     "Date: *\r\n"
+	     "Server: * UPnP/1.0 chorale/*\r\n"
+	     "Content-Type: text/html\r\n"
+	     "Connection: close\r\n"
+	     "\r\n"
+	     "/live"
+	);
+}
+
+int main(int, char*[])
+{
+    enum { NUM_CLIENTS = 100,
+	   NUM_THREADS = 50     // Note Wine (maybe Windows too) can't select() on more than 64 fds
+    };
+
+    util::WorkerThreadPool server_threads(util::WorkerThreadPool::NORMAL, 4);
+    util::WorkerThreadPool client_threads(util::WorkerThreadPool::NORMAL,
+					  NUM_THREADS);
+
+    util::http::Client hc;
+    util::BackgroundScheduler poller;
+    util::http::Server ws(&poller,&server_threads);
+    util::http::Server ws_inline(&poller,&server_threads);
+    ws_inline.SetInline(true);
+
+    unsigned rc = ws.Init();
+    assert(rc == 0);
+    rc = ws_inline.Init();
+    assert(rc == 0);
+
+    mkdir("http_server.dir", 0755);
+    util::http::FileContentFactory afcf(util::Canonicalise("http_server.dir"),
+					"/async");
+    afcf.SetAsync(true);
+
+    FileTestContentFactory ftcf;
+    LiveTestContentFactory ltcf;
+    EchoContentFactory ecf;
+    ws.AddContentFactory("/file", &ftcf);
+    ws.AddContentFactory("/live", &ltcf);
+    ws.AddContentFactory("/async", &afcf);
+    ws.AddContentFactory("/", &ecf);
+    ws_inline.AddContentFactory("/file", &ftcf);
+    ws_inline.AddContentFactory("/live", &ltcf);
+    ws_inline.AddContentFactory("/async", &afcf);
+    ws_inline.AddContentFactory("/", &ecf);
+
+    RequestTests(&poller, ws.GetPort());
+    RequestTests(&poller, ws_inline.GetPort());
+    rmdir("http_server.dir");
+
     std::string url = (boost::format("http://127.0.0.1:%u/zootle/wurdle.html")
 		       % ws.GetPort()
 	).str();
@@ -117,6 +117,13 @@ public:
     /** Return true if you recognise path, false if you don't.
      */
     virtual bool StreamForPath(const Request*, Response*) = 0;
+
+    /** Return true if StreamForPath for this request, and reading the
+     * body_source it returns, never block (eg they're served from memory),
+     * so a Server in inline mode can call them on its scheduler thread.
+     * The default is false: they're called on a worker thread.
+     */
+    virtual bool IsNonBlocking(const Request*) { return false; }
 };
 
 /** A ContentFactory which exposes a directory on the server's filesystem.
@@ -125,14 +132,24 @@ class FileContentFactory final: public ContentFactory
 {
     std::string m_file_root;
     std::string m_page_root;
+    bool m_async;
 public:
     FileContentFactory(const std::string& file_root,
 		       const std::string& page_root)
-	: m_file_root(file_root), m_page_root(page_root) {}
+	: m_file_root(file_root), m_page_root(page_root), m_async(false) {}
     ~FileContentFactory();
 
+    /** Open files with util::ASYNC, so that they're read through io_uring
+     * rather than sent with sendfile. That costs a copy, but reading never
+     * blocks: a Server in inline mode then serves files on its scheduler
+     * thread, and clients waiting for the disk don't each hold a pool
+     * thread. (Opening the file is still synchronous.)
+     */
+    void SetAsync(bool async) { m_async = async; }
+
     // Being a ContentFactory
     bool StreamForPath(const Request*, Response*) override;
+    bool IsNonBlocking(const Request*) override;
 };
 
 /** An HTTP/1.1 web server.
@@ -146,6 +163,7 @@ class Server
     list_t m_content;
     unsigned short m_port;
     std::string m_server_header;
+    bool m_inline;
 
     class DataTask;
     friend class DataTask;
@@ -153,6 +171,11 @@ class Server
     class AcceptorTask;
     friend class AcceptorTask;
 
+    /** Returns false, having done nothing, if nonblocking_only and a
+     * factory which might block would need asking.
+     */
+    bool StreamForPath(const Request*, Response*, bool nonblocking_only);
+
 public:
     Server(util::Scheduler*, util::WorkerThreadPool*, util::IPFilter* = NULL);
     ~Server();
@@ -163,6 +186,17 @@ public:
 
     unsigned short GetPort();
 
+    /** In inline mode, request parsing and socket IO are done on the
+     * scheduler thread, and only requests for content which might block
+     * (see ContentFactory::IsNonBlocking) are passed to the worker pool.
+     * That saves two context switches per event, and the pool's size no
+     * longer limits the number of active connections. Otherwise (the
+     * default) everything is done on the pool.
+     *
+     * Call before Init.
+     */
+    void SetInline(bool inline_io) { m_inline = inline_io; }
+
     const std::string& GetServerHeader() { return m_server_header; }
 
     /** Mounts a virtual filesystem on the given "mount point".
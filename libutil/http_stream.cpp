@@ -30,7 +30,11 @@ Stream::Stream(Client*, const IPEndPoint& ipe, const std::string& host,
       m_path(path),
       m_len(0),
       m_need_fetch(true),
-      m_last_pos(0)
+      m_last_pos(0),
+      m_chunked(false),
+      m_chunk_started(false),
+      m_chunk_eof(false),
+      m_chunk_remain(0)
 {
 }
 
@@ -150,8 +154,8 @@ unsigned Stream::ReadAt(void *buffer, uint64_t pos, size_t len, size_t *pread)
 	    return rc;
 	}
 
-	util::GreedyLineReader lr(&m_socket);
-	http::Parser hp(&lr);
+	m_line_reader.reset(new util::GreedyLineReader(&m_socket));
+	http::Parser hp(m_line_reader.get());
 
 	bool is_error = false;
 
@@ -189,6 +193,8 @@ unsigned Stream::ReadAt(void *buffer, uint64_t pos, size_t len, size_t *pread)
 
 	bool got_range = false;
 	uint64_t clen = 0;
+	m_chunked = m_chunk_started = m_chunk_eof = false;
+	m_chunk_remain = 0;
 
 	for (;;)
 	{
@@ -251,8 +257,16 @@ unsigned Stream::ReadAt(void *buffer, uint64_t pos, size_t len, size_t *pread)
 	    {
 		util::Scanf64(value.c_str(), "%llu", &clen);
 	    }
+	    else if (!strcasecmp(key.c_str(), "Transfer-Encoding"))
+	    {
+		if (strstr(value.c_str(), "chunked"))
+		    m_chunked = true;
+	    }
 	}
 
+	if (m_chunked)
+	    clen = 0; // Length unknown
+
 	if (!got_range)
 	    m_len = clen;
 
@@ -269,13 +283,16 @@ unsigned Stream::ReadAt(void *buffer, uint64_t pos, size_t len, size_t *pread)
 	m_need_fetch = false;
 
 	m_last_pos = pos;
+    }
 
-	lr.ReadLeftovers(buffer, len, pread);
-	if (*pread)
-	{
-	    m_last_pos += *pread;
-	    return 0;
-	}
+    if (m_chunked)
+	return ReadChunked(buffer, len, pread);
+
+    m_line_reader->ReadLeftovers(buffer, len, pread);
+    if (*pread)
+    {
+	m_last_pos += *pread;
+	return 0;
     }
 	
     unsigned int rc = m_socket.Read(buffer, len, pread);
@@ -293,6 +310,63 @@ unsigned Stream::ReadAt(void *buffer, uint64_t pos, size_t len, size_t *pread)
     return rc;
 }
 
+/** Reads the body when it's chunked, which it is if the server didn't
+ * know its length in advance.
+ */
+unsigned Stream::ReadChunked(void *buffer, size_t len, size_t *pread)
+{
+    *pread = 0;
+
+    if (!m_chunk_remain)
+    {
+	if (m_chunk_eof)
+	    return 0;
+
+	http::Parser hp(m_line_reader.get());
+	unsigned int rc;
+	if (m_chunk_started)
+	{
+	    rc = hp.GetChunkEnd();
+	    if (rc)
+		return rc;
+	}
+	rc = hp.GetChunkHeader(&m_chunk_remain);
+	if (rc)
+	    return rc;
+	m_chunk_started = true;
+
+	if (!m_chunk_remain)
+	{
+	    // Skip any trailer
+	    std::string key, value;
+	    do {
+		rc = hp.GetHeaderLine(&key, &value);
+		if (rc)
+		    return rc;
+	    } while (!key.empty());
+	    m_chunk_eof = true;
+	    return 0;
+	}
+    }
+
+    if (len > m_chunk_remain)
+	len = (size_t)m_chunk_remain;
+
+    m_line_reader->ReadLeftovers(buffer, len, pread);
+    if (!*pread)
+    {
+	unsigned int rc = m_socket.Read(buffer, len, pread);
+	if (rc)
+	    return rc;
+	if (!*pread)
+	    return EIO; // Truncated
+    }
+
+    m_chunk_remain -= *pread;
+    m_last_pos += *pread;
+    return 0;
+}
+
 unsigned Stream::WriteAt(const void*, uint64_t, size_t, size_t*)
 {
     return EPERM;
@@ -350,16 +424,18 @@ public:
 	}
 
 	char buf[2048];
-	size_t nread = 0;
-	rc = hsp->Read(buf, sizeof(buf), &nread);
+	size_t nread;
+	do {
+	    rc = hsp->Read(buf, sizeof(buf), &nread);
 
-	if (rc)
-	{
-	    fprintf(stderr, "rc=%u\n", rc);
-	    assert(rc == 0);
-	    return rc;
-	}
-	m_contents = std::string(buf, buf+nread);
+	    if (rc)
+	    {
+		fprintf(stderr, "rc=%u\n", rc);
+		assert(rc == 0);
+		return rc;
+	    }
+	    m_contents.append(buf, buf+nread);
+	} while (nread);
 	m_waker->Wake();
 //	TRACE << "Fetcher done " << rc << "\n";
 	m_done = true;
@@ -381,6 +457,38 @@ public:
     }
 };
 
+/** Hides the length of a StringStream, so the server sends it chunked */
+class LiveStream: public util::Stream
+{
+    util::StringStream m_ss;
+
+public:
+    explicit LiveStream(const std::string& s) : m_ss(s) {}
+
+    unsigned GetStreamFlags() const { return READABLE; }
+
+    unsigned Read(void *buffer, size_t len, size_t *pread)
+    {
+	return m_ss.Read(buffer, len, pread);
+    }
+};
+
+/** Serves the path over and over, about 20K in all */
+class LiveContentFactory: public util::http::ContentFactory
+{
+public:
+    bool StreamForPath(const util::http::Request *rq, util::http::Response *rs)
+    {
+	if (rq->path.compare(0, 6, "/live/"))
+	    return false;
+	std::string s;
+	while (s.size() < 20000)
+	    s += rq->path;
+	rs->body_source.reset(new LiveStream(s));
+	return true;
+    }
+};
+
 int main(int, char*[])
 {
     util::BackgroundScheduler poller;
@@ -391,7 +499,9 @@ int main(int, char*[])
 
     unsigned rc = ws.Init();
 
+    LiveContentFactory lcf;
     EchoContentFactory ecf;
+    ws.AddContentFactory("/live/", &lcf);
     ws.AddContentFactory("/", &ecf);
 
     assert(rc == 0);
@@ -422,6 +532,24 @@ int main(int, char*[])
 //	  << ft->GetContents().length() << ")\n";
     assert(ft->GetContents() == "/zootle/wurdle.html");
 
+    url = (boost::format("http://127.0.0.1:%u/live/stream.mp3")
+	   % ws.GetPort()).str();
+    ft.reset(new FetchTask(url, &wc, &poller));
+    wtp.PushTask(util::Bind(ft).To<&FetchTask::Run>());
+
+    finish = time(NULL) + 5;
+    do {
+	now = time(NULL);
+	if (now < finish)
+	    poller.Poll((unsigned)(finish-now)*1000);
+    } while (now < finish && !ft->IsDone());
+
+    const std::string& contents = ft->GetContents();
+    assert(contents.size() >= 20000);
+    assert(contents.size() % strlen("/live/stream.mp3") == 0);
+    assert(contents.compare(contents.size() - 16, 16,
+			    "/live/stream.mp3") == 0);
+
     return 0;
 }
 
@@ -3,10 +3,13 @@
 
 #include "socket.h"
 #include "stream.h"
+#include <memory>
 #include <string>
 
 namespace util {
 
+class GreedyLineReader;
+
 namespace http {
 
 class Client;
@@ -27,10 +30,19 @@ class Stream: public util::SeekableStream
     uint64_t m_len;
     bool m_need_fetch;
     uint64_t m_last_pos;
+    std::unique_ptr<GreedyLineReader> m_line_reader;
+
+    /** Transfer-Encoding: chunked */
+    bool m_chunked;
+    bool m_chunk_started;
+    bool m_chunk_eof;
+    uint64_t m_chunk_remain;
 
     Stream(Client *client, const IPEndPoint& ipe, const std::string& host,
 	   const std::string& path);
 
+    unsigned ReadChunked(void *buffer, size_t len, size_t *pread);
+
 public:
     ~Stream();
 
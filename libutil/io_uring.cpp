@@ -0,0 +1,416 @@
+#include "config.h"
+#include "io_uring.h"
+#include "trace.h"
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#if HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/eventfd.h>
+#endif
+
+/* There's no liburing dependency: the interface is three system calls and
+ * some shared memory, and this is all the library we need.
+ */
+#if HAVE_LINUX_IO_URING_H && defined(__NR_io_uring_setup) \
+    && defined(IORING_FEAT_RW_CUR_POS)
+# define USE_IO_URING 1
+#else
+# define USE_IO_URING 0
+#endif
+
+namespace util {
+
+#if USE_IO_URING
+
+struct IOUring::Impl
+{
+    int fd;
+    int event_fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned int queued; ///< Since last Submit
+
+    Impl()
+	: fd(-1), event_fd(-1), sq_ring(MAP_FAILED), sq_ring_size(0),
+	  cq_ring(MAP_FAILED), cq_ring_size(0),
+	  sqes((struct io_uring_sqe*)MAP_FAILED), sqes_size(0), queued(0)
+    {
+    }
+
+    ~Impl();
+
+    unsigned int Init(unsigned int entries);
+    unsigned int Queue(unsigned char opcode, int fd, const void *buffer,
+		       size_t len, uint64_t pos, uint64_t tag);
+};
+
+IOUring::Impl::~Impl()
+{
+    if (sqes != MAP_FAILED)
+	munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+	munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED)
+	munmap(sq_ring, sq_ring_size);
+    if (event_fd >= 0)
+	close(event_fd);
+    if (fd >= 0)
+	close(fd);
+}
+
+unsigned int IOUring::Impl::Init(unsigned int entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+	return ENOSYS; // Whether not built-in, or not allowed
+
+    // IORING_OP_READ/WRITE arrived in the same kernel (5.6)
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+	return ENOSYS;
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes
+	+ p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+	if (cq_ring_size > sq_ring_size)
+	    sq_ring_size = cq_ring_size;
+	cq_ring_size = sq_ring_size;
+    }
+
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+	return (unsigned)errno;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	cq_ring = sq_ring;
+    else
+    {
+	cq_ring = mmap(NULL, cq_ring_size, PROT_READ|PROT_WRITE,
+		       MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (cq_ring == MAP_FAILED)
+	    return (unsigned)errno;
+    }
+
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(NULL, sqes_size, PROT_READ|PROT_WRITE,
+				      MAP_SHARED|MAP_POPULATE, fd,
+				      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+	return (unsigned)errno;
+
+    char *sq = (char*)sq_ring;
+    sq_head = (unsigned*)(sq + p.sq_off.head);
+    sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + p.sq_off.array);
+    sq_entries = p.sq_entries;
+
+    char *cq = (char*)cq_ring;
+    cq_head = (unsigned*)(cq + p.cq_off.head);
+    cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+unsigned int IOUring::Impl::Queue(unsigned char opcode, int file,
+				  const void *buffer, size_t len,
+				  uint64_t pos, uint64_t tag)
+{
+    unsigned tail = *sq_tail;
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+	return EAGAIN;
+
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = file;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = (uint32_t)len;
+    sqe->off = pos;
+    sqe->user_data = tag;
+    sq_array[index] = index;
+
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++queued;
+    return 0;
+}
+
+IOUring::IOUring()
+{
+}
+
+IOUring::~IOUring()
+{
+}
+
+unsigned int IOUring::Init(unsigned int entries)
+{
+    m_impl.reset(new Impl);
+    unsigned int rc = m_impl->Init(entries);
+    if (rc)
+	m_impl.reset();
+    return rc;
+}
+
+bool IOUring::IsAvailable()
+{
+    static const bool available = []() {
+	IOUring ring;
+	return ring.Init(1) == 0;
+    }();
+    return available;
+}
+
+unsigned int IOUring::QueueRead(int fd, void *buffer, size_t len,
+				uint64_t pos, uint64_t tag)
+{
+    return m_impl->Queue(IORING_OP_READ, fd, buffer, len, pos, tag);
+}
+
+unsigned int IOUring::QueueWrite(int fd, const void *buffer, size_t len,
+				 uint64_t pos, uint64_t tag)
+{
+    return m_impl->Queue(IORING_OP_WRITE, fd, buffer, len, pos, tag);
+}
+
+unsigned int IOUring::Submit(unsigned int wait)
+{
+    if (!m_impl->queued && !wait)
+	return 0;
+
+    unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    for (;;)
+    {
+	int rc = (int)syscall(__NR_io_uring_enter, m_impl->fd, m_impl->queued,
+			      wait, flags, NULL, 0);
+	if (rc >= 0)
+	{
+	    m_impl->queued -= (unsigned)rc;
+	    if (!m_impl->queued || wait)
+		return 0;
+	    // Partial submission; go round again for the rest
+	}
+	else if (errno != EINTR)
+	{
+	    TRACE << "io_uring_enter failed " << errno << "\n";
+	    return (unsigned)errno;
+	}
+    }
+}
+
+bool IOUring::GetCompletion(uint64_t *tag, int *result)
+{
+    unsigned head = *m_impl->cq_head;
+    if (head == __atomic_load_n(m_impl->cq_tail, __ATOMIC_ACQUIRE))
+	return false;
+
+    struct io_uring_cqe *cqe = &m_impl->cqes[head & *m_impl->cq_mask];
+    *tag = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(m_impl->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+int IOUring::GetHandle()
+{
+    if (m_impl->event_fd < 0)
+    {
+	int efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (efd < 0)
+	    return -1;
+	if (syscall(__NR_io_uring_register, m_impl->fd,
+		    IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+	{
+	    TRACE << "Can't register eventfd " << errno << "\n";
+	    close(efd);
+	    return -1;
+	}
+	m_impl->event_fd = efd;
+    }
+    return m_impl->event_fd;
+}
+
+void IOUring::ClearHandle()
+{
+    if (m_impl->event_fd >= 0)
+    {
+	uint64_t count;
+	ssize_t rc = read(m_impl->event_fd, &count, sizeof(count));
+	(void)rc; // EAGAIN just means there was nothing to clear
+    }
+}
+
+#else // !USE_IO_URING
+
+struct IOUring::Impl
+{
+};
+
+IOUring::IOUring()
+{
+}
+
+IOUring::~IOUring()
+{
+}
+
+unsigned int IOUring::Init(unsigned int)
+{
+    return ENOSYS;
+}
+
+bool IOUring::IsAvailable()
+{
+    return false;
+}
+
+unsigned int IOUring::QueueRead(int, void*, size_t, uint64_t, uint64_t)
+{
+    return ENOSYS;
+}
+
+unsigned int IOUring::QueueWrite(int, const void*, size_t, uint64_t,
+				 uint64_t)
+{
+    return ENOSYS;
+}
+
+unsigned int IOUring::Submit(unsigned int)
+{
+    return ENOSYS;
+}
+
+bool IOUring::GetCompletion(uint64_t*, int*)
+{
+    return false;
+}
+
+int IOUring::GetHandle()
+{
+    return -1;
+}
+
+void IOUring::ClearHandle()
+{
+}
+
+#endif // !USE_IO_URING
+
+} // namespace util
+
+#ifdef TEST
+
+# include <assert.h>
+# include <stdio.h>
+# include <fcntl.h>
+
+int main()
+{
+    util::IOUring ring;
+    if (ring.Init(8))
+    {
+	assert(!util::IOUring::IsAvailable());
+	fprintf(stderr, "No io_uring here, nothing to test\n");
+	return 0;
+    }
+    assert(util::IOUring::IsAvailable());
+
+    int fd = open("io_uring.tmp", O_RDWR|O_CREAT|O_TRUNC, 0644);
+    assert(fd >= 0);
+    unlink("io_uring.tmp");
+
+    char out[2][4096];
+    memset(out[0], 'a', sizeof(out[0]));
+    memset(out[1], 'b', sizeof(out[1]));
+
+    int h = ring.GetHandle();
+    assert(h >= 0);
+
+    // Two writes, one system call
+    unsigned int rc = ring.QueueWrite(fd, out[0], 4096, 0, 1);
+    assert(rc == 0);
+    rc = ring.QueueWrite(fd, out[1], 4096, 4096, 2);
+    assert(rc == 0);
+    rc = ring.Submit(2);
+    assert(rc == 0);
+
+    ring.ClearHandle();
+    unsigned int seen = 0;
+    uint64_t tag;
+    int result;
+    while (ring.GetCompletion(&tag, &result))
+    {
+	assert(result == 4096);
+	seen |= 1u << tag;
+    }
+    assert(seen == 6);
+
+    char in[6000];
+    rc = ring.QueueRead(fd, in, sizeof(in), 2048, 3);
+    assert(rc == 0);
+    rc = ring.Submit(1);
+    assert(rc == 0);
+    assert(ring.GetCompletion(&tag, &result));
+    assert(tag == 3);
+    assert(result == 6000);
+    assert(in[0] == 'a' && in[2047] == 'a' && in[2048] == 'b');
+    assert(in[5999] == 'b');
+
+    // Reading past EOF completes with 0 bytes
+    rc = ring.QueueRead(fd, in, sizeof(in), 8192, 4);
+    assert(rc == 0);
+    rc = ring.Submit(1);
+    assert(rc == 0);
+    assert(ring.GetCompletion(&tag, &result));
+    assert(tag == 4 && result == 0);
+    assert(!ring.GetCompletion(&tag, &result));
+
+    // The eventfd is readable (and only clears on ClearHandle)
+    uint64_t count;
+    assert(read(h, &count, sizeof(count)) == sizeof(count));
+    ring.ClearHandle();
+    assert(read(h, &count, sizeof(count)) < 0 && errno == EAGAIN);
+
+    // A full submission queue says so
+    util::IOUring small;
+    rc = small.Init(1);
+    assert(rc == 0);
+    rc = small.QueueRead(fd, in, 1, 0, 1);
+    assert(rc == 0);
+    rc = small.QueueRead(fd, in, 1, 0, 2);
+    assert(rc == EAGAIN);
+    rc = small.Submit(1);
+    assert(rc == 0);
+
+    close(fd);
+    return 0;
+}
+
+#endif
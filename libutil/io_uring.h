@@ -0,0 +1,66 @@
+#ifndef LIBUTIL_IO_URING_H
+#define LIBUTIL_IO_URING_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+namespace util {
+
+/** A Linux io_uring: a queue of IO requests, handed to the kernel in
+ * batches, and a queue of their completions.
+ *
+ * Each request carries a tag, which comes back with its result. Not
+ * thread-safe: a ring belongs to one thread (or one stream) at a time.
+ *
+ * On systems without io_uring (including kernels too old for
+ * IORING_OP_READ, and containers which forbid it) Init returns ENOSYS, and
+ * callers should fall back to ordinary synchronous IO.
+ */
+class IOUring
+{
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+
+public:
+    IOUring();
+    ~IOUring();
+
+    unsigned int Init(unsigned int entries);
+
+    /** Whether Init is likely to succeed; found out once per process.
+     */
+    static bool IsAvailable();
+
+    /** Queue a read or write. Nothing reaches the kernel until Submit.
+     *
+     * Returns EAGAIN if the submission queue is full (Submit first). The
+     * buffer must stay valid until the request's completion is collected.
+     */
+    unsigned int QueueRead(int fd, void *buffer, size_t len, uint64_t pos,
+			   uint64_t tag);
+    unsigned int QueueWrite(int fd, const void *buffer, size_t len,
+			    uint64_t pos, uint64_t tag);
+
+    /** Hand all queued requests to the kernel in one system call and, if
+     * wait is nonzero, block until at least that many completions are
+     * available.
+     */
+    unsigned int Submit(unsigned int wait = 0);
+
+    /** Collect one completion, if there is one. As for pread/pwrite,
+     * *result is bytes transferred, or minus an errno.
+     */
+    bool GetCompletion(uint64_t *tag, int *result);
+
+    /** An eventfd which becomes readable when completions arrive, so the
+     * ring can be waited-for by a Scheduler. Call ClearHandle once it has
+     * been readable, before collecting completions.
+     */
+    int GetHandle();
+    void ClearHandle();
+};
+
+} // namespace util
+
+#endif
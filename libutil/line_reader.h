@@ -48,6 +48,9 @@ public:
      * MAX_LINE bytes).
      */
     void ReadLeftovers(void *buffer, size_t n, size_t *nread);
+
+    /** How much has been read from the stream but not yet returned */
+    size_t GetBuffered() const { return m_buffered; }
 };
 
 } // namespace util
@@ -25,6 +25,7 @@ public:
 		     size_t *pwrote);
     uint64_t GetLength();
     unsigned SetLength(uint64_t);
+    unsigned GetFileExtent(int *pfd, uint64_t *poffset);
 
     int GetHandle() { return m_stream->GetHandle(); }
 };
@@ -64,6 +65,14 @@ unsigned PartialSeekableStream::SetLength(uint64_t)
     return EINVAL;
 }
 
+unsigned PartialSeekableStream::GetFileExtent(int *pfd, uint64_t *poffset)
+{
+    unsigned rc = m_stream->GetFileExtent(pfd, poffset);
+    if (rc == 0)
+	*poffset += m_begin;
+    return rc;
+}
+
 
         /* PartialStream */
 
@@ -1,6 +1,7 @@
 #ifndef LIBUTIL_POLLER_CORE_H
 #define LIBUTIL_POLLER_CORE_H 1
 
+#include <map>
 #include <vector>
 #include "bind.h"
 #include "task.h"
@@ -11,6 +12,7 @@
 #undef OUT
 
 struct pollfd;
+struct epoll_event;
 
 /* Implementation details and platform-independence support for Poller */
 
@@ -24,13 +26,66 @@ struct PollRecord
     unsigned char direction;
     enum { IN = 1, OUT = 2 };
     bool oneshot;
+    bool edge; ///< Edge-triggered, if the core can (only if !oneshot)
+    unsigned int serial; ///< Distinguishes successive records for one h
 
-    PollRecord() : internal(NULL), h(0), direction(IN), oneshot(false) {}
+    PollRecord() : internal(NULL), h(0), direction(IN), oneshot(false),
+		   edge(false), serial(0) {}
+};
+
+/** The records being polled, by handle (a handle is polled at most once).
+ *
+ * A record whose direction is zero is a oneshot that has fired, awaiting
+ * removal.
+ */
+typedef std::map<int, PollRecord> pollables_t;
+
+/** Interface to the OS's way of waiting for IO, as used by
+ * BackgroundScheduler. All calls but Poll and Wake are made with the
+ * scheduler's lock held.
+ */
+class PollerCore
+{
+public:
+    virtual ~PollerCore() {}
+
+    /** A record has been added to (or, if its handle was there already,
+     * replaced in) the pollables.
+     */
+    virtual void Added(PollRecord*) {}
+
+    /** A record is about to be removed from the pollables.
+     */
+    virtual void Deleting(PollRecord*) {}
+
+    /** Whether Added and Deleting take effect at once, even during a Poll;
+     * if not, changes must Wake the poll thread to call SetUpArray.
+     */
+    virtual bool IsIncremental() const { return false; }
+
+    /** Called before Poll whenever the pollables have changed.
+     */
+    virtual unsigned int SetUpArray(const pollables_t*) = 0;
+
+    virtual unsigned int Poll(unsigned int timeout_ms) = 0;
+
+    /** Makes the callbacks for whatever Poll found, marking fired oneshots
+     * (direction = 0) and adding their handles to *done.
+     *
+     * @param valid False if the pollables have changed since SetUpArray
+     */
+    virtual unsigned int DoCallbacks(pollables_t*, bool valid,
+				     std::vector<int> *done) = 0;
+
+    virtual void Wake() = 0;
 };
 
 namespace posix {
 
-class PollerCore
+/** PollerCore using poll(), which rebuilds its array whenever the pollables
+ * change, and scans all of them on every wakeup.
+ */
+class PollerCore final: public util::PollerCore
 {
     pollfd *m_array;
     size_t m_count;
@@ -41,16 +96,51 @@ public:
     PollerCore();
     ~PollerCore();
 
-    unsigned int SetUpArray(const std::vector<PollRecord>*);
-    unsigned int Poll(unsigned int timeout_ms);
-    unsigned int DoCallbacks(std::vector<PollRecord>*, bool valid);
-    void Deleting(PollRecord*) {}
-    void Wake();
+    unsigned int SetUpArray(const pollables_t*) override;
+    unsigned int Poll(unsigned int timeout_ms) override;
+    unsigned int DoCallbacks(pollables_t*, bool valid,
+			     std::vector<int> *done) override;
+    void Wake() override;
 };
 
 } // namespace util::posix
 
-namespace pollapi = ::util::posix;
+namespace epoll {
+
+/** PollerCore using Linux epoll, which is told of each change as it
+ * happens, and on wakeup sees only the handles which are ready; so both
+ * cost in proportion to the activity, not to the number of handles.
+ *
+ * Oneshot records use EPOLLONESHOT, and records with "edge" set use
+ * EPOLLET. Wake uses an eventfd.
+ */
+class PollerCore final: public util::PollerCore
+{
+    int m_epoll_fd;
+    int m_wake_fd;
+
+    enum { MAX_EVENTS = 64 };
+    epoll_event *m_events;
+    int m_nevents;
+
+public:
+    PollerCore();
+    ~PollerCore();
+
+    /** False if epoll isn't available after all (eg old kernel) */
+    bool IsOK() const { return m_epoll_fd >= 0 && m_wake_fd >= 0; }
+
+    bool IsIncremental() const override { return true; }
+    void Added(PollRecord*) override;
+    void Deleting(PollRecord*) override;
+    unsigned int SetUpArray(const pollables_t*) override;
+    unsigned int Poll(unsigned int timeout_ms) override;
+    unsigned int DoCallbacks(pollables_t*, bool valid,
+			     std::vector<int> *done) override;
+    void Wake() override;
+};
+
+} // namespace util::epoll
 
 } // namespace util
 
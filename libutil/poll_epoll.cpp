@@ -0,0 +1,166 @@
+#include "config.h"
+#include "poll.h"
+#include "trace.h"
+#include "bind.h"
+#include "task_queue.h"
+
+#if HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <stdint.h>
+
+LOG_DECL(POLL);
+
+namespace util {
+
+namespace epoll {
+
+/** The epoll_event data for the waker; real records use (serial<<32)|fd,
+ * and serials start at one.
+ */
+static const uint64_t WAKER = (uint64_t)-1;
+
+PollerCore::PollerCore()
+    : m_epoll_fd(::epoll_create1(EPOLL_CLOEXEC)),
+      m_wake_fd(::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)),
+      m_events(new epoll_event[MAX_EVENTS]),
+      m_nevents(0)
+{
+    if (m_epoll_fd < 0 || m_wake_fd < 0)
+    {
+	TRACE << "Can't epoll_create1/eventfd\n";
+	return;
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKER;
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev);
+}
+
+PollerCore::~PollerCore()
+{
+    delete[] m_events;
+    if (m_wake_fd >= 0)
+	close(m_wake_fd);
+    if (m_epoll_fd >= 0)
+	close(m_epoll_fd);
+}
+
+void PollerCore::Added(PollRecord *r)
+{
+    epoll_event ev;
+    ev.events = 0;
+    if (r->direction & PollRecord::IN)
+	ev.events |= EPOLLIN;
+    if (r->direction & PollRecord::OUT)
+	ev.events |= EPOLLOUT;
+    if (r->oneshot)
+	ev.events |= EPOLLONESHOT;
+    else if (r->edge)
+	ev.events |= EPOLLET;
+    ev.data.u64 = ((uint64_t)r->serial << 32) | (uint32_t)r->h;
+
+    /* A fired oneshot stays registered (disabled) until the scheduler gets
+     * round to deleting it, so it may be being replaced.
+     */
+    if (::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, r->h, &ev) < 0)
+    {
+	if (errno != EEXIST
+	    || ::epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, r->h, &ev) < 0)
+	{
+	    TRACE << "Can't epoll fd " << r->h << ": " << errno << "\n";
+	}
+    }
+}
+
+void PollerCore::Deleting(PollRecord *r)
+{
+    /* Fails harmlessly (EBADF) if the fd has already been closed, which
+     * removed it anyway.
+     */
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, r->h, NULL);
+}
+
+unsigned int PollerCore::SetUpArray(const pollables_t*)
+{
+    return 0; // Told of each change as it happens
+}
+
+unsigned int PollerCore::Poll(unsigned int timeout_ms)
+{
+    int rc = ::epoll_wait(m_epoll_fd, m_events, MAX_EVENTS, (int)timeout_ms);
+    if (rc < 0)
+    {
+	m_nevents = 0;
+	if (errno != EINTR)
+	    return (unsigned)errno;
+	return 0;
+    }
+    m_nevents = rc;
+    return 0;
+}
+
+unsigned int PollerCore::DoCallbacks(pollables_t *pollables, bool,
+				     std::vector<int> *done)
+{
+    /* Unlike poll(), events can't be discarded if the pollables have
+     * changed since: an edge-triggered or oneshot event wouldn't be
+     * reported again. Instead, an event for a record that's since been
+     * removed or replaced is recognised by its serial number.
+     */
+    std::vector<TaskCallback> task_callbacks;
+
+    for (int i=0; i<m_nevents; ++i)
+    {
+	uint64_t data = m_events[i].data.u64;
+	if (data == WAKER)
+	{
+	    LOG(POLL) << "Got wake\n";
+	    uint64_t count;
+	    ssize_t rc = read(m_wake_fd, &count, sizeof(count));
+	    (void)rc;
+	    continue;
+	}
+
+	int h = (int)(uint32_t)data;
+	pollables_t::iterator it = pollables->find(h);
+	if (it == pollables->end()
+	    || it->second.serial != (unsigned int)(data >> 32)
+	    || !it->second.direction)
+	    continue;
+
+	PollRecord& record = it->second;
+	if (record.oneshot)
+	{
+	    record.direction = 0; // Mark for deletion
+	    done->push_back(record.h);
+	}
+
+	if (record.tc.IsValid())
+	    task_callbacks.push_back(record.tc);
+    }
+    m_nevents = 0;
+
+    for (size_t i=0; i<task_callbacks.size(); ++i)
+	task_callbacks[i]();
+
+    return 0;
+}
+
+void PollerCore::Wake()
+{
+    uint64_t one = 1;
+    ssize_t rc = write(m_wake_fd, &one, sizeof(one));
+    (void)rc;
+}
+
+} // namespace util::epoll
+
+} // namespace util
+
+#endif // HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H
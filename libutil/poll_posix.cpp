@@ -33,7 +33,7 @@ PollerCore::PollerCore()
     fcntl(m_waker_fd[0], F_SETFL, flags | O_NONBLOCK);
 }
 
-unsigned int PollerCore::SetUpArray(const std::vector<PollRecord> *pollables)
+unsigned int PollerCore::SetUpArray(const pollables_t *pollables)
 {
     m_count = pollables->size() + 1;
 
@@ -49,18 +49,19 @@ unsigned int PollerCore::SetUpArray(const std::vector<PollRecord> *pollables)
     m_array[0].events = POLLIN;
     m_array[0].revents = 0;
 
-    for (size_t i=1; i<m_count; ++i)
+    size_t i = 1;
+    for (pollables_t::const_iterator j = pollables->begin();
+	 j != pollables->end();
+	 ++i, ++j)
     {
-	m_array[i].fd = (*pollables)[i-1].h;
+	m_array[i].fd = j->second.h;
 	short events = 0;
-	unsigned int directions = (*pollables)[i-1].direction;
+	unsigned int directions = j->second.direction;
 
 	if (directions & PollRecord::IN)
 	    events |= POLLIN;
 	if (directions & PollRecord::OUT)
 	    events |= POLLOUT;
-//	TRACE << "pc" << this << ": " << i << ". fd " << m_array[i].fd << " events "
-//	      << events << " pollable " << (*pollables)[i].p << "\n";
 	m_array[i].events = events;
 	m_array[i].revents = 0;
     }
@@ -78,8 +79,8 @@ unsigned int PollerCore::Poll(unsigned int timeout_ms)
     return 0;
 }
 
-unsigned int PollerCore::DoCallbacks(std::vector<PollRecord> *pollables,
-				     bool array_valid)
+unsigned int PollerCore::DoCallbacks(pollables_t *pollables,
+				     bool array_valid, std::vector<int> *done)
 {
     if (!array_valid)
 	return 0; // All Posix pollables are level-triggered
@@ -101,28 +102,27 @@ unsigned int PollerCore::DoCallbacks(std::vector<PollRecord> *pollables,
 	}
     }
  
-//    for (size_t i=1; i<m_count; ++i)
-//    {
-//	TRACE << i << ". arrayfd=" << m_array[i].fd << " pollables[i-1].h="
-//	      << (*pollables)[i-1].h << " p=" << (*pollables)[i-1].p << "\n";
-//    }
-
     /* Care here as "pollables" might get changed as soon as we start making
      * callbacks.
      */
     std::vector<TaskCallback> task_callbacks;
-    task_callbacks.reserve(pollables->size());
 
-    for (size_t i=1; i<m_count; ++i)
+    /* The array was built from the map in handle order, so walk the two
+     * together.
+     */
+    pollables_t::iterator j = pollables->begin();
+    for (size_t i=1; i<m_count; ++i, ++j)
     {
 	if (m_array[i].revents)
 	{
-//	    TRACE << "pc" << this << ": activity on fd " << m_array[i].fd << "\n";
-	    PollRecord& record = (*pollables)[i-1];
+	    PollRecord& record = j->second;
 	    assert(record.h == m_array[i].fd);
 
 	    if (record.oneshot)
+	    {
 		record.direction = 0; // Mark for deletion
+		done->push_back(record.h);
+	    }
 
 	    if (record.tc.IsValid())
 		task_callbacks.push_back(record.tc);
@@ -0,0 +1,487 @@
+#include "config.h"
+#include "readahead_stream.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace util {
+
+namespace {
+
+enum {
+    BLOCK = 64*1024,
+    MAX_WINDOW = 16 ///< In blocks
+};
+
+
+        /* SharedBlocks */
+
+
+/** Every whole block, of every file, that some ReadAheadStream is holding.
+ *
+ * Entries are weak, so a block lasts exactly as long as some stream holds
+ * it; this isn't a cache in its own right, just a way for streams to share.
+ */
+class SharedBlocks
+{
+    struct Key
+    {
+	dev_t dev;
+	ino_t ino;
+	uint64_t offset;
+
+	bool operator<(const Key& other) const
+	{
+	    return std::tie(dev, ino, offset)
+		< std::tie(other.dev, other.ino, other.offset);
+	}
+    };
+
+    std::mutex m_mutex;
+    typedef std::map<Key, std::weak_ptr<const char> > map_t;
+    map_t m_map;
+    size_t m_sweep_at;
+
+public:
+    SharedBlocks() : m_sweep_at(1024) {}
+
+    static SharedBlocks *Instance()
+    {
+	static SharedBlocks s_instance;
+	return &s_instance;
+    }
+
+    std::shared_ptr<const char> Find(dev_t dev, ino_t ino, uint64_t offset)
+    {
+	Key k = { dev, ino, offset };
+	std::lock_guard<std::mutex> lock(m_mutex);
+	map_t::iterator i = m_map.find(k);
+	if (i == m_map.end())
+	    return std::shared_ptr<const char>();
+	std::shared_ptr<const char> data = i->second.lock();
+	if (!data)
+	    m_map.erase(i);
+	return data;
+    }
+
+    void Add(dev_t dev, ino_t ino, uint64_t offset,
+	     const std::shared_ptr<const char>& data)
+    {
+	Key k = { dev, ino, offset };
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_map[k] = data;
+
+	// Every so often, forget the blocks nobody holds any more
+	if (m_map.size() >= m_sweep_at)
+	{
+	    for (map_t::iterator i = m_map.begin(); i != m_map.end(); )
+	    {
+		if (i->second.expired())
+		    i = m_map.erase(i);
+		else
+		    ++i;
+	    }
+	    m_sweep_at = std::max((size_t)1024, m_map.size() * 2);
+	}
+    }
+};
+
+
+        /* ReadAheadStream */
+
+
+class ReadAheadStream final: public SeekableStream
+{
+    struct Block
+    {
+	uint64_t index;
+	size_t len; ///< Less than BLOCK only at EOF
+	std::shared_ptr<const char> data;
+    };
+
+    std::unique_ptr<Stream> m_stream;
+    int m_fd; ///< Or -1 if the underlying stream isn't a file
+    uint64_t m_base;
+    bool m_shared;
+    dev_t m_dev;
+    ino_t m_ino;
+
+    std::vector<Block> m_blocks;
+    uint64_t m_next; ///< Where a sequential reader would read next
+    unsigned int m_window; ///< Blocks to read at once
+    bool m_hinted;
+
+    const Block *Find(uint64_t index) const;
+    unsigned int Fill(uint64_t index, bool sequential);
+
+public:
+    explicit ReadAheadStream(std::unique_ptr<Stream> underlying);
+
+    // Being a SeekableStream
+    unsigned GetStreamFlags() const override
+    {
+	return m_stream->GetStreamFlags() & ~WRITABLE;
+    }
+    unsigned ReadAt(void *buffer, uint64_t pos, size_t len,
+		    size_t *pread) override;
+    unsigned WriteAt(const void*, uint64_t, size_t, size_t*) override
+    {
+	return EINVAL;
+    }
+    uint64_t GetLength() override { return m_stream->GetLength(); }
+    unsigned SetLength(uint64_t) override { return EINVAL; }
+    unsigned GetFileExtent(int *pfd, uint64_t *poffset) override
+    {
+	return m_stream->GetFileExtent(pfd, poffset);
+    }
+    int GetHandle() override { return m_stream->GetHandle(); }
+};
+
+ReadAheadStream::ReadAheadStream(std::unique_ptr<Stream> underlying)
+    : m_stream(std::move(underlying)),
+      m_fd(-1),
+      m_base(0),
+      m_shared(false),
+      m_dev(0),
+      m_ino(0),
+      m_next(0),
+      m_window(1),
+      m_hinted(false)
+{
+    struct stat st;
+    if (m_stream->GetFileExtent(&m_fd, &m_base) != 0)
+	m_fd = -1;
+    else if (::fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+	m_shared = true;
+	m_dev = st.st_dev;
+	m_ino = st.st_ino;
+    }
+}
+
+const ReadAheadStream::Block *ReadAheadStream::Find(uint64_t index) const
+{
+    for (unsigned int i=0; i<m_blocks.size(); ++i)
+	if (m_blocks[i].index == index)
+	    return &m_blocks[i];
+    return NULL;
+}
+
+/** Makes sure we're holding the window of blocks starting at index (or up
+ * to EOF), reading each run of blocks nobody else has in one go.
+ */
+unsigned int ReadAheadStream::Fill(uint64_t index, bool sequential)
+{
+    if (sequential)
+	m_window = std::min(m_window * 2, (unsigned int)MAX_WINDOW);
+    else
+	m_window = 1;
+
+    uint64_t end = index + m_window;
+
+    // Let go of anything outside the new window
+    std::vector<Block> keep;
+    for (unsigned int i=0; i<m_blocks.size(); ++i)
+	if (m_blocks[i].index >= index && m_blocks[i].index < end
+	    && m_blocks[i].len == BLOCK)
+	    keep.push_back(m_blocks[i]);
+    m_blocks.swap(keep);
+
+    SharedBlocks *shared = SharedBlocks::Instance();
+
+    uint64_t i = index;
+    while (i < end)
+    {
+	if (Find(i))
+	{
+	    ++i;
+	    continue;
+	}
+
+	if (m_shared)
+	{
+	    std::shared_ptr<const char> data = shared->Find(m_dev, m_ino,
+							    m_base + i*BLOCK);
+	    if (data)
+	    {
+		Block b = { i, BLOCK, data };
+		m_blocks.push_back(b);
+		++i;
+		continue;
+	    }
+	}
+
+	// A run of blocks we'll have to read ourselves
+	uint64_t count = 1;
+	while (i + count < end && !Find(i + count)
+	       && !(m_shared && shared->Find(m_dev, m_ino,
+					     m_base + (i+count)*BLOCK)))
+	    ++count;
+
+	size_t want = (size_t)(count * BLOCK);
+	std::shared_ptr<char[]> run(new char[want]);
+	size_t got = 0;
+	unsigned int rc = 0;
+	while (got < want)
+	{
+	    size_t nread;
+	    rc = m_stream->ReadAt(run.get() + got, i*BLOCK + got, want - got,
+				  &nread);
+	    if (rc || !nread)
+		break;
+	    got += nread;
+	}
+
+	if (rc && i == index)
+	    return rc;
+
+	for (uint64_t j=0; j*BLOCK < got; ++j)
+	{
+	    Block b = { i + j, std::min((size_t)BLOCK, got - j*BLOCK),
+			std::shared_ptr<const char>(run, run.get() + j*BLOCK) };
+	    m_blocks.push_back(b);
+	    if (m_shared && b.len == BLOCK)
+		shared->Add(m_dev, m_ino, m_base + b.index*BLOCK, b.data);
+	}
+
+	if (rc || got < want)
+	    break; // EOF (or an error, which the reader will find later)
+	i += count;
+    }
+
+#if HAVE_POSIX_FADVISE
+    // Have the kernel start on the window after this one
+    if (m_fd >= 0 && sequential)
+    {
+	if (!m_hinted && m_window == MAX_WINDOW)
+	{
+	    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	    m_hinted = true;
+	}
+	posix_fadvise(m_fd, (off_t)(m_base + end*BLOCK),
+		      (off_t)m_window*BLOCK, POSIX_FADV_WILLNEED);
+    }
+#endif
+
+    return 0;
+}
+
+unsigned ReadAheadStream::ReadAt(void *buffer, uint64_t pos, size_t len,
+				 size_t *pread)
+{
+    *pread = 0;
+    bool sequential = (pos == m_next);
+    uint64_t index = pos / BLOCK;
+
+    const Block *b = Find(index);
+
+    // At EOF last time; look again, in case the file's grown since
+    if (b && b->len < BLOCK && pos - index*BLOCK >= b->len)
+    {
+	m_blocks.erase(m_blocks.begin() + (b - &m_blocks[0]));
+	b = NULL;
+    }
+
+    if (!b)
+    {
+	// Big reads gain nothing from being copied through a block
+	if (len >= BLOCK)
+	{
+	    unsigned int rc = m_stream->ReadAt(buffer, pos, len, pread);
+	    if (rc == 0)
+		m_next = pos + *pread;
+	    return rc;
+	}
+
+	unsigned int rc = Fill(index, sequential);
+	if (rc)
+	    return rc;
+	b = Find(index);
+    }
+
+    char *ptr = (char*)buffer;
+    while (b && len)
+    {
+	size_t offset = (size_t)(pos - b->index*BLOCK);
+	if (offset >= b->len)
+	    break;
+	size_t n = std::min(len, b->len - offset);
+	memcpy(ptr, b->data.get() + offset, n);
+	ptr += n;
+	pos += n;
+	len -= n;
+	*pread += n;
+	b = Find(b->index + 1);
+    }
+
+    m_next = pos;
+    return 0;
+}
+
+} // anon namespace
+
+std::unique_ptr<Stream> CreateReadAheadStream(std::unique_ptr<Stream>
+					      underlying)
+{
+    if (!underlying || !(underlying->GetStreamFlags() & Stream::SEEKABLE))
+	return underlying;
+    return std::unique_ptr<Stream>(new ReadAheadStream(std::move(underlying)));
+}
+
+} // namespace util
+
+#ifdef TEST
+
+# include "file_stream.h"
+# include <assert.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <unistd.h>
+
+/** Counts the reads that get through to the file */
+class CountingStream: public util::SeekableStream
+{
+    std::unique_ptr<util::Stream> m_stream;
+
+public:
+    unsigned int reads;
+
+    explicit CountingStream(std::unique_ptr<util::Stream> s)
+	: m_stream(std::move(s)), reads(0) {}
+
+    unsigned GetStreamFlags() const override
+    {
+	return m_stream->GetStreamFlags();
+    }
+    unsigned ReadAt(void *buffer, uint64_t pos, size_t len,
+		    size_t *pread) override
+    {
+	++reads;
+	return m_stream->ReadAt(buffer, pos, len, pread);
+    }
+    uint64_t GetLength() override { return m_stream->GetLength(); }
+    unsigned GetFileExtent(int *pfd, uint64_t *poffset) override
+    {
+	return m_stream->GetFileExtent(pfd, poffset);
+    }
+};
+
+static std::unique_ptr<util::Stream> Open(const char *filename,
+					  CountingStream **pcounter)
+{
+    std::unique_ptr<util::Stream> fsp;
+    unsigned int rc = util::OpenFileStream(filename, util::READ, &fsp);
+    assert(rc == 0);
+    *pcounter = new CountingStream(std::move(fsp));
+    return util::CreateReadAheadStream(
+	std::unique_ptr<util::Stream>(*pcounter));
+}
+
+int main()
+{
+    const char *filename = "readahead_stream.tmp";
+
+    std::string expected;
+    for (unsigned int i=0; i<100000; ++i)
+    {
+	char line[20];
+	int n = snprintf(line, sizeof(line), "%u\n", i);
+	expected.append(line, (size_t)n);
+    }
+
+    std::unique_ptr<util::Stream> wsp;
+    unsigned int rc = util::OpenFileStream(filename, util::WRITE, &wsp);
+    assert(rc == 0);
+    rc = wsp->WriteAll(expected.data(), expected.size());
+    assert(rc == 0);
+
+    // Sector-at-a-time, as TarFS does: few reads get through
+    CountingStream *counter;
+    std::unique_ptr<util::Stream> rsp = Open(filename, &counter);
+    assert(!(rsp->GetStreamFlags() & util::Stream::WRITABLE));
+    std::string contents;
+    for (;;)
+    {
+	char buffer[512];
+	size_t nread;
+	rc = rsp->Read(buffer, sizeof(buffer), &nread);
+	assert(rc == 0);
+	if (!nread)
+	    break;
+	contents.append(buffer, nread);
+    }
+    assert(contents == expected);
+    assert(counter->reads < 10);
+
+    // Random reads still read the right thing (perhaps short, at the end
+    // of a block)
+    for (unsigned int i=0; i<1000; ++i)
+    {
+	char buffer[3000];
+	uint64_t pos = (uint64_t)(rand() % (expected.size() + 10));
+	size_t len = (size_t)(rand() % sizeof(buffer));
+	size_t want = pos >= expected.size() ? 0
+	    : std::min(len, (size_t)(expected.size() - pos));
+	size_t got = 0;
+	for (;;)
+	{
+	    size_t nread;
+	    rc = rsp->ReadAt(buffer + got, pos + got, len - got, &nread);
+	    assert(rc == 0);
+	    if (!nread)
+		break;
+	    got += nread;
+	}
+	assert(got == want);
+	assert(!memcmp(buffer, expected.data() + pos, got));
+    }
+
+    // A second reader of the same file gets blocks the first one holds
+    char buffer[100];
+    size_t nread;
+    rc = rsp->ReadAt(buffer, 1000, sizeof(buffer), &nread);
+    assert(rc == 0);
+    CountingStream *counter2;
+    std::unique_ptr<util::Stream> rsp2 = Open(filename, &counter2);
+    rc = rsp2->ReadAt(buffer, 1100, sizeof(buffer), &nread);
+    assert(rc == 0);
+    assert(nread == sizeof(buffer));
+    assert(!memcmp(buffer, expected.data() + 1100, sizeof(buffer)));
+    assert(counter2->reads == 0);
+
+    // Big reads go straight through
+    std::string big(200000, '\0');
+    rc = rsp2->ReadAt(&big[0], 300000, big.size(), &nread);
+    assert(rc == 0);
+    assert(nread == big.size());
+    assert(!memcmp(big.data(), expected.data() + 300000, big.size()));
+    assert(counter2->reads == 1);
+
+    // A growing file keeps growing
+    rsp->Seek(expected.size());
+    rc = rsp->Read(buffer, sizeof(buffer), &nread);
+    assert(rc == 0);
+    assert(nread == 0);
+    rc = wsp->WriteAll("more", 4);
+    assert(rc == 0);
+    rc = rsp->Read(buffer, sizeof(buffer), &nread);
+    assert(rc == 0);
+    assert(nread == 4);
+    assert(!memcmp(buffer, "more", 4));
+
+    // Not for writing
+    rc = rsp->WriteAt("x", 0, 1, &nread);
+    assert(rc == EINVAL);
+
+    unlink(filename);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef READAHEAD_STREAM_H
+#define READAHEAD_STREAM_H 1
+
+#include "stream.h"
+#include <memory>
+
+namespace util {
+
+/** A read-only stream which reads the underlying SeekableStream in large
+ * blocks, so that many small reads (a sector, an MP3 frame, an NFS packet)
+ * cost one system call between them.
+ *
+ * The amount read at once starts at one 64K block, and doubles (up to 1M)
+ * while the reader keeps reading sequentially; a seek elsewhere starts it
+ * again from one block. Where the underlying stream is a file, the kernel
+ * is told too, with posix_fadvise, so that its own readahead keeps ahead
+ * of ours.
+ *
+ * Whole blocks of a file are shared between all its ReadAheadStreams in
+ * the process, for as long as any of them holds the block -- so two
+ * clients streaming the same track mostly read it from disk once.
+ *
+ * Streams that aren't SEEKABLE are returned unwrapped. EWOULDBLOCK, and
+ * GetHandle, come from the underlying stream; so does GetFileExtent, so
+ * the HTTP server can still use sendfile.
+ */
+std::unique_ptr<Stream> CreateReadAheadStream(std::unique_ptr<Stream>
+					      underlying);
+
+} // namespace util
+
+#endif
@@ -1,3 +1,4 @@
+#include "config.h"
 #include "scheduler.h"
 #include "bind.h"
 #include "task.h"
@@ -6,11 +7,14 @@
 #include "errors.h"
 #include "stream.h"
 #include "locking.h"
+#include "timer_wheel.h"
 #include "counted_pointer.h"
 #include <list>
+#include <memory>
 #include <deque>
 #include <queue>
 #include <vector>
+#include <unordered_map>
 #include <stdint.h>
 #include <unistd.h>
 #include <algorithm>
@@ -20,62 +24,114 @@ LOG_DECL(POLL);
 
 namespace util {
 
-using pollapi::PollerCore;
-
 class BackgroundScheduler::Impl: private util::PerObjectRecursiveLocking
 {
     friend class BackgroundScheduler;
 
-    typedef std::vector<PollRecord> pollables_t;
-
-    struct Timed
+    /** A timer; "when" is time_t * 1000, plus milliseconds.
+     */
+    struct Timed: public TimerWheel::Timer
     {
-	uint64_t t; // time_t * 1000
 	unsigned int repeatms;
 	TaskCallback callback;
+	bool firing; ///< Expired, but not yet called back
 
-        Timed() : t(0), repeatms(0) {}
+        Timed() : repeatms(0), firing(false) {}
     };
 
-    /** Comparator for timers that makes queue.top() the soonest.
-     *
-     * This means that operator()(x,y) returns true if y is sooner.
+    /** Timers nearer together than this are called back in one wakeup.
      */
-    struct TimerSooner
-    {
-	bool operator()(const Timed& x, const Timed& y)
-	{
-	    return y.t < x.t;
-	}
-    };
+    enum { COALESCE_MS = 4 };
 
-    typedef std::vector<Timed> timed_t;
+    typedef std::unordered_multimap<const Task*, Timed*> timers_t;
+    typedef std::unordered_multimap<const Task*, int> handles_t;
 
     pollables_t m_pollables;
-    timed_t m_timers; // Used as a priority-queue
+    handles_t m_handles; ///< The keys of m_pollables, by task
+    TimerWheel m_wheel;
+    timers_t m_timers; ///< Owns every Timed, whether in m_wheel or firing
+    std::vector<TimerWheel::Timer*> m_due;
 
     bool m_array_valid;
     bool m_exiting;
+    unsigned int m_serial;
 
-    PollerCore m_core;
+    std::unique_ptr<PollerCore> m_core;
+
+    static uint64_t NowMs();
+    void Unindex(const PollRecord&);
+    void Unindex(Timed*);
 
 public:
-    Impl();
+    explicit Impl(Backend);
     ~Impl();
 
     unsigned int Poll(unsigned int ms);
 
     void Wait(const TaskCallback&, int, unsigned int direction,
-	      bool oneshot);
-    void Wait(const TaskCallback&, time_t first, unsigned int repeatms);
+	      bool oneshot, bool edge);
+    void WaitUntilMs(const TaskCallback&, uint64_t when,
+		     unsigned int repeatms);
     void Wait(const TaskCallback&, TaskPtr waitedon);
     void Remove(TaskPtr);
     void Shutdown();
 };
 
-BackgroundScheduler::Impl::Impl()
-    : m_array_valid(false), m_exiting(false)
+static PollerCore *CreateCore(BackgroundScheduler::Backend backend)
+{
+#if HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H
+    if (backend != BackgroundScheduler::POLL)
+    {
+	std::unique_ptr<epoll::PollerCore> core(new epoll::PollerCore);
+	if (core->IsOK())
+	    return core.release();
+    }
+#else
+    (void)backend;
+#endif
+    return new posix::PollerCore;
+}
+
+BackgroundScheduler::Impl::Impl(Backend backend)
+    : m_wheel(NowMs()),
+      m_array_valid(false), m_exiting(false), m_serial(0),
+      m_core(CreateCore(backend))
+{
+}
+
+uint64_t BackgroundScheduler::Impl::NowMs()
+{
+    timeval now;
+    ::gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec*1000 + (uint64_t)(now.tv_usec/1000);
+}
+
+void BackgroundScheduler::Impl::Unindex(const PollRecord& r)
+{
+    std::pair<handles_t::iterator, handles_t::iterator> range
+	= m_handles.equal_range(r.tc.GetPtr().get());
+    for (handles_t::iterator i = range.first; i != range.second; ++i)
+    {
+	if (i->second == r.h)
+	{
+	    m_handles.erase(i);
+	    return;
+	}
+    }
+}
+
+void BackgroundScheduler::Impl::Unindex(Timed *t)
 {
+    std::pair<timers_t::iterator, timers_t::iterator> range
+	= m_timers.equal_range(t->callback.GetPtr().get());
+    for (timers_t::iterator i = range.first; i != range.second; ++i)
+    {
+	if (i->second == t)
+	{
+	    m_timers.erase(i);
+	    return;
+	}
+    }
 }
 
 void BackgroundScheduler::Impl::Shutdown()
@@ -87,9 +143,22 @@ void BackgroundScheduler::Impl::Shutdown()
 	Lock lock(this);
 	
 	LOG(POLL) << "BS" << (void*)this << " shutdown wakes\n";
-	m_core.Wake();
+	m_core->Wake();
+	for (timers_t::iterator i = m_timers.begin(); i != m_timers.end(); ++i)
+	{
+	    // Poll deletes the ones it's in the middle of calling back
+	    Timed *t = i->second;
+	    if (t->firing)
+		t->callback = TaskCallback();
+	    else
+	    {
+		m_wheel.Cancel(t);
+		delete t;
+	    }
+	}
 	m_timers.clear();
 	m_pollables.clear();
+	m_handles.clear();
 	LOG(POLL) << "Shutdown done\n";
     }
 }
@@ -103,7 +172,8 @@ BackgroundScheduler::Impl::~Impl()
 #undef OUT
 
 void BackgroundScheduler::Impl::Wait(const TaskCallback& tc, int h,
-				     unsigned int direction, bool oneshot)
+				     unsigned int direction, bool oneshot,
+				     bool edge)
 {
     if (m_exiting)
 	return;
@@ -118,6 +188,7 @@ void BackgroundScheduler::Impl::Wait(const TaskCallback& tc, int h,
     r.h = h;
     r.direction = (unsigned char)direction;
     r.oneshot = oneshot;
+    r.edge = edge && !oneshot;
     r.internal = NULL;
 
     if (r.h == NOT_POLLABLE)
@@ -126,20 +197,35 @@ void BackgroundScheduler::Impl::Wait(const TaskCallback& tc, int h,
 	return;
     }
 
-    for (unsigned int i=0; i<m_pollables.size(); ++i)
+    /* An entry with direction zero is a fired oneshot not yet removed,
+     * typically because this is its own callback re-arming it; replacing
+     * it is fine.
+     */
+    pollables_t::iterator it = m_pollables.find(r.h);
+    if (it != m_pollables.end())
     {
-	if (m_pollables[i].h == r.h && m_pollables[i].direction)
+	if (it->second.direction)
 	{
 	    TRACE << "Pollable fd " << r.h << " polled-on twice\n";
 	    assert(false);
 	}
+	Unindex(it->second);
     }
 
-    m_pollables.push_back(r);
+    // Serial zero is never used, so no stale event can match
+    if (++m_serial == 0)
+	++m_serial;
+    r.serial = m_serial;
+
+    PollRecord& rec = m_pollables[r.h];
+    rec = r;
+    m_core->Added(&rec);
+    m_handles.insert(std::make_pair(tc.GetPtr().get(), r.h));
 
     m_array_valid = false;
 
-    m_core.Wake();
+    if (!m_core->IsIncremental())
+	m_core->Wake();
 }
 
 void BackgroundScheduler::Impl::Remove(TaskPtr p)
@@ -151,54 +237,65 @@ void BackgroundScheduler::Impl::Remove(TaskPtr p)
 
     LOG(POLL) << "Remove timed " << p << "\n";
 
-    for (timed_t::iterator i = m_timers.begin(); i != m_timers.end(); ++i)
-	if (i->callback.GetPtr() == p)
-	    i->callback = TaskCallback();
+    std::pair<timers_t::iterator, timers_t::iterator> timers
+	= m_timers.equal_range(p.get());
+    for (timers_t::iterator i = timers.first; i != timers.second; ++i)
+    {
+	// Poll deletes the ones it's in the middle of calling back
+	Timed *t = i->second;
+	if (t->firing)
+	    t->callback = TaskCallback();
+	else
+	{
+	    m_wheel.Cancel(t);
+	    delete t;
+	}
+    }
+    m_timers.erase(timers.first, timers.second);
 
     LOG(POLL) << "Remove pollable " << p << "\n";
 
-    for (pollables_t::iterator i = m_pollables.begin();
-	 i != m_pollables.end();
-	 ++i)
+    std::pair<handles_t::iterator, handles_t::iterator> handles
+	= m_handles.equal_range(p.get());
+    for (handles_t::iterator i = handles.first; i != handles.second; ++i)
     {
-	if (i->tc.GetPtr() == p)
+	pollables_t::iterator it = m_pollables.find(i->second);
+	if (it != m_pollables.end() && it->second.tc.GetPtr() == p)
 	{
 	    LOG(POLL) << "Found pollable, erasing\n";
-	    m_core.Deleting(&*i);
-	    m_pollables.erase(i);
-	    break;
+	    m_core->Deleting(&it->second);
+	    m_pollables.erase(it);
 	}
     }
+    m_handles.erase(handles.first, handles.second);
     m_array_valid = false;
 
-    m_core.Wake();
+    if (!m_core->IsIncremental())
+	m_core->Wake();
 }
 
-void BackgroundScheduler::Impl::Wait(const TaskCallback& callback,
-				     time_t first, unsigned int repeatms)
+void BackgroundScheduler::Impl::WaitUntilMs(const TaskCallback& callback,
+					    uint64_t when,
+					    unsigned int repeatms)
 {
     if (m_exiting)
 	return;
 
-    Timed t;
-    t.t = (uint64_t)first*1000u;
-    t.repeatms = repeatms;
-    t.callback = callback;
+    std::unique_ptr<Timed> t(new Timed);
+    t->when = when;
+    t->repeatms = repeatms;
+    t->callback = callback;
     
     Lock lock(this);
     if (m_exiting)
 	return;
 
-    m_timers.push_back(t);
-//    TRACE << "Pushing timer for " << t.t << "\n";
-    std::push_heap(m_timers.begin(), m_timers.end(), TimerSooner());
-
-    m_core.Wake();
-}
+//    TRACE << "Adding timer for " << t->when << "\n";
+    m_wheel.Add(t.get());
+    m_timers.insert(std::make_pair(callback.GetPtr().get(), t.get()));
+    t.release();
 
-static bool DoneOneShot(const PollRecord& rec)
-{
-    return !rec.direction;
+    m_core->Wake();
 }
 
 unsigned BackgroundScheduler::Impl::Poll(unsigned int timeout_ms)
@@ -208,36 +305,32 @@ unsigned BackgroundScheduler::Impl::Poll(unsigned int timeout_ms)
 
 	if (!m_array_valid)
 	{
-	    m_core.SetUpArray(&m_pollables);
+	    m_core->SetUpArray(&m_pollables);
 	    m_array_valid = true;
 	}
 
-	if (!m_timers.empty())
+	uint64_t next = m_wheel.NextExpiry(COALESCE_MS);
+	if (next != UINT64_MAX)
 	{
-	    timeval now;
-	    ::gettimeofday(&now, NULL);
-	    uint64_t nowms = (uint64_t)now.tv_sec*1000
-		+ (uint64_t)(now.tv_usec/1000);
+	    uint64_t nowms = NowMs();
 	    
-	    if (nowms >= m_timers.front().t)
+	    if (nowms >= next)
 		timeout_ms = 0;
 	    else if (timeout_ms == BackgroundScheduler::INFINITE_MS
-		     || (nowms+timeout_ms) > m_timers.front().t)
+		     || (nowms+timeout_ms) > next)
 	    {
-		timeout_ms = (unsigned)(m_timers.front().t - nowms);
+		timeout_ms = (unsigned)std::min(next - nowms,
+						(uint64_t)600000);
 
 //		TRACE << "Adjusted timeout to " << timeout_ms << " nowms="
 //		      << nowms << "\n";
-
-		// Wake up every ten minutes anyway, just in case
-		if (timeout_ms > 600000)
-		    timeout_ms = 600000;
+		// (Waking up every ten minutes anyway, just in case)
 	    }
 	}
     }
 
     LOG(POLL) << "BS" << (void*)this << " calls poll(" << timeout_ms << ")\n";
-    unsigned int rc = m_core.Poll(timeout_ms);
+    unsigned int rc = m_core->Poll(timeout_ms);
     LOG(POLL) << "BS" << (void*)this << " poll returned " << rc << "\n";
 
     if (rc != 0)
@@ -246,73 +339,66 @@ unsigned BackgroundScheduler::Impl::Poll(unsigned int timeout_ms)
     if (m_exiting)
 	return 0;
 
-    uint64_t nowms = 0;
-    bool any = false;
+    /* Because we always expire up to the same time -- as opposed to
+     * calling gettimeofday each time round the loop -- even a repeating
+     * timer is called at most once per invocation of Poll().
+     */
+    uint64_t nowms = NowMs();
     for (;;)
     {
-	Timed t;
-
 	{
-//	    TRACE << "BS gets timer lock\n";
 	    Lock lock(this);
-//	    TRACE << "Got timer lock\n";
-	    if (m_timers.empty())
+	    m_due.clear();
+	    m_wheel.Expire(nowms, &m_due);
+	    if (m_due.empty())
 		break;
+	    for (size_t i=0; i<m_due.size(); ++i)
+		static_cast<Timed*>(m_due[i])->firing = true;
+	}
 
-	    if (!any)
+	/* Taking the lock for each one, so that other threads can get in
+	 * between; Remove and Shutdown leave firing timers for us to delete.
+	 */
+	for (size_t i=0; i<m_due.size(); ++i)
+	{
+	    Lock lock(this);
+	    Timed *t = static_cast<Timed*>(m_due[i]);
+	    TaskCallback callback = t->callback;
+
+	    if (!callback.IsValid())
+		delete t; // Removed while firing
+	    else if (t->repeatms == 0)
 	    {
-		timeval now;
-		::gettimeofday(&now, NULL);
-		nowms = (uint64_t)now.tv_sec*1000
-		    + (uint64_t)(now.tv_usec/1000);
-		any = true;
+		Unindex(t);
+		delete t;
 	    }
-
-	    /* Because we always compare against the same value -- as opposed
-	     * to calling gettimeofday each time round the loop -- even a
-	     * repeating timer is called at most once per invocation of Poll().
-	     */
-	    if (m_timers.front().t > nowms)
-		break;
-
-	    t = m_timers.front();
-//	    TRACE << "now " << nowms << ", timer " << t.t << ", calling\n";
-
-	    /* std::pop_heap moves the "popped" element to the end,
-	     * where we can pop_back() it to delete it, or push_heap()
-	     * it to re-enable it.
-	     */
-	    std::pop_heap(m_timers.begin(), m_timers.end(), TimerSooner());
-
-	    if (t.repeatms == 0 || !t.callback.IsValid())
-		m_timers.pop_back();
 	    else
 	    {
-		if (t.t == 0)
+		if (t->when == 0)
 		{
-		    m_timers.back().t = nowms + t.repeatms;
+		    t->when = nowms + t->repeatms;
 		}
 		else
 		{
 		    // Round up to next scheduled event that's still
 		    // in the future
-		    m_timers.back().t += ((nowms + t.repeatms - t.t)
-					   / t.repeatms)
-			                 * t.repeatms;
+		    t->when += ((nowms + t->repeatms - t->when) / t->repeatms)
+			* t->repeatms;
 
-		    assert(m_timers.back().t > nowms);
-		    assert(m_timers.back().t <= (nowms + t.repeatms));
+		    assert(t->when > nowms);
+		    assert(t->when <= (nowms + t->repeatms));
 		}
 
-//		TRACE << "Next repeat at " << m_timers.back().t << "\n";
-		std::push_heap(m_timers.begin(), m_timers.end(), TimerSooner());
+//		TRACE << "Next repeat at " << t->when << "\n";
+		t->firing = false;
+		m_wheel.Add(t);
 	    }
 
 	    /* Because the lock is a recursive lock, we can call the
 	     * callback inside it.
 	     */
-	    if (t.callback.IsValid())
-		t.callback();
+	    if (callback.IsValid())
+		callback();
 	}
     }
 
@@ -321,16 +407,23 @@ unsigned BackgroundScheduler::Impl::Poll(unsigned int timeout_ms)
 	Lock lock(this);
 
 //	TRACE << "BS got lock, does callbacks\n";
-	m_core.DoCallbacks(&m_pollables, m_array_valid);
+	std::vector<int> done;
+	m_core->DoCallbacks(&m_pollables, m_array_valid, &done);
 //	TRACE << "BS done callbacks\n";
 
-	pollables_t::iterator it = std::remove_if(m_pollables.begin(),
-						  m_pollables.end(),
-						  &DoneOneShot);
-	if (it != m_pollables.end())
+	/* Unless a callback has since re-armed (replaced) them, or Remove
+	 * has already erased them.
+	 */
+	for (size_t i=0; i<done.size(); ++i)
 	{
-	    m_pollables.erase(it, m_pollables.end());
-	    m_array_valid = false;
+	    pollables_t::iterator it = m_pollables.find(done[i]);
+	    if (it != m_pollables.end() && !it->second.direction)
+	    {
+		Unindex(it->second);
+		m_core->Deleting(&it->second);
+		m_pollables.erase(it);
+		m_array_valid = false;
+	    }
 	}
     }
 
@@ -339,8 +432,8 @@ unsigned BackgroundScheduler::Impl::Poll(unsigned int timeout_ms)
     return 0;
 }
 
-BackgroundScheduler::BackgroundScheduler()
-    : m_impl(new Impl)
+BackgroundScheduler::BackgroundScheduler(Backend backend)
+    : m_impl(new Impl(backend))
 {
 }
 
@@ -352,19 +445,31 @@ BackgroundScheduler::~BackgroundScheduler()
 void BackgroundScheduler::WaitForReadable(const TaskCallback& callback,
 					  int h, bool oneshot)
 {
-    m_impl->Wait(callback, h, PollRecord::IN, oneshot);
+    m_impl->Wait(callback, h, PollRecord::IN, oneshot, false);
+}
+
+void BackgroundScheduler::WaitForReadableEdge(const TaskCallback& callback,
+					      int h)
+{
+    m_impl->Wait(callback, h, PollRecord::IN, false, true);
 }
 
 void BackgroundScheduler::WaitForWritable(const TaskCallback& callback,
 					  int h, bool oneshot)
 {
-    m_impl->Wait(callback, h, PollRecord::OUT, oneshot);
+    m_impl->Wait(callback, h, PollRecord::OUT, oneshot, false);
 }
 
 void BackgroundScheduler::Wait(const TaskCallback& callback, time_t first,
 			       unsigned int repeatms)
 {
-    m_impl->Wait(callback, first, repeatms);
+    m_impl->WaitUntilMs(callback, (uint64_t)first*1000u, repeatms);
+}
+
+void BackgroundScheduler::WaitFor(const TaskCallback& callback,
+				  unsigned int delayms)
+{
+    m_impl->WaitUntilMs(callback, Impl::NowMs() + delayms, 0);
 }
 
 unsigned int BackgroundScheduler::Poll(unsigned int ms)
@@ -379,7 +484,7 @@ void BackgroundScheduler::Remove(TaskPtr p)
 
 void BackgroundScheduler::Wake()
 {
-    m_impl->m_core.Wake();
+    m_impl->m_core->Wake();
 }
 
 void BackgroundScheduler::Shutdown()
@@ -414,10 +519,12 @@ public:
 
 typedef util::CountedPointer<TestTask> TestPtr;
 
-int main()
+static void Test(util::BackgroundScheduler::Backend backend)
 {
+    g_calls = g_destroy = 0;
+
     {
-	util::BackgroundScheduler poller;
+	util::BackgroundScheduler poller(backend);
 
 	time_t start = time(NULL);
 
@@ -458,9 +565,9 @@ int main()
 	char buf[1];
 	g_rc = read(pipefd[0], buf, 1);
 
-	poller.WaitForReadable(
-	    util::Bind(TestPtr(new TestTask)).To<&TestTask::Run>(),
-	    pipefd[0], false);
+	TestPtr level(new TestTask);
+	poller.WaitForReadable(util::Bind(level).To<&TestTask::Run>(),
+			       pipefd[0], false);
 
 	g_rc = ::write(pipefd[1], "*", 1);
 
@@ -475,15 +582,110 @@ int main()
 
 	poller.Poll(0);
 	assert(g_calls == 4);
+
+	g_rc = read(pipefd[0], buf, 1);
+	poller.Remove(level);
+	level.reset(NULL);
+
+	/* Edge-triggered: called once per write, not for as long as there's
+	 * something to read.
+	 */
+	TestPtr edge(new TestTask);
+	poller.WaitForReadableEdge(util::Bind(edge).To<&TestTask::Run>(),
+				   pipefd[0]);
+	g_rc = ::write(pipefd[1], "*", 1);
+	poller.Poll(0);
+	assert(g_calls == 5);
+	poller.Poll(0);
+	if (backend == util::BackgroundScheduler::EPOLL)
+	    assert(g_calls == 5);
+	poller.Remove(edge);
+
+	close(pipefd[0]);
+	close(pipefd[1]);
 #endif
     }
 
 #if HAVE_PIPE
-    assert(g_destroy == 3);
+    assert(g_destroy == 4);
 #else
     assert(g_destroy == 1);
 #endif
+}
+
+/** A repeating timer which cancels itself */
+class SelfRemover: public util::Task
+{
+    util::Scheduler *m_poller;
+
+public:
+    unsigned int calls;
+
+    explicit SelfRemover(util::Scheduler *poller)
+	: m_poller(poller), calls(0) {}
+
+    unsigned Run()
+    {
+	if (++calls == 3)
+	    m_poller->Remove(util::TaskPtr(this));
+	return 0;
+    }
+};
+
+static void TestTimers()
+{
+    g_calls = g_destroy = 0;
+
+    util::BackgroundScheduler poller;
+
+    // Lots of timers, most of them removed before they fire
+    enum { N = 1000 };
+    std::vector<TestPtr> tasks;
+    time_t first = time(NULL) + 1;
+    for (unsigned int i=0; i<N; ++i)
+    {
+	tasks.push_back(TestPtr(new TestTask));
+	poller.Wait(util::Bind(tasks[i]).To<&TestTask::Run>(), first, 0);
+    }
+    for (unsigned int i=10; i<N; ++i)
+	poller.Remove(tasks[i]);
+    tasks.clear();
+    assert(g_destroy == N-10);
+
+    while (time(NULL) <= first + 1)
+	poller.Poll(1000);
+    assert(g_calls == 10);
+    assert(g_destroy == N);
+
+    // A repeating one, which its own callback removes
+    util::CountedPointer<SelfRemover> sr(new SelfRemover(&poller));
+    poller.Wait(util::Bind(sr).To<&SelfRemover::Run>(), 0, 10);
+    for (unsigned int i=0; i<20; ++i)
+	poller.Poll(10);
+    assert(sr->calls == 3);
+
+    // A delay in milliseconds, not rounded to seconds
+    g_calls = 0;
+    timeval before, after;
+    ::gettimeofday(&before, NULL);
+    poller.WaitFor(util::Bind(TestPtr(new TestTask)).To<&TestTask::Run>(),
+		   50);
+    while (!g_calls)
+	poller.Poll(1000);
+    ::gettimeofday(&after, NULL);
+    long ms = (after.tv_sec - before.tv_sec) * 1000
+	+ (after.tv_usec - before.tv_usec) / 1000;
+    assert(ms >= 49);
+    assert(ms < 500);
+}
 
+int main()
+{
+    Test(util::BackgroundScheduler::POLL);
+#if HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H
+    Test(util::BackgroundScheduler::EPOLL);
+#endif
+    TestTimers();
     return 0;
 }
 
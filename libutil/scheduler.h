@@ -51,6 +51,23 @@ public:
 				 int poll_handle,
 				 bool oneshot=true) = 0;
 
+    /** Like WaitForReadable(callback, poll_handle, false), but
+     * edge-triggered where the scheduler can do that: the callback is made
+     * only when the poll handle becomes readable again, not for as long as
+     * it stays readable.
+     *
+     * So the callback must read (or accept) until EWOULDBLOCK each time, or
+     * it may never be called again; in return, a callback which punts the
+     * real work to a background thread needn't be called incessantly.
+     * Schedulers which can't do this fall back to level-triggering, so the
+     * callback must cope with that too.
+     */
+    virtual void WaitForReadableEdge(const TaskCallback& callback,
+				     int poll_handle)
+    {
+	WaitForReadable(callback, poll_handle, false);
+    }
+
     /** Like WaitForReadable, but for writability.
      */
     virtual void WaitForWritable(const TaskCallback&, int poll_handle,
@@ -61,6 +78,15 @@ public:
     virtual void Wait(const TaskCallback&, time_t first, 
 		      unsigned int repeatms) = 0;
 
+    /** Wait for delayms milliseconds, then call the callback once.
+     *
+     * Schedulers which only count whole seconds round the delay up.
+     */
+    virtual void WaitFor(const TaskCallback& callback, unsigned int delayms)
+    {
+	Wait(callback, time(NULL) + (delayms + 999) / 1000 + 1, 0);
+    }
+
     /** Remove this task from all waiting lists.
      *
      * Once this function returns, no new timers or poll callbacks
@@ -90,7 +116,13 @@ class BackgroundScheduler: public Scheduler
     Impl *m_impl;
 
 public:
-    BackgroundScheduler();
+    /** Which OS facility to wait with. EPOLL (Linux) costs in proportion
+     * to the number of handles that are active, POLL to the number that
+     * are waited on. BEST is EPOLL if available, else POLL.
+     */
+    enum Backend { BEST, POLL, EPOLL };
+
+    explicit BackgroundScheduler(Backend backend = BEST);
     ~BackgroundScheduler();
 
     enum { INFINITE_MS = (unsigned int)-1 };
@@ -100,9 +132,11 @@ public:
 
     // Being a Scheduler
     void WaitForReadable(const TaskCallback&, int, bool oneshot) override;
+    void WaitForReadableEdge(const TaskCallback&, int) override;
     void WaitForWritable(const TaskCallback&, int, bool oneshot) override;
     void Wait(const TaskCallback&, time_t first,
               unsigned int repeatms) override;
+    void WaitFor(const TaskCallback&, unsigned int delayms) override;
     void Remove(TaskPtr) override;
     void Wake() override;
     void Shutdown() override;
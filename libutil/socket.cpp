@@ -4,6 +4,9 @@
 #include <unistd.h>
 
 #include <sys/uio.h>
+#if HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -722,6 +725,26 @@ unsigned StreamSocket::SetCork(bool corked)
     return 0;
 }
 
+unsigned StreamSocket::SendFile(int fd, uint64_t *ppos, size_t len,
+				size_t *pwrote)
+{
+    *pwrote = 0;
+#if HAVE_SYS_SENDFILE_H
+    off_t off = (off_t)*ppos;
+    ssize_t rc = ::sendfile(m_fd, fd, &off, len);
+    if (rc < 0)
+	return SocketError();
+    *ppos += (uint64_t)rc;
+    *pwrote = (size_t)rc;
+    return 0;
+#else
+    (void)fd;
+    (void)ppos;
+    (void)len;
+    return ENOSYS;
+#endif
+}
+
 unsigned StreamSocket::ShutdownWrite()
 {
     int how;
@@ -134,6 +134,15 @@ public:
 
     unsigned SetCork(bool corked);
 
+    /** Send up to len bytes of a file, starting at *ppos, without reading
+     * them into user space (eg with sendfile). Advances *ppos by the
+     * number sent.
+     *
+     * Returns ENOSYS (or EINVAL for unsuitable files) if the caller should
+     * use Read and Write instead.
+     */
+    unsigned SendFile(int fd, uint64_t *ppos, size_t len, size_t *pwrote);
+
     /** TCP half-close: we will read no more from this socket
      */
     unsigned ShutdownRead();
@@ -54,6 +54,11 @@ unsigned Stream::Wait(const TaskCallback&)
     return ENOSYS;
 }
 
+unsigned Stream::GetFileExtent(int*, uint64_t*)
+{
+    return ENOSYS;
+}
+
 unsigned Stream::WriteAll(const void *buffer, size_t len)
 {
     while (len)
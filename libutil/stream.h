@@ -134,6 +134,18 @@ public:
      */
     virtual unsigned Wait(const TaskCallback& callback);
 
+    /** If the stream's contents are simply a range of a file, get that
+     * file's descriptor, and the file offset of the stream's offset zero,
+     * so that the contents can be sent without reading them in (eg with
+     * sendfile).
+     *
+     * The descriptor still belongs to the stream. Default implementation
+     * returns ENOSYS.
+     *
+     * @pre GetStreamFlags() & SEEKABLE
+     */
+    virtual unsigned GetFileExtent(int *pfd, uint64_t *poffset);
+
     
     /* The following helper functions could be implemented using the
      * class interface, and are members for notational reasons only.
@@ -0,0 +1,443 @@
+#include "timer_wheel.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace util {
+
+TimerWheel::TimerWheel(uint64_t now)
+    : m_now(now), m_count(0)
+{
+    for (unsigned int i=0; i<SLOTS; ++i)
+    {
+	m_slots[i].head = m_slots[i].tail = NULL;
+	m_slots[i].level = (i < INNER_SLOTS) ? 0
+	    : 1 + (i - INNER_SLOTS) / OUTER_SLOTS;
+	m_slots[i].index = (i < INNER_SLOTS) ? i
+	    : (i - INNER_SLOTS) % OUTER_SLOTS;
+    }
+    m_overdue.head = m_overdue.tail = NULL;
+    m_overdue.level = LEVELS;
+    m_overdue.index = 0;
+    std::fill(m_bitmap, m_bitmap + SLOTS/64, 0);
+}
+
+TimerWheel::~TimerWheel()
+{
+    // Leave the timers looking un-added
+    for (unsigned int i=0; i<=SLOTS; ++i)
+    {
+	Slot *s = (i < SLOTS) ? &m_slots[i] : &m_overdue;
+	for (Timer *t = s->head; t; t = t->m_next)
+	    t->m_slot = NULL;
+    }
+}
+
+/** The bit position, within a time, of a level's slot index */
+unsigned int TimerWheel::Shift(unsigned int level)
+{
+    return level ? INNER_BITS + (level-1) * OUTER_BITS : 0;
+}
+
+TimerWheel::Slot *TimerWheel::SlotFor(unsigned int level, unsigned int index)
+{
+    if (!level)
+	return &m_slots[index];
+    return &m_slots[INNER_SLOTS + (level-1) * OUTER_SLOTS + index];
+}
+
+void TimerWheel::Link(Slot *s, Timer *t)
+{
+    t->m_slot = s;
+    t->m_next = NULL;
+    t->m_prev = s->tail;
+    if (s->tail)
+	s->tail->m_next = t;
+    else
+    {
+	s->head = t;
+	if (s != &m_overdue)
+	{
+	    unsigned int bit = (unsigned int)(s - m_slots);
+	    m_bitmap[bit / 64] |= 1ull << (bit % 64);
+	}
+    }
+    s->tail = t;
+    ++m_count;
+}
+
+void TimerWheel::Unlink(Timer *t)
+{
+    Slot *s = t->m_slot;
+    if (t->m_prev)
+	t->m_prev->m_next = t->m_next;
+    else
+	s->head = t->m_next;
+    if (t->m_next)
+	t->m_next->m_prev = t->m_prev;
+    else
+	s->tail = t->m_prev;
+
+    if (!s->head && s != &m_overdue)
+    {
+	unsigned int bit = (unsigned int)(s - m_slots);
+	m_bitmap[bit / 64] &= ~(1ull << (bit % 64));
+    }
+
+    t->m_slot = NULL;
+    t->m_next = t->m_prev = NULL;
+    --m_count;
+}
+
+void TimerWheel::Add(Timer *t)
+{
+    if (t->m_slot)
+	Unlink(t);
+
+    if (t->when <= m_now)
+    {
+	Link(&m_overdue, t);
+	return;
+    }
+
+    /* Measured from the next tick, which is the one being cascaded if
+     * we're cascading.
+     *
+     * Too far off for the outermost wheel: file it as far off as will go,
+     * and look again when it gets there.
+     */
+    uint64_t tick = m_now + 1;
+    uint64_t when = t->when;
+    const uint64_t horizon = 1ull << Shift(LEVELS);
+    if (when - tick >= horizon)
+	when = tick + horizon - 1;
+
+    uint64_t delta = when - tick;
+    unsigned int level = 0;
+    while (level < LEVELS-1 && delta >= (1ull << Shift(level+1)))
+	++level;
+
+    unsigned int mask = level ? OUTER_SLOTS-1 : INNER_SLOTS-1;
+    Link(SlotFor(level, (unsigned int)(when >> Shift(level)) & mask), t);
+}
+
+void TimerWheel::Cancel(Timer *t)
+{
+    if (t->m_slot)
+	Unlink(t);
+}
+
+/** Re-files the timers in an outer slot, now that their time's coming.
+ */
+void TimerWheel::Cascade(unsigned int level, unsigned int index)
+{
+    Slot *s = SlotFor(level, index);
+    Timer *t = s->head;
+    if (!t)
+	return;
+
+    // Detach them all first: some may be filed straight back in this slot
+    s->head = s->tail = NULL;
+    unsigned int bit = (unsigned int)(s - m_slots);
+    m_bitmap[bit / 64] &= ~(1ull << (bit % 64));
+
+    while (t)
+    {
+	Timer *next = t->m_next;
+	t->m_slot = NULL;
+	--m_count;
+	Add(t);
+	t = next;
+    }
+}
+
+/** Finds the first non-empty slot, from..to inclusive, of one level.
+ */
+bool TimerWheel::AnySet(unsigned int level, unsigned int from,
+			unsigned int to, unsigned int *first) const
+{
+    unsigned int base = level ? INNER_SLOTS + (level-1) * OUTER_SLOTS : 0;
+    unsigned int lo = base + from;
+    unsigned int hi = base + to;
+    while (lo <= hi)
+    {
+	uint64_t bits = m_bitmap[lo / 64] >> (lo % 64);
+	unsigned int span = std::min(hi - lo + 1, 64 - (lo % 64));
+	if (span < 64)
+	    bits &= (1ull << span) - 1;
+	if (bits)
+	{
+	    *first = lo + (unsigned int)__builtin_ctzll(bits) - base;
+	    return true;
+	}
+	lo += span;
+    }
+    return false;
+}
+
+void TimerWheel::Expire(uint64_t now, std::vector<Timer*> *due)
+{
+    while (m_overdue.head)
+    {
+	Timer *t = m_overdue.head;
+	Unlink(t);
+	due->push_back(t);
+    }
+
+    while (m_now < now && m_count)
+    {
+	uint64_t tick = m_now + 1;
+
+	// Start of a turn of the inner wheel: bring the next lot inwards
+	if ((tick & (INNER_SLOTS-1)) == 0)
+	{
+	    for (unsigned int level = 1; level < LEVELS; ++level)
+	    {
+		unsigned int index = (unsigned int)(tick >> Shift(level))
+		    & (OUTER_SLOTS-1);
+		Cascade(level, index);
+		if (index)
+		    break;
+	    }
+	}
+
+	// Skip straight to the next timer, or the end of this turn
+	uint64_t last = std::min(now, tick | (INNER_SLOTS-1));
+	unsigned int first;
+	if (!AnySet(0, (unsigned int)(tick & (INNER_SLOTS-1)),
+		    (unsigned int)(last & (INNER_SLOTS-1)), &first))
+	{
+	    m_now = last;
+	    continue;
+	}
+
+	m_now = (tick & ~(uint64_t)(INNER_SLOTS-1)) | first;
+	Slot *s = SlotFor(0, first);
+	while (s->head)
+	{
+	    Timer *t = s->head;
+	    Unlink(t);
+	    assert(t->when <= m_now);
+	    due->push_back(t);
+	}
+    }
+
+    // Nothing's waiting, so it doesn't matter where the wheel points
+    if (m_now < now)
+	m_now = now;
+}
+
+uint64_t TimerWheel::NextExpiry(unsigned int slack) const
+{
+    if (!m_count)
+	return UINT64_MAX;
+    if (m_overdue.head)
+	return m_now;
+
+    uint64_t best = UINT64_MAX;
+    bool exact = false;
+
+    // Inner wheel, going round from the next tick
+    uint64_t tick = m_now + 1;
+    unsigned int index = (unsigned int)(tick & (INNER_SLOTS-1));
+    unsigned int first;
+    if (AnySet(0, index, INNER_SLOTS-1, &first))
+	best = tick + (first - index);
+    else if (index && AnySet(0, 0, index-1, &first))
+	best = tick + (INNER_SLOTS - index) + first;
+    exact = (best != UINT64_MAX);
+
+    // Outer wheels: when the soonest slot of each next cascades
+    for (unsigned int level = 1; level < LEVELS; ++level)
+    {
+	unsigned int shift = Shift(level);
+	uint64_t next = ((m_now >> shift) + 1) << shift;
+	unsigned int start = (unsigned int)(next >> shift) & (OUTER_SLOTS-1);
+	uint64_t k;
+	if (AnySet(level, start, OUTER_SLOTS-1, &first))
+	    k = first - start;
+	else if (start && AnySet(level, 0, start-1, &first))
+	    k = OUTER_SLOTS - start + first;
+	else
+	    continue;
+	uint64_t cascade = next + (k << shift);
+	if (cascade < best)
+	{
+	    best = cascade;
+	    exact = false;
+	}
+    }
+
+    // Wait for any others due soon after, so as to wake up once for them
+    if (exact)
+    {
+	uint64_t extended = best;
+	uint64_t limit = std::min(best + slack, m_now + INNER_SLOTS);
+	for (uint64_t t = best + 1; t <= limit; ++t)
+	{
+	    unsigned int bit = (unsigned int)(t & (INNER_SLOTS-1));
+	    if (m_bitmap[bit / 64] & (1ull << (bit % 64)))
+		extended = t;
+	}
+	best = extended;
+    }
+
+    return best;
+}
+
+} // namespace util
+
+#ifdef TEST
+
+# include <stdlib.h>
+# include <stdio.h>
+# include <map>
+
+struct TestTimer: public util::TimerWheel::Timer
+{
+    unsigned int id;
+};
+
+int main()
+{
+    uint64_t now = 1000000007;
+    util::TimerWheel wheel(now);
+    assert(wheel.NextExpiry() == UINT64_MAX);
+
+    // One each side of every level boundary, and one way past the end
+    const uint64_t offsets[] = {
+	1, 255, 256, 257, 16383, 16384, 16385, 1ull<<20, (1ull<<20) + 1,
+	1ull<<26, (1ull<<26) + 1, (1ull<<32) - 1, 1ull<<32, 1ull<<34
+    };
+    enum { N = sizeof(offsets)/sizeof(offsets[0]) };
+    TestTimer timers[N];
+    for (unsigned int i=0; i<N; ++i)
+    {
+	timers[i].when = now + offsets[i];
+	timers[i].id = i;
+	wheel.Add(&timers[i]);
+    }
+    assert(wheel.Count() == N);
+    for (unsigned int i=0; i<N; ++i)
+    {
+	// Sleep until the next expiry, as a scheduler would
+	std::vector<util::TimerWheel::Timer*> due;
+	unsigned int wakeups = 0;
+	while (due.empty())
+	{
+	    uint64_t next = wheel.NextExpiry();
+	    assert(next > now);
+	    assert(next <= timers[i].when);
+	    now = next;
+	    wheel.Expire(now, &due);
+	    ++wakeups;
+	}
+	assert(wakeups <= 10);
+	assert(due.size() == 1);
+	assert(due[0] == &timers[i]);
+	assert(now == timers[i].when);
+	assert(!util::TimerWheel::IsPending(&timers[i]));
+    }
+    assert(wheel.IsEmpty());
+
+    // Overdue ones come first, in the order they were added
+    timers[0].when = now - 10;
+    timers[1].when = now;
+    wheel.Add(&timers[0]);
+    wheel.Add(&timers[1]);
+    assert(wheel.NextExpiry() == now);
+    std::vector<util::TimerWheel::Timer*> due;
+    wheel.Expire(now, &due);
+    assert(due.size() == 2 && due[0] == &timers[0] && due[1] == &timers[1]);
+
+    // Slack gathers up neighbours
+    timers[0].when = now + 10;
+    timers[1].when = now + 12;
+    timers[2].when = now + 20;
+    for (unsigned int i=0; i<3; ++i)
+	wheel.Add(&timers[i]);
+    assert(wheel.NextExpiry() == now + 10);
+    assert(wheel.NextExpiry(5) == now + 12);
+    wheel.Cancel(&timers[1]);
+    assert(wheel.NextExpiry(5) == now + 10);
+    wheel.Cancel(&timers[0]);
+    wheel.Cancel(&timers[2]);
+    assert(wheel.IsEmpty());
+
+    /* Against a reference: lots of random adds, moves and cancels, with
+     * time jumping about by random amounts.
+     */
+    enum { M = 2000 };
+    static TestTimer many[M];
+    std::multimap<uint64_t, unsigned int> reference;
+    for (unsigned int i=0; i<M; ++i)
+	many[i].id = i;
+
+    srand(42);
+    for (unsigned int round = 0; round < 20000; ++round)
+    {
+	unsigned int i = (unsigned int)rand() % M;
+	TestTimer *t = &many[i];
+	if (util::TimerWheel::IsPending(t))
+	{
+	    for (std::multimap<uint64_t, unsigned int>::iterator j
+		     = reference.lower_bound(t->when); ; ++j)
+	    {
+		assert(j != reference.end());
+		if (j->second == i)
+		{
+		    reference.erase(j);
+		    break;
+		}
+	    }
+	}
+
+	if (rand() % 4)
+	{
+	    unsigned int bits = (unsigned int)rand() % 30;
+	    t->when = now + ((uint64_t)rand() & ((1ull << bits) - 1));
+	    wheel.Add(t);
+	    reference.insert(std::make_pair(t->when, i));
+	}
+	else
+	    wheel.Cancel(t);
+	assert(wheel.Count() == reference.size());
+
+	if (reference.empty())
+	    continue;
+
+	uint64_t soonest = reference.begin()->first;
+	uint64_t next = wheel.NextExpiry();
+	assert(next <= soonest);
+
+	if (rand() % 3 == 0)
+	{
+	    // Somewhere beyond the next expiry, sometimes a long way
+	    uint64_t step = (uint64_t)rand() % ((rand() % 2) ? 100 : 100000);
+	    uint64_t then = std::max(next, now) + step;
+	    due.clear();
+	    wheel.Expire(then, &due);
+	    now = then;
+
+	    uint64_t last = 0;
+	    for (unsigned int j=0; j<due.size(); ++j)
+	    {
+		TestTimer *d = (TestTimer*)due[j];
+		assert(d->when <= now);
+		assert(d->when >= last);
+		last = d->when;
+		std::multimap<uint64_t, unsigned int>::iterator k
+		    = reference.begin();
+		while (k->second != d->id)
+		    ++k;
+		assert(k->first == d->when);
+		reference.erase(k);
+	    }
+	    assert(reference.empty() || reference.begin()->first > now);
+	    assert(wheel.Count() == reference.size());
+	}
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef LIBUTIL_TIMER_WHEEL_H
+#define LIBUTIL_TIMER_WHEEL_H 1
+
+#include <stdint.h>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace util {
+
+/** A hierarchical timing wheel, with millisecond ticks: adding and
+ * cancelling a timer are constant-time, however many there are.
+ *
+ * The innermost wheel has a slot for each of the next 256ms; each outer one
+ * has 64 slots, each covering a whole turn of the wheel inside it, so five
+ * wheels reach 2^32ms (49 days) ahead. As time reaches each outer slot, its
+ * timers "cascade" into the wheel inside. Timers further off than that wait
+ * in the outermost wheel, and go round again.
+ *
+ * The wheel doesn't own its timers; they're intrusive, so that the caller
+ * can embed a Timer in whatever it's timing. Not thread-safe.
+ */
+class TimerWheel: private boost::noncopyable
+{
+    struct Slot;
+
+public:
+    struct Timer
+    {
+	uint64_t when; ///< Milliseconds, on whatever clock the caller uses
+
+	Timer() : when(0), m_next(NULL), m_prev(NULL), m_slot(NULL) {}
+
+    private:
+	friend class TimerWheel;
+	Timer *m_next;
+	Timer *m_prev;
+	Slot *m_slot; ///< NULL if not in the wheel
+    };
+
+    /** @param now Current time; timers due at or before it are overdue */
+    explicit TimerWheel(uint64_t now);
+    ~TimerWheel();
+
+    /** Add a timer, whose "when" is already set. Adding one that's already
+     * in the wheel moves it.
+     */
+    void Add(Timer*);
+
+    /** Take a timer out of the wheel, if it's in it.
+     */
+    void Cancel(Timer*);
+
+    static bool IsPending(const Timer *t) { return t->m_slot != NULL; }
+
+    /** Take out every timer due by "now", appending them to *due in the
+     * order they fell due (and, for any falling due together, the order
+     * they were added).
+     */
+    void Expire(uint64_t now, std::vector<Timer*> *due);
+
+    /** When Expire next needs calling.
+     *
+     * That's exactly when the soonest timer falls due, if it's in the
+     * innermost wheel; if not, it's when the soonest timer cascades inwards,
+     * which is sooner. Either way, anything else falling due within slack
+     * ms afterwards is waited for too, so that they're expired together.
+     *
+     * @return Time, or UINT64_MAX if the wheel is empty
+     */
+    uint64_t NextExpiry(unsigned int slack = 0) const;
+
+    bool IsEmpty() const { return m_count == 0; }
+    size_t Count() const { return m_count; }
+
+private:
+    enum {
+	LEVELS = 5,
+	INNER_BITS = 8,
+	OUTER_BITS = 6,
+	INNER_SLOTS = 1<<INNER_BITS,
+	OUTER_SLOTS = 1<<OUTER_BITS,
+	SLOTS = INNER_SLOTS + (LEVELS-1) * OUTER_SLOTS
+    };
+
+    struct Slot
+    {
+	Timer *head;
+	Timer *tail;
+	unsigned int level;
+	unsigned int index;
+    };
+
+    Slot m_slots[SLOTS];
+    Slot m_overdue; ///< Due already when added
+    uint64_t m_bitmap[SLOTS / 64]; ///< Which slots aren't empty
+    uint64_t m_now; ///< Everything due at or before this has been expired
+    size_t m_count;
+
+    static unsigned int Shift(unsigned int level);
+    Slot *SlotFor(unsigned int level, unsigned int index);
+    void Link(Slot*, Timer*);
+    void Unlink(Timer*);
+    void Cascade(unsigned int level, unsigned int index);
+    bool AnySet(unsigned int level, unsigned int from, unsigned int to,
+		unsigned int *first) const;
+};
+
+} // namespace util
+
+#endif
@@ -197,6 +197,60 @@ utf32string UTF8ToUTF32(const char *s)
     return Convert<utf32_t>(s);
 }
 
+
+        /* Case folding */
+
+
+/** The lower-case equivalent of ch, for the alphabets we're likely to see
+ * in tags: Latin (to the end of Extended-A), Greek and Cyrillic.
+ */
+static utf32_t FoldChar(utf32_t ch)
+{
+    if (ch < 0x80)
+	return (ch >= 'A' && ch <= 'Z') ? ch + 0x20 : ch;
+    if (ch >= 0xC0 && ch <= 0xDE && ch != 0xD7)
+	return ch + 0x20;
+    if (ch >= 0x100 && ch <= 0x17F)
+    {
+	if (ch == 0x130 || ch == 0x131 || ch == 0x138 || ch == 0x149
+	    || ch == 0x17F)
+	    return ch;
+	if (ch == 0x178)
+	    return 0xFF;
+	// Pairs start on an odd code point in these two runs
+	if ((ch >= 0x139 && ch <= 0x148) || (ch >= 0x179 && ch <= 0x17E))
+	    return (ch & 1) ? ch + 1 : ch;
+	return ch | 1;
+    }
+    if (ch >= 0x391 && ch <= 0x3AB && ch != 0x3A2)
+	return ch + 0x20;
+    if (ch >= 0x410 && ch <= 0x42F)
+	return ch + 0x20;
+    if (ch >= 0x400 && ch <= 0x40F)
+	return ch + 0x50;
+    return ch;
+}
+
+std::string FoldCase(const std::string& s)
+{
+    std::string result;
+    result.reserve(s.size());
+    const char *ptr = s.c_str();
+    const char *end = ptr + s.size();
+    while (ptr < end)
+    {
+	unsigned char c = (unsigned char)*ptr;
+	if (c < 0x80)
+	{
+	    result += (c >= 'A' && c <= 'Z') ? (char)(c + 0x20) : (char)c;
+	    ++ptr;
+	}
+	else
+	    PutChar(FoldChar(GetChar(&ptr)), &result);
+    }
+    return result;
+}
+
 std::string LocalEncodingToUTF8(const char *local_string)
 {
     size_t len_chars = mbstowcs(NULL, local_string, 0);
@@ -273,6 +327,13 @@ int main()
 	assert(util::UTF32ToUTF8(utf32) == utf8);
     }
 
+    assert(util::FoldCase("Foo BAR 9") == "foo bar 9");
+    assert(util::FoldCase("BEYONC\xC3\x89") == "beyonc\xC3\xA9");
+    assert(util::FoldCase("\xC3\x81g\xC3\xa6tis") == "\xc3\xa1g\xc3\xa6tis");
+    assert(util::FoldCase("\xC5\x81\xC3\x97\xC5\xB8") == "\xC5\x82\xC3\x97\xC3\xBF");
+    assert(util::FoldCase("\xD0\x9C\xD0\x81") == "\xD0\xBC\xD1\x91");
+    assert(util::FoldCase("\xE6\xB2\xB3") == "\xE6\xB2\xB3");
+
     return 0;
 }
 
@@ -40,6 +40,12 @@ inline void UTF8ToWide(const std::string& i, utf16string *o) { *o = UTF8ToUTF16(
 inline void UTF8ToWide(const char *i, utf32string *o) { *o = UTF8ToUTF32(i); }
 inline void UTF8ToWide(const std::string& i, utf32string *o) { *o = UTF8ToUTF32(i); }
 
+/** Lower-case a UTF-8 string, for case-insensitive comparison. Covers
+ * Latin (to the end of Extended-A), Greek and Cyrillic; other characters,
+ * and the string's length in characters, are unchanged.
+ */
+std::string FoldCase(const std::string&);
+
 /** Convert text from the system local character encoding, to UTF-8.
  *
  * Strings in the system local character encoding are rare and
@@ -29,12 +29,15 @@ class WorkerThread
 {
     WorkerThreadPool *m_owner;
     WorkerThreadPool::Priority m_priority;
+    unsigned int m_slot;
     std::thread m_thread;
     
 public:
-    WorkerThread(WorkerThreadPool *owner, WorkerThreadPool::Priority p) 
+    WorkerThread(WorkerThreadPool *owner, WorkerThreadPool::Priority p,
+		 unsigned int slot)
 	: m_owner(owner),
 	  m_priority(p),
+	  m_slot(slot),
 	  m_thread(Bind(this).To<&WorkerThread::Run>())
 	{}
 
@@ -43,9 +46,15 @@ public:
         m_thread.join();
     }
 
+    WorkerThreadPool *GetOwner() const { return m_owner; }
+    unsigned int GetSlot() const { return m_slot; }
+
     unsigned int Run();
 };
 
+/** The WorkerThread (if any) running on this thread */
+static thread_local WorkerThread *s_current = NULL;
+
 unsigned int WorkerThread::Run()
 {
     if (m_priority == WorkerThreadPool::LOW)
@@ -83,38 +92,68 @@ unsigned int WorkerThread::Run()
 #endif
     }
 
-    for (;;)
-    {
-	TaskCallback cb = m_owner->PopTaskOrQuit(this);
-	if (!cb.IsValid())
-	{
-//	    TRACE << "No task, quitting\n";
-	    return 0;
-	}
-
-	cb();
-    }
+    s_current = this;
+    m_owner->Work(this);
+    s_current = NULL;
+    return 0;
 }
 
 
         /* WorkerThreadPool */
 
 
+struct WorkerThreadPool::Slot
+{
+    std::mutex mutex;
+    std::deque<TaskCallback> lanes[LANES];
+    std::atomic<size_t> count[LANES] = {}; ///< Peek without the mutex
+    bool busy = false; ///< Has a thread
+};
+
 WorkerThreadPool::WorkerThreadPool(Priority p, unsigned int n)
     : m_priority(p),
-      m_max_threads(n ? n : (util::CountCPUs() + 1))
+      m_next_slot(0),
+      m_sleeping(0),
+      m_nthreads(0),
+      m_exiting(false)
 {
+    if (!n)
+	n = util::CountCPUs() + 1;
+    m_bulk_limit = n;
+    for (unsigned int i=0; i<=n; ++i)
+	m_slots.push_back(std::unique_ptr<Slot>(new Slot));
+    for (unsigned int i=0; i<LANES; ++i)
+    {
+	m_queued[i] = 0;
+	m_running[i] = 0;
+    }
 }
 
 void WorkerThreadPool::SuggestNewThread()
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    if (m_threads.size() >= m_max_threads)
+    if (m_nthreads >= m_slots.size()
+	|| (m_nthreads >= m_bulk_limit && !m_queued[INTERACTIVE]))
     {
-//	TRACE << "Max " << m_max_threads << " threads, holding\n";
+//	TRACE << "Max " << m_nthreads << " threads, holding\n";
 	return;
     }
-    WorkerThread *thread = new WorkerThread(this, m_priority);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (WorkerThread *w : m_dead_threads) {
+        TRACE << "Reaped thread\n";
+        delete w;
+    }
+    m_dead_threads.clear();
+
+    if (m_exiting || m_threads.size() >= m_slots.size())
+	return;
+
+    unsigned int slot = 0;
+    while (m_slots[slot]->busy)
+	++slot;
+    m_slots[slot]->busy = true;
+    ++m_nthreads;
+    WorkerThread *thread = new WorkerThread(this, m_priority, slot);
     m_threads.push_back(thread);
     TRACE << "New thread\n";
 //    TRACE << "+Now " << m_threads.size() << " threads\n";
@@ -138,12 +177,13 @@ WorkerThreadPool::~WorkerThreadPool()
 
 void WorkerThreadPool::Shutdown()
 {
-    m_max_threads = 0; // Stop new ones being created
+    m_exiting = true; // Stop new ones being created
+    {
+	std::lock_guard<std::mutex> lock(m_idle_mutex);
+	m_idle.notify_all();
+    }
 
     std::unique_lock<std::mutex> lock(m_mutex);
-//    TRACE << "wtp" << this << " Shutdown pushing\n";
-    for (unsigned int i=0; i<m_threads.size(); ++i)
-	m_queue.PushTask(TaskCallback());
 //    TRACE << "Shutdown waiting\n";
     while (!m_threads.empty())
     {
@@ -152,62 +192,183 @@ void WorkerThreadPool::Shutdown()
 //    TRACE << "Shutdown done\n";
 }
 
-void WorkerThreadPool::PushTask(const TaskCallback& cb)
+/* Nobody sleeps while a task they could run is queued, and no thread retires
+ * while one is. Both are the same handshake: the pusher counts the task in
+ * m_queued, then looks at m_sleeping and m_nthreads; the sleeper or retirer
+ * counts itself out of those, then looks at m_queued. (All seq_cst, so at
+ * least one side sees the other.)
+ */
+void WorkerThreadPool::Push(const TaskCallback& cb, Lane lane, bool front)
 {
-    if (m_max_threads == 0) // Shutting down
+    if (m_exiting) // Shutting down
 	return;
 
-    ReapDeadThreads();
-    if (!m_queue.AnyWaiting())
+    Slot *slot;
+    if (s_current && s_current->GetOwner() == this)
+	slot = m_slots[s_current->GetSlot()].get();
+    else
+	slot = m_slots[m_next_slot++ % m_slots.size()].get();
+
+    ++m_queued[lane];
+    {
+	std::lock_guard<std::mutex> lock(slot->mutex);
+	if (front)
+	    slot->lanes[lane].push_front(cb);
+	else
+	    slot->lanes[lane].push_back(cb);
+	++slot->count[lane];
+    }
+
+    if (m_sleeping)
+    {
+	// Past any sleeper's check of Runnable(), so it's waiting by now
+	{ std::lock_guard<std::mutex> lock(m_idle_mutex); }
+	m_idle.notify_one();
+    }
+    else
 	SuggestNewThread();
-    m_queue.PushTask(cb);
+}
+
+void WorkerThreadPool::PushTask(const TaskCallback& cb, Lane lane)
+{
+    Push(cb, lane, false);
+}
+
+void WorkerThreadPool::PushTask(const TaskCallback& cb)
+{
+    Push(cb, BULK, false);
 }
 
 void WorkerThreadPool::PushTaskFront(const TaskCallback& cb)
 {
-    if (m_max_threads == 0) // Shutting down
-	return;
+    Push(cb, BULK, true);
+}
 
-    ReapDeadThreads();
-    if (!m_queue.AnyWaiting())
-	SuggestNewThread();
-    m_queue.PushTaskFront(cb);
+bool WorkerThreadPool::Runnable()
+{
+    return m_queued[INTERACTIVE] > 0
+	|| (m_queued[BULK] > 0 && m_running[BULK] < m_bulk_limit);
 }
 
-TaskCallback WorkerThreadPool::PopTaskOrQuit(WorkerThread *wt)
+TaskCallback WorkerThreadPool::TryPop(unsigned int self, Lane *plane)
 {
-    TaskCallback cb = PopTask(10);
-    if (!cb.IsValid())
+    const unsigned int n = (unsigned int)m_slots.size();
+
+    for (unsigned int i=0; i<LANES; ++i)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        TRACE << "Dead thread\n";
-        m_threads.remove(wt);
-	m_dead_threads.push_front(wt);
-//	TRACE << "-Now " << m_threads.size() << " threads\n";
-        if (m_threads.empty())
-            m_threads_empty.notify_all();
+	Lane lane = (Lane)i;
+	if (!m_queued[lane])
+	    continue;
+
+	if (lane == BULK)
+	{
+	    unsigned int running = m_running[BULK];
+	    do {
+		if (running >= m_bulk_limit)
+		    return TaskCallback();
+	    } while (!m_running[BULK].compare_exchange_weak(running,
+							     running+1));
+	}
+	else
+	    ++m_running[lane];
+
+	// Own deque first, then steal
+	for (unsigned int j=0; j<n; ++j)
+	{
+	    Slot *slot = m_slots[(self + j) % n].get();
+	    if (!slot->count[lane])
+		continue;
+	    std::lock_guard<std::mutex> lock(slot->mutex);
+	    std::deque<TaskCallback>& d = slot->lanes[lane];
+	    if (!d.empty())
+	    {
+		TaskCallback cb = d.front();
+		d.pop_front();
+		--slot->count[lane];
+		--m_queued[lane];
+		*plane = lane;
+		return cb;
+	    }
+	}
+
+	--m_running[lane];
     }
-    return cb;
+    return TaskCallback();
 }
 
-TaskCallback WorkerThreadPool::PopTask(unsigned int timeout_sec)
+bool WorkerThreadPool::Retire(WorkerThread *wt)
 {
-    return m_queue.PopTask(timeout_sec);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_nthreads;
+    if (Runnable())
+    {
+	++m_nthreads;
+	return false;
+    }
+
+    TRACE << "Dead thread\n";
+    m_slots[wt->GetSlot()]->busy = false;
+    m_threads.remove(wt);
+    m_dead_threads.push_front(wt);
+//    TRACE << "-Now " << m_threads.size() << " threads\n";
+    if (m_threads.empty())
+	m_threads_empty.notify_all();
+    return true;
 }
 
-bool WorkerThreadPool::AnyWaiting()
+TaskCallback WorkerThreadPool::PopTaskOrQuit(WorkerThread *wt, Lane *plane)
 {
-    if (m_queue.AnyWaiting())
-	return true;
+    for (;;)
+    {
+	TaskCallback cb = TryPop(wt->GetSlot(), plane);
+	if (cb.IsValid())
+	    return cb;
 
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return m_threads.size() < m_max_threads;
+	bool timed_out = false;
+	{
+	    std::unique_lock<std::mutex> lock(m_idle_mutex);
+	    ++m_sleeping;
+	    while (!Runnable() && !m_exiting && !timed_out)
+	    {
+		timed_out = m_idle.wait_for(
+		    lock, std::chrono::seconds(IDLE_SECONDS))
+		    == std::cv_status::timeout;
+	    }
+	    --m_sleeping;
+	}
+
+	if ((timed_out || m_exiting) && Retire(wt))
+	    return TaskCallback();
+    }
+}
+
+void WorkerThreadPool::Work(WorkerThread *wt)
+{
+    for (;;)
+    {
+	Lane lane;
+	TaskCallback cb = PopTaskOrQuit(wt, &lane);
+	if (!cb.IsValid())
+	{
+//	    TRACE << "No task, quitting\n";
+	    return;
+	}
+
+	cb();
+	cb = TaskCallback(); // Count the destructor as part of the task
+	--m_running[lane];
+    }
+}
+
+bool WorkerThreadPool::AnyWaiting()
+{
+    return m_queued[BULK] + m_running[BULK] < m_bulk_limit;
 }
 
 size_t WorkerThreadPool::Count()
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return m_queue.Count() + m_threads.size();
+    return m_queued[INTERACTIVE] + m_queued[BULK]
+	+ m_running[INTERACTIVE] + m_running[BULK];
 }
 
 
@@ -344,11 +505,106 @@ static void Test(util::WorkerThreadPool::Priority p)
     Test2(p, 100);
 }
 
+/** Holds up a thread until released, like a long encode */
+class Encode: public util::Task
+{
+public:
+    static std::condition_variable sm_cv;
+    static bool sm_released;
+
+    unsigned int Run()
+    {
+	std::unique_lock<std::mutex> lock(s_mx);
+	while (!sm_released)
+	    sm_cv.wait(lock);
+	++s_run;
+	return 0;
+    }
+};
+
+std::condition_variable Encode::sm_cv;
+bool Encode::sm_released = false;
+
+class Release: public util::Task
+{
+public:
+    unsigned int Run()
+    {
+	std::lock_guard<std::mutex> lock(s_mx);
+	Encode::sm_released = true;
+	Encode::sm_cv.notify_all();
+	++s_run;
+	return 0;
+    }
+};
+
+/** An interactive task still gets a thread when all the bulk ones are busy
+ * (or it'd never release them).
+ */
+static void TestLanes()
+{
+    s_run = 0;
+    Encode::sm_released = false;
+
+    util::WorkerThreadPool wtp(util::WorkerThreadPool::NORMAL, 2);
+
+    for (unsigned int i=0; i<4; ++i)
+	wtp.PushTask(util::Bind(util::TaskPtr(new Encode))
+		     .To<&util::Task::Run>());
+    wtp.PushTask(util::Bind(util::TaskPtr(new Release))
+		 .To<&util::Task::Run>(),
+		 util::WorkerThreadPool::INTERACTIVE);
+
+    wtp.Shutdown();
+    assert(s_run == 5);
+    assert(wtp.Count() == 0);
+}
+
+/** Fans out from one worker thread; the others must steal its tasks */
+class Spawner: public util::Task
+{
+    util::WorkerThreadPool *m_pool;
+    unsigned int m_depth;
+
+public:
+    Spawner(util::WorkerThreadPool *pool, unsigned int depth)
+	: m_pool(pool), m_depth(depth) {}
+
+    unsigned int Run()
+    {
+	if (m_depth)
+	{
+	    for (unsigned int i=0; i<4; ++i)
+		m_pool->PushTask(
+		    util::Bind(util::TaskPtr(new Spawner(m_pool, m_depth-1)))
+		    .To<&util::Task::Run>());
+	}
+	std::lock_guard<std::mutex> lock(s_mx);
+	++s_run;
+	return 0;
+    }
+};
+
+static void TestStealing()
+{
+    s_run = 0;
+    util::WorkerThreadPool wtp(util::WorkerThreadPool::NORMAL, 4);
+
+    wtp.PushTask(util::Bind(util::TaskPtr(new Spawner(&wtp, 5)))
+		 .To<&util::Task::Run>());
+    while (wtp.Count())
+	usleep(1000);
+
+    assert(s_run == 1+4+16+64+256+1024);
+}
+
 int main()
 {
     Test(util::WorkerThreadPool::LOW);
     Test(util::WorkerThreadPool::NORMAL);
     Test(util::WorkerThreadPool::HIGH);
+    TestLanes();
+    TestStealing();
 }
 
 #endif
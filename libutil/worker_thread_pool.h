@@ -2,10 +2,13 @@
 #define WORKER_THREAD_POOL_H 1
 
 #include "task_queue.h"
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <list>
 #include <deque>
+#include <memory>
+#include <vector>
 
 namespace util {
 
@@ -30,6 +33,19 @@ public:
     size_t Count() override;
 };
 
+/** A pool of worker threads.
+ *
+ * Each thread has its own deque of tasks; a thread runs tasks from its own
+ * deque first, and steals from the others when that's empty. Tasks pushed
+ * by a worker thread go on that thread's deque, others are dealt out in
+ * turn, so pushing never takes a pool-wide lock. Ordering is only per-deque:
+ * PushTaskFront means "soon", not "next".
+ *
+ * Tasks queue in one of two lanes. Threads always prefer INTERACTIVE tasks,
+ * and the pool keeps one thread more than it will let run BULK tasks. So a
+ * pool busy with long encodes still has a thread for a short HTTP request.
+ * Tasks pushed through the TaskQueue interface go in the BULK lane.
+ */
 class WorkerThreadPool final: public TaskQueue
 {
 public:
@@ -39,21 +55,51 @@ public:
 	LOW
     };
 
+    enum Lane {
+	INTERACTIVE,
+	BULK,
+
+	LANES
+    };
+
 private:
-    SimpleTaskQueue m_queue;
+    friend class WorkerThread;
+    struct Slot;
+
+    enum { IDLE_SECONDS = 10 };
+
     Priority m_priority;
-    unsigned int m_max_threads;
-    std::mutex m_mutex;
+    unsigned int m_bulk_limit;
+    std::vector<std::unique_ptr<Slot> > m_slots;
+    std::atomic<unsigned int> m_next_slot;
+    std::atomic<size_t> m_queued[LANES];
+    std::atomic<unsigned int> m_running[LANES];
+    std::atomic<unsigned int> m_sleeping;
+    std::atomic<unsigned int> m_nthreads;
+    std::atomic<bool> m_exiting;
+
+    std::mutex m_idle_mutex;
+    std::condition_variable m_idle;
+
+    std::mutex m_mutex; // protects m_threads, m_dead_threads, Slot::busy
     std::list<WorkerThread*> m_threads;
     std::condition_variable m_threads_empty;
     std::list<WorkerThread*> m_dead_threads;
 
+    void Push(const TaskCallback&, Lane, bool front);
     void SuggestNewThread();
-    TaskCallback PopTask(unsigned int timeout_sec);
     void ReapDeadThreads();
 
+    /** Whether there's a task that an idle thread could take now */
+    bool Runnable();
+    TaskCallback TryPop(unsigned int slot, Lane*);
+    TaskCallback PopTaskOrQuit(WorkerThread*, Lane*);
+    bool Retire(WorkerThread*);
+    void Work(WorkerThread*);
+
 public:
-    /** Create a thread pool with up to n threads. 
+    /** Create a thread pool with up to n threads (plus one for
+     * INTERACTIVE tasks).
      *
      * If n=0, use one per CPU, plus one. Note that the default for a
      * pool is low priority; the default for an individual thread is
@@ -62,20 +108,18 @@ public:
     explicit WorkerThreadPool(Priority, unsigned int n = 0);
     ~WorkerThreadPool();
 
-    /** Forbid any more threads from starting, and join all existing ones.
+    /** Forbid any more threads from starting, and join all existing ones
+     * once they've run out of tasks.
      */
     void Shutdown();
 
-    /** Obtain the next task, or, if there are none, a null task that means
-     * to quit.
-     */
-    TaskCallback PopTaskOrQuit(WorkerThread*);
+    void PushTask(const TaskCallback&, Lane);
 
     // Being a TaskQueue
     void PushTask(const TaskCallback&) override;
     void PushTaskFront(const TaskCallback&) override;
     bool AnyWaiting() override;
-    size_t Count() override;
+    size_t Count() override; ///< Tasks queued or running
 };
 
 } // namespace util
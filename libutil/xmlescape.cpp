@@ -8,22 +8,44 @@ std::string XmlEscape(const std::string& s)
 {
     std::string result;
     result.reserve(s.length());
+    XmlEscape(s, &result);
+    return result;
+}
 
-    for (unsigned int i=0; i<s.length(); ++i)
+void XmlEscape(std::string_view s, std::string *out)
+{
+    for (size_t i=0; i<s.length(); ++i)
     {
 	unsigned char c = (unsigned char)s[i];
 	if (c == '&')
-	    result += "&amp;";
+	    *out += "&amp;";
 	else if (c == '\"')
-	    result += "&quot;";
+	    *out += "&quot;";
 	else if (c == '<')
-	    result += "&lt;";
+	    *out += "&lt;";
 	else if (c == '>')
-	    result += "&gt;";
+	    *out += "&gt;";
 	else if (c >= ' ' || c == 10) // No control characters please
-	    result += (char)c;
+	    *out += (char)c;
     }
-    return result;
+}
+
+size_t XmlEscapedLength(std::string_view s)
+{
+    size_t n = 0;
+    for (size_t i=0; i<s.length(); ++i)
+    {
+	unsigned char c = (unsigned char)s[i];
+	if (c == '&')
+	    n += 5;
+	else if (c == '\"')
+	    n += 6;
+	else if (c == '<' || c == '>')
+	    n += 4;
+	else if (c >= ' ' || c == 10)
+	    ++n;
+    }
+    return n;
 }
 
 std::string XmlUnEscape(const std::string& s)
@@ -79,6 +101,16 @@ int main()
     assert(util::XmlEscape("You\xE2\x80\x99re My Flame.flac")
 	   == "You\xE2\x80\x99re My Flame.flac");
 
+    std::string s = "<a>";
+    util::XmlEscape(std::string_view("X&Y\x01"), &s);
+    assert(s == "<a>X&amp;Y");
+
+    const char *const escapees[] = {
+	"", "foo", "\"hi\"", "X<>Y", "X&Y\x01\n"
+    };
+    for (const char *e: escapees)
+	assert(util::XmlEscapedLength(e) == util::XmlEscape(e).length());
+
     assert(util::XmlUnEscape("foo") == "foo");
     assert(util::XmlUnEscape("&quot;hi&quot;") == "\"hi\"");
     assert(util::XmlUnEscape("&amp;quot;hi&amp;quot;") == "&quot;hi&quot;");
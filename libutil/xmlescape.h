@@ -2,10 +2,21 @@
 #define LIBUTIL_XMLESCAPE_H
 
 #include <string>
+#include <string_view>
 
 namespace util {
 
 std::string XmlEscape(const std::string&);
+
+/** Appends the escaped form of the string to *out, so that a caller
+ * building a document piece by piece needs no temporary per piece.
+ */
+void XmlEscape(std::string_view, std::string *out);
+
+/** The length XmlEscape would produce, without producing it.
+ */
+size_t XmlEscapedLength(std::string_view);
+
 std::string XmlUnEscape(const std::string&);
 
 } // namespace util